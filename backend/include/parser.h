@@ -13,28 +13,46 @@ namespace Backend {
 
 	class Parser {
 	public:
-		Parser(const std::vector<Token> &tokens, std::set<std::string> &aliases, std::string sc) :
-				tokens(tokens), externalTypeAliases(aliases), sourceCode(std::move(sc)) {}
+		// `namespaces` are the namespaces the script can see (declared by its imports), the ones it declares are added
+		Parser(const std::vector<Token> &tokens, std::set<std::string> &aliases, std::set<std::string> &namespaces,
+					 std::string sc) :
+				externalTypeAliases(aliases), namespaces(namespaces), sourceCode(std::move(sc)),
+				tokenBuffer(std::make_shared<const std::vector<Token>>(tokens)), tokens(*tokenBuffer) {}
 		~Parser() = default;
 		std::set<std::string> &externalTypeAliases;
+		std::set<std::string> &namespaces; // `Name.member` on these compiles to the global `Name::member`
 		std::vector<std::shared_ptr<Stmt>> parse();
 
+		// Parses a skimmed function body (FunctionStmt::deferred/bodyStart/bodyNamespace).
+		// Errors are reported and leave RyTools::hadError set.
+		static std::vector<std::shared_ptr<Stmt>> parseDeferred(const DeferredSource &source, size_t bodyStart,
+																														const std::string &bodyNamespace);
+
 	private:
+		// Picks up a skimmed script again, see parseDeferred()
+		Parser(const DeferredSource &source, std::set<std::string> &aliases, std::set<std::string> &namespaces) :
+				externalTypeAliases(aliases), namespaces(namespaces), sourceCode(source.source), tokenBuffer(source.tokens),
+				tokens(*tokenBuffer) {}
+
 		int loopDepth = 0;
+		int parallelDepth = 0; // Inside a parallel foreach body
+		int blockDepth = 0; // Inside braces other than a namespace or class body
 		std::string sourceCode;
-		std::vector<Token> tokens;
+		std::shared_ptr<const std::vector<Token>> tokenBuffer; // Shared with skimmed functions
+		const std::vector<Token> &tokens;
+		std::shared_ptr<DeferredSource> deferred; // Made on the first skimmed function body
+		void skipBody();
 
 		// Position
 		int current = 0;
 		std::set<std::string> typeAliases;
-		Token peek();
-		Token next();
+		const Token &peek();
+		const Token &next();
 		bool isTypeAlias(std::string const &name);
 		bool isTypeAlias(std::shared_ptr<Expr> expr);
-		Token previous();
-		Token consume(TokenType type, const std::string &message);
+		const Token &previous();
+		const Token &consume(TokenType type, const std::string &message);
 		std::string currentNamespace = "";
-		static std::set<std::string> namespaces;
 		bool check(TokenType type);
 		[[nodiscard]] bool checkNext(TokenType type) const;
 		[[nodiscard]] bool isAtEnd() const;
@@ -62,7 +80,7 @@ namespace Backend {
 
 		// Statements
 		std::shared_ptr<Stmt> forStatement();
-		std::shared_ptr<Stmt> eachStatement();
+		std::shared_ptr<Stmt> eachStatement(bool isParallel = false);
 		std::shared_ptr<Stmt> statement();
 		std::shared_ptr<Stmt> declaration();
 		std::shared_ptr<Stmt> whileStatement();
@@ -80,7 +98,7 @@ namespace Backend {
 		std::shared_ptr<Stmt> attemptStatement();
 		std::shared_ptr<Stmt> panicStatement();
 
-		std::vector<std::shared_ptr<Stmt>> block();
+		std::vector<std::shared_ptr<Stmt>> block(bool nested = true);
 	};
 
 } // namespace Backend
@@ -3,7 +3,10 @@
 //
 
 #pragma once
+#include <memory>
 #include <optional>
+#include <set>
+#include <string>
 #include <utility>
 #include <vector>
 #include "expr.h"
@@ -17,6 +20,15 @@ namespace Backend {
 		std::shared_ptr<Expr> defaultValue;
 	};
 
+	// A script whose function bodies the parser only skimmed. Kept alive by those functions so their
+	// bodies can be parsed when they are first called (see Parser::parseDeferred).
+	struct DeferredSource {
+		std::shared_ptr<const std::vector<Token>> tokens;
+		std::string source;
+		std::set<std::string> aliases;
+		std::set<std::string> namespaces; // Everything the script could see once it was parsed
+	};
+
 	struct ExpressionStmt;
 	struct FunctionStmt;
 	struct ClassStmt;
@@ -80,6 +92,10 @@ namespace Backend {
 		std::optional<Token> returnTypeAlias;
 		bool isPrivate = false; // member for Classes
 
+		// Set instead of `body` when the body was skimmed: it starts at deferred->tokens[bodyStart]
+		std::shared_ptr<DeferredSource> deferred;
+		size_t bodyStart = 0;
+		std::string bodyNamespace; // The parser's namespace inside the body
 
 		FunctionStmt(Token n, std::vector<Parameter> p, std::vector<std::shared_ptr<Stmt>> b, std::optional<Token> rTypeNs,
 								 std::optional<Token> rTypeAlias) :
@@ -169,6 +185,8 @@ namespace Backend {
 		std::optional<Token> dataType = std::nullopt;
 		std::shared_ptr<Expr> collection;
 		std::shared_ptr<Stmt> body;
+		bool isParallel = false; // parallel foreach: every iteration runs on a worker VM
+		std::optional<Token> target = std::nullopt; // '-> name' collects the returned values in order
 		EachStmt(Token id, std::shared_ptr<Expr> collection, std::shared_ptr<Stmt> body,
 						 std::optional<Token> dataType = std::nullopt) :
 				id(std::move(id)), collection(std::move(collection)), body(std::move(body)), dataType(std::move(dataType)) {}
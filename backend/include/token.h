@@ -81,6 +81,7 @@ namespace Backend {
 		FAIL,
 		PANIC,
 		FINALLY,
+		PARALLEL,
 
 
 		// Misc
@@ -110,5 +111,5 @@ namespace Backend {
 			{"skip", TokenType::SKIP},			 {"unless", TokenType::UNLESS},		{"until", TokenType::UNTIL},
 			{"do", TokenType::DO},					 {"class", TokenType::CLASS},			{"private", TokenType::PRIVATE},
 			{"childof", TokenType::CHILDOF}, {"attempt", TokenType::ATTEMPT}, {"fail", TokenType::FAIL},
-			{"panic", TokenType::PANIC},		 {"finally", TokenType::FINALLY}};
+			{"panic", TokenType::PANIC},		 {"finally", TokenType::FINALLY}, {"parallel", TokenType::PARALLEL}};
 } // namespace Backend
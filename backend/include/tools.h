@@ -17,25 +17,57 @@ namespace fs = std::filesystem;
 namespace RyTools {
 	// We use 'inline' so we don't get "multiple definition" errors
 	// when including this file in different .cpp files.
-	inline bool hadError = false;
+	// thread_local so worker isolates don't trip each other's error state.
+	inline thread_local bool hadError = false;
+	// When set, errors are collected here (one per line) instead of being printed. Used by the embedding API.
+	inline thread_local std::string *errorLog = nullptr;
+	inline thread_local bool errorLogSnippets = false; // Each error in errorLog is followed by its line and a caret
+
+	// Sends this thread's errors to `log` while it is in scope, with their source lines if `snippets`
+	class CaptureErrors {
+	public:
+		explicit CaptureErrors(std::string &log, bool snippets = false) :
+				previous(errorLog), previousSnippets(errorLogSnippets) {
+			errorLog = &log;
+			errorLogSnippets = snippets;
+		}
+		~CaptureErrors() {
+			errorLog = previous;
+			errorLogSnippets = previousSnippets;
+		}
+
+	private:
+		std::string *previous;
+		bool previousSnippets;
+	};
 
 	inline void report(int line, int col, const std::string &where, const std::string &message,
 										 const std::string currentSourceCode, bool showCaret = true) {
-		std::cerr << RyColor::RED << RyColor::BOLD << "Error" << RyColor::RESET << where << ": " << message << std::endl;
-
 		// Extract the line from currentSourceCode
-		if (!currentSourceCode.empty()) {
+		std::string lineText;
+		bool snippet = showCaret && !currentSourceCode.empty() && (!errorLog || errorLogSnippets);
+		if (snippet) {
 			std::stringstream ss(currentSourceCode);
-			std::string lineText;
 			for (int i = 0; i < line; ++i)
 				std::getline(ss, lineText);
+		}
 
-			if (showCaret) {
-				// Print the caret
-				std::cerr << "  " << RyColor::CYAN << line << " | " << RyColor::RESET << lineText << std::endl;
-				std::cerr << RyColor::CYAN << "    | " << RyColor::RESET << std::string(col - 1, ' ') << RyColor::RED << "^~~"
-									<< RyColor::RESET << std::endl;
+		if (errorLog) {
+			*errorLog += "line " + std::to_string(line) + ":" + std::to_string(col) + ": Error" + where + ": " + message + "\n";
+			if (snippet) {
+				*errorLog += "  " + std::to_string(line) + " | " + lineText + "\n";
+				*errorLog += "    | " + std::string(col - 1, ' ') + "^~~\n";
 			}
+			hadError = true;
+			return;
+		}
+		std::cerr << RyColor::RED << RyColor::BOLD << "Error" << RyColor::RESET << where << ": " << message << std::endl;
+
+		if (snippet) {
+			// Print the caret
+			std::cerr << "  " << RyColor::CYAN << line << " | " << RyColor::RESET << lineText << std::endl;
+			std::cerr << RyColor::CYAN << "    | " << RyColor::RESET << std::string(col - 1, ' ') << RyColor::RED << "^~~"
+								<< RyColor::RESET << std::endl;
 		}
 		hadError = true;
 	}
@@ -15,8 +15,6 @@
 
 using namespace Backend;
 
-std::set<std::string> Parser::namespaces;
-
 std::vector<std::shared_ptr<Stmt>> Parser::parse() {
 	std::vector<std::shared_ptr<Stmt>> statements;
 
@@ -26,25 +24,61 @@ std::vector<std::shared_ptr<Stmt>> Parser::parse() {
 		}
 	} catch (const RyTools::ParseError &error) {
 		loopDepth = 0;
+		parallelDepth = 0;
+		blockDepth = 0;
 		return {};
 	} catch (const std::exception &error) {
 		loopDepth = 0;
+		parallelDepth = 0;
+		blockDepth = 0;
 		std::cout << "System Failure: " << error.what() << std::endl;
 		return {};
 	}
 
+	if (deferred) {
+		deferred->aliases = externalTypeAliases;
+		deferred->namespaces = namespaces;
+	}
 	return statements;
 }
 
-Token Parser::peek() { return tokens[current]; }
+std::vector<std::shared_ptr<Stmt>> Parser::parseDeferred(const DeferredSource &source, size_t bodyStart,
+																												 const std::string &bodyNamespace) {
+	std::set<std::string> aliases = source.aliases;
+	std::set<std::string> namespaces = source.namespaces;
+	Parser parser(source, aliases, namespaces);
+	parser.current = bodyStart;
+	parser.currentNamespace = bodyNamespace;
+	try {
+		return parser.block();
+	} catch (const RyTools::ParseError &error) {
+		return {};
+	}
+}
+
+// Jumps over a function body by matching braces, the lexer already took care of strings and comments
+void Parser::skipBody() {
+	int depth = 1;
+	while (!isAtEnd()) {
+		TokenType type = tokens[current++].type;
+		if (type == TokenType::LBRACE) {
+			depth++;
+		} else if (type == TokenType::RBRACE && --depth == 0) {
+			return;
+		}
+	}
+	error(peek(), "Expect '}' after block.");
+}
 
-Token Parser::next() {
+const Token &Parser::peek() { return tokens[current]; }
+
+const Token &Parser::next() {
 	if (!isAtEnd())
 		current++;
 	return previous();
 }
 
-Token Parser::previous() { return tokens[current - 1]; }
+const Token &Parser::previous() { return tokens[current - 1]; }
 
 bool Parser::isAtEnd() const { return tokens[current].type == TokenType::EOF_TOKEN; }
 
@@ -78,7 +112,7 @@ bool Parser::checkNext(const TokenType type) const {
 	return tokens[current + 1].type == type;
 }
 
-Token Parser::consume(const TokenType type, const std::string &message) {
+const Token &Parser::consume(const TokenType type, const std::string &message) {
 	if (check(type))
 		return next();
 
@@ -389,12 +423,18 @@ std::shared_ptr<Stmt> Parser::statement() {
 	if (match({TokenType::NAMESPACE}))
 		return namespaceStatement();
 	if (match({TokenType::STOP})) {
+		if (loopDepth == 0 && parallelDepth > 0) {
+			error(previous(), "Cannot use 'stop' in a parallel foreach, iterations run independently.");
+		}
 		if (loopDepth == 0) {
 			error(previous(), "Cannot use 'stop' outside of a loop.");
 		}
 		return std::make_shared<StopStmt>(previous());
 	}
 	if (match({TokenType::SKIP})) {
+		if (loopDepth == 0 && parallelDepth > 0) {
+			error(previous(), "Use 'return' to finish a parallel foreach iteration.");
+		}
 		if (loopDepth == 0) {
 			error(previous(), "Cannot use 'skip' outside of a loop.");
 		}
@@ -406,6 +446,10 @@ std::shared_ptr<Stmt> Parser::statement() {
 		return std::make_shared<BlockStmt>(block());
 	if (match({TokenType::EACH}))
 		return eachStatement();
+	if (match({TokenType::PARALLEL})) {
+		consume(TokenType::EACH, "Expect 'foreach' after 'parallel'.");
+		return eachStatement(true);
+	}
 	if (match({TokenType::CLASS}))
 		return classStatement();
 	if (match({TokenType::ATTEMPT}))
@@ -496,6 +540,22 @@ std::shared_ptr<FunctionStmt> Parser::functionDeclaration(const std::string &kin
 	}
 	consume(TokenType::LBRACE, "Expect '{' before " + kind + " body.");
 
+	// Top-level functions and methods are only skimmed, their bodies get parsed and compiled on the first call
+	if (blockDepth == 0 && loopDepth == 0 && parallelDepth == 0) {
+		if (!deferred) {
+			deferred = std::make_shared<DeferredSource>();
+			deferred->tokens = tokenBuffer;
+			deferred->source = sourceCode;
+		}
+		auto function = std::make_shared<FunctionStmt>(name, parameters, std::vector<std::shared_ptr<Stmt>>(),
+																									 std::move(returnTypeNamespace), std::move(returnTypeAlias));
+		function->deferred = deferred;
+		function->bodyStart = current;
+		function->bodyNamespace = currentNamespace;
+		skipBody();
+		return function;
+	}
+
 	// Use std::move for the body to ensure the vector is passed correctly
 	std::vector<std::shared_ptr<Stmt>> body = block();
 
@@ -554,8 +614,15 @@ std::shared_ptr<Stmt> Parser::forStatement() {
 	return std::make_shared<ForStmt>(std::move(initializer), std::move(condition), std::move(increment), body);
 }
 
-std::shared_ptr<Stmt> Parser::eachStatement() {
-	loopDepth++;
+std::shared_ptr<Stmt> Parser::eachStatement(bool isParallel) {
+	// The body of a parallel foreach is a function of its own, loops around it don't count
+	int outerLoopDepth = loopDepth;
+	if (isParallel) {
+		loopDepth = 0;
+		parallelDepth++;
+	} else {
+		loopDepth++;
+	}
 	Token typeToken(TokenType::Nothing_Here, "", RyValue(), 0, 0); // Rename to avoid confusion
 
 	consume(TokenType::DATA, "Expect 'data' in each loop.");
@@ -569,14 +636,28 @@ std::shared_ptr<Stmt> Parser::eachStatement() {
 
 	auto iterable = expression();
 
+	std::optional<Token> target = std::nullopt;
+	if (isParallel && match({TokenType::LARROW})) {
+		target = consume(TokenType::IDENTIFIER, "Expect result name after '->'.");
+		if (!currentNamespace.empty()) {
+			target->lexeme = currentNamespace + "::" + target->lexeme;
+		}
+	}
+
 	auto body = statement();
-	loopDepth--;
+	loopDepth = outerLoopDepth;
+	if (isParallel)
+		parallelDepth--;
 
+	std::shared_ptr<EachStmt> each;
 	if (typeToken.type == TokenType::Nothing_Here) {
-		return std::make_shared<EachStmt>(name, iterable, body);
+		each = std::make_shared<EachStmt>(name, iterable, body);
 	} else {
-		return std::make_shared<EachStmt>(name, iterable, body, typeToken);
+		each = std::make_shared<EachStmt>(name, iterable, body, typeToken);
 	}
+	each->isParallel = isParallel;
+	each->target = target;
+	return each;
 }
 
 std::shared_ptr<Stmt> Parser::AliasDeclaration() {
@@ -739,7 +820,7 @@ std::shared_ptr<Stmt> Parser::namespaceStatement() {
 
 	consume(TokenType::LBRACE, "Expect '{' after namespace body.");
 
-	std::vector<std::shared_ptr<Stmt>> body = block();
+	std::vector<std::shared_ptr<Stmt>> body = block(false); // Still top level
 
 	currentNamespace = previousNamespace;
 
@@ -811,11 +892,13 @@ std::shared_ptr<Stmt> Parser::panicStatement() {
 	return std::make_shared<PanicStmt>(keyword, value);
 }
 
-std::vector<std::shared_ptr<Stmt>> Parser::block() {
+std::vector<std::shared_ptr<Stmt>> Parser::block(bool nested) {
 	std::vector<std::shared_ptr<Stmt>> statements;
+	blockDepth += nested;
 	while (!check(TokenType::RBRACE) && !isAtEnd()) {
 		statements.push_back(declaration());
 	}
 	consume(TokenType::RBRACE, "Expect '}' after block.");
+	blockDepth -= nested;
 	return statements;
 }
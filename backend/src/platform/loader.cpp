@@ -8,7 +8,7 @@ namespace Backend {
 #ifdef _WIN32
         return LoadLibraryA(path.c_str());
 #else
-        return dlopen(path.c_str(), RTLD_NOW | RTLD_GLOBAL);
+        return dlopen(path.c_str(), RTLD_LAZY | RTLD_GLOBAL); // Symbols bind on first call (LD_BIND_NOW=1 to check them all up front)
 #endif
     }
 
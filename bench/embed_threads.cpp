@@ -0,0 +1,101 @@
+/**
+	File: embed_threads.cpp
+	Description: Throughput of the embedding API across threads. One Program is compiled up front and shared;
+	every thread owns a Ry::VM. Two workloads are measured for 1..N threads:
+	  call  - a warm VM calls handle(i) over and over (a service invoking a loaded script)
+	  fresh - every invocation gets a new VM and runs the whole program (one-shot scripts)
+
+	Usage: ry_embed_threads [-t max threads] [-d seconds per run]
+*/
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <thread>
+#include <vector>
+#include "ry.h"
+
+using Clock = std::chrono::steady_clock;
+
+static const char *SCRIPT = R"(
+data table = [1, 2, 3, 4, 5, 6, 7, 8]
+
+func handle(n) {
+  data total = 0
+  data i = 0
+  while i < 200 {
+    total = total + table[i % 8] * n
+    i = i + 1
+  }
+  return host_scale(total)
+}
+
+data warmup = handle(1)
+)";
+
+static Ry::Value hostScale(std::span<Ry::Value> args) { return Ry::Value(args[0].asNumber() / 2); }
+
+// Runs `work` on `threads` threads for `seconds` and returns invocations per second
+template<typename Work>
+static double measure(int threads, double seconds, Work work) {
+	std::atomic<long long> total{0};
+	std::atomic<bool> stop{false};
+	std::vector<std::thread> workers;
+	for (int t = 0; t < threads; t++) {
+		workers.emplace_back([&] {
+			long long done = work(stop);
+			total += done;
+		});
+	}
+	auto start = Clock::now();
+	std::this_thread::sleep_for(std::chrono::duration<double>(seconds));
+	stop = true;
+	for (auto &worker: workers)
+		worker.join();
+	double elapsed = std::chrono::duration<double>(Clock::now() - start).count();
+	return total / elapsed;
+}
+
+int main(int argc, char **argv) {
+	int maxThreads = std::max(1u, std::thread::hardware_concurrency());
+	double seconds = 1;
+	for (int i = 1; i + 1 < argc; i += 2) {
+		std::string arg = argv[i];
+		if (arg == "-t")
+			maxThreads = std::max(1, std::atoi(argv[i + 1]));
+		else if (arg == "-d")
+			seconds = std::atof(argv[i + 1]);
+	}
+
+	auto program = Ry::Program::compile(SCRIPT, "bench");
+
+	std::printf("%-8s %16s %16s\n", "threads", "call/s", "fresh VM/s");
+	for (int threads = 1; threads <= maxThreads; threads *= 2) {
+		double calls = measure(threads, seconds, [&](std::atomic<bool> &stop) {
+			Ry::VM vm;
+			vm.define("host_scale", hostScale);
+			vm.run(*program);
+			Ry::Value handle = vm.get("handle");
+			long long done = 0;
+			for (double n = 0; !stop; n++, done++)
+				vm.call(handle, {Ry::Value(n)});
+			return done;
+		});
+		double fresh = measure(threads, seconds, [&](std::atomic<bool> &stop) {
+			long long done = 0;
+			for (; !stop; done++) {
+				Ry::VM vm;
+				vm.define("host_scale", hostScale);
+				vm.run(*program);
+			}
+			return done;
+		});
+		std::printf("%-8d %16.0f %16.0f\n", threads, calls, fresh);
+		if (threads < maxThreads && threads * 2 > maxThreads)
+			threads = maxThreads / 2; // Always finish with the full thread count
+	}
+	return 0;
+}
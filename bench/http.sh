@@ -0,0 +1,23 @@
+#!/usr/bin/env bash
+# Serves bench/http_hello.ry and hammers it with ry_http_load over loopback.
+# Usage: bench/http.sh [build dir] [workers] [ry_http_load options...]
+set -e
+BUILD=${1:-build}
+WORKERS=${2:-1}
+[ $# -gt 0 ] && shift
+[ $# -gt 0 ] && shift
+PORT=8089
+
+SCRIPT=$(mktemp --suffix=.ry)
+sed "s/\"workers\": 1/\"workers\": $WORKERS/" "$(dirname "$0")/http_hello.ry" > "$SCRIPT"
+LD_LIBRARY_PATH="$BUILD" "$BUILD/ry" run "$SCRIPT" &
+SERVER=$!
+trap 'kill $SERVER 2>/dev/null; rm -f "$SCRIPT"' EXIT
+
+# Wait for the port to open
+for _ in $(seq 50); do
+  (exec 3<>/dev/tcp/127.0.0.1/$PORT) 2>/dev/null && break
+  sleep 0.1
+done
+
+"$BUILD/ry_http_load" "$@" $PORT
@@ -0,0 +1,186 @@
+/**
+	File: http_load.cpp
+	Description: Loopback load generator for the HTTP module. Keeps a fixed number of
+	keep-alive connections busy (optionally pipelined) and reports requests/sec and latency percentiles.
+
+	Usage: ry_http_load [-c connections] [-d seconds] [-p pipeline] [-h host] [-u path] port
+*/
+
+#include <algorithm>
+#include <arpa/inet.h>
+#include <cerrno>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <string>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <vector>
+
+using Clock = std::chrono::steady_clock;
+
+struct Client {
+	int fd = -1;
+	std::string in;
+	std::deque<Clock::time_point> inflight; // Send times of the requests still waiting for an answer
+};
+
+static bool connectTo(Client &client, const sockaddr_in &address) {
+	client.fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (client.fd < 0 || connect(client.fd, (const sockaddr *) &address, sizeof(address)) < 0)
+		return false;
+	int yes = 1;
+	setsockopt(client.fd, IPPROTO_TCP, TCP_NODELAY, &yes, sizeof(yes));
+	return true;
+}
+
+static bool sendAll(int fd, const std::string &data) {
+	size_t sent = 0;
+	while (sent < data.size()) {
+		ssize_t count = send(fd, data.data() + sent, data.size() - sent, MSG_NOSIGNAL);
+		if (count <= 0)
+			return false;
+		sent += count;
+	}
+	return true;
+}
+
+// Pops one complete response off the buffer, false if it isn't all there yet
+static bool takeResponse(std::string &buffer, bool &ok) {
+	size_t headerEnd = buffer.find("\r\n\r\n");
+	if (headerEnd == std::string::npos)
+		return false;
+
+	size_t length = 0;
+	size_t at = buffer.find("Content-Length:");
+	if (at != std::string::npos && at < headerEnd)
+		length = std::strtoull(buffer.c_str() + at + 15, nullptr, 10);
+	if (buffer.size() < headerEnd + 4 + length)
+		return false;
+
+	ok = buffer.compare(0, 12, "HTTP/1.1 200") == 0;
+	buffer.erase(0, headerEnd + 4 + length);
+	return true;
+}
+
+int main(int argc, char **argv) {
+	int connections = 64;
+	double seconds = 5;
+	int pipeline = 1;
+	std::string host = "127.0.0.1";
+	std::string path = "/";
+	int port = 0;
+
+	for (int i = 1; i < argc; i++) {
+		std::string arg = argv[i];
+		bool hasValue = i + 1 < argc;
+		if (arg == "-c" && hasValue)
+			connections = std::atoi(argv[++i]);
+		else if (arg == "-d" && hasValue)
+			seconds = std::atof(argv[++i]);
+		else if (arg == "-p" && hasValue)
+			pipeline = std::max(1, std::atoi(argv[++i]));
+		else if (arg == "-h" && hasValue)
+			host = argv[++i];
+		else if (arg == "-u" && hasValue)
+			path = argv[++i];
+		else
+			port = std::atoi(argv[i]);
+	}
+	if (port <= 0) {
+		std::fprintf(stderr, "Usage: ry_http_load [-c connections] [-d seconds] [-p pipeline] [-h host] [-u path] port\n");
+		return 1;
+	}
+
+	sockaddr_in address{};
+	address.sin_family = AF_INET;
+	address.sin_port = htons(port);
+	inet_pton(AF_INET, host.c_str(), &address.sin_addr);
+
+	const std::string request = "GET " + path + " HTTP/1.1\r\nHost: " + host + "\r\n\r\n";
+	std::string batch;
+	for (int i = 0; i < pipeline; i++)
+		batch += request;
+
+	int epollFd = epoll_create1(EPOLL_CLOEXEC);
+	std::vector<Client> clients(connections);
+	for (int i = 0; i < connections; i++) {
+		if (!connectTo(clients[i], address)) {
+			std::fprintf(stderr, "connect: %s\n", std::strerror(errno));
+			return 1;
+		}
+		epoll_event event{};
+		event.events = EPOLLIN;
+		event.data.u32 = i;
+		epoll_ctl(epollFd, EPOLL_CTL_ADD, clients[i].fd, &event);
+	}
+
+	std::vector<double> latencies; // Microseconds
+	latencies.reserve(1 << 20);
+	long long errors = 0;
+
+	auto start = Clock::now();
+	auto end = start + std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(seconds));
+	for (auto &client: clients) {
+		auto now = Clock::now();
+		for (int i = 0; i < pipeline; i++)
+			client.inflight.push_back(now);
+		sendAll(client.fd, batch);
+	}
+
+	epoll_event events[256];
+	char chunk[65536];
+	while (Clock::now() < end) {
+		int count = epoll_wait(epollFd, events, 256, 100);
+		for (int i = 0; i < count; i++) {
+			Client &client = clients[events[i].data.u32];
+			ssize_t received = recv(client.fd, chunk, sizeof(chunk), 0);
+			if (received <= 0) {
+				errors++;
+				epoll_ctl(epollFd, EPOLL_CTL_DEL, client.fd, nullptr);
+				continue;
+			}
+			client.in.append(chunk, received);
+
+			auto now = Clock::now();
+			bool ok = false;
+			std::string more;
+			while (!client.inflight.empty() && takeResponse(client.in, ok)) {
+				latencies.push_back(std::chrono::duration<double, std::micro>(now - client.inflight.front()).count());
+				client.inflight.pop_front();
+				errors += !ok;
+				more += request;
+			}
+			// Keep `pipeline` requests in flight on every connection
+			for (size_t sent = 0; sent < more.size(); sent += request.size())
+				client.inflight.push_back(now);
+			if (!more.empty() && now < end)
+				sendAll(client.fd, more);
+		}
+	}
+	double elapsed = std::chrono::duration<double>(Clock::now() - start).count();
+
+	for (auto &client: clients)
+		close(client.fd);
+	close(epollFd);
+
+	std::sort(latencies.begin(), latencies.end());
+	auto percentile = [&](double p) {
+		if (latencies.empty())
+			return 0.0;
+		return latencies[std::min(latencies.size() - 1, (size_t) (p * latencies.size()))] / 1000.0;
+	};
+
+	std::printf("connections:  %d (pipeline %d)\n", connections, pipeline);
+	std::printf("requests:     %zu in %.2fs\n", latencies.size(), elapsed);
+	std::printf("requests/sec: %.0f\n", latencies.size() / elapsed);
+	std::printf("latency p50:  %.3f ms\n", percentile(0.50));
+	std::printf("latency p99:  %.3f ms\n", percentile(0.99));
+	std::printf("errors:       %lld\n", errors);
+	return 0;
+}
@@ -0,0 +1,345 @@
+/**
+	File: micro.cpp
+	Description: Microbenchmarks for the pieces every script goes through: RyValue construction and copies
+	per kind, VM::push/pop, RyValueHasher per key kind, a call round trip (OP_CALL to OP_RETURN), Chunk::write,
+	and the lexer, parser and compiler per MB of source. Each one is timed in rounds of at least -m ms and the
+	median round is kept. Prints one JSON object, one benchmark per line like ry_bench: ns_per_op always, and
+	mb_per_s for the front end.
+
+	Usage: ry_micro [-m ms per round] [-r rounds] [-f name filter] [-o out.json]
+*/
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <functional>
+#include <memory>
+#include <set>
+#include <string>
+#include <vector>
+#include "chunk.h"
+#include "compiler.h"
+#include "lexer.h"
+#include "parser.h"
+#include "tools.h"
+#include "value.h"
+#include "vm.h"
+
+using Clock = std::chrono::steady_clock;
+
+// Keeps the compiler from dropping work whose result is never used
+template<typename T>
+static inline void keep(T const &value) {
+	asm volatile("" : : "g"(&value) : "memory");
+}
+
+namespace RyRuntime {
+	// VM::push/pop are private, this is the one outside caller (declared a friend in vm.h)
+	struct VMBench {
+		static void pushPop(VM &vm, long long n) {
+			RyValue value(1.0);
+			while (n > 0) {
+				int batch = (int) std::min<long long>(n, 128);
+				for (int i = 0; i < batch; i++)
+					vm.push(value);
+				for (int i = 0; i < batch; i++)
+					keep(vm.pop());
+				n -= batch;
+			}
+		}
+	};
+} // namespace RyRuntime
+
+using namespace RyRuntime;
+
+struct Result {
+	std::string name;
+	double nsPerOp = 0;
+	double mbPerSecond = -1; // Only for what reads source
+	long long ops = 0; // Per round
+};
+
+struct Options {
+	double roundMs = 50;
+	int rounds = 7;
+	std::string filter;
+};
+
+static double seconds(Clock::time_point start) { return std::chrono::duration<double>(Clock::now() - start).count(); }
+
+// `body(n)` does n operations. n is doubled until a round takes roundMs, then the median of the rounds is kept.
+static Result measure(const Options &options, const std::string &name, const std::function<void(long long)> &body) {
+	long long n = 1;
+	for (;;) {
+		auto start = Clock::now();
+		body(n);
+		if (seconds(start) * 1000 >= options.roundMs || n >= (1LL << 40))
+			break;
+		n *= 2;
+	}
+	std::vector<double> times;
+	for (int i = 0; i < options.rounds; i++) {
+		auto start = Clock::now();
+		body(n);
+		times.push_back(seconds(start));
+	}
+	std::sort(times.begin(), times.end());
+	Result result;
+	result.name = name;
+	result.ops = n;
+	result.nsPerOp = times[times.size() / 2] * 1e9 / n;
+	return result;
+}
+
+// The same for a whole pass over `bytes` of source
+static Result measureSource(const Options &options, const std::string &name, size_t bytes,
+														const std::function<void()> &pass) {
+	Result result = measure(options, name, [&](long long n) {
+		for (long long i = 0; i < n; i++)
+			pass();
+	});
+	result.mbPerSecond = bytes / (result.nsPerOp / 1e9) / (1024 * 1024);
+	return result;
+}
+
+// About `bytes` of source, as scripts of 8 units each (a chunk holds 256 constants, and every unit takes about
+// 25). Everything sits inside blocks, since top-level function bodies are only skimmed by the parser and
+// compiled on their first call; these get parsed and compiled in full.
+static std::vector<std::string> generateSources(size_t bytes) {
+	std::vector<std::string> sources;
+	for (size_t total = 0, n = 0; total < bytes; n++) {
+		if (n % 8 == 0)
+			sources.emplace_back();
+		std::string id = std::to_string(n);
+		std::string unit = "data flag_" + id + " = false\n"
+											 "if (flag_" + id + ") {\n"
+											 "  func step_" + id + "(data a, data b) {\n"
+											 "    data total = 0\n"
+											 "    data i = 0\n"
+											 "    while (i < a) {\n"
+											 "      if (i % 3 == 0) { total = total + b * i } else { total = total - 1 }\n"
+											 "      i = i + 1\n"
+											 "    }\n"
+											 "    data items = [1, 2.5, \"item " + id + "\", true, null]\n"
+											 "    data config = {\"name\": \"step " + id + "\", \"limit\": 40}\n"
+											 "    return total + items.len\n"
+											 "  }\n"
+											 "  out(step_" + id + "(10, 2))\n"
+											 "}\n"
+											 "data sum_" + id + " = 0\n"
+											 "foreach data k in 0 to 10 {\n"
+											 "  sum_" + id + " = sum_" + id + " + k * 2 - (k / 3)\n"
+											 "}\n";
+		total += unit.size();
+		sources.back() += unit;
+	}
+	return sources;
+}
+
+static std::vector<std::shared_ptr<Backend::Stmt>> parse(const std::vector<Backend::Token> &tokens,
+																												 const std::string &source) {
+	std::set<std::string> aliases, namespaces;
+	Backend::Parser parser(tokens, aliases, namespaces, source);
+	return parser.parse();
+}
+
+// Seconds for one run of `source` in a fresh VM
+static double runScript(const std::string &source) {
+	VM vm;
+	auto function = vm.compile(source, "micro");
+	if (!function) {
+		std::fprintf(stderr, "ry_micro: the call benchmark script doesn't compile\n");
+		std::exit(2);
+	}
+	auto start = Clock::now();
+	vm.interpret(function);
+	return seconds(start);
+}
+
+// A call and return of an empty function, less the loop around it: the median over a few runs of each
+static Result measureCall(const Options &options) {
+	const long long calls = 2000000;
+	std::string loop = "data i = 0\n"
+										 "while (i < " + std::to_string(calls) + ") {\n"
+										 "  BODY\n"
+										 "  i = i + 1\n"
+										 "}\n";
+	std::string empty = loop, call = "func nothing() { }\n" + loop;
+	empty.replace(empty.find("BODY"), 4, "");
+	call.replace(call.find("BODY"), 4, "nothing()");
+
+	std::vector<double> differences;
+	for (int i = 0; i < options.rounds; i++)
+		differences.push_back(runScript(call) - runScript(empty));
+	std::sort(differences.begin(), differences.end());
+	Result result;
+	result.name = "call_round_trip";
+	result.ops = calls;
+	result.nsPerOp = std::max(0.0, differences[differences.size() / 2] * 1e9 / calls);
+	return result;
+}
+
+static std::vector<Result> runAll(const Options &options) {
+	std::vector<Result> results;
+	auto wanted = [&](const std::string &name) {
+		return options.filter.empty() || name.find(options.filter) != std::string::npos;
+	};
+	auto add = [&](const std::string &name, const std::function<void(long long)> &body) {
+		if (!wanted(name))
+			return;
+		results.push_back(measure(options, name, body));
+		std::fprintf(stderr, "%-24s %10.2f ns/op\n", name.c_str(), results.back().nsPerOp);
+	};
+
+	const std::string shortText = "key_1234", longText(64, 'x');
+	const RyValue number(42.0), boolean(true), shortString(shortText), longString(longText);
+	const RyValue list(std::make_shared<std::vector<RyValue>>(8, RyValue(1.0)));
+	const RyValue map(std::make_shared<std::unordered_map<RyValue, RyValue, RyValueHasher>>());
+
+	// --- RyValue ---
+	add("value_new_number", [](long long n) {
+		for (long long i = 0; i < n; i++)
+			keep(RyValue((double) i));
+	});
+	add("value_new_short_string", [&](long long n) {
+		for (long long i = 0; i < n; i++) {
+			RyValue value(shortText);
+			keep(value);
+		}
+	});
+	add("value_new_long_string", [&](long long n) {
+		for (long long i = 0; i < n; i++) {
+			RyValue value(longText);
+			keep(value);
+		}
+	});
+	add("value_new_list", [](long long n) {
+		for (long long i = 0; i < n; i++) {
+			RyValue value(std::make_shared<std::vector<RyValue>>());
+			keep(value);
+		}
+	});
+	for (auto &[kind, value]: std::vector<std::pair<std::string, const RyValue *>>{
+					 {"number", &number}, {"short_string", &shortString}, {"long_string", &longString}, {"list", &list},
+					 {"map", &map}}) {
+		const RyValue &source = *value;
+		add("value_copy_" + kind, [&source](long long n) {
+			for (long long i = 0; i < n; i++) {
+				RyValue copy = source;
+				keep(copy);
+			}
+		});
+	}
+
+	// --- The VM stack ---
+	if (wanted("vm_push_pop")) {
+		VM vm;
+		add("vm_push_pop", [&vm](long long n) { VMBench::pushPop(vm, n); });
+	}
+
+	// --- Map keys ---
+	for (auto &[kind, value]: std::vector<std::pair<std::string, const RyValue *>>{
+					 {"number", &number}, {"bool", &boolean}, {"short_string", &shortString}, {"long_string", &longString},
+					 {"list", &list}}) {
+		const RyValue &key = *value;
+		add("hash_" + kind, [&key](long long n) {
+			RyValueHasher hasher;
+			for (long long i = 0; i < n; i++)
+				keep(hasher(key));
+		});
+	}
+
+	// --- Bytecode ---
+	add("chunk_write", [](long long n) {
+		Chunk chunk;
+		for (long long i = 0; i < n; i++)
+			chunk.write((uint8_t) i, (int) (i >> 4), (int) (i & 15));
+		keep(chunk.code.data());
+	});
+	if (wanted("call_round_trip")) {
+		results.push_back(measureCall(options));
+		std::fprintf(stderr, "%-24s %10.2f ns/op\n", "call_round_trip", results.back().nsPerOp);
+	}
+
+	// --- Front end ---
+	const auto sources = generateSources(1 << 20);
+	size_t bytes = 0;
+	std::vector<std::vector<Backend::Token>> tokens;
+	for (const auto &source: sources) {
+		bytes += source.size();
+		tokens.push_back(Backend::Lexer(source).scanTokens());
+	}
+	auto front = [&](const std::string &name, const std::function<void(size_t)> &pass) {
+		if (!wanted(name))
+			return;
+		RyTools::hadError = false;
+		results.push_back(measureSource(options, name, bytes, [&] {
+			for (size_t i = 0; i < sources.size(); i++)
+				pass(i);
+		}));
+		if (RyTools::hadError) {
+			std::fprintf(stderr, "ry_micro: the generated source has errors\n");
+			std::exit(2);
+		}
+		std::fprintf(stderr, "%-24s %10.2f MB/s\n", name.c_str(), results.back().mbPerSecond);
+	};
+	front("lexer", [&](size_t i) { keep(Backend::Lexer(sources[i]).scanTokens().size()); });
+	front("parser", [&](size_t i) { keep(parse(tokens[i], sources[i]).size()); });
+	std::vector<std::vector<std::shared_ptr<Backend::Stmt>>> statements;
+	for (size_t i = 0; i < sources.size(); i++)
+		statements.push_back(parse(tokens[i], sources[i]));
+	front("compiler", [&](size_t i) {
+		Chunk chunk;
+		Compiler compiler(nullptr, sources[i]);
+		keep(compiler.compile(statements[i], &chunk));
+	});
+	return results;
+}
+
+static std::string toJson(const std::vector<Result> &results, const Options &options) {
+	char head[128];
+	std::snprintf(head, sizeof(head), "{\"round_ms\": %g, \"rounds\": %d, \"benchmarks\": [\n", options.roundMs,
+								options.rounds);
+	std::string out = head;
+	for (size_t i = 0; i < results.size(); i++) {
+		const Result &r = results[i];
+		char line[256];
+		int length = std::snprintf(line, sizeof(line), "  {\"name\": \"%s\", \"ns_per_op\": %.3f, \"ops\": %lld",
+															 r.name.c_str(), r.nsPerOp, r.ops);
+		if (r.mbPerSecond >= 0)
+			std::snprintf(line + length, sizeof(line) - length, ", \"mb_per_s\": %.2f", r.mbPerSecond);
+		out += line;
+		out += i + 1 < results.size() ? "},\n" : "}\n";
+	}
+	return out + "]}\n";
+}
+
+int main(int argc, char **argv) {
+	Options options;
+	std::string outPath;
+	for (int i = 1; i < argc; i++) {
+		std::string arg = argv[i];
+		bool hasValue = i + 1 < argc;
+		if (arg == "-m" && hasValue)
+			options.roundMs = std::max(1.0, std::atof(argv[++i]));
+		else if (arg == "-r" && hasValue)
+			options.rounds = std::max(1, std::atoi(argv[++i]));
+		else if (arg == "-f" && hasValue)
+			options.filter = argv[++i];
+		else if (arg == "-o" && hasValue)
+			outPath = argv[++i];
+		else {
+			std::fprintf(stderr, "Usage: ry_micro [-m ms per round] [-r rounds] [-f name filter] [-o out.json]\n");
+			return 2;
+		}
+	}
+
+	std::string json = toJson(runAll(options), options);
+	if (outPath.empty())
+		std::fputs(json.c_str(), stdout);
+	else
+		std::ofstream(outPath) << json;
+	return 0;
+}
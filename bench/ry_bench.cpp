@@ -0,0 +1,307 @@
+/**
+	File: ry_bench.cpp
+	Description: Whole-program benchmark runner. Runs every script in bench/suite (or the ones given) with
+	`ry run`, a few times to warm up and then N times measured, and prints one JSON object: median and p95
+	wall time, instructions retired (user space, from perf_event_open; null where it isn't allowed) and
+	peak RSS for each. With a baseline (an earlier output) it also prints the changes and exits with 1 if
+	anything got slower by more than the threshold.
+
+	Usage: ry_bench [-n runs] [-w warmup] [-r path/to/ry] [-b baseline.json] [-t percent] [-o out.json]
+									[script.ry or directory...]
+*/
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <filesystem>
+#include <fstream>
+#include <linux/perf_event.h>
+#include <map>
+#include <string>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <vector>
+
+namespace fs = std::filesystem;
+using Clock = std::chrono::steady_clock;
+
+struct Run {
+	double ms = 0;
+	long long instructions = -1; // -1 when the counter couldn't be opened
+	long peakKb = 0;
+	bool ok = false;
+};
+
+struct Result {
+	std::string name;
+	double medianMs = 0, p95Ms = 0, minMs = 0;
+	long long instructions = -1;
+	long peakKb = 0;
+	bool failed = false;
+};
+
+// User-space instructions of `pid` and its threads, counting from its exec
+static int openInstructionCounter(pid_t pid) {
+	perf_event_attr attr{};
+	attr.size = sizeof(attr);
+	attr.type = PERF_TYPE_HARDWARE;
+	attr.config = PERF_COUNT_HW_INSTRUCTIONS;
+	attr.disabled = 1;
+	attr.enable_on_exec = 1;
+	attr.inherit = 1;
+	attr.exclude_kernel = 1;
+	attr.exclude_hv = 1;
+	return (int) syscall(SYS_perf_event_open, &attr, pid, -1, -1, PERF_FLAG_FD_CLOEXEC);
+}
+
+static Run runOnce(const std::string &ry, const std::string &script) {
+	Run run;
+	int gate[2];
+	if (pipe2(gate, O_CLOEXEC) < 0)
+		return run;
+
+	pid_t pid = fork();
+	if (pid < 0)
+		return run;
+	if (pid == 0) {
+		// Held until the parent has the counter on us, so it sees the exec
+		char go;
+		close(gate[1]);
+		if (read(gate[0], &go, 1) != 1)
+			_exit(127);
+		int devNull = open("/dev/null", O_WRONLY);
+		dup2(devNull, STDOUT_FILENO);
+		execl(ry.c_str(), ry.c_str(), "run", script.c_str(), (char *) nullptr);
+		std::fprintf(stderr, "ry_bench: cannot run %s: %s\n", ry.c_str(), std::strerror(errno));
+		_exit(127);
+	}
+
+	close(gate[0]);
+	int counter = openInstructionCounter(pid);
+	auto start = Clock::now();
+	if (write(gate[1], "x", 1) != 1) {
+		kill(pid, SIGKILL);
+	}
+	close(gate[1]);
+
+	int status = 0;
+	rusage usage{};
+	while (wait4(pid, &status, 0, &usage) < 0 && errno == EINTR) {
+	}
+	run.ms = std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+	run.peakKb = usage.ru_maxrss;
+	run.ok = WIFEXITED(status) && WEXITSTATUS(status) == 0;
+
+	if (counter >= 0) {
+		long long count = 0;
+		if (read(counter, &count, sizeof(count)) == sizeof(count))
+			run.instructions = count;
+		close(counter);
+	}
+	return run;
+}
+
+// Nearest rank
+static double percentile(std::vector<double> sorted, double p) {
+	std::sort(sorted.begin(), sorted.end());
+	size_t rank = (size_t) (p * sorted.size() + 0.999999);
+	return sorted[std::min(sorted.size() - 1, rank > 0 ? rank - 1 : 0)];
+}
+
+static Result measure(const std::string &ry, const std::string &script, int runs, int warmup) {
+	Result result;
+	result.name = fs::path(script).stem().string();
+	for (int i = 0; i < warmup; i++)
+		runOnce(ry, script);
+
+	std::vector<double> times;
+	std::vector<long long> instructions;
+	for (int i = 0; i < runs; i++) {
+		Run run = runOnce(ry, script);
+		if (!run.ok) {
+			result.failed = true;
+			return result;
+		}
+		times.push_back(run.ms);
+		if (run.instructions >= 0)
+			instructions.push_back(run.instructions);
+		result.peakKb = std::max(result.peakKb, run.peakKb);
+	}
+	result.medianMs = percentile(times, 0.5);
+	result.p95Ms = percentile(times, 0.95);
+	result.minMs = *std::min_element(times.begin(), times.end());
+	if (instructions.size() == times.size()) {
+		std::sort(instructions.begin(), instructions.end());
+		result.instructions = instructions[instructions.size() / 2];
+	}
+	return result;
+}
+
+// One benchmark per line, so a baseline can be read back a line at a time
+static std::string toJson(const std::vector<Result> &results, int runs, int warmup) {
+	std::string out = "{\"runs\": " + std::to_string(runs) + ", \"warmup\": " + std::to_string(warmup) +
+										", \"benchmarks\": [\n";
+	for (size_t i = 0; i < results.size(); i++) {
+		const Result &r = results[i];
+		char line[512];
+		if (r.failed) {
+			std::snprintf(line, sizeof(line), "  {\"name\": \"%s\", \"failed\": true}", r.name.c_str());
+		} else {
+			std::string instructions = r.instructions >= 0 ? std::to_string(r.instructions) : "null";
+			std::snprintf(line, sizeof(line),
+										"  {\"name\": \"%s\", \"median_ms\": %.3f, \"p95_ms\": %.3f, \"min_ms\": %.3f, "
+										"\"instructions\": %s, \"peak_rss_kb\": %ld}",
+										r.name.c_str(), r.medianMs, r.p95Ms, r.minMs, instructions.c_str(), r.peakKb);
+		}
+		out += line;
+		out += i + 1 < results.size() ? ",\n" : "\n";
+	}
+	return out + "]}\n";
+}
+
+// The number after "key": on a line of toJson() output, or -1
+static double numberField(const std::string &line, const std::string &key) {
+	size_t at = line.find("\"" + key + "\":");
+	if (at == std::string::npos)
+		return -1;
+	const char *value = line.c_str() + at + key.size() + 3;
+	char *end;
+	double number = std::strtod(value, &end);
+	return end == value ? -1 : number;
+}
+
+static std::map<std::string, Result> loadBaseline(const std::string &path) {
+	std::map<std::string, Result> baseline;
+	std::ifstream in(path);
+	std::string line;
+	while (std::getline(in, line)) {
+		size_t at = line.find("\"name\": \"");
+		if (at == std::string::npos)
+			continue;
+		at += 9;
+		Result r;
+		r.name = line.substr(at, line.find('"', at) - at);
+		r.failed = line.find("\"failed\": true") != std::string::npos;
+		r.medianMs = numberField(line, "median_ms");
+		r.instructions = (long long) numberField(line, "instructions");
+		r.peakKb = (long) numberField(line, "peak_rss_kb");
+		baseline[r.name] = r;
+	}
+	return baseline;
+}
+
+static double change(double now, double before) { return before > 0 ? (now / before - 1) * 100 : 0; }
+
+// Prints the comparison to stderr, returns whether anything regressed
+static bool compare(const std::vector<Result> &results, const std::map<std::string, Result> &baseline,
+										double threshold) {
+	bool regressed = false;
+	std::fprintf(stderr, "\n%-16s %12s %12s %9s %9s %9s\n", "benchmark", "base ms", "now ms", "time", "instr", "rss");
+	for (const Result &r: results) {
+		auto found = baseline.find(r.name);
+		if (found == baseline.end() || found->second.failed || r.failed) {
+			std::fprintf(stderr, "%-16s %s\n", r.name.c_str(), r.failed ? "FAILED" : "(not in the baseline)");
+			regressed |= r.failed;
+			continue;
+		}
+		const Result &b = found->second;
+		double time = change(r.medianMs, b.medianMs);
+		bool counted = r.instructions >= 0 && b.instructions > 0;
+		double instructions = counted ? change((double) r.instructions, (double) b.instructions) : 0;
+		// Instructions are far less noisy than time, so either going up past the threshold counts
+		bool slower = time > threshold || instructions > threshold;
+		regressed |= slower;
+
+		char instr[16] = "-";
+		if (counted)
+			std::snprintf(instr, sizeof(instr), "%+.1f%%", instructions);
+		std::fprintf(stderr, "%-16s %12.2f %12.2f %+8.1f%% %9s %+8.1f%%%s\n", r.name.c_str(), b.medianMs, r.medianMs,
+								 time, instr, change((double) r.peakKb, (double) b.peakKb), slower ? "  REGRESSION" : "");
+	}
+	return regressed;
+}
+
+int main(int argc, char **argv) {
+	int runs = 10;
+	int warmup = 2;
+	double threshold = 5;
+	std::string ry = "./ry";
+	std::string baselinePath, outPath;
+	std::vector<std::string> inputs;
+
+	for (int i = 1; i < argc; i++) {
+		std::string arg = argv[i];
+		bool hasValue = i + 1 < argc;
+		if (arg == "-n" && hasValue)
+			runs = std::max(1, std::atoi(argv[++i]));
+		else if (arg == "-w" && hasValue)
+			warmup = std::max(0, std::atoi(argv[++i]));
+		else if (arg == "-r" && hasValue)
+			ry = argv[++i];
+		else if (arg == "-b" && hasValue)
+			baselinePath = argv[++i];
+		else if (arg == "-t" && hasValue)
+			threshold = std::atof(argv[++i]);
+		else if (arg == "-o" && hasValue)
+			outPath = argv[++i];
+		else if (arg[0] == '-') {
+			std::fprintf(stderr, "Usage: ry_bench [-n runs] [-w warmup] [-r path/to/ry] [-b baseline.json] [-t percent] "
+													 "[-o out.json] [script.ry or directory...]\n");
+			return 2;
+		} else
+			inputs.push_back(arg);
+	}
+	if (inputs.empty())
+		inputs.push_back("bench/suite");
+
+	std::vector<std::string> scripts;
+	for (const auto &input: inputs) {
+		if (fs::is_directory(input)) {
+			std::vector<std::string> found;
+			for (const auto &entry: fs::directory_iterator(input))
+				if (entry.path().extension() == ".ry")
+					found.push_back(entry.path().string());
+			std::sort(found.begin(), found.end());
+			scripts.insert(scripts.end(), found.begin(), found.end());
+		} else {
+			scripts.push_back(input);
+		}
+	}
+
+	std::vector<Result> results;
+	for (const auto &script: scripts) {
+		std::fprintf(stderr, "%-16s ", fs::path(script).stem().c_str());
+		Result result = measure(ry, script, runs, warmup);
+		if (result.failed)
+			std::fprintf(stderr, "failed (see the error above)\n");
+		else
+			std::fprintf(stderr, "median %9.2f ms  p95 %9.2f ms\n", result.medianMs, result.p95Ms);
+		results.push_back(result);
+	}
+
+	std::string json = toJson(results, runs, warmup);
+	if (outPath.empty()) {
+		std::fputs(json.c_str(), stdout);
+	} else {
+		std::ofstream(outPath) << json;
+	}
+
+	bool regressed = false;
+	if (!baselinePath.empty()) {
+		auto baseline = loadBaseline(baselinePath);
+		if (baseline.empty()) {
+			std::fprintf(stderr, "ry_bench: no results in %s\n", baselinePath.c_str());
+			return 2;
+		}
+		regressed = compare(results, baseline, threshold);
+	}
+	bool failed = std::any_of(results.begin(), results.end(), [](const Result &r) { return r.failed; });
+	return regressed || failed ? 1 : 0;
+}
@@ -1,18 +1,177 @@
+/**
+	File: rylib-dk.h
+	Description: The Ry native extension ABI. A plain C interface, so an extension keeps working across compilers,
+	standard libraries and Ry builds as long as the major ABI version matches.
+
+	  #include "rylib-dk.h"
+
+	  static const RyApi *ry;
+
+	  static RyStatus twice(RyContext *ctx, int argc, const RyHandle *args, RyHandle *result) {
+	      double number;
+	      if (!ry->get_number(args[0], &number))
+	          return ry->error(ctx, "twice() expects a number.");
+	      *result = ry->make_number(ctx, number * 2);
+	      return RY_OK;
+	  }
+
+	  RY_MODULE_INIT(api, module) {
+	      ry = api;
+	      ry->define(module, "twice", twice, 1);
+	      return RY_OK;
+	  }
+
+	Handles are borrowed. Arguments live until the function returns. Values made with make_* belong to the call
+	and are released when it returns, except the one stored in *result. Views (strings, list items, map values)
+	point into the value itself and are not copied; they stay valid while the value is not modified.
+	Errors are returned, never thrown: an extension must not let a C++ exception escape into Ry.
+*/
+
 #ifndef RY_LIB_DK_H
 #define RY_LIB_DK_H
 
-typedef enum { RY_NIL, RY_BOOL, RY_NUMBER, RY_STRING, RY_OBJECT } RyType;
+#include <stddef.h>
+#include <stdint.h>
+
+#define RY_ABI_MAJOR 1 // Bumped when something is removed or changes meaning
+#define RY_ABI_MINOR 3 // Bumped when something is appended to RyApi
+#define RY_ABI_VERSION (((uint32_t) RY_ABI_MAJOR << 16) | RY_ABI_MINOR)
+
+#ifdef __cplusplus
+#define RY_EXTERN_C extern "C"
+#else
+#define RY_EXTERN_C
+#endif
+
+#ifdef _WIN32
+#define RY_EXPORT RY_EXTERN_C __declspec(dllexport)
+#else
+#define RY_EXPORT RY_EXTERN_C __attribute__((visibility("default")))
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct RyContext RyContext; // One call into the extension
+typedef struct RyModule RyModule; // The map use() returns
+typedef const struct RyOpaqueValue *RyHandle;
+
+typedef enum {
+	RY_KIND_NULL = 0,
+	RY_KIND_BOOL = 1,
+	RY_KIND_NUMBER = 2,
+	RY_KIND_STRING = 3,
+	RY_KIND_LIST = 4,
+	RY_KIND_MAP = 5,
+	RY_KIND_RANGE = 6,
+	RY_KIND_CALLABLE = 7, // Functions, closures, natives, classes and bound methods
+	RY_KIND_INSTANCE = 8,
+	RY_KIND_OTHER = 9, // Threads, channels, fibers...
+	RY_KIND_BYTES = 10 // 1.2, extensions built for 1.0 and 1.1 see bytes as RY_KIND_OTHER
+} RyKind;
 
-struct RyValue {
-	RyType type;
-	union {
-		double number;
-		bool boolean;
-		void *ptr;
-	} data;
-};
+typedef enum { RY_OK = 0, RY_ERROR = 1 } RyStatus;
+
+typedef struct {
+	const char *data; // Not NUL terminated before 1.3, since then a NUL always follows the `length` bytes
+	size_t length;
+} RyStringView;
+
+typedef struct {
+	uint8_t *data; // NULL for read-only bytes
+	const uint8_t *readable;
+	size_t length;
+} RyBytesView;
+
+typedef RyStatus (*RyCFunction)(RyContext *ctx, int argc, const RyHandle *args, RyHandle *result);
+
+typedef struct RyApi {
+	uint32_t version; // RY_ABI_VERSION of the running Ry
+	uint32_t size; // sizeof(RyApi) of the running Ry, members past it don't exist
+
+	// Registers `function` under `name` in the module. An arity of -1 accepts any number of arguments.
+	void (*define)(RyModule *module, const char *name, RyCFunction function, int arity);
+
+	// Reading. The getters return 0 (and leave *out alone) if the value is of another kind.
+	RyKind (*kind)(RyHandle value);
+	int (*get_bool)(RyHandle value, int *out);
+	int (*get_number)(RyHandle value, double *out);
+	int (*get_string)(RyHandle value, RyStringView *out);
+	int (*get_range)(RyHandle value, double *start, double *end);
+	size_t (*list_length)(RyHandle list); // 0 for anything but a list
+	RyHandle (*list_get)(RyHandle list, size_t index); // NULL if out of range
+	size_t (*map_length)(RyHandle map);
+	RyHandle (*map_get)(RyHandle map, RyHandle key); // NULL if missing
+	int (*truthy)(RyHandle value); // The way `if` sees it
+
+	// Making values, owned by the call
+	RyHandle (*make_null)(RyContext *ctx);
+	RyHandle (*make_bool)(RyContext *ctx, int value);
+	RyHandle (*make_number)(RyContext *ctx, double value);
+	RyHandle (*make_string)(RyContext *ctx, const char *data, size_t length);
+	// A string of `length` bytes to be filled in through the returned pointer, so results need not be copied
+	char *(*make_string_buffer)(RyContext *ctx, size_t length, RyHandle *out);
+	RyHandle (*make_list)(RyContext *ctx, size_t capacity);
+	RyHandle (*make_map)(RyContext *ctx);
+
+	// Changing lists and maps (including ones passed in, which the script sees). RY_ERROR on the wrong kind.
+	RyStatus (*list_append)(RyHandle list, RyHandle item);
+	RyStatus (*map_set)(RyHandle map, RyHandle key, RyHandle value);
+
+	// Fails the call: `return ry->error(ctx, "message")` panics in the script with the message
+	RyStatus (*error)(RyContext *ctx, const char *message);
+
+	// 1.1: functions made at run time, carrying `data` (passed to `release` once the function is gone).
+	// Before 1.3 one taking no arguments could also be used by `foreach`, now that takes make_iterator.
+	RyHandle (*make_function)(RyContext *ctx, const char *name, RyCFunction function, int arity, void *data,
+														void (*release)(void *data));
+	void *(*function_data)(RyContext *ctx); // The data of the function being called, NULL for define()d ones
+
+	// 1.2: binary data. Views point into the bytes themselves.
+	int (*get_bytes)(RyHandle value, RyBytesView *out);
+	uint8_t *(*make_bytes)(RyContext *ctx, size_t length, RyHandle *out); // Mutable, zero filled
+	// Read-only bytes over memory the extension owns (a memory map...), `release(data)` runs once they are gone
+	RyHandle (*make_bytes_external)(RyContext *ctx, const void *memory, size_t length, void *data,
+																	void (*release)(void *data));
+
+	// 1.3: an iterator for `foreach`, `next` is called with no arguments for every element until it returns null
+	RyHandle (*make_iterator)(RyContext *ctx, const char *name, RyCFunction next, void *data,
+														void (*release)(void *data));
+	RyStatus (*list_set)(RyHandle list, size_t index, RyHandle item); // RY_ERROR on the wrong kind or out of range
+	// Values made after scope_open() are released by scope_close(), so a call making many values it only
+	// stores away (or doesn't keep at all) doesn't hold on to all of them until it returns
+	size_t (*scope_open)(RyContext *ctx);
+	void (*scope_close)(RyContext *ctx, size_t scope);
+	// Like list_append and map_set, except that an item (or key, or value) that is the last value the call made
+	// is moved in and released instead of copied; its handle is gone afterwards. Anything else is copied.
+	RyStatus (*list_append_move)(RyContext *ctx, RyHandle list, RyHandle item);
+	RyStatus (*map_set_move)(RyContext *ctx, RyHandle map, RyHandle key, RyHandle value);
+	// A list of the last `count` values the call made, or a map of the last `pairs` keys and values (key first),
+	// moved in and released. Built bottom up this way nothing is copied and the list or map is made at its size.
+	RyHandle (*make_list_of_last)(RyContext *ctx, size_t count);
+	RyHandle (*make_map_of_last)(RyContext *ctx, size_t pairs);
+	// Calls `visit` for every entry until it returns RY_ERROR, which is then returned (also for the wrong kind).
+	// The map or instance must not be changed meanwhile.
+	RyStatus (*map_each)(RyHandle map, RyStatus (*visit)(void *data, RyHandle key, RyHandle value), void *data);
+	RyStatus (*fields_each)(RyHandle instance, RyStatus (*visit)(void *data, RyStringView name, RyHandle value),
+													void *data);
+	RyHandle (*to_string)(RyContext *ctx, RyHandle value); // The text `out` prints for the value
+	// Calls a function (or anything callable) of the script with `argc` arguments, *result is what it returned.
+	// RY_ERROR if it panicked, *result is then the message and the extension decides whether to fail too.
+	RyStatus (*call)(RyContext *ctx, RyHandle callable, int argc, const RyHandle *args, RyHandle *result);
+} RyApi;
+
+// Every extension exports both, RY_MODULE_INIT writes them
+typedef uint32_t (*RyAbiVersionFn)(void);
+typedef RyStatus (*RyInitFn)(const RyApi *api, RyModule *module);
+
+#ifdef __cplusplus
+}
+#endif
 
-typedef RyValue (*RyNativeFn)(int argCount, RyValue *args);
-typedef void (*RyRegisterFn)(const char *name, RyNativeFn fn, int arity, void *target);
+#define RY_MODULE_INIT(api, module)                                                                                    \
+	RY_EXPORT uint32_t ry_abi_version(void) { return RY_ABI_VERSION; }                                                   \
+	RY_EXPORT RyStatus init_ry_module(const RyApi *api, RyModule *module)
 
 #endif
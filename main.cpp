@@ -1,59 +1,100 @@
+#include <algorithm>
+#include <filesystem>
 #include <fstream>
 #include <iostream>
 #include <memory>
 #include <string>
+#include <vector>
+#include "alloc_profile.h"
 #include "chunk.h"
 #include "colors.h"
 #include "compiler.h"
+#include "daemon.h"
 #include "func.h"
 #include "lexer.h"
 #include "parser.h"
+#include "snapshot.h"
 #include "tools.h"
+#include "trace.h"
 #include "vm.h"
 
 
 using namespace RyRuntime;
 
-namespace RyRuntime {
-	void setVMSource(const std::string &source);
-}
-
-void interpret(VM &vm, const std::string &source) {
-	// Reset flag to stop infinite loops
-	RyTools::hadError = false;
+// Exit codes of a script run (sysexits.h style)
+const int EXIT_COMPILE_ERROR = 65;
+const int EXIT_RUNTIME_ERROR = 70;
 
-	RyRuntime::setVMSource(source);
+int interpret(VM &vm, const std::string &source) {
+	auto function = vm.compile(source, "<main>");
+	if (!function)
+		return EXIT_COMPILE_ERROR;
 
-	// Lexing
-	Backend::Lexer lexer(source);
-	std::vector<Backend::Token> tokens = lexer.scanTokens();
+	// Running
+	InterpretResult result = vm.interpret(function, std::make_shared<const std::string>(source));
+	std::fflush(stdout);
+	std::fflush(stderr);
+	std::cout << std::flush;
+	std::cerr << std::flush;
+	return result == INTERPRET_OK ? 0 : EXIT_RUNTIME_ERROR;
+}
 
-	// Setup Aliases & Parsing
-	std::set<std::string> aliases; // Temporary set for the parser
-	Backend::Parser parser(tokens, aliases, source);
+// Restores a heap image made by `ry snapshot` and calls its main(), if it has one
+int runImage(VM &vm, const std::string &path, RyValue args) {
+	try {
+		loadSnapshot(vm, path);
+	} catch (const std::runtime_error &error) {
+		std::cerr << "Could not load image " << path << ": " << error.what() << "\n";
+		return 1;
+	}
+	vm.defineGlobal("args", args);
 
-	std::vector<std::shared_ptr<Backend::Stmt>> statements = parser.parse();
+	auto entry = vm.getGlobals().find("main");
+	if (entry == vm.getGlobals().end())
+		return 0;
+	RyValue result;
+	InterpretResult status = vm.call(entry->second, {}, result);
+	std::cout << std::flush;
+	if (status != INTERPRET_OK) {
+		std::cerr << RyColor::RED << "Error: " << vm.panicMessage << RyColor::RESET << "\n";
+		return EXIT_RUNTIME_ERROR;
+	}
+	return 0;
+}
 
-	if (RyTools::hadError)
+// Runs a script file (or a heap image); its arguments are visible to it as the global list 'args'
+int runFile(VM &vm, const std::string &path, const std::vector<std::string> &args) {
+	auto list = std::make_shared<std::vector<RyValue>>();
+	for (const auto &arg: args) {
+		list->push_back(RyValue(arg));
+	}
 
-		return;
+	if (isSnapshot(path))
+		return runImage(vm, path, RyValue(list));
 
-	//  Compiling
-	Compiler compiler = Compiler(nullptr, source);
-	Chunk chunk;
-	if (!compiler.compile(statements, &chunk)) {
-		std::cout << "Compilation failed.\n";
-		return;
+	std::ifstream inputFile(path);
+	if (!inputFile.is_open()) {
+		std::cerr << "Could not open file: " << path << "\n";
+		return 1;
 	}
+	std::string src((std::istreambuf_iterator<char>(inputFile)), std::istreambuf_iterator<char>());
+	vm.defineGlobal("args", RyValue(list));
+	return interpret(vm, src);
+}
 
-	auto function = std::make_shared<Frontend::RyFunction>(std::move(chunk), "<main>", 0);
-
-	// Running
-	vm.interpret(function);
-	std::fflush(stdout);
-	std::fflush(stderr);
-	std::cout << std::flush;
-	std::cerr << std::flush;
+// Runs `script` and saves everything its top level left in the globals as an image
+int makeImage(const std::string &script, const std::string &output) {
+	VM vm;
+	int code = runFile(vm, script, {});
+	if (code != 0)
+		return code;
+	try {
+		saveSnapshot(vm, output);
+	} catch (const std::runtime_error &error) {
+		std::cerr << "ry snapshot: " << error.what() << "\n";
+		return 1;
+	}
+	return 0;
 }
 
 void runREPL(VM &vm) {
@@ -108,24 +149,56 @@ void runREPL(VM &vm) {
 }
 
 int main(int argc, char *argv[]) {
-	VM vm;
-
 	if (argc >= 2) {
 		std::string command = argv[1];
-
-		if (command == "run" && argc == 3) {
-			std::ifstream inputFile(argv[2]);
-			if (!inputFile.is_open()) {
-				std::cerr << "Could not open file: " << argv[2] << "\n";
-				return 1;
+		std::vector<std::string> args(argv + std::min(argc, 3), argv + argc);
+
+		if (command == "run" && argc >= 3) {
+			// Options come between `run` and the script
+			int at = 2;
+			std::string allocStacks, traceFile;
+			for (; at < argc && std::string(argv[at]).starts_with("--"); at++) {
+				std::string option = argv[at];
+				if (option == "--alloc-profile" || option.starts_with("--alloc-profile=")) {
+					allocStacks = option.size() > 16 ? option.substr(16) : "ry-alloc.folded";
+				} else if (option == "--trace" || option.starts_with("--trace=")) {
+					traceFile = option.size() > 8 ? option.substr(8) : "ry-trace.json";
+				} else {
+					std::cerr << "Unknown option " << option << "\n";
+					return 64;
+				}
+			}
+			if (at == argc) {
+				std::cerr << "Usage: ry run [--alloc-profile[=stacks.folded]] [--trace[=trace.json]] script.ry [args...]\n";
+				return 64;
 			}
-			std::string src((std::istreambuf_iterator<char>(inputFile)), std::istreambuf_iterator<char>());
-			interpret(vm, src);
+			if (!allocStacks.empty())
+				AllocProfile::start(allocStacks);
+			if (!traceFile.empty())
+				Trace::start(traceFile);
+			VM vm;
+			return runFile(vm, argv[at], std::vector<std::string>(argv + at + 1, argv + argc));
+		} else if (command == "exec" && argc >= 3) {
+			// Thin client: the warm daemon runs it, without one we run it ourselves
+			int code = execInDaemon(defaultDaemonSocket(), argv[2], args);
+			if (code >= 0)
+				return code;
+			VM vm;
+			return runFile(vm, argv[2], args);
+		} else if (command == "snapshot" && argc >= 3) {
+			std::string output = std::filesystem::path(argv[2]).replace_extension(".img").string();
+			if (argc >= 5 && std::string(argv[3]) == "-o")
+				output = argv[4];
+			return makeImage(argv[2], output);
+		} else if (command == "daemon") {
+			VM vm;
+			return runDaemon(vm, argc >= 3 ? argv[2] : defaultDaemonSocket(), runFile);
 		} else if (command == "-v" || command == "--version") {
 			std::cout << "Ry (ByteCode Edition) v0.2.0\n";
 		} else {
 		}
 	} else {
+		VM vm;
 		runREPL(vm);
 	}
 
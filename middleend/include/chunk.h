@@ -72,7 +72,14 @@ namespace RyRuntime {
 		OP_FUNCTION, // func test() {}
 		OP_ATTEMPT, // attempt {} fail err {}
 		OP_END_ATTEMPT,
-		OP_IMPORT
+		OP_IMPORT,
+		OP_PARALLEL_EACH, // parallel foreach
+
+		// Kept last so images saved before these existed still load with the same numbering
+		OP_GET_LOCAL_INDEX, // text[i] with text a local, indexed in its slot
+		OP_GET_GLOBAL_INDEX, // text[i] with text a global
+		OP_GET_LOCAL_LEN, // text.len with text a local
+		OP_GET_GLOBAL_LEN, // text.len with text a global
 	};
 
 	// The sequence of bytecode
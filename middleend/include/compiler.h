@@ -1,6 +1,8 @@
 #ifndef ry_compiler_h
 #define ry_compiler_h
 
+#include <atomic>
+#include <mutex>
 #include <unordered_set>
 #include "chunk.h"
 #include "expr.h"
@@ -18,6 +20,9 @@ namespace RyRuntime {
 		Backend::Token name;
 		int depth;
 		bool isCaptured = false;
+		// In a parallel foreach body: holds only data the body made itself, so it may be changed in place
+		bool owned = false;
+		bool changed = false; // ...and it was, so it can't be given outside data any more
 
 		Local(Backend::Token n, int d, bool c = false) : name(n), depth(d), isCaptured(c) {}
 	};
@@ -33,11 +38,32 @@ namespace RyRuntime {
 		LoopType type;
 	};
 
+	// A top-level function or method whose body the parser skimmed. compileLazy() fills in its chunk on the
+	// first call; functions can be shared between threads (Ry::Program), so that happens under `lock`.
+	struct LazyBody {
+		std::shared_ptr<Backend::DeferredSource> source;
+		size_t bodyStart = 0;
+		std::string bodyNamespace;
+		Backend::Token name;
+		std::vector<Backend::Parameter> parameters;
+		bool isMethod = false; // Slot 0 is `this`
+		std::atomic<bool> ready{false}; // The chunk is compiled (or `error` is set)
+		std::mutex lock;
+		std::string error;
+	};
+
+	// Makes sure a function's body is compiled. Returns false with the compile error if it can't be.
+	bool compileLazy(Frontend::RyFunction &function, std::string &error);
+
 	class Compiler : public Backend::ExprVisitor, public Backend::StmtVisitor {
 	public:
 		Compiler *enclosing = nullptr;
 		Compiler(Compiler *enclosing, const std::string &source) : enclosing(enclosing), sourceCode(source) {
-			RyTools::hadError = false;
+			// Function bodies get their own Compiler, they must not clear errors found so far
+			if (enclosing == nullptr)
+				RyTools::hadError = false;
+			else
+				parallelBody = enclosing->parallelBody; // Functions declared in a parallel body are checked too
 			for (const auto &name: getNativeNames()) {
 				nativeNames.insert(name);
 			}
@@ -109,6 +135,19 @@ namespace RyRuntime {
 		void compileStatement(std::shared_ptr<Backend::Stmt> stmt);
 		void compileExpression(std::shared_ptr<Backend::Expr> expr);
 		void compileMethod(std::shared_ptr<Backend::FunctionStmt> stmt);
+		bool deferBody(Backend::FunctionStmt &stmt, Frontend::RyFunction &function, bool isMethod);
+		friend bool compileLazy(Frontend::RyFunction &function, std::string &error);
+		void compileParallelEach(Backend::EachStmt &stmt);
+		void defineVariable(Backend::Token name);
+		// The compiler of the parallel foreach body this code is in, if any. Only data the body made itself
+		// may be changed there, only its own variables (and those of functions in it) assigned.
+		Compiler *parallelBody = nullptr;
+		// The body's (or a function in it's) local `name` refers to, nullptr if it is outside data
+		Local *bodyLocal(Backend::Token &name);
+		// Whether `value` always makes something new: a literal, arithmetic or a collection constructor
+		bool makesNew(Backend::Expr &value);
+		bool checkParallelMutation(Backend::Expr &target, Backend::Token &where);
+		bool checkParallelAssign(Backend::Token &name, Backend::Expr *value);
 
 
 		// Scope & Locals
@@ -119,6 +158,9 @@ namespace RyRuntime {
 		void endScope();
 		int resolveLocal(Backend::Token &name);
 		int resolveUpvalue(Backend::Token &name);
+		std::string globalName(const std::string &name); // With the namespace it is in
+		// A local's slot, or -1 and the global's name; false for upvalues, which must be loaded to be read
+		bool resolveStored(Backend::VariableExpr &variable, int &slot, std::string &global);
 		void addLocal(Backend::Token name);
 		int addUpvalue(uint8_t index, bool isLocal);
 		std::unordered_set<std::string> nativeNames;
@@ -128,6 +170,12 @@ namespace RyRuntime {
 		// Stack helpers
 		std::vector<LoopContext> loopStack;
 	};
+
+	// Parses and compiles a whole (already lexed) script into its top-level function. `namespaces` are the ones
+	// the script can see, the ones it declares are added. Returns nullptr if there were errors (already reported).
+	std::shared_ptr<Frontend::RyFunction> compileTokens(const std::vector<Backend::Token> &tokens,
+																											const std::string &source, const std::string &name,
+																											std::set<std::string> &namespaces);
 } // namespace RyRuntime
 
 #endif
@@ -0,0 +1,31 @@
+/**
+	File: prefetch.h
+	Description: Import prefetching. Before a script is compiled, its `import("...")` statements are found by
+	scanning tokens, the module graph is walked and every module in it is compiled on a pool of threads.
+	Namespaces declared anywhere in the graph are known to the parser up front, so `Module.member` resolves
+	no matter which file gets compiled first. Imports with computed paths are still compiled when they run.
+*/
+
+#pragma once
+#include <functional>
+#include <memory>
+#include <set>
+#include <string>
+#include <unordered_map>
+#include "func.h"
+
+namespace RyRuntime {
+	struct CompiledProgram {
+		std::shared_ptr<Frontend::RyFunction> main; // nullptr if the script has errors (already reported)
+		// Modules it imports, keyed by moduleKey(). Ones that failed are left out, the import reports them.
+		std::unordered_map<std::string, std::shared_ptr<Frontend::RyFunction>> modules;
+	};
+
+	// The key the import cache uses for a module path: the same file reached by different paths is one module
+	std::string moduleKey(const std::string &path);
+
+	// Compiles `source` and every module it imports with a literal path, except the ones `loaded` says are
+	// already available. `namespaces` are the namespaces visible so far; everything declared in the graph is added.
+	CompiledProgram compileProgram(const std::string &source, const std::string &name, std::set<std::string> &namespaces,
+																 const std::function<bool(const std::string &key)> &loaded = nullptr);
+} // namespace RyRuntime
@@ -4,6 +4,7 @@
 #include "chunk.h"
 #include "class.h"
 #include "func.h"
+#include "parser.h"
 #include "stmt.h"
 #include "token.h"
 #include "tools.h"
@@ -11,6 +12,22 @@
 using namespace Backend;
 
 namespace RyRuntime {
+	std::shared_ptr<Frontend::RyFunction> compileTokens(const std::vector<Backend::Token> &tokens,
+																											const std::string &source, const std::string &name,
+																											std::set<std::string> &namespaces) {
+		std::set<std::string> aliases; // Type aliases only live as long as the parse
+		Backend::Parser parser(tokens, aliases, namespaces, source);
+		std::vector<std::shared_ptr<Backend::Stmt>> statements = parser.parse();
+		if (RyTools::hadError)
+			return nullptr;
+
+		Compiler compiler(nullptr, source);
+		Chunk chunk;
+		if (!compiler.compile(statements, &chunk))
+			return nullptr;
+		return std::make_shared<Frontend::RyFunction>(std::move(chunk), name, 0);
+	}
+
 	bool Compiler::compile(const std::vector<std::shared_ptr<Backend::Stmt>> &statements, Chunk *chunk) {
 		this->compilingChunk = chunk;
 		this->locals.clear();
@@ -24,7 +41,7 @@ namespace RyRuntime {
 		}
 
 		emitByte(OP_RETURN);
-		return true; // Return false if there's a compilation error
+		return !RyTools::hadError; // Return false if there's a compilation error
 	}
 
 	void Compiler::compileStatement(std::shared_ptr<Backend::Stmt> stmt) {
@@ -39,12 +56,16 @@ namespace RyRuntime {
 	void Compiler::compileMethod(std::shared_ptr<Backend::FunctionStmt> stmt) {
 		track(stmt->name);
 
-		Compiler subCompiler(this, this->sourceCode);
-		subCompiler.currentClass = this->currentClass;
 		auto function = std::make_shared<Frontend::RyFunction>();
 		function->name = stmt->name.lexeme;
 		function->arity = stmt->parameters.size();
+		if (deferBody(*stmt, *function, true)) {
+			emitBytes(OP_CLOSURE, (uint8_t) makeConstant(RyValue(function)));
+			return;
+		}
 
+		Compiler subCompiler(this, this->sourceCode);
+		subCompiler.currentClass = this->currentClass;
 		subCompiler.compilingChunk = &function->chunk;
 		subCompiler.beginScope();
 
@@ -74,6 +95,81 @@ namespace RyRuntime {
 		}
 	}
 
+	// At the top level nothing around a function can be captured, so a skimmed body can wait for the first
+	// call (compileLazy). Anywhere else it is parsed now and compiled as usual. Returns true if it was deferred.
+	bool Compiler::deferBody(Backend::FunctionStmt &stmt, Frontend::RyFunction &function, bool isMethod) {
+		if (!stmt.deferred)
+			return false;
+
+		if (enclosing == nullptr && scopeDepth == 0) {
+			auto lazy = std::make_shared<LazyBody>();
+			lazy->source = stmt.deferred;
+			lazy->bodyStart = stmt.bodyStart;
+			lazy->bodyNamespace = stmt.bodyNamespace;
+			lazy->name = stmt.name;
+			lazy->parameters = stmt.parameters;
+			lazy->isMethod = isMethod;
+			function.lazy = lazy;
+			return true;
+		}
+
+		stmt.body = Backend::Parser::parseDeferred(*stmt.deferred, stmt.bodyStart, stmt.bodyNamespace);
+		stmt.deferred = nullptr;
+		return false;
+	}
+
+	bool compileLazy(Frontend::RyFunction &function, std::string &error) {
+		LazyBody &lazy = *function.lazy;
+		std::lock_guard<std::mutex> guard(lazy.lock);
+		if (!lazy.ready.load(std::memory_order_relaxed)) {
+			bool previousError = RyTools::hadError; // We may be called from the middle of a run
+			std::string log;
+			{
+				RyTools::CaptureErrors capture(log, true);
+				RyTools::hadError = false;
+				auto body = Backend::Parser::parseDeferred(*lazy.source, lazy.bodyStart, lazy.bodyNamespace);
+
+				Chunk chunk;
+				if (!RyTools::hadError) {
+					// Same as the function's own Compiler would have been, minus an enclosing one
+					Compiler compiler(nullptr, lazy.source->source);
+					if (lazy.isMethod)
+						compiler.currentClass = std::make_shared<Frontend::ClassCompiler>();
+					compiler.compilingChunk = &chunk;
+					compiler.track(lazy.name);
+					compiler.beginScope();
+
+					Token slotZero;
+					if (lazy.isMethod)
+						slotZero.lexeme = "this";
+					compiler.addLocal(slotZero);
+					for (const auto &param: lazy.parameters) {
+						compiler.addLocal(param.name);
+					}
+					for (const auto &bodyStmt: body) {
+						compiler.compileStatement(bodyStmt);
+					}
+					compiler.emitByte(OP_NULL);
+					compiler.emitByte(OP_RETURN);
+					compiler.endScope();
+				}
+
+				if (RyTools::hadError) {
+					// All of it, each error with its line and a caret where it is in the script
+					lazy.error = "Cannot compile '" + function.name + "':\n" + log;
+					while (!lazy.error.empty() && lazy.error.back() == '\n')
+						lazy.error.pop_back();
+				} else {
+					function.chunk = std::move(chunk);
+				}
+			}
+			RyTools::hadError = previousError;
+			lazy.ready.store(true, std::memory_order_release);
+		}
+		error = lazy.error;
+		return error.empty();
+	}
+
 	// --- Bytecode Helpers ---
 
 	void Compiler::emitByte(uint8_t byte) { compilingChunk->write(byte, currentLine, currentColumn); }
@@ -266,18 +362,29 @@ namespace RyRuntime {
 			return;
 		}
 
-		if (name.find("::") != std::string::npos) {
-			emitBytes(OP_GET_GLOBAL, (uint8_t) makeConstant(RyValue(name)));
-			return;
-		}
+		emitBytes(OP_GET_GLOBAL, (uint8_t) makeConstant(RyValue(globalName(name))));
+	}
+
+	std::string Compiler::globalName(const std::string &name) {
+		if (name.find("::") != std::string::npos)
+			return name;
 
 		bool isNative = nativeNames.count(name) > 0;
 
-		if (!currentNamespace.empty() && !isNative && !name.starts_with("native") && name.find("::") == std::string::npos) {
-			name = currentNamespace + "::" + name;
+		if (!currentNamespace.empty() && !isNative && !name.starts_with("native")) {
+			return currentNamespace + "::" + name;
 		}
+		return name;
+	}
 
-		emitBytes(OP_GET_GLOBAL, (uint8_t) makeConstant(RyValue(name)));
+	bool Compiler::resolveStored(VariableExpr &variable, int &slot, std::string &global) {
+		slot = resolveLocal(variable.name);
+		if (slot != -1)
+			return true;
+		if (resolveUpvalue(variable.name) != -1)
+			return false;
+		global = globalName(variable.name.lexeme);
+		return true;
 	}
 
 	void Compiler::visitValue(ValueExpr &expr) {
@@ -337,6 +444,8 @@ namespace RyRuntime {
 	void Compiler::visitAssign(AssignExpr &expr) {
 		track(expr.name);
 		compileExpression(expr.value);
+		if (parallelBody && !checkParallelAssign(expr.name, expr.value.get()))
+			return;
 		int arg = resolveLocal(expr.name);
 		if (arg != -1) {
 			emitBytes(OP_SET_LOCAL, (uint8_t) arg);
@@ -361,8 +470,80 @@ namespace RyRuntime {
 		}
 	}
 
+	Local *Compiler::bodyLocal(Token &name) {
+		for (Compiler *compiler = this; compiler; compiler = compiler->enclosing) {
+			int slot = compiler->resolveLocal(name);
+			if (slot != -1)
+				return &compiler->locals[slot];
+			if (compiler == parallelBody)
+				break;
+		}
+		return nullptr;
+	}
+
+	bool Compiler::makesNew(Expr &value) {
+		if (auto group = dynamic_cast<GroupExpr *>(&value))
+			return makesNew(*group->expression);
+		if (auto logical = dynamic_cast<LogicalExpr *>(&value))
+			return makesNew(*logical->left) && makesNew(*logical->right);
+		if (auto call = dynamic_cast<CallExpr *>(&value)) {
+			static const std::unordered_set<std::string> constructors = {"set", "deque", "heap", "bytes"};
+			auto variable = dynamic_cast<VariableExpr *>(call->callee.get());
+			return variable && constructors.count(variable->name.lexeme) && !bodyLocal(variable->name);
+		}
+		// List `+` makes a new list too, numbers and strings can't be changed
+		return dynamic_cast<ValueExpr *>(&value) || dynamic_cast<ListExpr *>(&value) ||
+					 dynamic_cast<MapExpr *>(&value) || dynamic_cast<RangeExpr *>(&value) ||
+					 dynamic_cast<MathExpr *>(&value) || dynamic_cast<PrefixExpr *>(&value) ||
+					 dynamic_cast<PostfixExpr *>(&value) || dynamic_cast<BitwiseAndExpr *>(&value) ||
+					 dynamic_cast<BitwiseOrExpr *>(&value) || dynamic_cast<BitwiseXorExpr *>(&value) ||
+					 dynamic_cast<ShiftExpr *>(&value);
+	}
+
+	bool Compiler::checkParallelMutation(Expr &target, Token &where) {
+		if (!parallelBody)
+			return true;
+		// Workers share everything else (the loop variable, its elements, outside data), so changing it would race
+		auto variable = dynamic_cast<VariableExpr *>(&target);
+		Local *local = variable ? bodyLocal(variable->name) : nullptr;
+		if (local && local->owned) {
+			local->changed = true;
+			return true;
+		}
+		error(where, "A parallel foreach body can only change data it made itself, return the result instead.");
+		return false;
+	}
+
+	bool Compiler::checkParallelAssign(Token &name, Expr *value) {
+		Local *local = bodyLocal(name);
+		if (!local) {
+			error(name, "A parallel foreach body can only assign its own variables, return the result instead.");
+			return false;
+		}
+		if (local->owned && !(value && makesNew(*value))) {
+			if (local->changed) {
+				error(name, "A parallel foreach body can't put outside data in a variable it changes, return the result instead.");
+				return false;
+			}
+			local->owned = false;
+		}
+		return true;
+	}
+
 	void Compiler::visitCall(CallExpr &expr) {
 		track(expr.Paren);
+		if (parallelBody) {
+			// Natives that change their first argument, and list.pop()
+			static const std::unordered_set<std::string> mutating = {
+					"add", "remove", "push_back", "push_front", "pop_back", "pop_front", "heap_push", "heap_pop", "fd_read_into"};
+			if (auto variable = dynamic_cast<VariableExpr *>(expr.callee.get());
+					variable && !expr.arguments.empty() && mutating.count(variable->name.lexeme) &&
+					resolveLocal(variable->name) == -1 && !checkParallelMutation(*expr.arguments[0], expr.Paren))
+				return;
+			if (auto get = dynamic_cast<GetExpr *>(expr.callee.get());
+					get && get->name.lexeme == "pop" && !checkParallelMutation(*get->object, expr.Paren))
+				return;
+		}
 		compileExpression(expr.callee);
 		for (const auto &arg: expr.arguments) {
 			compileExpression(arg);
@@ -479,19 +660,24 @@ namespace RyRuntime {
 			emitByte(OP_NULL);
 		}
 
+		defineVariable(stmt.name);
+		if (parallelBody && scopeDepth > 0)
+			locals.back().owned = !stmt.initializer || makesNew(*stmt.initializer);
+	}
+
+	void Compiler::defineVariable(Token name) {
 		if (scopeDepth > 0) {
-			std::string name = stmt.name.lexeme;
-			size_t lastColon = name.find_last_of(':');
+			std::string lexeme = name.lexeme;
+			size_t lastColon = lexeme.find_last_of(':');
 			if (lastColon != std::string::npos) {
-				Token baseName = stmt.name;
-				baseName.lexeme = name.substr(lastColon + 1);
+				Token baseName = name;
+				baseName.lexeme = lexeme.substr(lastColon + 1);
 				addLocal(baseName);
 			} else {
-				addLocal(stmt.name);
+				addLocal(name);
 			}
 		} else {
-			std::string name = stmt.name.lexeme;
-			emitBytes(OP_DEFINE_GLOBAL, (uint8_t) makeConstant(RyValue(name)));
+			emitBytes(OP_DEFINE_GLOBAL, (uint8_t) makeConstant(RyValue(name.lexeme)));
 		}
 	}
 
@@ -563,11 +749,24 @@ namespace RyRuntime {
 	}
 	void Compiler::visitGet(GetExpr &expr) {
 		track(expr.name);
+		// Measured in place, like indexing
+		int slot;
+		std::string global;
+		if (auto variable = dynamic_cast<VariableExpr *>(expr.object.get());
+				expr.name.lexeme == "len" && variable && resolveStored(*variable, slot, global)) {
+			if (slot != -1)
+				emitBytes(OP_GET_LOCAL_LEN, (uint8_t) slot);
+			else
+				emitBytes(OP_GET_GLOBAL_LEN, (uint8_t) makeConstant(RyValue(global)));
+			return;
+		}
 		compileExpression(expr.object);
 		emitBytes(OP_GET_PROPERTY, (uint8_t) makeConstant(RyValue(expr.name.lexeme)));
 	}
 	void Compiler::visitSet(SetExpr &expr) {
 		track(expr.name);
+		if (!checkParallelMutation(*expr.object, expr.name))
+			return;
 		compileExpression(expr.object);
 		compileExpression(expr.value);
 		emitBytes(OP_SET_PROPERTY, (uint8_t) makeConstant(RyValue(expr.name.lexeme)));
@@ -575,12 +774,16 @@ namespace RyRuntime {
 	void Compiler::visitFunctionStmt(FunctionStmt &stmt) {
 		track(stmt.name);
 
-		Compiler subCompiler(this, this->sourceCode);
-
 		auto function = std::make_shared<Frontend::RyFunction>();
 		function->name = stmt.name.lexeme;
 		function->arity = stmt.parameters.size();
+		if (deferBody(stmt, *function, false)) {
+			emitBytes(OP_CLOSURE, (uint8_t) makeConstant(RyValue(function)));
+			emitBytes(OP_DEFINE_GLOBAL, (uint8_t) makeConstant(RyValue(stmt.name.lexeme)));
+			return;
+		}
 
+		Compiler subCompiler(this, this->sourceCode);
 		subCompiler.compilingChunk = &function->chunk;
 
 		subCompiler.beginScope();
@@ -623,6 +826,8 @@ namespace RyRuntime {
 	}
 	void Compiler::visitIndexSet(IndexSetExpr &expr) {
 		track(expr.bracket);
+		if (!checkParallelMutation(*expr.object, expr.bracket))
+			return;
 		compileExpression(expr.object);
 		compileExpression(expr.index);
 		compileExpression(expr.value);
@@ -630,6 +835,18 @@ namespace RyRuntime {
 	}
 	void Compiler::visitIndex(IndexExpr &expr) {
 		track(expr.bracket);
+		// A variable is indexed where it is stored instead of being pushed first, which copies strings
+		int slot;
+		std::string global;
+		if (auto variable = dynamic_cast<VariableExpr *>(expr.object.get());
+				variable && resolveStored(*variable, slot, global)) {
+			compileExpression(expr.index);
+			if (slot != -1)
+				emitBytes(OP_GET_LOCAL_INDEX, (uint8_t) slot);
+			else
+				emitBytes(OP_GET_GLOBAL_INDEX, (uint8_t) makeConstant(RyValue(global)));
+			return;
+		}
 		compileExpression(expr.object);
 		compileExpression(expr.index);
 		emitByte(OP_GET_INDEX);
@@ -662,6 +879,8 @@ namespace RyRuntime {
 		if (var) {
 			// Get the current value onto the stack
 			int arg = resolveLocal(var->name);
+			if (parallelBody && !checkParallelAssign(var->name, &expr))
+				return;
 			if (arg != -1) {
 				emitBytes(OP_GET_LOCAL, (uint8_t) arg);
 			} else {
@@ -775,6 +994,10 @@ namespace RyRuntime {
 		currentNamespace = lastNamespace;
 	}
 	void Compiler::visitEachStmt(EachStmt &stmt) {
+		if (stmt.isParallel) {
+			compileParallelEach(stmt);
+			return;
+		}
 		track(stmt.id);
 		compileExpression(stmt.collection);
 		emitConstant(RyValue(0.0));
@@ -812,6 +1035,49 @@ namespace RyRuntime {
 		}
 		loopStack.pop_back();
 	}
+	void Compiler::compileParallelEach(EachStmt &stmt) {
+		track(stmt.id);
+		compileExpression(stmt.collection);
+
+		// The body becomes a one-parameter function, the VM calls it once per element on worker VMs
+		Compiler subCompiler(this, this->sourceCode);
+		subCompiler.parallelBody = &subCompiler;
+
+		auto function = std::make_shared<Frontend::RyFunction>();
+		function->name = "<parallel foreach>";
+		function->arity = 1;
+
+		subCompiler.compilingChunk = &function->chunk;
+
+		subCompiler.beginScope();
+		subCompiler.addLocal(Token());
+		subCompiler.addLocal(stmt.id);
+
+		subCompiler.compileStatement(stmt.body);
+
+		subCompiler.emitByte(OP_NULL);
+		subCompiler.emitByte(OP_RETURN);
+		subCompiler.endScope();
+
+		emitBytes(OP_CLOSURE, (uint8_t) makeConstant(RyValue(function)));
+		function->upvalueCount = subCompiler.upvalues.size();
+
+		for (int i = 0; i < subCompiler.upvalues.size(); i++) {
+			emitByte(subCompiler.upvalues[i].isLocal ? 1 : 0);
+			emitByte(subCompiler.upvalues[i].index);
+		}
+
+		// Leaves the list of returned values, in order
+		emitByte(OP_PARALLEL_EACH);
+
+		if (stmt.target) {
+			track(*stmt.target);
+			defineVariable(*stmt.target);
+		} else {
+			emitByte(OP_POP);
+		}
+	}
+
 	void Compiler::visitAttemptStmt(AttemptStmt &stmt) {
 		// Emit OP_ATTEMPT and a placeholder for the jump to the 'fail' block
 		int jumpToFail = emitJump(OP_ATTEMPT);
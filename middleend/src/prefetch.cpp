@@ -0,0 +1,160 @@
+#include "prefetch.h"
+#include <algorithm>
+#include <atomic>
+#include <cstdlib>
+#include <fstream>
+#include <thread>
+#include <vector>
+#include "compiler.h"
+#include "lexer.h"
+#include "tools.h"
+
+namespace RyRuntime {
+	namespace {
+		struct Module {
+			std::string path;
+			std::string source;
+			std::vector<Backend::Token> tokens;
+			std::vector<std::string> imports; // Module paths as the import cache resolves them
+			std::set<std::string> declared; // Namespaces it declares
+			bool failed = false;
+		};
+
+		// Runs `job(0..count-1)` on up to one thread per core (RY_THREADS overrides), the caller included
+		template<typename Job>
+		void parallelFor(size_t count, const Job &job) {
+			size_t workers = std::max(1u, std::thread::hardware_concurrency());
+			if (const char *requested = std::getenv("RY_THREADS"))
+				workers = std::max(1, std::atoi(requested));
+			workers = std::min(workers, count);
+
+			std::atomic<size_t> cursor{0};
+			auto work = [&]() {
+				for (size_t i = cursor++; i < count; i = cursor++)
+					job(i);
+			};
+			std::vector<std::thread> pool;
+			for (size_t i = 1; i < workers; i++)
+				pool.emplace_back(work);
+			work();
+			for (auto &thread: pool)
+				thread.join();
+		}
+
+		// Pulls `import("literal")` and `namespace Name` out of a token stream without parsing it
+		void scan(const std::vector<Backend::Token> &tokens, std::vector<std::string> &imports,
+							std::set<std::string> &declared) {
+			using Backend::TokenType;
+			for (size_t i = 0; i + 1 < tokens.size(); i++) {
+				if (tokens[i].type == TokenType::NAMESPACE && tokens[i + 1].type == TokenType::IDENTIFIER) {
+					declared.insert(tokens[i + 1].lexeme);
+				} else if (tokens[i].type == TokenType::IMPORT && i + 3 < tokens.size() &&
+									 tokens[i + 1].type == TokenType::LPAREN && tokens[i + 2].type == TokenType::STRING &&
+									 tokens[i + 3].type == TokenType::RPAREN) {
+					std::string path = RyTools::findModulePath(tokens[i + 2].lexeme, false);
+					if (!path.empty())
+						imports.push_back(path);
+				}
+			}
+		}
+
+		// Reads and lexes one module, errors are kept quiet (the import reports them when it runs)
+		void discover(Module &module) {
+			std::string errors;
+			RyTools::CaptureErrors quiet(errors);
+			RyTools::hadError = false;
+
+			std::ifstream file(module.path);
+			if (file.is_open()) {
+				module.source.assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+				Backend::Lexer lexer(module.source);
+				module.tokens = lexer.scanTokens();
+				scan(module.tokens, module.imports, module.declared);
+			}
+			module.failed = !file.is_open() || RyTools::hadError;
+		}
+	} // namespace
+
+	std::string moduleKey(const std::string &path) {
+		std::error_code error;
+		std::string key = std::filesystem::weakly_canonical(path, error).string();
+		return error || key.empty() ? path : key;
+	}
+
+	CompiledProgram compileProgram(const std::string &source, const std::string &name, std::set<std::string> &namespaces,
+																 const std::function<bool(const std::string &key)> &loaded) {
+		RyTools::hadError = false;
+		Backend::Lexer lexer(source);
+		std::vector<Backend::Token> tokens = lexer.scanTokens();
+		bool lexed = !RyTools::hadError;
+
+		std::vector<std::string> imports;
+		std::set<std::string> declared;
+		scan(tokens, imports, declared);
+		namespaces.insert(declared.begin(), declared.end());
+
+		// Walk the import graph one level at a time, each level is read and lexed in parallel
+		std::unordered_map<std::string, Module> graph;
+		std::vector<Module *> level;
+		auto enqueue = [&](const std::vector<std::string> &paths, std::vector<Module *> &next) {
+			for (auto const &path: paths) {
+				std::string key = moduleKey(path);
+				if (graph.count(key) || (loaded && loaded(key)))
+					continue;
+				Module &module = graph[key];
+				module.path = path;
+				next.push_back(&module);
+			}
+		};
+		enqueue(imports, level);
+		while (!level.empty()) {
+			parallelFor(level.size(), [&](size_t i) { discover(*level[i]); });
+			std::vector<Module *> next;
+			for (Module *module: level) {
+				enqueue(module->imports, next);
+			}
+			level = std::move(next);
+		}
+
+		// Every module sees every namespace in the graph, like a script that imported them all in one go
+		for (auto const &[key, module]: graph) {
+			namespaces.insert(module.declared.begin(), module.declared.end());
+		}
+
+		std::vector<std::pair<const std::string, Module> *> pending;
+		for (auto &entry: graph) {
+			if (!entry.second.failed)
+				pending.push_back(&entry);
+		}
+		std::vector<std::shared_ptr<Frontend::RyFunction>> compiled(pending.size());
+		std::thread modules;
+		if (!pending.empty()) {
+			modules = std::thread([&]() {
+				parallelFor(pending.size(), [&](size_t i) {
+					std::string errors;
+					RyTools::CaptureErrors quiet(errors);
+					RyTools::hadError = false;
+					std::set<std::string> visible = namespaces;
+					Module &module = pending[i]->second;
+					compiled[i] = compileTokens(module.tokens, module.source, module.path, visible);
+				});
+			});
+		}
+
+		// The script itself compiles here meanwhile, its errors are the ones the user sees
+		CompiledProgram program;
+		std::set<std::string> visible = namespaces;
+		RyTools::hadError = !lexed;
+		if (lexed)
+			program.main = compileTokens(tokens, source, name, visible);
+		if (modules.joinable())
+			modules.join();
+
+		namespaces.insert(visible.begin(), visible.end());
+		for (size_t i = 0; i < pending.size(); i++) {
+			if (compiled[i])
+				program.modules[pending[i]->first] = compiled[i];
+		}
+		return program;
+	}
+} // namespace RyRuntime
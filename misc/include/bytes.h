@@ -0,0 +1,58 @@
+#pragma once
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include "object.h"
+#include "value.h"
+
+namespace RyRuntime {
+	/*
+	 * Binary data: a window on a block of memory. Slices are windows on the same block, nothing is copied.
+	 * Read-only bytes are never written by anyone (a block is either all mutable or all read-only), so they
+	 * can be shared between isolates as they are; mutable ones are copied like lists.
+	 */
+	class RyBytes : public RyObject {
+	public:
+		std::shared_ptr<void> owner; // Keeps the block alive (a heap buffer, a memory map...)
+		uint8_t *data = nullptr;
+		size_t size = 0;
+		bool readOnly = false;
+
+		RyBytes(std::shared_ptr<void> owner, uint8_t *data, size_t size, bool readOnly) :
+				owner(std::move(owner)), data(data), size(size), readOnly(readOnly) {}
+
+		std::string typeName() const override { return "bytes"; }
+
+		// Zero filled
+		static std::shared_ptr<RyBytes> allocate(size_t size) {
+			std::shared_ptr<uint8_t[]> block(new uint8_t[size ? size : 1]());
+			return std::make_shared<RyBytes>(block, block.get(), size, false);
+		}
+
+		static std::shared_ptr<RyBytes> copyOf(const void *from, size_t size, bool readOnly = false) {
+			auto made = allocate(size);
+			if (size)
+				std::memcpy(made->data, from, size);
+			made->readOnly = readOnly;
+			return made;
+		}
+
+		// [from, to) of this window, clamped to it
+		std::shared_ptr<RyBytes> slice(size_t from, size_t to) const {
+			to = std::min(to, size);
+			from = std::min(from, to);
+			return std::make_shared<RyBytes>(owner, data + from, to - from, readOnly);
+		}
+
+		std::string text() const { return std::string((const char *) data, size); }
+	};
+
+	// The bytes in a value, or nullptr if it holds something else
+	inline RyBytes *bytesOf(const RyValue &value) {
+		auto object = std::get_if<RyValue::Object>(&value.val);
+		return object ? dynamic_cast<RyBytes *>(object->get()) : nullptr;
+	}
+} // namespace RyRuntime
@@ -0,0 +1,302 @@
+#pragma once
+#include <cstdint>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+#include "object.h"
+#include "value.h"
+
+namespace RyRuntime {
+	/*
+	 * Unordered unique values: open addressing with linear probing over a power-of-two table. Values are
+	 * hashed with RyValueHasher and compared with ==, the same as map keys, so lists are members by identity.
+	 */
+	class RySet : public RyObject {
+	public:
+		std::string typeName() const override { return "set"; }
+
+		size_t size() const { return count; }
+
+		// False if it was already there
+		bool add(const RyValue &value) {
+			if ((used + 1) * 4 > slots.size() * 3)
+				resize(count + 1);
+			size_t hash = hashOf(value);
+			size_t reuse = slots.size();
+			for (size_t at = hash & mask();; at = (at + 1) & mask()) {
+				Slot &slot = slots[at];
+				if (slot.state == EMPTY) {
+					if (reuse == slots.size()) {
+						reuse = at;
+						used++;
+					}
+					break;
+				}
+				if (slot.state == DELETED) {
+					if (reuse == slots.size())
+						reuse = at;
+				} else if (slot.hash == hash && slot.value == value) {
+					return false;
+				}
+			}
+			slots[reuse] = Slot{value, hash, FULL};
+			count++;
+			return true;
+		}
+
+		bool has(const RyValue &value) const { return find(value) < slots.size(); }
+
+		// False if it wasn't there
+		bool remove(const RyValue &value) {
+			size_t at = find(value);
+			if (at == slots.size())
+				return false;
+			slots[at].value = RyValue();
+			slots[at].state = DELETED; // Keeps the probe chains behind it intact
+			count--;
+			return true;
+		}
+
+		// For walking the members: the first filled slot at or after `from`, or capacity() if there is none
+		size_t next(size_t from) const {
+			while (from < slots.size() && slots[from].state != FULL)
+				from++;
+			return from;
+		}
+		size_t capacity() const { return slots.size(); }
+		const RyValue &at(size_t slot) const { return slots[slot].value; }
+
+	private:
+		enum State : uint8_t { EMPTY, FULL, DELETED };
+		struct Slot {
+			RyValue value;
+			size_t hash = 0;
+			State state = EMPTY;
+		};
+
+		std::vector<Slot> slots;
+		size_t count = 0; // FULL slots
+		size_t used = 0; // FULL and DELETED ones, what the probes see
+
+		size_t mask() const { return slots.size() - 1; }
+
+		// RyValueHasher gives pointers for lists and maps, whose low bits are all alike
+		static size_t hashOf(const RyValue &value) {
+			uint64_t hash = RyValueHasher{}(value);
+			hash ^= hash >> 33;
+			hash *= 0xff51afd7ed558ccdULL;
+			hash ^= hash >> 33;
+			return (size_t) hash;
+		}
+
+		size_t find(const RyValue &value) const {
+			if (count == 0)
+				return slots.size();
+			size_t hash = hashOf(value);
+			for (size_t at = hash & mask();; at = (at + 1) & mask()) {
+				const Slot &slot = slots[at];
+				if (slot.state == EMPTY)
+					return slots.size();
+				if (slot.state == FULL && slot.hash == hash && slot.value == value)
+					return at;
+			}
+		}
+
+		// Room for `wanted` members at most half full, dropping the tombstones
+		void resize(size_t wanted) {
+			size_t capacity = 8;
+			while (capacity < wanted * 2)
+				capacity *= 2;
+			std::vector<Slot> old(capacity);
+			old.swap(slots);
+			used = count;
+			for (Slot &slot: old) {
+				if (slot.state != FULL)
+					continue;
+				size_t at = slot.hash & mask();
+				while (slots[at].state != EMPTY)
+					at = (at + 1) & mask();
+				slots[at] = std::move(slot);
+			}
+		}
+	};
+
+	/*
+	 * A ring buffer: pushing and popping at either end is O(1), and so is d[i].
+	 */
+	class RyDeque : public RyObject {
+	public:
+		std::string typeName() const override { return "deque"; }
+
+		size_t size() const { return count; }
+
+		void pushBack(RyValue value) {
+			grow();
+			ring[(head + count) & mask()] = std::move(value);
+			count++;
+		}
+
+		void pushFront(RyValue value) {
+			grow();
+			head = (head - 1) & mask();
+			ring[head] = std::move(value);
+			count++;
+		}
+
+		RyValue popBack() {
+			if (count == 0)
+				throw std::runtime_error("pop_back() on an empty deque.");
+			count--;
+			return std::move(ring[(head + count) & mask()]);
+		}
+
+		RyValue popFront() {
+			if (count == 0)
+				throw std::runtime_error("pop_front() on an empty deque.");
+			RyValue value = std::move(ring[head]);
+			head = (head + 1) & mask();
+			count--;
+			return value;
+		}
+
+		// 0 is the front; callers check the index
+		const RyValue &at(size_t index) const { return ring[(head + index) & mask()]; }
+
+	private:
+		std::vector<RyValue> ring; // Power-of-two size
+		size_t head = 0;
+		size_t count = 0;
+
+		size_t mask() const { return ring.size() - 1; }
+
+		void grow() {
+			if (count < ring.size())
+				return;
+			std::vector<RyValue> bigger(ring.empty() ? 8 : ring.size() * 2);
+			for (size_t i = 0; i < count; i++)
+				bigger[i] = std::move(ring[(head + i) & mask()]);
+			ring.swap(bigger);
+			head = 0;
+		}
+	};
+
+	/*
+	 * A binary min-heap. With a key function, each value is ordered by its key, worked out once when it is
+	 * pushed; without one, by the value itself. Numbers and strings compare as usual and lists element by
+	 * element, so [priority, item] pairs work.
+	 */
+	class RyHeap : public RyObject {
+	public:
+		RyValue key; // The key function, or null
+
+		std::string typeName() const override { return "heap"; }
+
+		size_t size() const { return values.size(); }
+
+		// `order` is the key of `value` (the value itself without a key function)
+		void push(RyValue value, RyValue order) {
+			if (!values.empty())
+				less(key.isNil() ? value : order, orderOf(0)); // Throws for a key of another kind, before anything moves
+			values.push_back(std::move(value));
+			if (!key.isNil())
+				keys.push_back(std::move(order));
+			up(values.size() - 1);
+		}
+
+		const RyValue &top() const {
+			if (values.empty())
+				throw std::runtime_error("heap_peek() on an empty heap.");
+			return values[0];
+		}
+
+		RyValue pop() {
+			if (values.empty())
+				throw std::runtime_error("heap_pop() on an empty heap.");
+			RyValue first = std::move(values[0]);
+			values[0] = std::move(values.back());
+			values.pop_back();
+			if (!key.isNil()) {
+				keys[0] = std::move(keys.back());
+				keys.pop_back();
+			}
+			if (!values.empty())
+				down(0);
+			return first;
+		}
+
+		// Adds all of them, then restores the order in O(n)
+		void assign(std::vector<RyValue> items, std::vector<RyValue> orders) {
+			values = std::move(items);
+			keys = std::move(orders);
+			for (size_t i = values.size() / 2; i-- > 0;)
+				down(i);
+		}
+
+		// In heap order, which is not sorted
+		const RyValue &at(size_t index) const { return values[index]; }
+		const RyValue &keyAt(size_t index) const { return orderOf(index); }
+
+		// a < b for heap keys
+		static bool less(const RyValue &a, const RyValue &b) {
+			if (a.isNumber() && b.isNumber())
+				return a.asNumber() < b.asNumber();
+			auto left = std::get_if<std::string>(&a.val), right = std::get_if<std::string>(&b.val);
+			if (left && right)
+				return *left < *right;
+			if (a.isList() && b.isList()) {
+				const auto &x = *a.asList(), &y = *b.asList();
+				for (size_t i = 0; i < x.size() && i < y.size(); i++) {
+					if (less(x[i], y[i]))
+						return true;
+					if (less(y[i], x[i]))
+						return false;
+				}
+				return x.size() < y.size();
+			}
+			throw std::runtime_error("Heap keys must be numbers, strings or lists of them, and all of one kind.");
+		}
+
+	private:
+		std::vector<RyValue> values;
+		std::vector<RyValue> keys; // Parallel to values, empty without a key function
+
+		const RyValue &orderOf(size_t i) const { return key.isNil() ? values[i] : keys[i]; }
+
+		void swap(size_t i, size_t j) {
+			std::swap(values[i], values[j]);
+			if (!key.isNil())
+				std::swap(keys[i], keys[j]);
+		}
+
+		void up(size_t i) {
+			while (i > 0) {
+				size_t parent = (i - 1) / 2;
+				if (!less(orderOf(i), orderOf(parent)))
+					break;
+				swap(i, parent);
+				i = parent;
+			}
+		}
+
+		void down(size_t i) {
+			for (;;) {
+				size_t smallest = i, left = 2 * i + 1, right = left + 1;
+				if (left < values.size() && less(orderOf(left), orderOf(smallest)))
+					smallest = left;
+				if (right < values.size() && less(orderOf(right), orderOf(smallest)))
+					smallest = right;
+				if (smallest == i)
+					return;
+				swap(i, smallest);
+				i = smallest;
+			}
+		}
+	};
+
+	template<typename T>
+	inline T *collectionOf(const RyValue &value) {
+		auto object = std::get_if<RyValue::Object>(&value.val);
+		return object ? dynamic_cast<T *>(object->get()) : nullptr;
+	}
+} // namespace RyRuntime
@@ -0,0 +1,14 @@
+#pragma once
+#include <string>
+
+namespace RyRuntime {
+	/*
+	 * Base class for runtime handles that have no literal syntax
+	 * (threads, channels, ...). Natives create them, scripts pass them around.
+	 */
+	class RyObject {
+	public:
+		virtual ~RyObject() = default;
+		virtual std::string typeName() const = 0; // What type() reports
+	};
+} // namespace RyRuntime
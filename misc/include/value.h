@@ -12,6 +12,7 @@
 
 namespace RyRuntime {
 	class RyClosure;
+	class RyObject;
 }
 namespace Frontend {
 	class RyClass;
@@ -41,9 +42,10 @@ struct RyValue {
 	using Closure = std::shared_ptr<RyRuntime::RyClosure>;
 	using Class = std::shared_ptr<Frontend::RyClass>;
 	using BoundMethod = std::shared_ptr<Frontend::RyBoundMethod>;
+	using Object = std::shared_ptr<RyRuntime::RyObject>;
 
 	using Variant = std::variant<std::monostate, Native, Func, Closure, double, bool, std::string, List, RyRange, Map,
-															 Instance, Class, BoundMethod>;
+															 Instance, Class, BoundMethod, Object>;
 
 	Variant val;
 
@@ -62,6 +64,7 @@ struct RyValue {
 	RyValue(RyRange r) : val(r) {}
 	RyValue(Class c) : val(c) {}
 	RyValue(BoundMethod b) : val(b) {}
+	RyValue(Object o) : val(o) {}
 
 
 	bool isNil() const { return std::holds_alternative<std::monostate>(val); }
@@ -77,6 +80,7 @@ struct RyValue {
 	bool isRange() const { return std::holds_alternative<RyRange>(val); }
 	bool isClosure() const { return std::holds_alternative<Closure>(val); }
 	bool isBoundMethod() const { return std::holds_alternative<BoundMethod>(val); }
+	bool isObject() const { return std::holds_alternative<Object>(val); }
 
 	double asNumber() const {
 		if (const double *b = std::get_if<double>(&val)) {
@@ -162,6 +166,13 @@ struct RyValue {
 		std::cerr << "Value is not a bound method" << std::endl;
 		return nullptr;
 	}
+	Object asObject() const {
+		if (const Object *b = std::get_if<Object>(&val)) {
+			return *b;
+		}
+		std::cerr << "Value is not an object" << std::endl;
+		return nullptr;
+	}
 
 
 	bool operator==(const RyValue &other) const { return val == other.val; }
@@ -170,6 +181,9 @@ struct RyValue {
 
 	std::string to_string() const;
 
+	// One-byte strings, made once: what indexing or iterating a string hands out
+	static const RyValue &character(unsigned char c);
+
 	RyValue operator+(const RyValue &other) const;
 	RyValue operator-(const RyValue &other) const;
 	RyValue operator*(const RyValue &other) const;
@@ -1,5 +1,6 @@
 #include "value.h"
 #include "class.h"
+#include "object.h"
 
 RyValue RyValue::operator!() const {
 	if (isBool()) {
@@ -34,8 +35,8 @@ size_t RyValueHasher::operator()(const RyValue &v) const {
 		return std::hash<double>{}(v.asNumber());
 	if (v.isBool())
 		return std::hash<bool>{}(v.asBool());
-	if (v.isString())
-		return std::hash<std::string>{}(v.to_string());
+	if (auto text = std::get_if<std::string>(&v.val))
+		return std::hash<std::string>{}(*text); // Not to_string(), which copies
 	if (v.isList())
 		return std::hash<RyValue::List>{}(v.asList());
 	if (v.isMap())
@@ -96,9 +97,22 @@ std::string RyValue::to_string() const {
 		return asClass()->name;
 	if (isBoundMethod())
 		return "<bound method>";
+	if (isObject())
+		return "<" + asObject()->typeName() + ">";
 	return "<unknown>";
 }
 
+const RyValue &RyValue::character(unsigned char c) {
+	static const std::vector<RyValue> table = [] {
+		std::vector<RyValue> made;
+		made.reserve(256);
+		for (int i = 0; i < 256; i++)
+			made.emplace_back(std::string(1, (char) i));
+		return made;
+	}();
+	return table[c];
+}
+
 RyValue RyValue::operator+(const RyValue &other) const {
 	if (isNumber() && other.isNumber()) {
 		return RyValue(asNumber() + other.asNumber());
@@ -0,0 +1,489 @@
+#include <cerrno>
+#include <charconv>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <fcntl.h>
+#include <limits>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <unistd.h>
+#include <vector>
+#include "rylib-dk.h"
+#include "scan.h"
+
+static const RyApi *ry;
+
+// CSV as in RFC 4180: fields split by a delimiter, rows by \n or \r\n, and fields in double quotes may hold
+// delimiters, newlines and "" for a quote. The file is read in chunks and classified 64 bytes at a time: a
+// prefix XOR over the quote mask says which bytes are inside quotes (a "" pair switches out and back in), so
+// the delimiters and newlines that end fields fall out of a few vector compares. Only those positions are
+// kept; fields are looked at when a row is handed out, and fields nobody selected are never looked at.
+
+namespace {
+	const size_t CHUNK = 1024 * 1024;
+
+	// A column asked for in "select"
+	struct Wanted {
+		bool byName;
+		std::string name;
+		double index;
+	};
+
+	struct Options {
+		char delimiter = ',';
+		bool header = false; // The first row names the columns
+		bool numbers = false; // rows(): fields that are numbers come out as numbers, empty ones as null
+		bool packed = false; // columns(): number columns as bytes of 64 bit floats
+		bool selecting = false;
+		std::vector<Wanted> select; // The only columns wanted, in that order
+	};
+
+	Options optionsOf(RyContext *ctx, int argc, const RyHandle *args, int index, const char *native) {
+		Options options;
+		if (argc <= index || ry->kind(args[index]) == RY_KIND_NULL)
+			return options;
+		if (ry->kind(args[index]) != RY_KIND_MAP)
+			throw std::runtime_error(std::string(native) + "() expects a map of options.");
+		auto option = [&](const char *name) {
+			RyHandle found = ry->map_get(args[index], ry->make_string(ctx, name, std::strlen(name)));
+			return found && ry->kind(found) != RY_KIND_NULL ? found : nullptr;
+		};
+		auto flag = [&](const char *name) {
+			RyHandle found = option(name);
+			int value;
+			return found && ry->get_bool(found, &value) && value;
+		};
+
+		if (RyHandle delimiter = option("delimiter")) {
+			RyStringView text;
+			if (!ry->get_string(delimiter, &text) || text.length != 1 || text.data[0] == '"' || text.data[0] == '\n')
+				throw std::runtime_error(std::string(native) + "(): the delimiter must be one character.");
+			options.delimiter = text.data[0];
+		}
+		options.header = flag("header");
+		options.numbers = flag("numbers");
+		options.packed = flag("packed");
+		if (RyHandle select = option("select")) {
+			if (ry->kind(select) != RY_KIND_LIST)
+				throw std::runtime_error(std::string(native) + "(): select expects a list of column names or indexes.");
+			options.selecting = true;
+			for (size_t i = 0, count = ry->list_length(select); i < count; i++) {
+				RyHandle column = ry->list_get(select, i);
+				RyStringView name;
+				double number;
+				if (ry->get_number(column, &number) && number >= 0)
+					options.select.push_back({false, "", number});
+				else if (ry->get_string(column, &name))
+					options.select.push_back({true, std::string(name.data, name.length), 0});
+				else
+					throw std::runtime_error(std::string(native) + "(): select expects column names or indexes.");
+			}
+		}
+		return options;
+	}
+
+	bool toNumber(const char *text, size_t length, double &out) {
+		if (length == 0)
+			return false;
+		char first = text[0];
+		if (!(first >= '0' && first <= '9') && first != '-' && first != '.')
+			return false; // from_chars would take "inf" and "nan"
+		auto [end, error] = std::from_chars(text, text + length, out);
+		return error == std::errc() && end == text + length;
+	}
+
+	// Where the fields of each row end, read through one buffer
+	class Scanner {
+	public:
+		struct Field {
+			uint32_t start, end;
+		};
+
+		Scanner(int fd, bool owned, char delimiter) : fd(fd), owned(owned), delimiter(delimiter) {}
+		~Scanner() { close(); }
+
+		// The next row's fields, false at the end. Positions are valid until the next call.
+		bool next(std::vector<Field> &fields) {
+			for (;;) {
+				fields.clear();
+				size_t start = consumed, end = rowEnds;
+				bool found = false;
+				while (end < ends.size() && !found) {
+					uint32_t at = ends[end++];
+					fields.push_back({(uint32_t) start, at});
+					start = at + 1;
+					found = buffer[at] == '\n';
+				}
+				if (found) {
+					consumed = start;
+					rowEnds = end;
+				} else if (done) {
+					if (start >= buffer.size() && fields.empty())
+						return false;
+					fields.push_back({(uint32_t) start, (uint32_t) buffer.size()}); // The last row has no newline
+					consumed = buffer.size();
+					rowEnds = ends.size();
+				} else {
+					fill();
+					continue;
+				}
+
+				Field &last = fields.back();
+				if (last.end > last.start && buffer[last.end - 1] == '\r')
+					last.end--;
+				if (fields.size() > 1 || last.end > last.start)
+					return true; // Blank lines are skipped
+			}
+		}
+
+		const char *data() const { return buffer.data(); }
+
+	private:
+		int fd;
+		bool owned;
+		char delimiter;
+		std::string buffer;
+		size_t scanned = 0; // Classified so far, whole blocks until the end of the input
+		size_t consumed = 0; // Where the next row starts
+		std::vector<uint32_t> ends; // Unquoted delimiters and newlines found in the buffer
+		size_t rowEnds = 0; // The first of `ends` past `consumed`
+		uint64_t quoteCarry = 0;
+		bool done = false;
+
+		void close() {
+			if (owned && fd >= 0)
+				::close(fd);
+			fd = -1;
+		}
+
+		void classify(const uint8_t *in, size_t at) {
+			RyScan::Block block(in);
+			uint64_t inQuotes = RyScan::prefixXor(block.eq('"')) ^ quoteCarry;
+			quoteCarry = (uint64_t) ((int64_t) inQuotes >> 63);
+			uint64_t found = (block.eq(delimiter) | block.eq('\n')) & ~inQuotes;
+			size_t base = ends.size();
+			ends.resize(base + __builtin_popcountll(found));
+			uint32_t *out = ends.data() + base;
+			while (found) {
+				*out++ = (uint32_t) (at + __builtin_ctzll(found));
+				found &= found - 1;
+			}
+		}
+
+		// Moves the unfinished row to the front, reads more and classifies it
+		void fill() {
+			if (consumed > 0) {
+				buffer.erase(0, consumed);
+				ends.erase(ends.begin(), ends.begin() + rowEnds);
+				for (auto &end: ends)
+					end -= (uint32_t) consumed;
+				scanned -= consumed;
+				consumed = 0;
+				rowEnds = 0;
+			}
+			if (buffer.size() + CHUNK >= UINT32_MAX)
+				throw std::runtime_error("csv: a row longer than 4 GB.");
+
+			size_t kept = buffer.size();
+			buffer.resize(kept + CHUNK);
+			ssize_t got;
+			do {
+				got = fd >= 0 ? ::read(fd, buffer.data() + kept, CHUNK) : 0;
+			} while (got < 0 && errno == EINTR);
+			if (got < 0)
+				throw std::runtime_error("csv: " + std::string(std::strerror(errno)) + ".");
+			buffer.resize(kept + (size_t) got);
+
+			for (; scanned + 64 <= buffer.size(); scanned += 64)
+				classify((const uint8_t *) buffer.data() + scanned, scanned);
+			if (got == 0) {
+				if (scanned < buffer.size()) {
+					uint8_t tail[64] = {};
+					std::memcpy(tail, buffer.data() + scanned, buffer.size() - scanned);
+					classify(tail, scanned);
+					scanned = buffer.size();
+				}
+				if (quoteCarry)
+					throw std::runtime_error("csv: a quoted field is never closed.");
+				done = true;
+				close();
+			}
+		}
+	};
+
+	// The text of a field: quotes taken off and "" turned into "
+	void fieldText(const char *data, Scanner::Field field, std::string &out) {
+		const char *start = data + field.start, *end = data + field.end;
+		if (start == end || *start != '"') {
+			out.assign(start, end);
+			return;
+		}
+		start++;
+		if (end > start && end[-1] == '"')
+			end--;
+		out.clear();
+		for (;;) {
+			const char *quote = (const char *) std::memchr(start, '"', end - start);
+			if (!quote) {
+				out.append(start, end);
+				return;
+			}
+			out.append(start, quote + 1); // Keeps one of the pair
+			start = quote + 2 <= end ? quote + 2 : end;
+		}
+	}
+
+	bool isQuoted(const char *data, Scanner::Field field) { return field.end > field.start && data[field.start] == '"'; }
+
+	// The field each selected column comes from, by index or by header name
+	std::vector<size_t> fieldsFor(const Options &options, const std::vector<std::string> &names, const char *native) {
+		std::vector<size_t> fields;
+		for (const Wanted &column: options.select) {
+			if (!column.byName) {
+				fields.push_back((size_t) column.index);
+				continue;
+			}
+			size_t index = names.size();
+			for (size_t i = 0; i < names.size(); i++) {
+				if (names[i] == column.name)
+					index = i;
+			}
+			if (index == names.size())
+				throw std::runtime_error(std::string(native) + "(): no column named '" + column.name + "'" +
+																 (names.empty() ? " (select by name needs \"header\": true)." : "."));
+			fields.push_back(index);
+		}
+		return fields;
+	}
+
+	std::unique_ptr<Scanner> open(int argc, const RyHandle *args, const Options &options, const char *native) {
+		RyStringView path;
+		double fd;
+		if (argc > 0 && ry->get_string(args[0], &path)) {
+			std::string name(path.data, path.length);
+			int opened = ::open(name.c_str(), O_RDONLY | O_CLOEXEC);
+			if (opened < 0)
+				throw std::runtime_error(std::string(native) + "(): cannot open " + name + ": " + std::strerror(errno) + ".");
+			return std::make_unique<Scanner>(opened, true, options.delimiter);
+		}
+		if (argc > 0 && ry->get_number(args[0], &fd))
+			return std::make_unique<Scanner>((int) fd, false, options.delimiter);
+		throw std::runtime_error(std::string(native) + "() expects a path or a descriptor.");
+	}
+
+	std::vector<std::string> headerOf(Scanner &scanner, std::vector<Scanner::Field> &fields) {
+		std::vector<std::string> names;
+		if (scanner.next(fields)) {
+			for (auto field: fields)
+				fieldText(scanner.data(), field, names.emplace_back());
+		}
+		return names;
+	}
+
+	// Packed columns are little endian on any host, the byte order unpack() reads by default
+	void storeLittleEndian(const std::vector<double> &numbers, uint8_t *out) {
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+		for (double number: numbers) {
+			uint64_t bits;
+			std::memcpy(&bits, &number, sizeof(bits));
+			bits = __builtin_bswap64(bits);
+			std::memcpy(out, &bits, sizeof(bits));
+			out += sizeof(bits);
+		}
+#else
+		std::memcpy(out, numbers.data(), numbers.size() * sizeof(double));
+#endif
+	}
+
+	// A column of columns(): numbers as long as every field is one (or empty), strings from the first that isn't
+	struct Column {
+		bool numeric = true;
+		bool sawNumber = false;
+		std::vector<double> numbers; // NaN for empty fields, while numeric
+		std::string text; // The text of the fields one after another, in case one turns out not to be a number
+		std::vector<size_t> ends;
+
+		void add(const char *data, Scanner::Field field, std::string &scratch) {
+			bool quoted = isQuoted(data, field);
+			if (numeric) {
+				double number;
+				if (field.end == field.start) {
+					numbers.push_back(std::numeric_limits<double>::quiet_NaN());
+				} else if (!quoted && toNumber(data + field.start, field.end - field.start, number)) {
+					numbers.push_back(number);
+					sawNumber = true;
+				} else {
+					becomeText();
+				}
+			}
+			if (quoted) {
+				fieldText(data, field, scratch);
+				text += scratch;
+			} else {
+				text.append(data + field.start, field.end - field.start);
+			}
+			ends.push_back(text.size());
+		}
+
+		void becomeText() {
+			numeric = false;
+			std::vector<double>().swap(numbers);
+		}
+
+		RyHandle result(RyContext *ctx, bool packed) {
+			if (numeric && !sawNumber)
+				becomeText(); // Only empty fields
+			if (!numeric) {
+				size_t start = 0;
+				for (size_t end: ends) {
+					ry->make_string(ctx, text.data() + start, end - start);
+					start = end;
+				}
+				return ry->make_list_of_last(ctx, ends.size());
+			}
+			if (packed) {
+				RyHandle bytes;
+				storeLittleEndian(numbers, ry->make_bytes(ctx, numbers.size() * sizeof(double), &bytes));
+				return bytes;
+			}
+			for (double number: numbers)
+				std::isnan(number) ? ry->make_null(ctx) : ry->make_number(ctx, number);
+			return ry->make_list_of_last(ctx, numbers.size());
+		}
+	};
+
+	// What rows() hands to foreach
+	struct RowReader {
+		std::unique_ptr<Scanner> scanner;
+		std::vector<Scanner::Field> fields;
+		bool selecting = false;
+		std::vector<size_t> fieldOf; // The field each selected column comes from
+		bool numbers = false;
+		std::string text;
+
+		RyHandle value(RyContext *ctx, const char *data, Scanner::Field field) {
+			bool quoted = isQuoted(data, field);
+			double number;
+			if (numbers && !quoted && field.end == field.start)
+				return ry->make_null(ctx); // As in a number column of columns()
+			if (numbers && !quoted && toNumber(data + field.start, field.end - field.start, number))
+				return ry->make_number(ctx, number);
+			if (!quoted)
+				return ry->make_string(ctx, data + field.start, field.end - field.start);
+			fieldText(data, field, text);
+			return ry->make_string(ctx, text.data(), text.size());
+		}
+	};
+
+	// The next row for foreach, null at the end. Fields nobody selected are not even looked at.
+	RyStatus nextRow(RyContext *ctx, int argc, const RyHandle *args, RyHandle *result) {
+		auto reader = static_cast<RowReader *>(ry->function_data(ctx));
+		try {
+			auto &fields = reader->fields;
+			if (!reader->scanner->next(fields))
+				return RY_OK;
+			const char *data = reader->scanner->data();
+			if (reader->selecting) {
+				for (size_t field: reader->fieldOf)
+					field < fields.size() ? reader->value(ctx, data, fields[field]) : ry->make_null(ctx);
+				*result = ry->make_list_of_last(ctx, reader->fieldOf.size());
+			} else {
+				for (auto field: fields)
+					reader->value(ctx, data, field);
+				*result = ry->make_list_of_last(ctx, fields.size());
+			}
+			return RY_OK;
+		} catch (const std::exception &e) {
+			return ry->error(ctx, e.what());
+		}
+	}
+} // namespace
+
+// Native function: rows(path or fd, options?) - an iterator for foreach, one list of fields per row. Options:
+// "delimiter" (","), "header" (skip the first row, select may use its names), "select" (a list of the
+// columns wanted, by name or index), "numbers" (fields that are numbers come out as numbers, and empty fields
+// as null, as in columns()).
+static RyStatus csv_rows(RyContext *ctx, int argc, const RyHandle *args, RyHandle *result) {
+	try {
+		Options options = optionsOf(ctx, argc, args, 1, "rows");
+		auto reader = std::make_unique<RowReader>();
+		reader->scanner = open(argc, args, options, "rows");
+		std::vector<std::string> names;
+		if (options.header)
+			names = headerOf(*reader->scanner, reader->fields);
+		reader->selecting = options.selecting;
+		reader->fieldOf = fieldsFor(options, names, "rows");
+		reader->numbers = options.numbers;
+		*result = ry->make_iterator(ctx, "rows", nextRow, reader.release(),
+																[](void *data) { delete static_cast<RowReader *>(data); });
+		return RY_OK;
+	} catch (const std::exception &e) {
+		return ry->error(ctx, e.what());
+	}
+}
+
+// Native function: columns(path or fd, options?) - the whole file as a map from column (header name, or index
+// without a header) to a list: numbers where every field of the column is a number or empty (null), strings
+// otherwise. Options as for rows(), plus "packed": number columns as bytes of little endian doubles (NaN for
+// empty) on any host, read with unpack("d", column, 8 * i).
+static RyStatus csv_columns(RyContext *ctx, int argc, const RyHandle *args, RyHandle *result) {
+	try {
+		Options options = optionsOf(ctx, argc, args, 1, "columns");
+		auto scanner = open(argc, args, options, "columns");
+		std::vector<Scanner::Field> fields;
+		std::vector<std::string> names;
+		if (options.header)
+			names = headerOf(*scanner, fields);
+
+		bool selected = options.selecting;
+		std::vector<size_t> fieldOf = fieldsFor(options, names, "columns");
+		std::vector<Column> columns(selected ? fieldOf.size() : names.size());
+		std::string scratch;
+		size_t rows = 0;
+		Scanner::Field empty{0, 0};
+		while (scanner->next(fields)) {
+			const char *data = scanner->data();
+			if (!selected && fields.size() > columns.size()) {
+				// A column first seen here was empty in the rows before
+				size_t before = columns.size();
+				columns.resize(fields.size());
+				for (size_t c = before; c < columns.size(); c++) {
+					for (size_t r = 0; r < rows; r++)
+						columns[c].add(data, empty, scratch);
+				}
+			}
+			for (size_t c = 0; c < columns.size(); c++) {
+				size_t field = selected ? fieldOf[c] : c;
+				columns[c].add(data, field < fields.size() ? fields[field] : empty, scratch);
+			}
+			rows++;
+		}
+
+		for (size_t c = 0; c < columns.size(); c++) {
+			if (selected && options.select[c].byName)
+				ry->make_string(ctx, options.select[c].name.data(), options.select[c].name.size());
+			else if (selected)
+				ry->make_number(ctx, options.select[c].index);
+			else if (c < names.size())
+				ry->make_string(ctx, names[c].data(), names[c].size());
+			else
+				ry->make_number(ctx, (double) c);
+			columns[c].result(ctx, options.packed);
+			columns[c] = Column(); // Its values are made, the text isn't needed anymore
+		}
+		*result = ry->make_map_of_last(ctx, columns.size());
+		return RY_OK;
+	} catch (const std::exception &e) {
+		return ry->error(ctx, e.what());
+	}
+}
+
+// The Entry Point
+RY_MODULE_INIT(api, module) {
+	ry = api;
+	ry->define(module, "rows", csv_rows, -1);
+	ry->define(module, "columns", csv_columns, -1);
+	return RY_OK;
+}
@@ -0,0 +1,385 @@
+#include <cstdint>
+#include <cstring>
+#include <dlfcn.h>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include "rylib-dk.h"
+
+static const RyApi *ry;
+
+// Arguments are passed in registers only. On x86-64 System V and AArch64 integers and floating point numbers
+// use separate register files, filled in order within each, so one call shape with every register covers
+// any signature that fits in them: the callee reads the registers its parameters are in and ignores the rest.
+#if (defined(__x86_64__) || defined(__aarch64__)) && !defined(_WIN32)
+#define RY_FFI_SUPPORTED 1
+#endif
+
+namespace {
+	const int INT_REGISTERS = 6;
+	const int FLOAT_REGISTERS = 8;
+
+	enum class CType {
+		Void,
+		Int,
+		UInt,
+		Long,
+		ULong,
+		Bool,
+		Double,
+		Float,
+		String,
+		Pointer,
+		DoubleArray,
+		FloatArray,
+		IntArray,
+		LongArray
+	};
+
+	struct Parameter {
+		CType type;
+		int slot; // Register index within its file
+	};
+
+	typedef int64_t (*IntCall)(int64_t, int64_t, int64_t, int64_t, int64_t, int64_t, double, double, double, double,
+														 double, double, double, double);
+	typedef double (*FloatCall)(int64_t, int64_t, int64_t, int64_t, int64_t, int64_t, double, double, double, double,
+															double, double, double, double);
+
+	// What fn() works out once, so a call only converts its arguments
+	struct Trampoline {
+		void *function;
+		std::string name;
+		CType result;
+		std::vector<Parameter> parameters;
+		bool hasArrays = false;
+	};
+
+	std::string trim(const std::string &text) {
+		size_t first = text.find_first_not_of(" \t");
+		if (first == std::string::npos)
+			return "";
+		return text.substr(first, text.find_last_not_of(" \t") - first + 1);
+	}
+
+	CType parseType(std::string name, const std::string &signature) {
+		if (name.rfind("const ", 0) == 0)
+			name = trim(name.substr(6));
+		std::string compact;
+		for (char c: name) {
+			if (c != ' ')
+				compact += c;
+		}
+
+		if (compact == "void")
+			return CType::Void;
+		if (compact == "int" || compact == "int32_t" || compact == "short" || compact == "char")
+			return CType::Int;
+		if (compact == "unsigned" || compact == "unsignedint" || compact == "uint32_t")
+			return CType::UInt;
+		if (compact == "long" || compact == "int64_t" || compact == "ssize_t" || compact == "longlong" ||
+				compact == "intptr_t")
+			return CType::Long;
+		if (compact == "unsignedlong" || compact == "uint64_t" || compact == "size_t" || compact == "unsignedlonglong" ||
+				compact == "uintptr_t")
+			return CType::ULong;
+		if (compact == "bool")
+			return CType::Bool;
+		if (compact == "double")
+			return CType::Double;
+		if (compact == "float")
+			return CType::Float;
+		if (compact == "char*")
+			return CType::String;
+		if (compact == "void*")
+			return CType::Pointer;
+		if (compact == "double*")
+			return CType::DoubleArray;
+		if (compact == "float*")
+			return CType::FloatArray;
+		if (compact == "int*" || compact == "int32_t*")
+			return CType::IntArray;
+		if (compact == "long*" || compact == "int64_t*")
+			return CType::LongArray;
+		throw std::runtime_error("fn(): unsupported type '" + name + "' in \"" + signature + "\".");
+	}
+
+	bool isFloat(CType type) { return type == CType::Double || type == CType::Float; }
+
+	bool isArray(CType type) {
+		return type == CType::DoubleArray || type == CType::FloatArray || type == CType::IntArray ||
+					 type == CType::LongArray;
+	}
+
+	// "double(double, int)" -> result and parameters, with the register each parameter goes in
+	void parseSignature(const std::string &signature, Trampoline &trampoline) {
+		size_t open = signature.find('('), close = signature.rfind(')');
+		if (open == std::string::npos || close == std::string::npos || close < open)
+			throw std::runtime_error("fn(): expected a signature like \"double(double)\", got \"" + signature + "\".");
+
+		trampoline.result = parseType(trim(signature.substr(0, open)), signature);
+		if (isArray(trampoline.result))
+			throw std::runtime_error("fn(): cannot return an array in \"" + signature + "\".");
+
+		std::string list = trim(signature.substr(open + 1, close - open - 1));
+		if (list.empty() || list == "void")
+			return;
+		int ints = 0, floats = 0;
+		size_t start = 0;
+		for (;;) {
+			size_t comma = list.find(',', start);
+			std::string item = trim(list.substr(start, comma == std::string::npos ? std::string::npos : comma - start));
+			if (item == "...")
+				throw std::runtime_error("fn(): variadic functions are not supported.");
+
+			CType type = parseType(item, signature);
+			if (type == CType::Void)
+				throw std::runtime_error("fn(): void parameter in \"" + signature + "\".");
+			int slot = isFloat(type) ? floats++ : ints++;
+			trampoline.parameters.push_back({type, slot});
+			trampoline.hasArrays = trampoline.hasArrays || isArray(type);
+			if (comma == std::string::npos)
+				break;
+			start = comma + 1;
+		}
+		if (ints > INT_REGISTERS || floats > FLOAT_REGISTERS)
+			throw std::runtime_error("fn(): at most " + std::to_string(INT_REGISTERS) + " integer/pointer and " +
+															 std::to_string(FLOAT_REGISTERS) + " floating point parameters are supported.");
+	}
+
+	double number(RyHandle value, const Trampoline &trampoline, size_t index) {
+		double number;
+		int boolean;
+		if (ry->get_number(value, &number))
+			return number;
+		if (ry->get_bool(value, &boolean))
+			return boolean ? 1 : 0;
+		throw std::runtime_error(trampoline.name + "() expects a number for argument " + std::to_string(index + 1) + ".");
+	}
+
+	// A list of numbers copied into a C array, and back out after the call (the C side may write to it)
+	struct ArrayArgument {
+		CType type;
+		RyHandle list;
+		std::vector<uint8_t> buffer;
+
+		template<typename T>
+		T *fill() {
+			size_t length = ry->list_length(list);
+			buffer.resize(length * sizeof(T));
+			T *items = reinterpret_cast<T *>(buffer.data());
+			for (size_t i = 0; i < length; i++) {
+				double number = 0;
+				ry->get_number(ry->list_get(list, i), &number);
+				items[i] = (T) number;
+			}
+			return items;
+		}
+
+		template<typename T>
+		void writeBack(RyContext *ctx) {
+			const T *items = reinterpret_cast<const T *>(buffer.data());
+			size_t length = buffer.size() / sizeof(T);
+			for (size_t i = 0; i < length; i++) {
+				size_t scope = ry->scope_open(ctx); // The numbers only live until they are in the list
+				ry->list_set(list, i, ry->make_number(ctx, (double) items[i]));
+				ry->scope_close(ctx, scope);
+			}
+		}
+	};
+
+	RyHandle invoke(RyContext *ctx, const Trampoline &trampoline, const RyHandle *args) {
+		int64_t ints[INT_REGISTERS] = {};
+		double floats[FLOAT_REGISTERS] = {};
+		std::vector<ArrayArgument> arrays;
+		if (trampoline.hasArrays)
+			arrays.reserve(trampoline.parameters.size());
+
+		for (size_t i = 0; i < trampoline.parameters.size(); i++) {
+			const Parameter &parameter = trampoline.parameters[i];
+			RyHandle arg = args[i];
+			switch (parameter.type) {
+				case CType::Double:
+					floats[parameter.slot] = number(arg, trampoline, i);
+					break;
+				case CType::Float: {
+					// A float goes in the low half of its register
+					float single = (float) number(arg, trampoline, i);
+					std::memcpy(&floats[parameter.slot], &single, sizeof(single));
+					break;
+				}
+				case CType::String: {
+					RyStringView text;
+					if (ry->kind(arg) == RY_KIND_NULL) {
+						ints[parameter.slot] = 0;
+					} else if (ry->get_string(arg, &text)) {
+						ints[parameter.slot] = (int64_t) (intptr_t) text.data; // Borrowed for the call, NUL follows it
+					} else {
+						throw std::runtime_error(trampoline.name + "() expects a string for argument " + std::to_string(i + 1) +
+																		 ".");
+					}
+					break;
+				}
+				case CType::DoubleArray:
+				case CType::FloatArray:
+				case CType::IntArray:
+				case CType::LongArray: {
+					if (ry->kind(arg) != RY_KIND_LIST)
+						throw std::runtime_error(trampoline.name + "() expects a list for argument " + std::to_string(i + 1) +
+																		 ".");
+					ArrayArgument &array = arrays.emplace_back(ArrayArgument{parameter.type, arg, {}});
+					void *pointer = parameter.type == CType::DoubleArray ? (void *) array.fill<double>()
+													: parameter.type == CType::FloatArray ? (void *) array.fill<float>()
+													: parameter.type == CType::IntArray		? (void *) array.fill<int32_t>()
+																																			: (void *) array.fill<int64_t>();
+					ints[parameter.slot] = (int64_t) (intptr_t) pointer;
+					break;
+				}
+				case CType::UInt:
+				case CType::ULong: {
+					// Through uint64_t, converting a double above INT64_MAX straight to int64_t is undefined
+					double value = number(arg, trampoline, i);
+					ints[parameter.slot] = value < 0 ? (int64_t) value : (int64_t) (uint64_t) value;
+					break;
+				}
+				default:
+					ints[parameter.slot] = (int64_t) number(arg, trampoline, i);
+					break;
+			}
+		}
+
+		RyHandle result = nullptr;
+		if (isFloat(trampoline.result)) {
+			double raw = ((FloatCall) trampoline.function)(ints[0], ints[1], ints[2], ints[3], ints[4], ints[5], floats[0],
+																										 floats[1], floats[2], floats[3], floats[4], floats[5],
+																										 floats[6], floats[7]);
+			if (trampoline.result == CType::Float) {
+				float single;
+				std::memcpy(&single, &raw, sizeof(single));
+				raw = single;
+			}
+			result = ry->make_number(ctx, raw);
+		} else {
+			int64_t raw = ((IntCall) trampoline.function)(ints[0], ints[1], ints[2], ints[3], ints[4], ints[5], floats[0],
+																										floats[1], floats[2], floats[3], floats[4], floats[5],
+																										floats[6], floats[7]);
+			switch (trampoline.result) {
+				case CType::Void:
+					break;
+				case CType::Int:
+					result = ry->make_number(ctx, (double) (int32_t) raw);
+					break;
+				case CType::UInt:
+					result = ry->make_number(ctx, (double) (uint32_t) raw);
+					break;
+				case CType::ULong:
+					result = ry->make_number(ctx, (double) (uint64_t) raw);
+					break;
+				case CType::Bool:
+					result = ry->make_bool(ctx, (raw & 0xff) != 0);
+					break;
+				case CType::String:
+					if (raw) {
+						const char *text = (const char *) (intptr_t) raw;
+						result = ry->make_string(ctx, text, std::strlen(text));
+					}
+					break;
+				default:
+					result = ry->make_number(ctx, (double) raw);
+					break;
+			}
+		}
+
+		for (auto &array: arrays) {
+			if (array.type == CType::DoubleArray)
+				array.writeBack<double>(ctx);
+			else if (array.type == CType::FloatArray)
+				array.writeBack<float>(ctx);
+			else if (array.type == CType::IntArray)
+				array.writeBack<int32_t>(ctx);
+			else
+				array.writeBack<int64_t>(ctx);
+		}
+		return result;
+	}
+
+	struct Library {
+		void *handle;
+		std::string path;
+	};
+
+	// A function fn() made, its arity checked by Ry
+	RyStatus call(RyContext *ctx, int argc, const RyHandle *args, RyHandle *result) {
+		auto trampoline = static_cast<Trampoline *>(ry->function_data(ctx));
+		try {
+			*result = invoke(ctx, *trampoline, args);
+			return RY_OK;
+		} catch (const std::exception &e) {
+			return ry->error(ctx, e.what());
+		}
+	}
+
+	// fn(name, signature) - the C function `name` of the library, callable from Ry
+	RyStatus fn(RyContext *ctx, int argc, const RyHandle *args, RyHandle *result) {
+		auto library = static_cast<Library *>(ry->function_data(ctx));
+		RyStringView name, signature;
+		if (!ry->get_string(args[0], &name) || !ry->get_string(args[1], &signature))
+			return ry->error(ctx, "fn() expects a function name and a signature like \"double(double)\".");
+
+		auto trampoline = std::make_unique<Trampoline>();
+		trampoline->name.assign(name.data, name.length);
+		try {
+			parseSignature(std::string(signature.data, signature.length), *trampoline);
+		} catch (const std::exception &e) {
+			return ry->error(ctx, e.what());
+		}
+		dlerror();
+		trampoline->function = dlsym(library->handle, trampoline->name.c_str());
+		if (!trampoline->function) {
+			std::string message = "fn(): no function '" + trampoline->name + "' in " +
+														(library->path.empty() ? "ry" : library->path) + ".";
+			return ry->error(ctx, message.c_str());
+		}
+
+		const std::string &called = trampoline->name;
+		int arity = (int) trampoline->parameters.size();
+		*result = ry->make_function(ctx, called.c_str(), call, arity, trampoline.release(),
+																[](void *data) { delete static_cast<Trampoline *>(data); });
+		return RY_OK;
+	}
+} // namespace
+
+// Native function: load(path?) - a C library (the process itself without a path) as a map with fn(name, signature)
+static RyStatus ffi_load(RyContext *ctx, int argc, const RyHandle *args, RyHandle *result) {
+#ifndef RY_FFI_SUPPORTED
+	return ry->error(ctx, "ffi is not supported on this platform.");
+#else
+	RyStringView view{"", 0};
+	bool self = argc < 1 || ry->kind(args[0]) == RY_KIND_NULL;
+	if (!self && !ry->get_string(args[0], &view))
+		return ry->error(ctx, "load() expects the path of a shared library.");
+	std::string path(view.data, view.length);
+
+	// Libraries stay loaded, functions taken from them may outlive the map
+	void *handle = dlopen(self ? nullptr : path.c_str(), RTLD_LAZY | RTLD_LOCAL);
+	if (!handle) {
+		std::string message = "load(): " + std::string(dlerror());
+		return ry->error(ctx, message.c_str());
+	}
+
+	*result = ry->make_map(ctx);
+	ry->map_set(*result, ry->make_string(ctx, "path", 4), ry->make_string(ctx, path.data(), path.size()));
+	RyHandle function = ry->make_function(ctx, "fn", fn, 2, new Library{handle, path},
+																				[](void *data) { delete static_cast<Library *>(data); });
+	ry->map_set(*result, ry->make_string(ctx, "fn", 2), function);
+	return RY_OK;
+#endif
+}
+
+// The Entry Point
+RY_MODULE_INIT(api, module) {
+	ry = api;
+	ry->define(module, "load", ffi_load, -1);
+	return RY_OK;
+}
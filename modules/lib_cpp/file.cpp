@@ -1,36 +1,536 @@
-#include <fstream>
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <mutex>
 #include <string>
+#include <sys/stat.h>
 #include <unordered_map>
-#include "value.h"
+#include <vector>
+#include "rylib-dk.h"
 
-typedef RyValue (*RawNativeFn)(int, RyValue*, std::unordered_map<std::string, RyValue>&);
-typedef void (*RegisterFn)(const char*, RawNativeFn, int, void*);
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+#ifdef __linux__
+#include <sys/sendfile.h>
+#endif
+
+static const RyApi *ry;
+
+// Views are not NUL terminated, paths have to be
+static bool pathOf(RyHandle value, char *out, size_t size) {
+    RyStringView path;
+    if (!ry->get_string(value, &path) || path.length >= size) return false;
+    for (size_t i = 0; i < path.length; i++) out[i] = path.data[i];
+    out[path.length] = '\0';
+    return true;
+}
+
+// Strings and bytes can both be written
+static bool dataOf(RyHandle value, RyStringView *out) {
+    RyBytesView bytes;
+    if (ry->get_string(value, out)) return true;
+    if (!ry->get_bytes(value, &bytes)) return false;
+    *out = {(const char *) bytes.readable, bytes.length};
+    return true;
+}
+
+static RyStatus failure(RyContext *ctx, const char *what) {
+    std::string message = std::string(what) + ": " + std::strerror(errno);
+    return ry->error(ctx, message.c_str());
+}
 
 // Native function: Read File
-RyValue file_read_raw(int argCount, RyValue* args, std::unordered_map<std::string, RyValue>& globals) {
-    if (argCount < 1 || !args[0].isString()) return RyValue();
+static RyStatus file_read(RyContext *ctx, int argc, const RyHandle *args, RyHandle *result) {
+    char path[4096];
+    if (!pathOf(args[0], path, sizeof(path))) return RY_OK; // null
+
+    FILE *file = std::fopen(path, "rb");
+    if (!file) return RY_OK;
+
+    // Read straight into the string the script gets
+    struct stat info;
+    size_t size = fstat(fileno(file), &info) == 0 ? (size_t) info.st_size : 0;
+    char *buffer = ry->make_string_buffer(ctx, size, result);
+    size_t got = size ? std::fread(buffer, 1, size, file) : 0;
+    std::fclose(file);
+    if (got != size) return ry->error(ctx, "File changed while it was read.");
+    return RY_OK;
+}
 
-    std::ifstream file(args[0].to_string());
-    if (!file.is_open()) return RyValue();
+// Native function: read_bytes(path) - the whole file as mutable bytes, or null
+static RyStatus file_read_bytes(RyContext *ctx, int argc, const RyHandle *args, RyHandle *result) {
+    char path[4096];
+    if (!pathOf(args[0], path, sizeof(path))) return RY_OK;
 
-    std::string content((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
-    return RyValue(content);
+    FILE *file = std::fopen(path, "rb");
+    if (!file) return RY_OK;
+    struct stat info;
+    size_t size = fstat(fileno(file), &info) == 0 ? (size_t) info.st_size : 0;
+    uint8_t *buffer = ry->make_bytes(ctx, size, result);
+    size_t got = size ? std::fread(buffer, 1, size, file) : 0;
+    std::fclose(file);
+    if (got != size) return ry->error(ctx, "File changed while it was read.");
+    return RY_OK;
+}
+
+static RyStatus writeFile(RyContext *ctx, const RyHandle *args, RyHandle *result, const char *mode) {
+    char path[4096];
+    RyStringView content;
+    if (!pathOf(args[0], path, sizeof(path)) || !dataOf(args[1], &content)) {
+        *result = ry->make_bool(ctx, 0);
+        return RY_OK;
+    }
+
+    FILE *file = std::fopen(path, mode);
+    bool written = file && std::fwrite(content.data, 1, content.length, file) == content.length;
+    if (file) written = std::fclose(file) == 0 && written;
+    *result = ry->make_bool(ctx, written);
+    return RY_OK;
 }
 
 // Native function: Write File
-RyValue file_write_raw(int argCount, RyValue* args, std::unordered_map<std::string, RyValue>& globals) {
-    if (argCount < 2 || !args[0].isString() || !args[1].isString()) return RyValue(false);
+static RyStatus file_write(RyContext *ctx, int argc, const RyHandle *args, RyHandle *result) {
+    return writeFile(ctx, args, result, "wb");
+}
+
+// Native function: append(path, data)
+static RyStatus file_append(RyContext *ctx, int argc, const RyHandle *args, RyHandle *result) {
+    return writeFile(ctx, args, result, "ab");
+}
+
+#ifndef _WIN32
+// Open files are plain descriptors. The ones read with chunk() or lines() get a buffer here, which is reused
+// for the whole file, so reading stays within it no matter how big the file is.
+struct Reader {
+    std::vector<char> buffer = std::vector<char>(64 * 1024);
+    size_t start = 0, end = 0;
+    bool atEnd = false;
+
+    // Reads more after what is buffered, making room first. False at the end of the file.
+    bool fill(int fd) {
+        if (atEnd) return false;
+        if (start > 0) {
+            std::memmove(buffer.data(), buffer.data() + start, end - start);
+            end -= start;
+            start = 0;
+        }
+        if (end == buffer.size()) buffer.resize(buffer.size() * 2); // A line longer than the buffer
+        ssize_t got;
+        do {
+            got = ::read(fd, buffer.data() + end, buffer.size() - end);
+        } while (got < 0 && errno == EINTR);
+        if (got <= 0) {
+            atEnd = true;
+            return false;
+        }
+        end += got;
+        return true;
+    }
+};
 
-    std::ofstream file(args[0].to_string());
-    if (!file.is_open()) return RyValue(false);
+static std::mutex readersLock;
+static std::unordered_map<int, std::shared_ptr<Reader>> readers;
+
+static std::shared_ptr<Reader> readerFor(int fd) {
+    std::lock_guard<std::mutex> guard(readersLock);
+    auto &reader = readers[fd];
+    if (!reader) reader = std::make_shared<Reader>();
+    return reader;
+}
 
-    file << args[1].to_string();
-    return RyValue(true);
+static void forget(int fd) {
+    std::lock_guard<std::mutex> guard(readersLock);
+    readers.erase(fd);
 }
 
+static bool descriptor(RyHandle value, int *fd) {
+    double number;
+    if (!ry->get_number(value, &number) || number < 0) return false;
+    *fd = (int) number;
+    return true;
+}
+
+// Native function: open(path, mode?) - a descriptor, or null. Modes: "r" (default), "w", "a", "r+"
+static RyStatus file_open(RyContext *ctx, int argc, const RyHandle *args, RyHandle *result) {
+    char path[4096];
+    if (argc < 1 || !pathOf(args[0], path, sizeof(path))) return ry->error(ctx, "open() expects a path.");
+
+    RyStringView mode = {"r", 1};
+    if (argc > 1 && !ry->get_string(args[1], &mode)) return ry->error(ctx, "open() expects a mode like \"r\".");
+    std::string text(mode.data, mode.length);
+    int flags;
+    if (text == "r") flags = O_RDONLY;
+    else if (text == "w") flags = O_WRONLY | O_CREAT | O_TRUNC;
+    else if (text == "a") flags = O_WRONLY | O_CREAT | O_APPEND;
+    else if (text == "r+") flags = O_RDWR;
+    else return ry->error(ctx, "open(): the mode must be \"r\", \"w\", \"a\" or \"r+\".");
+
+    int fd = ::open(path, flags | O_CLOEXEC, 0644);
+    if (fd >= 0) *result = ry->make_number(ctx, fd);
+    return RY_OK;
+}
+
+// Native function: close(fd)
+static RyStatus file_close(RyContext *ctx, int argc, const RyHandle *args, RyHandle *result) {
+    int fd;
+    if (!descriptor(args[0], &fd)) return ry->error(ctx, "close() expects a descriptor.");
+    forget(fd);
+    ::close(fd);
+    return RY_OK;
+}
+
+// Native function: chunk(fd, max?) - up to `max` bytes (64 KiB by default), null at the end of the file
+static RyStatus file_chunk(RyContext *ctx, int argc, const RyHandle *args, RyHandle *result) {
+    int fd;
+    double max = 64 * 1024;
+    if (argc < 1 || !descriptor(args[0], &fd)) return ry->error(ctx, "chunk() expects a descriptor.");
+    if (argc > 1 && (!ry->get_number(args[1], &max) || max < 1)) return ry->error(ctx, "chunk() expects a size.");
+
+    auto reader = readerFor(fd);
+    if (reader->start == reader->end && !reader->fill(fd)) return RY_OK;
+    size_t size = std::min((size_t) max, reader->end - reader->start);
+    *result = ry->make_string(ctx, reader->buffer.data() + reader->start, size);
+    reader->start += size;
+    return RY_OK;
+}
+
+// Native function: put(fd, data) - writes all of it
+static RyStatus file_put(RyContext *ctx, int argc, const RyHandle *args, RyHandle *result) {
+    int fd;
+    RyStringView data;
+    if (!descriptor(args[0], &fd) || !dataOf(args[1], &data))
+        return ry->error(ctx, "put() expects a descriptor and a string or bytes.");
+
+    for (size_t done = 0; done < data.length;) {
+        ssize_t wrote = ::write(fd, data.data + done, data.length - done);
+        if (wrote < 0 && errno == EINTR) continue;
+        if (wrote < 0) return failure(ctx, "put()");
+        done += wrote;
+    }
+    *result = ry->make_number(ctx, (double) data.length);
+    return RY_OK;
+}
+
+// Native function: chunk_into(fd, bytes) - fills the bytes (reused between calls) as far as it can in one
+// read, returns how many it got, or null at the end of the file
+static RyStatus file_chunk_into(RyContext *ctx, int argc, const RyHandle *args, RyHandle *result) {
+    int fd;
+    RyBytesView target;
+    if (!descriptor(args[0], &fd) || !ry->get_bytes(args[1], &target) || !target.data)
+        return ry->error(ctx, "chunk_into() expects a descriptor and mutable bytes.");
+
+    auto reader = readerFor(fd);
+    size_t got;
+    if (reader->start < reader->end) {
+        // Whatever lines() or chunk() buffered comes first
+        got = std::min(target.length, reader->end - reader->start);
+        std::memcpy(target.data, reader->buffer.data() + reader->start, got);
+        reader->start += got;
+    } else {
+        ssize_t count;
+        do {
+            count = ::read(fd, target.data, target.length);
+        } while (count < 0 && errno == EINTR);
+        if (count < 0) return failure(ctx, "chunk_into()");
+        if (count == 0 && target.length > 0) return RY_OK;
+        got = count;
+    }
+    *result = ry->make_number(ctx, (double) got);
+    return RY_OK;
+}
+
+struct Lines {
+    int fd;
+    bool owned; // Opened by lines() itself, closed at the end
+};
+
+static void closeLines(void *data) {
+    auto lines = static_cast<Lines *>(data);
+    if (lines->owned && lines->fd >= 0) {
+        forget(lines->fd);
+        ::close(lines->fd);
+    }
+    delete lines;
+}
+
+static RyStatus next_line(RyContext *ctx, int argc, const RyHandle *args, RyHandle *result) {
+    auto lines = static_cast<Lines *>(ry->function_data(ctx));
+    if (lines->fd < 0) return RY_OK;
+
+    auto reader = readerFor(lines->fd);
+    size_t scanned = reader->start;
+    for (;;) {
+        const char *buffer = reader->buffer.data();
+        auto newline = (const char *) std::memchr(buffer + scanned, '\n', reader->end - scanned);
+        if (newline) {
+            size_t length = newline - (buffer + reader->start);
+            size_t next = reader->start + length + 1;
+            if (length > 0 && newline[-1] == '\r') length--;
+            *result = ry->make_string(ctx, buffer + reader->start, length);
+            reader->start = next;
+            return RY_OK;
+        }
+        scanned = reader->end - reader->start; // Relative, fill() moves the data to the front
+        if (!reader->fill(lines->fd)) break;
+    }
+
+    // The last line may have no newline
+    if (reader->end > reader->start) {
+        *result = ry->make_string(ctx, reader->buffer.data() + reader->start, reader->end - reader->start);
+        reader->start = reader->end;
+        return RY_OK;
+    }
+    if (lines->owned) {
+        forget(lines->fd);
+        ::close(lines->fd);
+    }
+    lines->fd = -1;
+    return RY_OK;
+}
+
+// Native function: lines(path or fd) - an iterator for foreach, one line at a time without its newline
+static RyStatus file_lines(RyContext *ctx, int argc, const RyHandle *args, RyHandle *result) {
+    char path[4096];
+    int fd;
+    bool owned = false;
+    if (pathOf(args[0], path, sizeof(path))) {
+        fd = ::open(path, O_RDONLY | O_CLOEXEC);
+        if (fd < 0) return failure(ctx, "lines()");
+        owned = true;
+    } else if (!descriptor(args[0], &fd)) {
+        return ry->error(ctx, "lines() expects a path or a descriptor.");
+    }
+    *result = ry->make_iterator(ctx, "lines", next_line, new Lines{fd, owned}, closeLines);
+    return RY_OK;
+}
+
+// Memory mapped files, read only, by number. Only the pages that get read are loaded.
+struct View {
+    const char *data;
+    size_t size;
+};
+
+static std::mutex viewsLock;
+static std::unordered_map<int, View> views;
+static int nextView = 1;
+
+static bool viewOf(RyHandle value, View *view) {
+    double number;
+    if (!ry->get_number(value, &number)) return false;
+    std::lock_guard<std::mutex> guard(viewsLock);
+    auto found = views.find((int) number);
+    if (found == views.end()) return false;
+    *view = found->second;
+    return true;
+}
+
+// Native function: map(path) - a view number for size(), slice() and find()
+static RyStatus file_map(RyContext *ctx, int argc, const RyHandle *args, RyHandle *result) {
+    char path[4096];
+    if (!pathOf(args[0], path, sizeof(path))) return ry->error(ctx, "map() expects a path.");
+    int fd = ::open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return failure(ctx, "map()");
+
+    struct stat info;
+    View view = {nullptr, 0};
+    if (fstat(fd, &info) == 0 && info.st_size > 0) {
+        void *data = mmap(nullptr, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (data == MAP_FAILED) {
+            ::close(fd);
+            return failure(ctx, "map()");
+        }
+        madvise(data, info.st_size, MADV_SEQUENTIAL);
+        view = {(const char *) data, (size_t) info.st_size};
+    }
+    ::close(fd); // The mapping keeps the file
+
+    std::lock_guard<std::mutex> guard(viewsLock);
+    int id = nextView++;
+    views[id] = view;
+    *result = ry->make_number(ctx, id);
+    return RY_OK;
+}
+
+struct Mapping {
+    void *data;
+    size_t size;
+};
+
+static void unmapBytes(void *data) {
+    auto mapping = static_cast<Mapping *>(data);
+    munmap(mapping->data, mapping->size);
+    delete mapping;
+}
+
+// Native function: map_bytes(path) - the file as read-only bytes backed by the mapping, unmapped when the
+// bytes (and every slice of them) are gone
+static RyStatus file_map_bytes(RyContext *ctx, int argc, const RyHandle *args, RyHandle *result) {
+    char path[4096];
+    if (!pathOf(args[0], path, sizeof(path))) return ry->error(ctx, "map_bytes() expects a path.");
+    int fd = ::open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return failure(ctx, "map_bytes()");
+
+    struct stat info;
+    if (fstat(fd, &info) != 0 || info.st_size == 0) {
+        ::close(fd);
+        ry->make_bytes(ctx, 0, result);
+        return RY_OK;
+    }
+    void *data = mmap(nullptr, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd);
+    if (data == MAP_FAILED) return failure(ctx, "map_bytes()");
+    *result = ry->make_bytes_external(ctx, data, info.st_size, new Mapping{data, (size_t) info.st_size}, unmapBytes);
+    return RY_OK;
+}
+
+// Native function: unmap(view)
+static RyStatus file_unmap(RyContext *ctx, int argc, const RyHandle *args, RyHandle *result) {
+    double number;
+    if (!ry->get_number(args[0], &number)) return ry->error(ctx, "unmap() expects a view.");
+    std::lock_guard<std::mutex> guard(viewsLock);
+    auto found = views.find((int) number);
+    if (found != views.end()) {
+        if (found->second.data) munmap((void *) found->second.data, found->second.size);
+        views.erase(found);
+    }
+    return RY_OK;
+}
+
+// Native function: size(view)
+static RyStatus file_size(RyContext *ctx, int argc, const RyHandle *args, RyHandle *result) {
+    View view;
+    if (!viewOf(args[0], &view)) return ry->error(ctx, "size() expects a view from map().");
+    *result = ry->make_number(ctx, (double) view.size);
+    return RY_OK;
+}
+
+// Native function: slice(view, offset, length) - the bytes as a string, clamped to the file
+static RyStatus file_slice(RyContext *ctx, int argc, const RyHandle *args, RyHandle *result) {
+    View view;
+    double offset, length;
+    if (!viewOf(args[0], &view) || !ry->get_number(args[1], &offset) || !ry->get_number(args[2], &length))
+        return ry->error(ctx, "slice() expects a view, an offset and a length.");
+    size_t from = offset < 0 ? 0 : std::min((size_t) offset, view.size);
+    size_t count = length < 0 ? 0 : std::min((size_t) length, view.size - from);
+    *result = ry->make_string(ctx, view.data + from, count);
+    return RY_OK;
+}
+
+// Native function: find(view, text, from?) - the offset of the next match, or -1
+static RyStatus file_find(RyContext *ctx, int argc, const RyHandle *args, RyHandle *result) {
+    View view;
+    RyStringView needle;
+    double from = 0;
+    if (argc < 2 || !viewOf(args[0], &view) || !ry->get_string(args[1], &needle) ||
+        (argc > 2 && !ry->get_number(args[2], &from)))
+        return ry->error(ctx, "find() expects a view, a string and an optional offset.");
+
+    size_t start = from < 0 ? 0 : std::min((size_t) from, view.size);
+    const void *found = needle.length == 0 ? view.data + start
+                        : memmem(view.data + start, view.size - start, needle.data, needle.length);
+    *result = ry->make_number(ctx, found ? (double) ((const char *) found - view.data) : -1);
+    return RY_OK;
+}
+
+#ifdef __linux__
+// What copy_file_range and sendfile fail with when they can't copy between these two files, not on an I/O error
+static bool unsupported(int error) {
+    return error == EXDEV || error == EINVAL || error == ENOSYS || error == EOPNOTSUPP;
+}
+#endif
+
+static bool writeAll(int fd, const char *data, size_t size) {
+    while (size > 0) {
+        ssize_t wrote = ::write(fd, data, size);
+        if (wrote < 0 && errno == EINTR) continue;
+        if (wrote <= 0) return false;
+        data += wrote;
+        size -= wrote;
+    }
+    return true;
+}
+
+// Native function: copy(from, to) - the number of bytes copied. The kernel moves the data when it can.
+static RyStatus file_copy(RyContext *ctx, int argc, const RyHandle *args, RyHandle *result) {
+    char from[4096], to[4096];
+    if (!pathOf(args[0], from, sizeof(from)) || !pathOf(args[1], to, sizeof(to)))
+        return ry->error(ctx, "copy() expects two paths.");
+    int in = ::open(from, O_RDONLY | O_CLOEXEC);
+    if (in < 0) return failure(ctx, "copy()");
+    struct stat info;
+    fstat(in, &info);
+    int out = ::open(to, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, info.st_mode & 0777);
+    if (out < 0) {
+        int saved = errno;
+        ::close(in);
+        errno = saved;
+        return failure(ctx, "copy()");
+    }
+
+    // Each way carries on from where the one before stopped, both descriptors' offsets move with the data
+    size_t size = (size_t) info.st_size, copied = 0;
+    ssize_t moved = 0;
+#ifdef __linux__
+    // In-kernel copies (reflinks on filesystems that have them), then sendfile. Both can refuse a pair of files
+    // (across filesystems on older kernels, special files...) or stop early: files in /proc report a size of 0
+    // and copy_file_range copies nothing from them.
+    while ((moved = copy_file_range(in, nullptr, out, nullptr, 1 << 30, 0)) > 0) copied += moved;
+    if (moved < 0 && unsupported(errno)) moved = 0;
+    if (moved == 0 && (copied == 0 || copied < size)) {
+        while ((moved = sendfile(out, in, nullptr, 1 << 30)) > 0) copied += moved;
+        if (moved < 0 && unsupported(errno)) moved = 0;
+    }
+#endif
+    if (moved == 0 && (copied == 0 || copied < size)) {
+        std::vector<char> buffer(64 * 1024);
+        while ((moved = ::read(in, buffer.data(), buffer.size())) != 0) {
+            if (moved < 0 && errno == EINTR) continue;
+            if (moved < 0 || !writeAll(out, buffer.data(), moved)) {
+                moved = -1;
+                break;
+            }
+            copied += moved;
+        }
+    }
+    int saved = errno;
+    ::close(in);
+    ::close(out);
+    errno = saved;
+    if (moved < 0) return failure(ctx, "copy()");
+    *result = ry->make_number(ctx, (double) copied);
+    return RY_OK;
+}
+#endif
+
 // The Entry Point
-extern "C" void init_ry_module(RegisterFn register_fn, void *target) {
+RY_MODULE_INIT(api, module) {
+    ry = api;
     // Register "read" and "write" functions
-    register_fn("read", file_read_raw, 1, target);
-    register_fn("write", file_write_raw, 2, target);
-}
\ No newline at end of file
+    ry->define(module, "read", file_read, 1);
+    ry->define(module, "write", file_write, 2);
+    ry->define(module, "append", file_append, 2);
+    ry->define(module, "read_bytes", file_read_bytes, 1);
+#ifndef _WIN32
+    // Descriptors and streaming
+    ry->define(module, "open", file_open, -1);
+    ry->define(module, "close", file_close, 1);
+    ry->define(module, "chunk", file_chunk, -1);
+    ry->define(module, "chunk_into", file_chunk_into, 2);
+    ry->define(module, "put", file_put, 2);
+    ry->define(module, "lines", file_lines, 1);
+    // Memory mapped views
+    ry->define(module, "map", file_map, 1);
+    ry->define(module, "unmap", file_unmap, 1);
+    ry->define(module, "map_bytes", file_map_bytes, 1);
+    ry->define(module, "size", file_size, 1);
+    ry->define(module, "slice", file_slice, 3);
+    ry->define(module, "find", file_find, -1);
+    ry->define(module, "copy", file_copy, 2);
+#endif
+    return RY_OK;
+}
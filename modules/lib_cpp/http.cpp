@@ -0,0 +1,629 @@
+#include <algorithm>
+#include <arpa/inet.h>
+#include <cctype>
+#include <cerrno>
+#include <cstring>
+#include <ctime>
+#include <exception>
+#include <fcntl.h>
+#include <iostream>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <string>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <unordered_map>
+#include <vector>
+#include "rylib-dk.h"
+
+static const RyApi *ry;
+
+namespace {
+	const size_t MAX_HEADER = 64 * 1024;
+	const size_t MAX_BODY = 16 * 1024 * 1024;
+
+	struct Request {
+		std::string method, target, version, body;
+		std::vector<std::pair<std::string, std::string>> headers; // Names are lowercase
+		bool keepAlive = true;
+	};
+
+	enum class Parse { Incomplete, Done, Bad };
+
+	std::string lower(std::string text) {
+		for (auto &c: text)
+			c = (char) std::tolower((unsigned char) c);
+		return text;
+	}
+
+	std::string trim(const std::string &text) {
+		size_t first = text.find_first_not_of(" \t");
+		if (first == std::string::npos)
+			return "";
+		return text.substr(first, text.find_last_not_of(" \t") - first + 1);
+	}
+
+	// Decodes a chunked body starting at `at`. Moves `at` past the last chunk and its trailers.
+	Parse parseChunked(const std::string &buffer, size_t &at, std::string &body, int &status) {
+		for (;;) {
+			size_t lineEnd = buffer.find("\r\n", at);
+			if (lineEnd == std::string::npos)
+				return Parse::Incomplete;
+
+			std::string sizeText = buffer.substr(at, buffer.find_first_of(";\r", at) - at);
+			char *end = nullptr;
+			unsigned long long size = std::strtoull(sizeText.c_str(), &end, 16);
+			if (sizeText.empty() || *end != '\0' || !std::isxdigit((unsigned char) sizeText[0]))
+				return status = 400, Parse::Bad;
+			if (body.size() + size > MAX_BODY)
+				return status = 413, Parse::Bad;
+
+			size_t data = lineEnd + 2;
+			if (size == 0) {
+				// Trailers end with an empty line, we skip them
+				size_t trailerEnd = buffer.compare(data, 2, "\r\n") == 0 ? data : buffer.find("\r\n\r\n", data);
+				if (trailerEnd == std::string::npos)
+					return Parse::Incomplete;
+				at = trailerEnd + (trailerEnd == data ? 2 : 4);
+				return Parse::Done;
+			}
+
+			if (buffer.size() < data + size + 2)
+				return Parse::Incomplete;
+			if (buffer.compare(data + size, 2, "\r\n") != 0)
+				return status = 400, Parse::Bad;
+			body.append(buffer, data, size);
+			at = data + size + 2;
+		}
+	}
+
+	// Parses the request at `offset` and moves `offset` past it once it is complete
+	Parse parseRequest(const std::string &buffer, size_t &offset, Request &request, int &status) {
+		size_t headerEnd = buffer.find("\r\n\r\n", offset);
+		if (headerEnd == std::string::npos) {
+			if (buffer.size() - offset > MAX_HEADER)
+				return status = 431, Parse::Bad;
+			return Parse::Incomplete;
+		}
+
+		// Request line: METHOD SP target SP HTTP/x.y
+		size_t lineEnd = buffer.find("\r\n", offset);
+		std::string line = buffer.substr(offset, lineEnd - offset);
+		size_t firstSpace = line.find(' ');
+		size_t lastSpace = line.rfind(' ');
+		if (firstSpace == std::string::npos || firstSpace == lastSpace)
+			return status = 400, Parse::Bad;
+		request = Request();
+		request.method = line.substr(0, firstSpace);
+		request.target = line.substr(firstSpace + 1, lastSpace - firstSpace - 1);
+		request.version = line.substr(lastSpace + 1);
+		if (request.version != "HTTP/1.1" && request.version != "HTTP/1.0")
+			return status = 505, Parse::Bad;
+
+		bool chunked = false;
+		long long contentLength = -1;
+		std::string connection;
+		for (size_t at = lineEnd + 2; at < headerEnd;) {
+			size_t end = buffer.find("\r\n", at);
+			std::string header = buffer.substr(at, end - at);
+			at = end + 2;
+
+			size_t colon = header.find(':');
+			if (colon == std::string::npos || colon == 0 || header[0] == ' ' || header[0] == '\t')
+				return status = 400, Parse::Bad; // Also rejects obsolete line folding
+
+			std::string name = lower(header.substr(0, colon));
+			std::string value = trim(header.substr(colon + 1));
+			if (name == "content-length") {
+				char *end = nullptr;
+				long long length = std::strtoll(value.c_str(), &end, 10);
+				if (value.empty() || *end != '\0' || length < 0 || (contentLength >= 0 && length != contentLength))
+					return status = 400, Parse::Bad;
+				contentLength = length;
+			} else if (name == "transfer-encoding") {
+				chunked = lower(value).find("chunked") != std::string::npos;
+			} else if (name == "connection") {
+				connection = lower(value);
+			}
+			request.headers.emplace_back(std::move(name), std::move(value));
+		}
+
+		// Both length headers at once is how requests get smuggled past proxies
+		if (chunked && contentLength >= 0)
+			return status = 400, Parse::Bad;
+		if (contentLength > (long long) MAX_BODY)
+			return status = 413, Parse::Bad;
+
+		size_t next = headerEnd + 4;
+		if (chunked) {
+			Parse result = parseChunked(buffer, next, request.body, status);
+			if (result != Parse::Done)
+				return result;
+		} else if (contentLength > 0) {
+			if (buffer.size() < next + contentLength)
+				return Parse::Incomplete;
+			request.body = buffer.substr(next, contentLength);
+			next += contentLength;
+		}
+
+		if (request.version == "HTTP/1.1")
+			request.keepAlive = connection.find("close") == std::string::npos;
+		else
+			request.keepAlive = connection.find("keep-alive") != std::string::npos;
+		offset = next;
+		return Parse::Done;
+	}
+
+	const char *reason(int status) {
+		switch (status) {
+			case 200: return "OK";
+			case 201: return "Created";
+			case 204: return "No Content";
+			case 301: return "Moved Permanently";
+			case 302: return "Found";
+			case 304: return "Not Modified";
+			case 400: return "Bad Request";
+			case 401: return "Unauthorized";
+			case 403: return "Forbidden";
+			case 404: return "Not Found";
+			case 405: return "Method Not Allowed";
+			case 413: return "Content Too Large";
+			case 431: return "Request Header Fields Too Large";
+			case 500: return "Internal Server Error";
+			case 505: return "HTTP Version Not Supported";
+			default: return "Unknown";
+		}
+	}
+
+	// The Date header only changes once a second
+	const std::string &httpDate() {
+		static thread_local time_t last = 0;
+		static thread_local std::string cached;
+		time_t now = time(nullptr);
+		if (now != last) {
+			char text[64];
+			tm parts;
+			gmtime_r(&now, &parts);
+			strftime(text, sizeof(text), "%a, %d %b %Y %H:%M:%S GMT", &parts);
+			cached = text;
+			last = now;
+		}
+		return cached;
+	}
+
+	struct Response {
+		int status = 200;
+		std::string body;
+		std::vector<std::pair<std::string, std::string>> headers;
+		bool hasContentType = false;
+	};
+
+	void writeResponse(std::string &out, const Response &response, bool keepAlive, bool head) {
+		out += "HTTP/1.1 " + std::to_string(response.status) + " " + reason(response.status) + "\r\n";
+		out += "Date: " + httpDate() + "\r\n";
+		if (!response.hasContentType)
+			out += "Content-Type: text/plain; charset=utf-8\r\n";
+		for (auto const &[name, value]: response.headers) {
+			out += name + ": " + value + "\r\n";
+		}
+		out += "Content-Length: " + std::to_string(response.body.size()) + "\r\n";
+		if (!keepAlive)
+			out += "Connection: close\r\n";
+		out += "\r\n";
+		if (!head)
+			out += response.body;
+	}
+
+	Response errorResponse(int status) {
+		Response response;
+		response.status = status;
+		response.body = std::string(reason(status)) + "\n";
+		return response;
+	}
+
+	RyHandle makeString(RyContext *ctx, const std::string &text) {
+		return ry->make_string(ctx, text.data(), text.size());
+	}
+
+	std::string text(RyContext *ctx, RyHandle value) {
+		RyStringView view;
+		if (!ry->get_string(value, &view))
+			ry->get_string(ry->to_string(ctx, value), &view);
+		return std::string(view.data, view.length);
+	}
+
+	// The map the handler gets, built bottom up from its keys and values
+	RyHandle requestValue(RyContext *ctx, const Request &request) {
+		size_t question = request.target.find('?');
+		makeString(ctx, "method");
+		makeString(ctx, request.method);
+		makeString(ctx, "path");
+		makeString(ctx, request.target.substr(0, question));
+		makeString(ctx, "query");
+		makeString(ctx, question == std::string::npos ? "" : request.target.substr(question + 1));
+		makeString(ctx, "version");
+		makeString(ctx, request.version);
+		makeString(ctx, "headers");
+		RyHandle headers = ry->make_map(ctx);
+		for (auto const &[name, value]: request.headers) {
+			RyHandle key = makeString(ctx, name);
+			RyHandle existing = ry->map_get(headers, key);
+			RyHandle joined = existing ? makeString(ctx, text(ctx, existing) + ", " + value) : makeString(ctx, value);
+			ry->map_set_move(ctx, headers, key, joined); // Both are moved in, the map is the last value again
+		}
+		makeString(ctx, "body");
+		makeString(ctx, request.body);
+		return ry->make_map_of_last(ctx, 6);
+	}
+
+	struct HeaderWriter {
+		RyContext *ctx;
+		Response *response;
+	};
+
+	RyStatus addHeader(void *data, RyHandle name, RyHandle value) {
+		auto writer = static_cast<HeaderWriter *>(data);
+		std::string key = text(writer->ctx, name);
+		std::string lowered = lower(key);
+		if (lowered == "content-length" || lowered == "connection" || lowered == "date")
+			return RY_OK; // The server owns these
+		writer->response->hasContentType |= lowered == "content-type";
+		writer->response->headers.emplace_back(key, text(writer->ctx, value));
+		return RY_OK;
+	}
+
+	// A string is the body of a 200, a map can set "status", "headers" and "body", null is a 404
+	Response toResponse(RyContext *ctx, RyHandle result) {
+		Response response;
+		RyKind kind = ry->kind(result);
+		if (kind == RY_KIND_NULL)
+			return errorResponse(404);
+		if (kind != RY_KIND_MAP) {
+			response.body = text(ctx, result);
+			return response;
+		}
+
+		double status;
+		RyHandle found = ry->map_get(result, makeString(ctx, "status"));
+		if (found && ry->get_number(found, &status))
+			response.status = (int) status;
+		if ((found = ry->map_get(result, makeString(ctx, "body"))))
+			response.body = text(ctx, found);
+		if ((found = ry->map_get(result, makeString(ctx, "headers")))) {
+			HeaderWriter writer{ctx, &response};
+			ry->map_each(found, addHeader, &writer);
+		}
+		return response;
+	}
+
+	struct Connection {
+		std::string in;
+		size_t parsed = 0; // Start of the next request in `in`
+		std::string out;
+		size_t sent = 0;
+		bool closing = false; // Close once `out` is flushed
+		bool writing = false; // Watching EPOLLOUT
+	};
+
+	class Server {
+	public:
+		Server(RyContext *ctx, int listener, RyHandle handler, long long limit, int drain = -1) :
+				ctx(ctx), listener(listener), handler(handler), limit(limit), drain(drain) {}
+
+		long long run() {
+			epollFd = epoll_create1(EPOLL_CLOEXEC);
+			watch(listener, EPOLLIN, EPOLL_CTL_ADD);
+			if (drain >= 0)
+				watch(drain, EPOLLIN, EPOLL_CTL_ADD);
+
+			epoll_event events[256];
+			while (listener >= 0 || !connections.empty()) {
+				int count = epoll_wait(epollFd, events, 256, -1);
+				if (count < 0 && errno != EINTR)
+					break;
+				for (int i = 0; i < count; i++) {
+					int fd = events[i].data.fd;
+					if (fd == listener)
+						acceptAll();
+					else if (fd == drain)
+						stopAccepting();
+					else if (connections.count(fd))
+						service(fd, events[i].events);
+				}
+				if (listener < 0)
+					closeIdle();
+			}
+
+			close(epollFd);
+			return served;
+		}
+
+	private:
+		// Once the listener is closed, connections still coming in are refused by the kernel
+		void stopAccepting() {
+			if (listener >= 0) {
+				epoll_ctl(epollFd, EPOLL_CTL_DEL, listener, nullptr);
+				close(listener);
+				listener = -1;
+			}
+			if (drain >= 0) {
+				epoll_ctl(epollFd, EPOLL_CTL_DEL, drain, nullptr);
+				close(drain);
+				drain = -1;
+			}
+		}
+
+		// Once the listener is closed, connections with nothing left to send are done. Requests that already came
+		// in on them are answered first (or turned away, past the request limit).
+		void closeIdle() {
+			std::vector<int> idle;
+			for (auto const &[fd, connection]: connections) {
+				if (connection.out.empty())
+					idle.push_back(fd);
+			}
+			for (int fd: idle) {
+				service(fd, EPOLLIN); // May close it already
+				auto it = connections.find(fd);
+				if (it != connections.end() && it->second.out.empty()) {
+					close(fd);
+					connections.erase(it);
+				}
+			}
+		}
+
+		void watch(int fd, uint32_t events, int operation) {
+			epoll_event event{};
+			event.events = events;
+			event.data.fd = fd;
+			epoll_ctl(epollFd, operation, fd, &event);
+		}
+
+		void acceptAll() {
+			for (;;) {
+				int fd = accept4(listener, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+				if (fd < 0)
+					return; // EAGAIN, or a connection that died while queued
+				int yes = 1;
+				setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &yes, sizeof(yes));
+				connections.emplace(fd, Connection());
+				watch(fd, EPOLLIN | EPOLLRDHUP, EPOLL_CTL_ADD);
+			}
+		}
+
+		void service(int fd, uint32_t events) {
+			Connection &connection = connections[fd];
+			if (events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR)) {
+				char chunk[16384];
+				for (;;) {
+					ssize_t count = recv(fd, chunk, sizeof(chunk), 0);
+					if (count > 0) {
+						connection.in.append(chunk, count);
+						continue;
+					}
+					if (count == 0 || (errno != EAGAIN && errno != EWOULDBLOCK))
+						connection.closing = true; // Answer what we already have, then hang up
+					break;
+				}
+				handleRequests(connection);
+			}
+			flush(fd, connection);
+		}
+
+		// Answers every complete request in the buffer, in order (pipelining)
+		void handleRequests(Connection &connection) {
+			while (!connection.closing || connection.parsed < connection.in.size()) {
+				if (limit > 0 && served >= limit) {
+					connection.closing = true;
+					break;
+				}
+
+				Request parsed;
+				int status = 400;
+				Parse result = parseRequest(connection.in, connection.parsed, parsed, status);
+				if (result == Parse::Incomplete)
+					break;
+				if (result == Parse::Bad) {
+					writeResponse(connection.out, errorResponse(status), false, false);
+					connection.closing = true;
+					break;
+				}
+
+				// What the request makes is released once it is answered, serve() makes values as long as it runs
+				size_t scope = ry->scope_open(ctx);
+				RyHandle request = requestValue(ctx, parsed), returned;
+				Response response;
+				if (ry->call(ctx, handler, 1, &request, &returned) == RY_OK) {
+					response = toResponse(ctx, returned);
+				} else {
+					std::cerr << "Ry HTTP Error: " << text(ctx, returned) << std::endl;
+					response = errorResponse(500);
+				}
+				ry->scope_close(ctx, scope);
+				served++;
+
+				writeResponse(connection.out, response, parsed.keepAlive, parsed.method == "HEAD");
+				if (!parsed.keepAlive) {
+					connection.closing = true;
+					break;
+				}
+			}
+
+			// Drop what was parsed so the buffer doesn't grow with the connection's age
+			connection.in.erase(0, connection.parsed);
+			connection.parsed = 0;
+
+			if (limit > 0 && served >= limit)
+				stopAccepting();
+		}
+
+		void flush(int fd, Connection &connection) {
+			while (connection.sent < connection.out.size()) {
+				ssize_t count = send(fd, connection.out.data() + connection.sent, connection.out.size() - connection.sent,
+														 MSG_NOSIGNAL);
+				if (count < 0) {
+					if (errno == EAGAIN || errno == EWOULDBLOCK) {
+						if (!connection.writing)
+							watch(fd, EPOLLIN | EPOLLRDHUP | EPOLLOUT, EPOLL_CTL_MOD);
+						connection.writing = true;
+						return;
+					}
+					connection.out.clear(); // The peer is gone
+					connection.closing = true;
+					break;
+				}
+				connection.sent += count;
+			}
+
+			connection.out.clear();
+			connection.sent = 0;
+			if (connection.writing) {
+				watch(fd, EPOLLIN | EPOLLRDHUP, EPOLL_CTL_MOD);
+				connection.writing = false;
+			}
+			if (connection.closing) {
+				close(fd);
+				connections.erase(fd);
+			}
+		}
+
+		RyContext *ctx;
+		int listener;
+		RyHandle handler;
+		long long limit; // Requests to serve before stopping, 0 runs forever
+		int drain; // A worker's end of the pipe to the process that started it, closed when it is time to stop
+		long long served = 0;
+		int epollFd = -1;
+		std::unordered_map<int, Connection> connections;
+	};
+
+	int openListener(const std::string &host, int port) {
+		addrinfo hints{};
+		hints.ai_family = AF_UNSPEC;
+		hints.ai_socktype = SOCK_STREAM;
+		hints.ai_flags = AI_PASSIVE | AI_NUMERICSERV;
+		addrinfo *found = nullptr;
+		std::string service = std::to_string(port);
+		if (getaddrinfo(host.empty() ? nullptr : host.c_str(), service.c_str(), &hints, &found) != 0)
+			return -1;
+
+		int fd = socket(found->ai_family, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+		if (fd < 0) {
+			freeaddrinfo(found);
+			return -1;
+		}
+		int yes = 1;
+		setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &yes, sizeof(yes));
+		// Every worker process binds its own socket to the port, the kernel spreads connections between them
+		setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &yes, sizeof(yes));
+		bool ok = bind(fd, found->ai_addr, found->ai_addrlen) == 0 && listen(fd, SOMAXCONN) == 0;
+		freeaddrinfo(found);
+		if (!ok) {
+			int error = errno; // For the caller's message
+			close(fd);
+			errno = error;
+			return -1;
+		}
+		return fd;
+	}
+
+	int boundPort(int fd) {
+		sockaddr_storage address{};
+		socklen_t length = sizeof(address);
+		getsockname(fd, (sockaddr *) &address, &length);
+		if (address.ss_family == AF_INET6)
+			return ntohs(((sockaddr_in6 *) &address)->sin6_port);
+		return ntohs(((sockaddr_in *) &address)->sin_port);
+	}
+
+	double option(RyContext *ctx, int argc, const RyHandle *args, const char *name, double fallback) {
+		double number;
+		RyHandle found = argc > 3 ? ry->map_get(args[3], makeString(ctx, name)) : nullptr;
+		return found && ry->get_number(found, &number) ? number : fallback;
+	}
+} // namespace
+
+// Native function: serve(host, port, handler, options?)
+// Options: "workers" (processes sharing the port, default 1), "requests" (stop after that many per worker).
+// Once the first process stops, the other workers finish the requests they have and stop as well.
+static RyStatus http_serve(RyContext *ctx, int argc, const RyHandle *args, RyHandle *result) {
+	RyStringView hostView;
+	double portNumber;
+	if (argc < 3 || !ry->get_string(args[0], &hostView) || !ry->get_number(args[1], &portNumber))
+		return ry->error(ctx, "serve() expects a host, a port and a handler.");
+	try {
+		int workers = std::max(1, (int) option(ctx, argc, args, "workers", 1));
+		long long limit = (long long) option(ctx, argc, args, "requests", 0);
+		std::string host(hostView.data, hostView.length);
+
+		int listener = openListener(host, (int) portNumber);
+		if (listener < 0) {
+			std::string message = "serve() cannot listen on " + host + ":" + std::to_string((int) portNumber) + ": " +
+														std::strerror(errno);
+			return ry->error(ctx, message.c_str());
+		}
+		int port = boundPort(listener);
+
+		// Workers drain when the write end closes: when this process is done, and also if it dies
+		int drain[2] = {-1, -1};
+		if (workers > 1 && pipe2(drain, O_CLOEXEC) != 0) {
+			close(listener);
+			std::string message = std::string("serve(): ") + std::strerror(errno) + ".";
+			return ry->error(ctx, message.c_str());
+		}
+
+		std::cout.flush();
+		std::vector<pid_t> children;
+		for (int i = 1; i < workers; i++) {
+			pid_t child = fork();
+			if (child == 0) {
+				close(drain[1]);
+				close(listener);
+				int own = openListener(host, port);
+				if (own >= 0)
+					Server(ctx, own, args[2], limit, drain[0]).run();
+				std::cout.flush();
+				_exit(0);
+			}
+			if (child > 0)
+				children.push_back(child);
+		}
+		if (drain[0] >= 0)
+			close(drain[0]);
+
+		long long served = Server(ctx, listener, args[2], limit).run();
+		if (drain[1] >= 0)
+			close(drain[1]);
+		for (pid_t child: children) {
+			while (waitpid(child, nullptr, 0) < 0 && errno == EINTR) {
+			}
+		}
+		*result = ry->make_number(ctx, (double) served);
+		return RY_OK;
+	} catch (const std::exception &e) {
+		return ry->error(ctx, e.what());
+	}
+}
+
+// Native function: port(host) - a free port to pass to serve(), so callers know it up front
+static RyStatus http_port(RyContext *ctx, int argc, const RyHandle *args, RyHandle *result) {
+	RyStringView host;
+	bool named = argc > 0 && ry->get_string(args[0], &host);
+	int fd = openListener(named ? std::string(host.data, host.length) : "127.0.0.1", 0);
+	if (fd < 0)
+		return RY_OK;
+	int port = boundPort(fd);
+	close(fd);
+	*result = ry->make_number(ctx, port);
+	return RY_OK;
+}
+
+// The Entry Point
+RY_MODULE_INIT(api, module) {
+	ry = api;
+	ry->define(module, "serve", http_serve, -1);
+	ry->define(module, "port", http_port, -1);
+	return RY_OK;
+}
@@ -0,0 +1,760 @@
+#include <cerrno>
+#include <charconv>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <exception>
+#include <fcntl.h>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <unistd.h>
+#include <vector>
+#include "rylib-dk.h"
+#include "scan.h"
+
+static const RyApi *ry;
+
+// Parsing takes two passes, the way simdjson does it. Stage 1 reads the text 64 bytes at a time with vector
+// compares and turns it into bit masks, then into the positions of everything stage 2 must look at: { } [ ] : ,
+// the opening quote of each string and the first character of each number or literal. Whitespace and the
+// inside of strings are never looked at byte by byte. Stage 2 walks those positions and builds the lists and
+// maps straight away, there is no intermediate tree.
+
+namespace {
+	const size_t MAX_DEPTH = 1024;
+	const size_t CHUNK = 64 * 1024; // Reads for lines(), and how much write() buffers before it writes
+
+	// The characters after an odd run of backslashes, which are escaped. `carry` says whether the previous block
+	// ended in the middle of such a run.
+	uint64_t escapedBits(uint64_t backslash, uint64_t &carry) {
+		const uint64_t even = 0x5555555555555555ULL, odd = ~even;
+		uint64_t starts = backslash & ~(backslash << 1);
+		uint64_t evenStartMask = even ^ carry;
+		uint64_t evenStarts = starts & evenStartMask, oddStarts = starts & ~evenStartMask;
+		uint64_t evenCarries = backslash + evenStarts;
+		uint64_t oddCarries;
+		bool endsOdd = __builtin_add_overflow(backslash, oddStarts, &oddCarries);
+		oddCarries |= carry;
+		carry = endsOdd ? 1 : 0;
+		uint64_t evenCarryEnds = evenCarries & ~backslash, oddCarryEnds = oddCarries & ~backslash;
+		return (evenCarryEnds & odd) | (oddCarryEnds & even);
+	}
+
+	// Stage 1. Ends with `length` as a sentinel so stage 2 can always look one position ahead.
+	void indexStructure(const char *text, size_t length, std::vector<uint32_t> &positions) {
+		if (length >= UINT32_MAX)
+			throw std::runtime_error("parse(): documents are limited to 4 GB.");
+		positions.clear();
+		uint64_t escapeCarry = 0, inStringCarry = 0, scalarCarry = 0;
+		uint8_t tail[64];
+		for (size_t at = 0; at < length; at += 64) {
+			const uint8_t *in = (const uint8_t *) text + at;
+			if (length - at < 64) {
+				std::memset(tail, ' ', sizeof(tail));
+				std::memcpy(tail, in, length - at);
+				in = tail;
+			}
+			RyScan::Block block(in);
+			uint64_t quote = block.eq('"') & ~escapedBits(block.eq('\\'), escapeCarry);
+			uint64_t op = block.eqFolded('{') | block.eqFolded('}') | block.eq(',') | block.eq(':');
+			uint64_t space = block.eq(' ') | block.eq('\t') | block.eq('\n') | block.eq('\r');
+
+			uint64_t inString = RyScan::prefixXor(quote) ^ inStringCarry;
+			inStringCarry = (uint64_t) ((int64_t) inString >> 63);
+			uint64_t scalar = ~(op | space | quote | inString);
+			uint64_t scalarStart = scalar & ~(scalar << 1 | scalarCarry);
+			scalarCarry = scalar >> 63;
+			uint64_t structural = (op & ~inString) | (quote & inString) | scalarStart;
+
+			size_t base = positions.size();
+			positions.resize(base + __builtin_popcountll(structural));
+			uint32_t *out = positions.data() + base;
+			while (structural) {
+				*out++ = (uint32_t) (at + __builtin_ctzll(structural));
+				structural &= structural - 1;
+			}
+		}
+		if (inStringCarry)
+			throw std::runtime_error("parse(): unterminated string.");
+		positions.push_back((uint32_t) length);
+	}
+
+	bool isDelimiter(char c) {
+		switch (c) {
+			case ' ':
+			case '\t':
+			case '\n':
+			case '\r':
+			case ',':
+			case ':':
+			case '[':
+			case ']':
+			case '{':
+			case '}':
+				return true;
+			default:
+				return false;
+		}
+	}
+
+	void appendUtf8(std::string &out, uint32_t code) {
+		if (code < 0x80) {
+			out += (char) code;
+		} else if (code < 0x800) {
+			out += (char) (0xC0 | code >> 6);
+			out += (char) (0x80 | (code & 0x3F));
+		} else if (code < 0x10000) {
+			out += (char) (0xE0 | code >> 12);
+			out += (char) (0x80 | (code >> 6 & 0x3F));
+			out += (char) (0x80 | (code & 0x3F));
+		} else {
+			out += (char) (0xF0 | code >> 18);
+			out += (char) (0x80 | (code >> 12 & 0x3F));
+			out += (char) (0x80 | (code >> 6 & 0x3F));
+			out += (char) (0x80 | (code & 0x3F));
+		}
+	}
+
+	// Stage 2. The items of the lists and maps still open are the last values the call made, each list or map is
+	// made out of them once it is closed.
+	class Parser {
+	public:
+		Parser(RyContext *ctx, const char *text, size_t length, const std::vector<uint32_t> &positions,
+					 const std::string &context) :
+				ctx(ctx), text(text), length(length), positions(positions.data()), count(positions.size() - 1),
+				context(context) {}
+
+		RyHandle document() {
+			if (count == 0)
+				fail(length, "no value");
+			RyHandle result = value(0);
+			if (next < count)
+				fail(positions[next], "unexpected text after the value");
+			return result;
+		}
+
+	private:
+		RyContext *ctx;
+		const char *text;
+		size_t length;
+		const uint32_t *positions;
+		size_t count;
+		size_t next = 0;
+		const std::string &context;
+		std::string unescaped;
+
+		[[noreturn]] void fail(size_t offset, const std::string &message) {
+			size_t line = 1, column = 1;
+			for (size_t i = 0; i < offset && i < length; i++) {
+				if (text[i] == '\n') {
+					line++;
+					column = 1;
+				} else {
+					column++;
+				}
+			}
+			throw std::runtime_error(context + ": " + message + " at line " + std::to_string(line) + ", column " +
+															 std::to_string(column) + ".");
+		}
+
+		uint32_t take() {
+			if (next >= count)
+				fail(length, "unexpected end of input");
+			return positions[next++];
+		}
+
+		RyHandle value(size_t depth) {
+			uint32_t at = take();
+			switch (text[at]) {
+				case '{':
+					return object(at, depth + 1);
+				case '[':
+					return array(at, depth + 1);
+				case '"':
+					return string(at);
+				case 't':
+					literal(at, "true");
+					return ry->make_bool(ctx, 1);
+				case 'f':
+					literal(at, "false");
+					return ry->make_bool(ctx, 0);
+				case 'n':
+					literal(at, "null");
+					return ry->make_null(ctx);
+				default:
+					return ry->make_number(ctx, number(at));
+			}
+		}
+
+		RyHandle object(uint32_t open, size_t depth) {
+			if (depth > MAX_DEPTH)
+				fail(open, "nested deeper than " + std::to_string(MAX_DEPTH));
+			if (next < count && text[positions[next]] == '}') {
+				next++;
+				return ry->make_map(ctx);
+			}
+			size_t pairs = 0;
+			for (;;) {
+				uint32_t at = take();
+				if (text[at] != '"')
+					fail(at, "expected a string key");
+				string(at);
+				at = take();
+				if (text[at] != ':')
+					fail(at, "expected ':' after the key");
+				value(depth);
+				pairs++;
+				at = take();
+				if (text[at] == '}')
+					break;
+				if (text[at] != ',')
+					fail(at, "expected ',' or '}'");
+			}
+			return ry->make_map_of_last(ctx, pairs); // The last of duplicate keys wins
+		}
+
+		RyHandle array(uint32_t open, size_t depth) {
+			if (depth > MAX_DEPTH)
+				fail(open, "nested deeper than " + std::to_string(MAX_DEPTH));
+			if (next < count && text[positions[next]] == ']') {
+				next++;
+				return ry->make_list(ctx, 0);
+			}
+			size_t items = 0;
+			for (;;) {
+				value(depth);
+				items++;
+				uint32_t at = take();
+				if (text[at] == ']')
+					break;
+				if (text[at] != ',')
+					fail(at, "expected ',' or ']'");
+			}
+			return ry->make_list_of_last(ctx, items);
+		}
+
+		uint32_t hex4(size_t at) {
+			if (length - at < 4)
+				fail(at, "bad \\u escape");
+			uint32_t code = 0;
+			for (size_t i = at; i < at + 4; i++) {
+				char c = text[i];
+				int digit = c >= '0' && c <= '9' ? c - '0' : c >= 'a' && c <= 'f' ? c - 'a' + 10 : c >= 'A' && c <= 'F' ? c - 'A' + 10 : -1;
+				if (digit < 0)
+					fail(i, "bad \\u escape");
+				code = code << 4 | (uint32_t) digit;
+			}
+			return code;
+		}
+
+		// Stage 1 has made sure the closing quote exists
+		RyHandle string(uint32_t open) {
+			size_t at = open + 1, runStart = at;
+			std::string &out = unescaped;
+			out.clear();
+			for (;;) {
+				unsigned char c = (unsigned char) text[at];
+				if (c == '"')
+					break;
+				if (c < 0x20)
+					fail(at, "control character in a string");
+				if (c != '\\') {
+					at++;
+					continue;
+				}
+				out.append(text + runStart, at - runStart);
+				char escape = text[at + 1];
+				at += 2;
+				switch (escape) {
+					case '"':
+					case '\\':
+					case '/':
+						out += escape;
+						break;
+					case 'b':
+						out += '\b';
+						break;
+					case 'f':
+						out += '\f';
+						break;
+					case 'n':
+						out += '\n';
+						break;
+					case 'r':
+						out += '\r';
+						break;
+					case 't':
+						out += '\t';
+						break;
+					case 'u': {
+						uint32_t code = hex4(at);
+						at += 4;
+						if (code >= 0xD800 && code < 0xDC00 && length - at >= 6 && text[at] == '\\' && text[at + 1] == 'u') {
+							uint32_t low = hex4(at + 2);
+							if (low >= 0xDC00 && low < 0xE000) {
+								code = 0x10000 + ((code - 0xD800) << 10) + (low - 0xDC00);
+								at += 6;
+							}
+						}
+						appendUtf8(out, code);
+						break;
+					}
+					default:
+						fail(at - 1, "bad escape");
+				}
+				runStart = at;
+			}
+			if (out.empty() && runStart == open + 1)
+				return ry->make_string(ctx, text + runStart, at - runStart);
+			out.append(text + runStart, at - runStart);
+			return ry->make_string(ctx, out.data(), out.size());
+		}
+
+		void literal(uint32_t at, const char *word) {
+			size_t size = std::strlen(word);
+			if (length - at < size || std::memcmp(text + at, word, size) != 0 ||
+					(at + size < length && !isDelimiter(text[at + size])))
+				fail(at, "unexpected character");
+		}
+
+		// -?(0|[1-9][0-9]*)(\.[0-9]+)?([eE][+-]?[0-9]+)?
+		double number(uint32_t start) {
+			size_t at = start;
+			auto digits = [&] {
+				size_t first = at;
+				while (at < length && text[at] >= '0' && text[at] <= '9')
+					at++;
+				return at > first;
+			};
+			if (at < length && text[at] == '-')
+				at++;
+			if (at < length && text[at] == '0')
+				at++;
+			else if (!digits())
+				fail(start, "unexpected character");
+			if (at < length && text[at] == '.') {
+				at++;
+				if (!digits())
+					fail(start, "bad number");
+			}
+			if (at < length && (text[at] == 'e' || text[at] == 'E')) {
+				at++;
+				if (at < length && (text[at] == '+' || text[at] == '-'))
+					at++;
+				if (!digits())
+					fail(start, "bad number");
+			}
+			if (at < length && !isDelimiter(text[at]))
+				fail(start, "bad number");
+
+			double result;
+			auto [end, error] = std::from_chars(text + start, text + at, result);
+			if (error != std::errc())
+				fail(start, "number out of range");
+			return result;
+		}
+	};
+
+	RyHandle parseText(RyContext *ctx, const char *text, size_t length, const std::string &context) {
+		// Reused, so parsing many small documents does not allocate
+		thread_local std::vector<uint32_t> positions;
+		indexStructure(text, length, positions);
+		return Parser(ctx, text, length, positions, context).document();
+	}
+
+	// What stringify() names in its error for a value it can't write
+	const char *kindName(RyKind kind) {
+		switch (kind) {
+			case RY_KIND_RANGE:
+				return "a range";
+			case RY_KIND_CALLABLE:
+				return "a function";
+			case RY_KIND_BYTES:
+				return "bytes";
+			default:
+				return "this value";
+		}
+	}
+
+	class Writer {
+	public:
+		std::string &out;
+		int indent;
+		int fd; // Written out as it fills when >= 0
+		size_t flushed = 0;
+
+		Writer(std::string &out, int indent, int fd = -1) : out(out), indent(indent), fd(fd) {}
+
+		void value(RyHandle item, size_t depth) {
+			if (depth > MAX_DEPTH)
+				throw std::runtime_error("stringify(): nested deeper than " + std::to_string(MAX_DEPTH) +
+																 " (does a list or map contain itself?).");
+			if (fd >= 0 && out.size() >= CHUNK)
+				flush();
+
+			int boolean;
+			double number;
+			RyStringView text;
+			RyKind kind = ry->kind(item);
+			switch (kind) {
+				case RY_KIND_NULL:
+					out += "null";
+					break;
+				case RY_KIND_BOOL:
+					ry->get_bool(item, &boolean);
+					out += boolean ? "true" : "false";
+					break;
+				case RY_KIND_NUMBER:
+					ry->get_number(item, &number);
+					this->number(number);
+					break;
+				case RY_KIND_STRING:
+					ry->get_string(item, &text);
+					string(text.data, text.length);
+					break;
+				case RY_KIND_LIST: {
+					size_t length = ry->list_length(item);
+					out += '[';
+					for (size_t i = 0; i < length; i++) {
+						if (i > 0)
+							out += ',';
+						newline(depth + 1);
+						value(ry->list_get(item, i), depth + 1);
+					}
+					if (length > 0)
+						newline(depth);
+					out += ']';
+					break;
+				}
+				case RY_KIND_MAP:
+				case RY_KIND_INSTANCE: {
+					// An instance is written as its fields, like a map
+					Members members{this, depth};
+					out += '{';
+					if (kind == RY_KIND_MAP)
+						ry->map_each(item, entry, &members);
+					else
+						ry->fields_each(item, field, &members);
+					if (members.failed)
+						std::rethrow_exception(members.failed);
+					if (!members.first)
+						newline(depth);
+					out += '}';
+					break;
+				}
+				default:
+					throw std::runtime_error(std::string("stringify(): ") + kindName(kind) + " has no JSON form.");
+			}
+		}
+
+		void flush() {
+			size_t done = 0;
+			while (done < out.size()) {
+				ssize_t wrote = ::write(fd, out.data() + done, out.size() - done);
+				if (wrote < 0 && errno == EINTR)
+					continue;
+				if (wrote < 0)
+					throw std::runtime_error("write(): " + std::string(std::strerror(errno)) + ".");
+				done += (size_t) wrote;
+			}
+			flushed += done;
+			out.clear();
+		}
+
+	private:
+		// Where map_each() and fields_each() write to. Exceptions are carried across them, not thrown through.
+		struct Members {
+			Writer *writer;
+			size_t depth;
+			bool first = true;
+			std::exception_ptr failed;
+		};
+
+		static RyStatus entry(void *data, RyHandle key, RyHandle item) {
+			auto members = static_cast<Members *>(data);
+			try {
+				Writer &writer = *members->writer;
+				writer.key(*members);
+				writer.keyText(key);
+				writer.out += writer.indent > 0 ? ": " : ":";
+				writer.value(item, members->depth + 1);
+				return RY_OK;
+			} catch (...) {
+				members->failed = std::current_exception();
+				return RY_ERROR;
+			}
+		}
+
+		static RyStatus field(void *data, RyStringView name, RyHandle item) {
+			auto members = static_cast<Members *>(data);
+			try {
+				Writer &writer = *members->writer;
+				writer.key(*members);
+				writer.string(name.data, name.length);
+				writer.out += writer.indent > 0 ? ": " : ":";
+				writer.value(item, members->depth + 1);
+				return RY_OK;
+			} catch (...) {
+				members->failed = std::current_exception();
+				return RY_ERROR;
+			}
+		}
+
+		void key(Members &members) {
+			if (!members.first)
+				out += ',';
+			members.first = false;
+			newline(members.depth + 1);
+		}
+
+		// Keys are strings in JSON, numbers and booleans are written the way Ry prints them
+		void keyText(RyHandle key) {
+			RyStringView text;
+			double number;
+			int boolean;
+			if (ry->get_string(key, &text)) {
+				string(text.data, text.length);
+			} else if (ry->get_number(key, &number)) {
+				std::string printed = std::to_string(number);
+				printed.erase(printed.find_last_not_of('0') + 1, std::string::npos);
+				if (printed.back() == '.')
+					printed.pop_back();
+				string(printed.data(), printed.size());
+			} else if (ry->get_bool(key, &boolean)) {
+				out += boolean ? "\"true\"" : "\"false\"";
+			} else {
+				throw std::runtime_error("stringify(): map keys must be strings, numbers or booleans.");
+			}
+		}
+
+		void newline(size_t depth) {
+			if (indent <= 0)
+				return;
+			out += '\n';
+			out.append(depth * indent, ' ');
+		}
+
+		void number(double value) {
+			if (!std::isfinite(value)) {
+				out += "null"; // No infinities or NaN in JSON
+				return;
+			}
+			char buffer[32];
+			auto [end, error] = std::to_chars(buffer, buffer + sizeof(buffer), value); // Shortest that reads back
+			out.append(buffer, end);
+		}
+
+		void string(const char *text, size_t length) {
+			static const char *hex = "0123456789abcdef";
+			out += '"';
+			size_t runStart = 0;
+			for (size_t i = 0; i < length; i++) {
+				unsigned char c = (unsigned char) text[i];
+				if (c >= 0x20 && c != '"' && c != '\\')
+					continue;
+				out.append(text + runStart, i - runStart);
+				runStart = i + 1;
+				switch (c) {
+					case '"':
+						out += "\\\"";
+						break;
+					case '\\':
+						out += "\\\\";
+						break;
+					case '\n':
+						out += "\\n";
+						break;
+					case '\r':
+						out += "\\r";
+						break;
+					case '\t':
+						out += "\\t";
+						break;
+					case '\b':
+						out += "\\b";
+						break;
+					case '\f':
+						out += "\\f";
+						break;
+					default:
+						out += "\\u00";
+						out += hex[c >> 4];
+						out += hex[c & 0xF];
+				}
+			}
+			out.append(text + runStart, length - runStart);
+			out += '"';
+		}
+	};
+
+	int indentOf(int argc, const RyHandle *args, int index) {
+		double indent;
+		if (argc <= index || ry->kind(args[index]) == RY_KIND_NULL)
+			return 0;
+		if (!ry->get_number(args[index], &indent) || indent < 0)
+			throw std::runtime_error("the indent must be a number of spaces.");
+		return (int) indent;
+	}
+
+	// One line at a time out of a descriptor, through one reused buffer
+	struct LineReader {
+		int fd;
+		bool owned; // Opened by lines() itself, closed at the end
+		std::string buffer;
+		size_t start = 0; // Of the unread part of buffer
+		size_t line = 0;
+
+		~LineReader() { close(); }
+
+		void close() {
+			if (owned && fd >= 0)
+				::close(fd);
+			fd = -1;
+		}
+
+		// The next line without its newline (and \r), false at the end
+		bool next(const char *&text, size_t &length) {
+			for (;;) {
+				size_t end = buffer.find('\n', start);
+				if (end != std::string::npos || fd < 0) {
+					if (end == std::string::npos) {
+						if (start >= buffer.size())
+							return false;
+						end = buffer.size(); // The last line has no newline
+					}
+					text = buffer.data() + start;
+					length = end - start;
+					if (length > 0 && text[length - 1] == '\r')
+						length--;
+					start = end + 1;
+					line++;
+					return true;
+				}
+
+				buffer.erase(0, start);
+				start = 0;
+				size_t kept = buffer.size();
+				buffer.resize(kept + CHUNK);
+				ssize_t got;
+				do {
+					got = ::read(fd, buffer.data() + kept, CHUNK);
+				} while (got < 0 && errno == EINTR);
+				if (got < 0)
+					throw std::runtime_error("lines(): " + std::string(std::strerror(errno)) + ".");
+				buffer.resize(kept + (size_t) got);
+				if (got == 0)
+					close();
+			}
+		}
+	};
+
+	// The next parsed line for foreach, null at the end
+	RyStatus nextLine(RyContext *ctx, int argc, const RyHandle *args, RyHandle *result) {
+		auto reader = static_cast<LineReader *>(ry->function_data(ctx));
+		try {
+			const char *text;
+			size_t length;
+			while (reader->next(text, length)) {
+				size_t first = 0;
+				while (first < length && (text[first] == ' ' || text[first] == '\t'))
+					first++;
+				if (first < length) {
+					*result = parseText(ctx, text, length, "lines(), line " + std::to_string(reader->line));
+					return RY_OK;
+				}
+			}
+			return RY_OK;
+		} catch (const std::exception &e) {
+			return ry->error(ctx, e.what());
+		}
+	}
+} // namespace
+
+// Native function: parse(text or bytes) - the lists, maps, strings, numbers, booleans and nulls in a JSON document
+static RyStatus json_parse(RyContext *ctx, int argc, const RyHandle *args, RyHandle *result) {
+	RyStringView text;
+	RyBytesView bytes;
+	try {
+		if (ry->get_string(args[0], &text))
+			*result = parseText(ctx, text.data, text.length, "parse()");
+		else if (ry->get_bytes(args[0], &bytes))
+			*result = parseText(ctx, (const char *) bytes.readable, bytes.length, "parse()");
+		else
+			return ry->error(ctx, "parse() expects a string or bytes.");
+		return RY_OK;
+	} catch (const std::exception &e) {
+		return ry->error(ctx, e.what());
+	}
+}
+
+// Native function: stringify(value, indent?) - JSON text, compact or indented by `indent` spaces
+static RyStatus json_stringify(RyContext *ctx, int argc, const RyHandle *args, RyHandle *result) {
+	if (argc < 1)
+		return ry->error(ctx, "stringify() expects a value.");
+	thread_local std::string out; // Keeps its capacity between calls
+	out.clear();
+	try {
+		Writer(out, indentOf(argc, args, 1)).value(args[0], 0);
+	} catch (const std::exception &e) {
+		return ry->error(ctx, e.what());
+	}
+	*result = ry->make_string(ctx, out.data(), out.size());
+	return RY_OK;
+}
+
+// Native function: write(fd, value, indent?) - the value as JSON and a newline, written out as the text is
+// made instead of all at the end. Compact writes one after another make NDJSON.
+static RyStatus json_write(RyContext *ctx, int argc, const RyHandle *args, RyHandle *result) {
+	double fd;
+	if (argc < 2 || !ry->get_number(args[0], &fd))
+		return ry->error(ctx, "write() expects a descriptor and a value.");
+	thread_local std::string buffer; // Keeps its capacity between calls
+	buffer.clear();
+	try {
+		Writer writer(buffer, indentOf(argc, args, 2), (int) fd);
+		writer.value(args[1], 0);
+		buffer += '\n';
+		writer.flush();
+		*result = ry->make_number(ctx, (double) writer.flushed);
+		return RY_OK;
+	} catch (const std::exception &e) {
+		buffer.clear();
+		return ry->error(ctx, e.what());
+	}
+}
+
+// Native function: lines(path or fd) - an iterator for foreach over NDJSON, one parsed value per line.
+// Blank lines are skipped. Only one line is held in memory at a time.
+static RyStatus json_lines(RyContext *ctx, int argc, const RyHandle *args, RyHandle *result) {
+	RyStringView path;
+	double fd;
+	auto reader = std::make_unique<LineReader>();
+	if (ry->get_string(args[0], &path)) {
+		std::string name(path.data, path.length);
+		reader->fd = ::open(name.c_str(), O_RDONLY | O_CLOEXEC);
+		reader->owned = true;
+		if (reader->fd < 0) {
+			std::string message = "lines(): cannot open " + name + ": " + std::strerror(errno) + ".";
+			return ry->error(ctx, message.c_str());
+		}
+	} else if (ry->get_number(args[0], &fd)) {
+		reader->fd = (int) fd;
+		reader->owned = false;
+	} else {
+		return ry->error(ctx, "lines() expects a path or a descriptor.");
+	}
+	*result = ry->make_iterator(ctx, "lines", nextLine, reader.release(),
+															[](void *data) { delete static_cast<LineReader *>(data); });
+	return RY_OK;
+}
+
+// The Entry Point
+RY_MODULE_INIT(api, module) {
+	ry = api;
+	ry->define(module, "parse", json_parse, 1);
+	ry->define(module, "stringify", json_stringify, -1);
+	ry->define(module, "write", json_write, -1);
+	ry->define(module, "lines", json_lines, 1);
+	return RY_OK;
+}
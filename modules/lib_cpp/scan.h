@@ -0,0 +1,88 @@
+#pragma once
+#include <cstdint>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+
+// Text scanning 64 bytes at a time for the modules that parse (json, csv): a Block answers "which of these
+// bytes are c" as a 64 bit mask, with AVX2 or SSE2 compares where the compiler targets them.
+namespace RyScan {
+	// One bit per byte of a 64 byte block, for each byte value asked about
+#if defined(__AVX2__)
+	struct Block {
+		__m256i low, high;
+		explicit Block(const uint8_t *in) :
+				low(_mm256_loadu_si256((const __m256i *) in)), high(_mm256_loadu_si256((const __m256i *) (in + 32))) {}
+
+		static uint64_t bits(__m256i low, __m256i high, char c) {
+			__m256i wanted = _mm256_set1_epi8(c);
+			uint64_t lowBits = (uint32_t) _mm256_movemask_epi8(_mm256_cmpeq_epi8(low, wanted));
+			uint64_t highBits = (uint32_t) _mm256_movemask_epi8(_mm256_cmpeq_epi8(high, wanted));
+			return lowBits | highBits << 32;
+		}
+		uint64_t eq(char c) const { return bits(low, high, c); }
+		// Compared with bit 5 set, so '{' also finds '[' and '}' finds ']'
+		uint64_t eqFolded(char c) const {
+			__m256i fold = _mm256_set1_epi8(0x20);
+			return bits(_mm256_or_si256(low, fold), _mm256_or_si256(high, fold), c);
+		}
+	};
+#elif defined(__SSE2__)
+	struct Block {
+		__m128i parts[4];
+		explicit Block(const uint8_t *in) {
+			for (int i = 0; i < 4; i++)
+				parts[i] = _mm_loadu_si128((const __m128i *) (in + 16 * i));
+		}
+
+		uint64_t eq(char c) const {
+			__m128i wanted = _mm_set1_epi8(c);
+			uint64_t result = 0;
+			for (int i = 0; i < 4; i++)
+				result |= (uint64_t) (uint16_t) _mm_movemask_epi8(_mm_cmpeq_epi8(parts[i], wanted)) << (16 * i);
+			return result;
+		}
+		uint64_t eqFolded(char c) const {
+			__m128i wanted = _mm_set1_epi8(c), fold = _mm_set1_epi8(0x20);
+			uint64_t result = 0;
+			for (int i = 0; i < 4; i++)
+				result |= (uint64_t) (uint16_t) _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_or_si128(parts[i], fold), wanted))
+									<< (16 * i);
+			return result;
+		}
+	};
+#else
+	struct Block {
+		const uint8_t *in;
+		explicit Block(const uint8_t *in) : in(in) {}
+
+		uint64_t eq(char c) const {
+			uint64_t result = 0;
+			for (int i = 0; i < 64; i++)
+				result |= (uint64_t) (in[i] == (uint8_t) c) << i;
+			return result;
+		}
+		uint64_t eqFolded(char c) const {
+			uint64_t result = 0;
+			for (int i = 0; i < 64; i++)
+				result |= (uint64_t) ((in[i] | 0x20) == (uint8_t) c) << i;
+			return result;
+		}
+	};
+#endif
+
+	// Bit i is the XOR of bits 0..i: set from an opening quote up to (not including) its closing one
+	inline uint64_t prefixXor(uint64_t bits) {
+#if defined(__PCLMUL__)
+		return (uint64_t) _mm_cvtsi128_si64(_mm_clmulepi64_si128(_mm_set_epi64x(0, (int64_t) bits), _mm_set1_epi8(-1), 0));
+#else
+		bits ^= bits << 1;
+		bits ^= bits << 2;
+		bits ^= bits << 4;
+		bits ^= bits << 8;
+		bits ^= bits << 16;
+		bits ^= bits << 32;
+		return bits;
+#endif
+	}
+} // namespace RyScan
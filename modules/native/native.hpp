@@ -1,12 +1,35 @@
 #pragma once
+#include "native_bench.hpp"
+#include "native_bytes.hpp"
+#include "native_collections.hpp"
+#include "native_event.hpp"
+#include "native_fiber.hpp"
 #include "native_io.hpp"
 #include "native_list.hpp"
+#include "native_serial.hpp"
 #include "native_sys.hpp"
+#include "native_thread.hpp"
 #include "native_type.hpp"
 #include "native_use.hpp"
 
 namespace RyRuntime {
-	inline std::vector<std::string> getNativeNames() { return {"out", "input", "clock", "clear", "exit", "type", "use"}; }
+	inline std::vector<std::string> getNativeNames() {
+		return {"out", "input", "clock", "clear", "exit", "type", "use",
+						// Timing
+						"now_ns", "monotonic", "cpu_time", "bench", "mem_stats",
+						// Isolates and fibers
+						"spawn", "join", "channel", "send", "recv", "fiber", "yield", "sleep",
+						// Binary data
+						"bytes", "freeze", "slice", "decode", "pack", "unpack",
+						// Collections
+						"set", "add", "has", "remove", "deque", "push_back", "push_front", "pop_back", "pop_front", "heap", "heap_push",
+						"heap_pop", "heap_peek",
+						// Serialization
+						"serialize", "deserialize", "deserialize_all",
+						// Event loop I/O
+						"pipe", "fd_read", "fd_read_into", "fd_write", "fd_close", "timer", "tick", "tcp_listen", "tcp_accept", "tcp_connect",
+						"tcp_port"};
+	}
 	inline void registerNatives(std::map<std::string, RyValue> &globals) {
 		auto define = [&](std::string name, NativeFn fn, int arity) {
 			auto native = std::make_shared<Frontend::RyNative>(fn, name, arity);
@@ -16,9 +39,57 @@ namespace RyRuntime {
 		define("out", ry_out, 1);
 		define("input", ry_input, 1);
 		define("clock", ry_clock, 0);
+		define("now_ns", ry_now_ns, 0);
+		define("monotonic", ry_monotonic, 0);
+		define("cpu_time", ry_cpu_time, 0);
+		define("bench", ry_bench, -1);
+		define("mem_stats", ry_mem_stats, 0);
 		define("clear", ry_clear, 0);
 		define("exit", ry_exit, 1);
 		define("type", ry_type, 1);
 		define("use", ry_use, 1);
+		define("spawn", ry_spawn, 1);
+		define("join", ry_join, 1);
+		define("channel", ry_channel, 0);
+		define("send", ry_send, 2);
+		define("recv", ry_recv, 1);
+		define("fiber", ry_fiber, 1);
+		define("yield", ry_yield, 0);
+		define("sleep", ry_sleep, 1);
+		define("bytes", ry_bytes, 1);
+		define("freeze", ry_freeze, 1);
+		define("slice", ry_slice, -1);
+		define("decode", ry_decode, 1);
+		define("pack", ry_pack, -1);
+		define("unpack", ry_unpack, -1);
+		define("set", ry_set, -1);
+		define("add", ry_add, 2);
+		define("has", ry_has, 2);
+		define("remove", ry_remove, 2);
+		define("deque", ry_deque, -1);
+		define("push_back", ry_push_back, 2);
+		define("push_front", ry_push_front, 2);
+		define("pop_back", ry_pop_back, 1);
+		define("pop_front", ry_pop_front, 1);
+		define("heap", ry_heap, -1);
+		define("heap_push", ry_heap_push, 2);
+		define("heap_pop", ry_heap_pop, 1);
+		define("heap_peek", ry_heap_peek, 1);
+		define("serialize", ry_serialize, -1);
+		define("deserialize", ry_deserialize, 1);
+		define("deserialize_all", ry_deserialize_all, 1);
+#ifdef __linux__
+		define("pipe", ry_pipe, 0);
+		define("fd_read", ry_fd_read, 1);
+		define("fd_read_into", ry_fd_read_into, 2);
+		define("fd_write", ry_fd_write, 2);
+		define("fd_close", ry_fd_close, 1);
+		define("timer", ry_timer, 1);
+		define("tick", ry_tick, 1);
+		define("tcp_listen", ry_tcp_listen, 2);
+		define("tcp_accept", ry_tcp_accept, 1);
+		define("tcp_connect", ry_tcp_connect, 2);
+		define("tcp_port", ry_tcp_port, 1);
+#endif
 	}
 } // namespace RyRuntime
@@ -0,0 +1,63 @@
+#pragma once
+#include <algorithm>
+#include <cmath>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "native_sys.hpp"
+#include "value.h"
+#include "vm.h"
+
+namespace RyRuntime {
+	// Native 'bench(func, iterations, warmup?)' - calls func() `warmup` times (a tenth of the iterations by
+	// default), then `iterations` times, each timed on its own. Returns a map of nanoseconds per call: min,
+	// median, mean and stddev, plus the iterations. The calls go straight through VM::call, so no Ry loop or
+	// OP_CALL of the caller is counted, only the two clock reads around each call (tens of nanoseconds).
+	inline RyValue ry_bench(int argCount, RyValue *args, std::map<std::string, RyValue> &globals) {
+		if (argCount < 2 || argCount > 3 || !args[1].isNumber() || (argCount == 3 && !args[2].isNumber()))
+			throw std::runtime_error("bench() expects a function, an iteration count and optionally a warmup count.");
+		long long iterations = (long long) args[1].asNumber();
+		if (iterations < 1)
+			throw std::runtime_error("bench() needs at least one iteration.");
+		long long warmup = argCount == 3 ? (long long) args[2].asNumber() : std::max(1LL, iterations / 10);
+		VM *vm = VM::current();
+		if (!vm)
+			throw std::runtime_error("bench() needs a running VM.");
+
+		RyValue callee = args[0], result;
+		const std::vector<RyValue> none;
+		for (long long i = 0; i < warmup; i++) {
+			if (vm->call(callee, none, result) != INTERPRET_OK)
+				throw std::runtime_error(vm->panicMessage);
+		}
+
+		std::vector<double> samples((size_t) iterations);
+		for (auto &sample: samples) {
+			double start = monotonicNs();
+			InterpretResult status = vm->call(callee, none, result);
+			sample = monotonicNs() - start;
+			if (status != INTERPRET_OK)
+				throw std::runtime_error(vm->panicMessage);
+		}
+
+		std::sort(samples.begin(), samples.end());
+		size_t n = samples.size();
+		double median = n % 2 ? samples[n / 2] : (samples[n / 2 - 1] + samples[n / 2]) / 2;
+		double sum = 0;
+		for (double sample: samples)
+			sum += sample;
+		double mean = sum / n, squares = 0;
+		for (double sample: samples)
+			squares += (sample - mean) * (sample - mean);
+
+		auto stats = std::make_shared<std::unordered_map<RyValue, RyValue, RyValueHasher>>();
+		(*stats)[RyValue("min")] = RyValue(samples[0]);
+		(*stats)[RyValue("median")] = RyValue(median);
+		(*stats)[RyValue("mean")] = RyValue(mean);
+		(*stats)[RyValue("stddev")] = RyValue(n > 1 ? std::sqrt(squares / (n - 1)) : 0.0);
+		(*stats)[RyValue("iterations")] = RyValue((double) n);
+		return RyValue(stats);
+	}
+} // namespace RyRuntime
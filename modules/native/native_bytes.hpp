@@ -0,0 +1,211 @@
+#pragma once
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include "bytes.h"
+#include "value.h"
+
+namespace RyRuntime {
+	inline RyBytes &bytesArg(int argCount, RyValue *args, int index, const char *native) {
+		RyBytes *bytes = argCount > index ? bytesOf(args[index]) : nullptr;
+		if (!bytes)
+			throw std::runtime_error(std::string(native) + "() expects bytes.");
+		return *bytes;
+	}
+
+	// Native 'bytes(size or string or list or bytes)' - new mutable bytes: zeros, or a copy of the data
+	inline RyValue ry_bytes(int argCount, RyValue *args, std::map<std::string, RyValue> &globals) {
+		const RyValue &from = args[0];
+		if (from.isNumber() && from.asNumber() >= 0)
+			return RyValue(std::static_pointer_cast<RyObject>(RyBytes::allocate((size_t) from.asNumber())));
+		if (auto text = std::get_if<std::string>(&from.val))
+			return RyValue(std::static_pointer_cast<RyObject>(RyBytes::copyOf(text->data(), text->size())));
+		if (RyBytes *bytes = bytesOf(from))
+			return RyValue(std::static_pointer_cast<RyObject>(RyBytes::copyOf(bytes->data, bytes->size)));
+		if (from.isList()) {
+			auto list = from.asList();
+			auto made = RyBytes::allocate(list->size());
+			for (size_t i = 0; i < list->size(); i++) {
+				const RyValue &item = (*list)[i];
+				if (!item.isNumber() || item.asNumber() < 0 || item.asNumber() > 255)
+					throw std::runtime_error("bytes() expects numbers from 0 to 255.");
+				made->data[i] = (uint8_t) item.asNumber();
+			}
+			return RyValue(std::static_pointer_cast<RyObject>(made));
+		}
+		throw std::runtime_error("bytes() expects a size, a string, a list or bytes.");
+	}
+
+	// Native 'freeze(bytes)' - read-only bytes with the same content (the same bytes if already read-only)
+	inline RyValue ry_freeze(int argCount, RyValue *args, std::map<std::string, RyValue> &globals) {
+		RyBytes &bytes = bytesArg(argCount, args, 0, "freeze");
+		if (bytes.readOnly)
+			return args[0];
+		return RyValue(std::static_pointer_cast<RyObject>(RyBytes::copyOf(bytes.data, bytes.size, true)));
+	}
+
+	// Native 'slice(bytes, from, to?)' - the same memory, not a copy: writes show through both
+	inline RyValue ry_slice(int argCount, RyValue *args, std::map<std::string, RyValue> &globals) {
+		RyBytes &bytes = bytesArg(argCount, args, 0, "slice");
+		auto position = [&](int index, size_t fallback) {
+			if (argCount <= index || args[index].isNil())
+				return fallback;
+			if (!args[index].isNumber())
+				throw std::runtime_error("slice() expects numbers for from and to.");
+			double at = args[index].asNumber();
+			if (at < 0)
+				at += bytes.size; // From the end
+			return at < 0 ? 0 : (size_t) at;
+		};
+		return RyValue(std::static_pointer_cast<RyObject>(bytes.slice(position(1, 0), position(2, bytes.size))));
+	}
+
+	// Native 'decode(bytes)' - the bytes as a string
+	inline RyValue ry_decode(int argCount, RyValue *args, std::map<std::string, RyValue> &globals) {
+		return RyValue(bytesArg(argCount, args, 0, "decode").text());
+	}
+
+	// pack()/unpack() formats: an optional byte order ('<' little, the default, '>' or '!' big, '=' native),
+	// then codes with optional counts: b/B 8, h/H 16, i/I 32, q/Q 64 bit integers (upper case unsigned),
+	// f/d 32/64 bit floats and x for a padding byte.
+	struct PackFormat {
+		bool bigEndian = false;
+		std::vector<char> codes; // Counts expanded
+
+		explicit PackFormat(const std::string &format) {
+			size_t at = 0;
+			if (at < format.size() && std::strchr("<>!=", format[at])) {
+				char order = format[at++];
+				bigEndian = order == '>' || order == '!';
+				if (order == '=') {
+					uint16_t probe = 1;
+					bigEndian = *(uint8_t *) &probe == 0;
+				}
+			}
+			while (at < format.size()) {
+				size_t count = 0;
+				bool counted = false;
+				while (at < format.size() && format[at] >= '0' && format[at] <= '9') {
+					count = count * 10 + (format[at++] - '0');
+					counted = true;
+				}
+				if (at == format.size() || !std::strchr("bBhHiIqQfdx", format[at]))
+					throw std::runtime_error("Bad pack format \"" + format + "\".");
+				codes.insert(codes.end(), counted ? count : 1, format[at++]);
+			}
+		}
+
+		static size_t width(char code) {
+			switch (code) {
+				case 'h':
+				case 'H':
+					return 2;
+				case 'i':
+				case 'I':
+				case 'f':
+					return 4;
+				case 'q':
+				case 'Q':
+				case 'd':
+					return 8;
+				default:
+					return 1;
+			}
+		}
+
+		size_t size() const {
+			size_t total = 0;
+			for (char code: codes)
+				total += width(code);
+			return total;
+		}
+
+		void put(uint8_t *out, uint64_t bits, size_t width) const {
+			for (size_t i = 0; i < width; i++)
+				out[bigEndian ? width - 1 - i : i] = (uint8_t) (bits >> (8 * i));
+		}
+
+		uint64_t get(const uint8_t *in, size_t width) const {
+			uint64_t bits = 0;
+			for (size_t i = 0; i < width; i++)
+				bits |= (uint64_t) in[bigEndian ? width - 1 - i : i] << (8 * i);
+			return bits;
+		}
+	};
+
+	// Native 'pack(format, ...values)' - the values as binary, see PackFormat
+	inline RyValue ry_pack(int argCount, RyValue *args, std::map<std::string, RyValue> &globals) {
+		if (argCount < 1 || !args[0].isString())
+			throw std::runtime_error("pack() expects a format string.");
+		PackFormat format(args[0].asString());
+		auto made = RyBytes::allocate(format.size());
+
+		uint8_t *out = made->data;
+		int next = 1;
+		for (char code: format.codes) {
+			size_t width = PackFormat::width(code);
+			if (code != 'x') {
+				if (next >= argCount || !args[next].isNumber())
+					throw std::runtime_error("pack() expects a number for every code in the format.");
+				double number = args[next++].asNumber();
+				uint64_t bits;
+				if (code == 'f') {
+					float single = (float) number;
+					uint32_t raw;
+					std::memcpy(&raw, &single, 4);
+					bits = raw;
+				} else if (code == 'd') {
+					std::memcpy(&bits, &number, 8);
+				} else if (code >= 'a') {
+					bits = (uint64_t) (int64_t) number; // Signed: two's complement, truncated to the width
+				} else {
+					bits = (uint64_t) number;
+				}
+				format.put(out, bits, width);
+			}
+			out += width;
+		}
+		if (next != argCount)
+			throw std::runtime_error("pack() got more values than the format has codes.");
+		return RyValue(std::static_pointer_cast<RyObject>(made));
+	}
+
+	// Native 'unpack(format, bytes, offset?)' - a list with the numbers read from bytes at offset
+	inline RyValue ry_unpack(int argCount, RyValue *args, std::map<std::string, RyValue> &globals) {
+		if (argCount < 2 || !args[0].isString())
+			throw std::runtime_error("unpack() expects a format string and bytes.");
+		PackFormat format(args[0].asString());
+		RyBytes &bytes = bytesArg(argCount, args, 1, "unpack");
+		size_t offset = argCount > 2 && args[2].isNumber() && args[2].asNumber() > 0 ? (size_t) args[2].asNumber() : 0;
+		if (offset > bytes.size || bytes.size - offset < format.size())
+			throw std::runtime_error("unpack() needs " + std::to_string(format.size()) + " bytes at offset " +
+															 std::to_string(offset) + ", there are " + std::to_string(bytes.size) + ".");
+
+		auto values = std::make_shared<std::vector<RyValue>>();
+		const uint8_t *in = bytes.data + offset;
+		for (char code: format.codes) {
+			size_t width = PackFormat::width(code);
+			if (code != 'x') {
+				uint64_t bits = format.get(in, width);
+				double number;
+				if (code == 'f') {
+					uint32_t raw = (uint32_t) bits;
+					float single;
+					std::memcpy(&single, &raw, 4);
+					number = single;
+				} else if (code == 'd') {
+					std::memcpy(&number, &bits, 8);
+				} else if (code >= 'a') {
+					int shift = 64 - 8 * (int) width; // Sign extend
+					number = (double) ((int64_t) (bits << shift) >> shift);
+				} else {
+					number = (double) bits;
+				}
+				values->push_back(RyValue(number));
+			}
+			in += width;
+		}
+		return RyValue(values);
+	}
+} // namespace RyRuntime
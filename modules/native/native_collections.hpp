@@ -0,0 +1,139 @@
+#pragma once
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include "collections.h"
+#include "value.h"
+#include "vm.h"
+
+namespace RyRuntime {
+	template<typename T>
+	inline T &collectionArg(int argCount, RyValue *args, const char *native, const char *what) {
+		T *collection = argCount > 0 ? collectionOf<T>(args[0]) : nullptr;
+		if (!collection)
+			throw std::runtime_error(std::string(native) + "() expects a " + what + ".");
+		return *collection;
+	}
+
+	// The optional first argument of set(), deque() and heap(): the values to start with
+	inline std::vector<RyValue> initialItems(int argCount, RyValue *args, const char *native) {
+		if (argCount < 1 || args[0].isNil())
+			return {};
+		if (args[0].isList())
+			return *args[0].asList();
+		if (RySet *set = collectionOf<RySet>(args[0])) {
+			std::vector<RyValue> items;
+			items.reserve(set->size());
+			for (size_t at = set->next(0); at < set->capacity(); at = set->next(at + 1))
+				items.push_back(set->at(at));
+			return items;
+		}
+		throw std::runtime_error(std::string(native) + "() expects a list to start from.");
+	}
+
+	// Native 'set(list?)' - unique values with O(1) add, has and remove
+	inline RyValue ry_set(int argCount, RyValue *args, std::map<std::string, RyValue> &globals) {
+		auto made = std::make_shared<RySet>();
+		for (const auto &item: initialItems(argCount, args, "set"))
+			made->add(item);
+		return RyValue(std::static_pointer_cast<RyObject>(made));
+	}
+
+	// Native 'add(set, value)' - true if the value wasn't in the set yet
+	inline RyValue ry_add(int argCount, RyValue *args, std::map<std::string, RyValue> &globals) {
+		return RyValue(collectionArg<RySet>(argCount, args, "add", "set").add(args[1]));
+	}
+
+	// Native 'has(set, value)'
+	inline RyValue ry_has(int argCount, RyValue *args, std::map<std::string, RyValue> &globals) {
+		return RyValue(collectionArg<RySet>(argCount, args, "has", "set").has(args[1]));
+	}
+
+	// Native 'remove(set, value)' - true if the value was in the set
+	inline RyValue ry_remove(int argCount, RyValue *args, std::map<std::string, RyValue> &globals) {
+		return RyValue(collectionArg<RySet>(argCount, args, "remove", "set").remove(args[1]));
+	}
+
+	// Native 'deque(list?)' - a queue with O(1) pushes and pops at both ends and O(1) d[i]
+	inline RyValue ry_deque(int argCount, RyValue *args, std::map<std::string, RyValue> &globals) {
+		auto made = std::make_shared<RyDeque>();
+		for (auto &item: initialItems(argCount, args, "deque"))
+			made->pushBack(std::move(item));
+		return RyValue(std::static_pointer_cast<RyObject>(made));
+	}
+
+	// Native 'push_back(deque, value)'
+	inline RyValue ry_push_back(int argCount, RyValue *args, std::map<std::string, RyValue> &globals) {
+		collectionArg<RyDeque>(argCount, args, "push_back", "deque").pushBack(args[1]);
+		return RyValue();
+	}
+
+	// Native 'push_front(deque, value)'
+	inline RyValue ry_push_front(int argCount, RyValue *args, std::map<std::string, RyValue> &globals) {
+		collectionArg<RyDeque>(argCount, args, "push_front", "deque").pushFront(args[1]);
+		return RyValue();
+	}
+
+	// Native 'pop_back(deque)'
+	inline RyValue ry_pop_back(int argCount, RyValue *args, std::map<std::string, RyValue> &globals) {
+		return collectionArg<RyDeque>(argCount, args, "pop_back", "deque").popBack();
+	}
+
+	// Native 'pop_front(deque)'
+	inline RyValue ry_pop_front(int argCount, RyValue *args, std::map<std::string, RyValue> &globals) {
+		return collectionArg<RyDeque>(argCount, args, "pop_front", "deque").popFront();
+	}
+
+	// The key function of a heap applied to a value, in the VM that is running the native
+	inline RyValue heapKey(const RyHeap &heap, const RyValue &value) {
+		if (heap.key.isNil())
+			return RyValue();
+		VM *vm = VM::current();
+		if (!vm)
+			throw std::runtime_error("A heap key function needs a running VM.");
+		RyValue order;
+		if (vm->call(heap.key, {value}, order) != INTERPRET_OK)
+			throw std::runtime_error(vm->panicMessage);
+		return order;
+	}
+
+	// Native 'heap(list?, key?)' - a min-heap: heap_pop() always gives the smallest value (or the value with
+	// the smallest key(value)); O(log n) pushes and pops
+	inline RyValue ry_heap(int argCount, RyValue *args, std::map<std::string, RyValue> &globals) {
+		if (argCount > 2)
+			throw std::runtime_error("heap() expects a list and a key function, both optional.");
+		auto made = std::make_shared<RyHeap>();
+		if (argCount == 2 && !args[1].isNil()) {
+			const RyValue &key = args[1];
+			if (!(key.isClosure() || key.isFunction() || key.isBoundMethod() || key.isNative()))
+				throw std::runtime_error("heap() expects a function for the key.");
+			made->key = key;
+		}
+		std::vector<RyValue> items = initialItems(argCount, args, "heap"), keys;
+		if (!made->key.isNil()) {
+			keys.reserve(items.size());
+			for (const auto &item: items)
+				keys.push_back(heapKey(*made, item));
+		}
+		made->assign(std::move(items), std::move(keys));
+		return RyValue(std::static_pointer_cast<RyObject>(made));
+	}
+
+	// Native 'heap_push(heap, value)'
+	inline RyValue ry_heap_push(int argCount, RyValue *args, std::map<std::string, RyValue> &globals) {
+		RyHeap &heap = collectionArg<RyHeap>(argCount, args, "heap_push", "heap");
+		heap.push(args[1], heapKey(heap, args[1]));
+		return RyValue();
+	}
+
+	// Native 'heap_pop(heap)' - removes and returns the smallest
+	inline RyValue ry_heap_pop(int argCount, RyValue *args, std::map<std::string, RyValue> &globals) {
+		return collectionArg<RyHeap>(argCount, args, "heap_pop", "heap").pop();
+	}
+
+	// Native 'heap_peek(heap)' - the smallest, left in place
+	inline RyValue ry_heap_peek(int argCount, RyValue *args, std::map<std::string, RyValue> &globals) {
+		return collectionArg<RyHeap>(argCount, args, "heap_peek", "heap").top();
+	}
+} // namespace RyRuntime
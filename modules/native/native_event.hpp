@@ -0,0 +1,335 @@
+#pragma once
+#ifdef __linux__
+#include <arpa/inet.h>
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <functional>
+#include <memory>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <stdexcept>
+#include <string>
+#include <sys/socket.h>
+#include <sys/timerfd.h>
+#include <unistd.h>
+#include "bytes.h"
+#include "value.h"
+#include "vm.h"
+
+namespace RyRuntime {
+	// One attempt at a non-blocking operation: true (with the result) when done, false on EAGAIN
+	using FdAttempt = std::function<bool(RyValue &result)>;
+
+	inline std::runtime_error fdError(const char *native) {
+		return std::runtime_error(std::string(native) + "() failed: " + std::strerror(errno));
+	}
+
+	inline bool wouldBlock() { return errno == EAGAIN || errno == EWOULDBLOCK || errno == EINPROGRESS; }
+
+	inline int fdArg(int argCount, RyValue *args, int index, const char *native) {
+		if (argCount <= index || !args[index].isNumber())
+			throw std::runtime_error(std::string(native) + "() expects a file descriptor.");
+		return (int) args[index].asNumber();
+	}
+
+	// Runs `attempt` until it stops hitting EAGAIN. The calling fiber parks on the event loop in between,
+	// or the thread blocks in poll() when the VM can't switch fibers (inside a nested call()).
+	inline RyValue retryOnFd(int fd, int interest, FdAttempt attempt) {
+		RyValue result;
+		if (attempt(result))
+			return result;
+
+		VM *vm = VM::current();
+		if (vm && vm->canSuspend()) {
+			FiberWait wait;
+			wait.fd = fd;
+			wait.interest = interest;
+			wait.ready = [attempt](Fiber &, RyValue &out) { return attempt(out); };
+			vm->suspend(std::move(wait));
+			return RyValue();
+		}
+
+		for (;;) {
+			pollfd target{fd, (short) (interest & FD_READ ? POLLIN : POLLOUT), 0};
+			poll(&target, 1, -1);
+			if (attempt(result))
+				return result;
+		}
+	}
+
+	// Makes one attempt on `fd` non-blocking. The fds made here (pipes, sockets, timers) already are; anything
+	// else (a terminal, a file) gets its flags back after the attempt, they are shared with other processes.
+	struct NonBlockingAttempt {
+		int fd;
+		int flags;
+		explicit NonBlockingAttempt(int fd) : fd(fd), flags(fcntl(fd, F_GETFL, 0)) {
+			if (flags >= 0 && !(flags & O_NONBLOCK))
+				fcntl(fd, F_SETFL, flags | O_NONBLOCK);
+		}
+		~NonBlockingAttempt() {
+			if (flags >= 0 && !(flags & O_NONBLOCK)) {
+				int error = errno; // What the attempt failed with
+				fcntl(fd, F_SETFL, flags);
+				errno = error;
+			}
+		}
+	};
+
+	// Native 'pipe()' - [readFd, writeFd], both non-blocking
+	inline RyValue ry_pipe(int argCount, RyValue *args, std::map<std::string, RyValue> &globals) {
+		int fds[2];
+		if (pipe2(fds, O_NONBLOCK | O_CLOEXEC) < 0)
+			throw fdError("pipe");
+		return RyValue(std::make_shared<std::vector<RyValue>>(
+				std::vector<RyValue>{RyValue((double) fds[0]), RyValue((double) fds[1])}));
+	}
+
+	// Native 'fd_read(fd, max?)' - waits for data, returns up to max bytes or null at end of file
+	inline RyValue ry_fd_read(int argCount, RyValue *args, std::map<std::string, RyValue> &globals) {
+		int fd = fdArg(argCount, args, 0, "fd_read");
+		size_t max = argCount > 1 && args[1].isNumber() && args[1].asNumber() > 0 ? (size_t) args[1].asNumber() : 65536;
+		auto buffer = std::make_shared<std::string>(max, '\0'); // One for all the attempts
+		return retryOnFd(fd, FD_READ, [fd, max, buffer](RyValue &result) {
+			ssize_t count;
+			{
+				NonBlockingAttempt attempt(fd);
+				count = read(fd, buffer->data(), max);
+			}
+			if (count < 0) {
+				if (wouldBlock())
+					return false;
+				throw fdError("fd_read");
+			}
+			if (count == 0) {
+				result = RyValue(); // End of file
+			} else {
+				buffer->resize(count);
+				result = RyValue(std::move(*buffer));
+			}
+			return true;
+		});
+	}
+
+	// Native 'fd_read_into(fd, bytes)' - like fd_read, but into mutable bytes that can be reused.
+	// Returns the byte count, or null at end of file.
+	inline RyValue ry_fd_read_into(int argCount, RyValue *args, std::map<std::string, RyValue> &globals) {
+		int fd = fdArg(argCount, args, 0, "fd_read_into");
+		RyBytes *target = argCount > 1 ? bytesOf(args[1]) : nullptr;
+		if (!target || target->readOnly)
+			throw std::runtime_error("fd_read_into() expects mutable bytes.");
+
+		auto bytes = std::static_pointer_cast<RyBytes>(args[1].asObject()); // Kept alive while the fiber waits
+		return retryOnFd(fd, FD_READ, [fd, bytes](RyValue &result) {
+			ssize_t count;
+			{
+				NonBlockingAttempt attempt(fd);
+				count = read(fd, bytes->data, bytes->size);
+			}
+			if (count < 0) {
+				if (wouldBlock())
+					return false;
+				throw fdError("fd_read_into");
+			}
+			result = count == 0 && bytes->size > 0 ? RyValue() : RyValue((double) count);
+			return true;
+		});
+	}
+
+	// Native 'fd_write(fd, data)' - waits until all of data (a string or bytes) is written, returns the byte count
+	inline RyValue ry_fd_write(int argCount, RyValue *args, std::map<std::string, RyValue> &globals) {
+		int fd = fdArg(argCount, args, 0, "fd_write");
+		if (argCount < 2)
+			throw std::runtime_error("fd_write() expects data.");
+
+		// Bytes are written from where they are, anything else as its string
+		std::shared_ptr<void> owner;
+		const char *start;
+		size_t size;
+		if (RyBytes *bytes = bytesOf(args[1])) {
+			owner = args[1].asObject();
+			start = (const char *) bytes->data;
+			size = bytes->size;
+		} else {
+			auto text = std::make_shared<std::string>(args[1].isString() ? args[1].asString() : args[1].to_string());
+			start = text->data();
+			size = text->size();
+			owner = text;
+		}
+		auto written = std::make_shared<size_t>(0);
+		return retryOnFd(fd, FD_WRITE, [fd, owner, start, size, written](RyValue &result) {
+			NonBlockingAttempt attempt(fd);
+			while (*written < size) {
+				ssize_t count = send(fd, start + *written, size - *written, MSG_NOSIGNAL);
+				if (count < 0 && errno == ENOTSOCK)
+					count = write(fd, start + *written, size - *written);
+				if (count < 0) {
+					if (wouldBlock())
+						return false;
+					throw fdError("fd_write");
+				}
+				*written += count;
+			}
+			result = RyValue((double) *written);
+			return true;
+		});
+	}
+
+	// Native 'fd_close(fd)' - fibers still waiting on the fd panic instead of waiting forever
+	inline RyValue ry_fd_close(int argCount, RyValue *args, std::map<std::string, RyValue> &globals) {
+		int fd = fdArg(argCount, args, 0, "fd_close");
+		if (VM *vm = VM::current())
+			vm->closingFd(fd);
+		return RyValue(close(fd) == 0);
+	}
+
+	// Native 'timer(ms, interval?)' - a timer fd that fires after ms, then every interval ms
+	inline RyValue ry_timer(int argCount, RyValue *args, std::map<std::string, RyValue> &globals) {
+		if (argCount < 1 || !args[0].isNumber())
+			throw std::runtime_error("timer() expects milliseconds.");
+
+		auto toSpec = [](double ms) {
+			timespec spec{};
+			long long ns = (long long) (ms * 1e6);
+			spec.tv_sec = ns / 1000000000LL;
+			spec.tv_nsec = ns % 1000000000LL;
+			return spec;
+		};
+
+		int fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+		if (fd < 0)
+			throw fdError("timer");
+
+		itimerspec spec{};
+		spec.it_value = toSpec(std::max(args[0].asNumber(), 0.001)); // Zero would disarm it
+		if (argCount > 1 && args[1].isNumber() && args[1].asNumber() > 0)
+			spec.it_interval = toSpec(args[1].asNumber());
+		timerfd_settime(fd, 0, &spec, nullptr);
+		return RyValue((double) fd);
+	}
+
+	// Native 'tick(timer)' - waits for the timer to fire, returns how often it fired since the last tick
+	inline RyValue ry_tick(int argCount, RyValue *args, std::map<std::string, RyValue> &globals) {
+		int fd = fdArg(argCount, args, 0, "tick");
+		return retryOnFd(fd, FD_READ, [fd](RyValue &result) {
+			uint64_t expirations = 0;
+			if (read(fd, &expirations, sizeof(expirations)) < 0) {
+				if (wouldBlock())
+					return false;
+				throw fdError("tick");
+			}
+			result = RyValue((double) expirations);
+			return true;
+		});
+	}
+
+	inline addrinfo *resolve(const std::string &host, int port, bool passive) {
+		addrinfo hints{};
+		hints.ai_family = AF_UNSPEC;
+		hints.ai_socktype = SOCK_STREAM;
+		hints.ai_flags = AI_NUMERICSERV | (passive ? AI_PASSIVE : 0);
+		addrinfo *found = nullptr;
+		std::string service = std::to_string(port);
+		int status = getaddrinfo(host.empty() ? nullptr : host.c_str(), service.c_str(), &hints, &found);
+		if (status != 0)
+			throw std::runtime_error("Cannot resolve '" + host + "': " + gai_strerror(status));
+		return found;
+	}
+
+	// Native 'tcp_listen(host, port, backlog?)' - a non-blocking listening socket (port 0 picks a free one)
+	inline RyValue ry_tcp_listen(int argCount, RyValue *args, std::map<std::string, RyValue> &globals) {
+		if (argCount < 2 || !args[0].isString() || !args[1].isNumber())
+			throw std::runtime_error("tcp_listen() expects a host and a port.");
+		int backlog = argCount > 2 && args[2].isNumber() ? (int) args[2].asNumber() : SOMAXCONN;
+
+		addrinfo *found = resolve(args[0].asString(), (int) args[1].asNumber(), true);
+		int fd = socket(found->ai_family, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+		bool ok = fd >= 0;
+		if (ok) {
+			int yes = 1;
+			setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &yes, sizeof(yes));
+			ok = bind(fd, found->ai_addr, found->ai_addrlen) == 0 && listen(fd, backlog) == 0;
+		}
+		freeaddrinfo(found);
+		if (!ok) {
+			auto error = fdError("tcp_listen");
+			if (fd >= 0)
+				close(fd);
+			throw error;
+		}
+		return RyValue((double) fd);
+	}
+
+	// Native 'tcp_accept(listener)' - waits for the next connection and returns its fd
+	inline RyValue ry_tcp_accept(int argCount, RyValue *args, std::map<std::string, RyValue> &globals) {
+		int listener = fdArg(argCount, args, 0, "tcp_accept");
+		return retryOnFd(listener, FD_READ, [listener](RyValue &result) {
+			int fd = accept4(listener, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+			if (fd < 0) {
+				if (wouldBlock() || errno == ECONNABORTED)
+					return false;
+				throw fdError("tcp_accept");
+			}
+			int yes = 1;
+			setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &yes, sizeof(yes));
+			result = RyValue((double) fd);
+			return true;
+		});
+	}
+
+	// Native 'tcp_connect(host, port)' - waits until the connection is up and returns its fd
+	inline RyValue ry_tcp_connect(int argCount, RyValue *args, std::map<std::string, RyValue> &globals) {
+		if (argCount < 2 || !args[0].isString() || !args[1].isNumber())
+			throw std::runtime_error("tcp_connect() expects a host and a port.");
+
+		addrinfo *found = resolve(args[0].asString(), (int) args[1].asNumber(), false);
+		int fd = socket(found->ai_family, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+		if (fd < 0) {
+			freeaddrinfo(found);
+			throw fdError("tcp_connect");
+		}
+		int yes = 1;
+		setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &yes, sizeof(yes));
+		int status = connect(fd, found->ai_addr, found->ai_addrlen);
+		freeaddrinfo(found);
+		if (status < 0 && !wouldBlock()) {
+			auto error = fdError("tcp_connect");
+			close(fd);
+			throw error;
+		}
+
+		// The socket turns writable once the handshake is done, SO_ERROR tells how it went
+		return retryOnFd(fd, FD_WRITE, [fd, pending = status < 0](RyValue &result) {
+			if (pending) {
+				pollfd target{fd, POLLOUT, 0};
+				if (poll(&target, 1, 0) == 0)
+					return false;
+				int error = 0;
+				socklen_t length = sizeof(error);
+				getsockopt(fd, SOL_SOCKET, SO_ERROR, &error, &length);
+				if (error != 0) {
+					close(fd);
+					errno = error;
+					throw fdError("tcp_connect");
+				}
+			}
+			result = RyValue((double) fd);
+			return true;
+		});
+	}
+
+	// Native 'tcp_port(fd)' - the local port of a socket, handy after tcp_listen(host, 0)
+	inline RyValue ry_tcp_port(int argCount, RyValue *args, std::map<std::string, RyValue> &globals) {
+		int fd = fdArg(argCount, args, 0, "tcp_port");
+		sockaddr_storage address{};
+		socklen_t length = sizeof(address);
+		if (getsockname(fd, (sockaddr *) &address, &length) < 0)
+			throw fdError("tcp_port");
+		if (address.ss_family == AF_INET6)
+			return RyValue((double) ntohs(((sockaddr_in6 *) &address)->sin6_port));
+		return RyValue((double) ntohs(((sockaddr_in *) &address)->sin_port));
+	}
+} // namespace RyRuntime
+#endif
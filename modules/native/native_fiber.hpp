@@ -0,0 +1,49 @@
+#pragma once
+#include <chrono>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+#include "native_thread.hpp"
+#include "value.h"
+#include "vm.h"
+
+namespace RyRuntime {
+	// Native 'fiber(func, ...args)' - runs func concurrently on this VM, switching at yield()/sleep()/channels
+	inline RyValue ry_fiber(int argCount, RyValue *args, std::map<std::string, RyValue> &globals) {
+		if (argCount < 1 || !(args[0].isClosure() || args[0].isFunction() || args[0].isBoundMethod() || args[0].isNative()))
+			throw std::runtime_error("fiber() expects a function.");
+
+		VM *vm = VM::current();
+		if (!vm)
+			throw std::runtime_error("fiber() needs a running VM.");
+
+		std::vector<RyValue> callArgs(args + 1, args + argCount);
+		return RyValue(std::static_pointer_cast<RyObject>(vm->spawnFiber(args[0], callArgs)));
+	}
+
+	// Native 'yield()' - lets the other fibers run before this one continues
+	inline RyValue ry_yield(int argCount, RyValue *args, std::map<std::string, RyValue> &globals) {
+		if (VM *vm = parkingVM()) {
+			FiberWait wait;
+			wait.ready = [](Fiber &, RyValue &) { return true; };
+			vm->suspend(std::move(wait));
+		}
+		return RyValue();
+	}
+
+	// Native 'sleep(ms)' - parks the fiber, or the whole thread if nobody else could run
+	inline RyValue ry_sleep(int argCount, RyValue *args, std::map<std::string, RyValue> &globals) {
+		if (argCount < 1 || !args[0].isNumber())
+			throw std::runtime_error("sleep() expects milliseconds.");
+
+		double ms = std::max(0.0, args[0].asNumber());
+		if (VM *vm = parkingVM()) {
+			FiberWait wait;
+			wait.deadline = deadlineAfter(ms);
+			vm->suspend(std::move(wait));
+			return RyValue();
+		}
+		std::this_thread::sleep_for(std::chrono::duration<double, std::milli>(ms));
+		return RyValue();
+	}
+} // namespace RyRuntime
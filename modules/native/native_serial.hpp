@@ -0,0 +1,72 @@
+#pragma once
+#include <cstdlib>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include "bytes.h"
+#include "serial.h"
+#include "value.h"
+
+namespace RyRuntime {
+	// The input of deserialize(): bytes or a string. Read-only bytes (file.map_bytes, freeze) are never
+	// written, so bytes in the result can point into them; anything else is copied out.
+	inline const uint8_t *serialInput(int argCount, RyValue *args, const char *native, size_t &size,
+																		std::shared_ptr<void> &owner) {
+		if (argCount > 0) {
+			if (auto text = std::get_if<std::string>(&args[0].val)) {
+				size = text->size();
+				return (const uint8_t *) text->data();
+			}
+			if (RyBytes *bytes = bytesOf(args[0])) {
+				if (bytes->readOnly)
+					owner = bytes->owner;
+				size = bytes->size;
+				return bytes->data;
+			}
+		}
+		throw std::runtime_error(std::string(native) + "() expects bytes or a string.");
+	}
+
+	// Native 'serialize(value, fd?)' - the value as read-only bytes, or with an fd, written there as it is
+	// encoded and the number of bytes written
+	inline RyValue ry_serialize(int argCount, RyValue *args, std::map<std::string, RyValue> &globals) {
+		if (argCount < 1 || argCount > 2)
+			throw std::runtime_error("serialize() expects a value and an optional file descriptor.");
+		if (argCount == 2) {
+			if (!args[1].isNumber() || args[1].asNumber() < 0)
+				throw std::runtime_error("serialize() expects a file descriptor.");
+			thread_local SerialOutput buffer;
+			buffer.size = 0;
+			size_t written = serialize(args[0], buffer, (int) args[1].asNumber());
+			return RyValue((double) written);
+		}
+
+		SerialOutput encoded;
+		size_t size = serialize(args[0], encoded);
+		std::shared_ptr<uint8_t> block(encoded.release(), std::free);
+		return RyValue(std::static_pointer_cast<RyObject>(std::make_shared<RyBytes>(block, block.get(), size, true)));
+	}
+
+	// Native 'deserialize(data)' - the one value serialize() made
+	inline RyValue ry_deserialize(int argCount, RyValue *args, std::map<std::string, RyValue> &globals) {
+		size_t size = 0, at = 0;
+		std::shared_ptr<void> owner;
+		const uint8_t *data = serialInput(argCount, args, "deserialize", size, owner);
+		RyValue value = deserialize(data, size, at, globals, owner);
+		if (at != size)
+			throw std::runtime_error("deserialize(): " + std::to_string(size - at) +
+															 " bytes left after the value (use deserialize_all for several).");
+		return value;
+	}
+
+	// Native 'deserialize_all(data)' - every value in data, as from serialize() calls writing one after another
+	inline RyValue ry_deserialize_all(int argCount, RyValue *args, std::map<std::string, RyValue> &globals) {
+		size_t size = 0, at = 0;
+		std::shared_ptr<void> owner;
+		const uint8_t *data = serialInput(argCount, args, "deserialize_all", size, owner);
+		auto values = std::make_shared<std::vector<RyValue>>();
+		while (at < size)
+			values->push_back(deserialize(data, size, at, globals, owner));
+		return RyValue(values);
+	}
+} // namespace RyRuntime
@@ -1,13 +1,22 @@
+#pragma once
+#include <chrono>
+#include <ctime>
 #include <iostream>
+#include <memory>
+#include <unordered_map>
+#include "alloc_profile.h"
 #include "colors.h"
 #include "value.h"
+#ifdef __GLIBC__
+#include <malloc.h>
+#endif
 
 namespace RyRuntime {
 	inline RyValue ry_exit(int argCount, RyValue *args, std::map<std::string, RyValue> &globals) {
 		int exitCode = args->asNumber();
 		std::cout << RyColor::BOLD << RyColor::YELLOW << "[Ry] Exited Successfully with exit code: " << exitCode
 							<< RyColor::RESET << std::endl;
-		exit(0);
+		exit(exitCode);
 	}
 
 
@@ -16,6 +25,64 @@ namespace RyRuntime {
 		return RyValue((double) clock() / CLOCKS_PER_SEC);
 	}
 
+	// Nanoseconds on the monotonic clock (CLOCK_MONOTONIC on Linux), from an arbitrary start. Doubles hold them
+	// exactly for 104 days of uptime.
+	inline double monotonicNs() {
+		return (double) std::chrono::duration_cast<std::chrono::nanoseconds>(
+									 std::chrono::steady_clock::now().time_since_epoch())
+				.count();
+	}
+
+	// Native 'now_ns()' - for timing: only differences between two calls mean anything
+	inline RyValue ry_now_ns(int argCount, RyValue *args, std::map<std::string, RyValue> &globals) {
+		return RyValue(monotonicNs());
+	}
+
+	// Native 'monotonic()' - the same clock in seconds
+	inline RyValue ry_monotonic(int argCount, RyValue *args, std::map<std::string, RyValue> &globals) {
+		return RyValue(monotonicNs() / 1e9);
+	}
+
+	// Native 'cpu_time()' - seconds of CPU used by the process, all threads together
+	inline RyValue ry_cpu_time(int argCount, RyValue *args, std::map<std::string, RyValue> &globals) {
+#ifdef _WIN32
+		return RyValue((double) clock() / CLOCKS_PER_SEC);
+#else
+		timespec now{};
+		clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &now);
+		return RyValue(now.tv_sec + now.tv_nsec / 1e9);
+#endif
+	}
+
+	// Native 'mem_stats()' - heap_bytes: what malloc has handed out and not got back (glibc only, null
+	// elsewhere). Under `ry run --alloc-profile` also the objects the VM made that are still alive, per kind
+	// ({"count": n, "bytes": b}, without what lists and maps hold), and allocations/allocated_bytes so far.
+	inline RyValue ry_mem_stats(int argCount, RyValue *args, std::map<std::string, RyValue> &globals) {
+		auto stats = std::make_shared<std::unordered_map<RyValue, RyValue, RyValueHasher>>();
+#if defined(__GLIBC__) && (__GLIBC__ > 2 || __GLIBC_MINOR__ >= 33)
+		(*stats)[RyValue("heap_bytes")] = RyValue((double) mallinfo2().uordblks);
+#else
+		(*stats)[RyValue("heap_bytes")] = RyValue();
+#endif
+		(*stats)[RyValue("profiling")] = RyValue(AllocProfile::enabled);
+		if (!AllocProfile::enabled)
+			return RyValue(stats);
+
+		for (int kind = 0; kind < ALLOC_KINDS; kind++) {
+			if (kind == ALLOC_STRING)
+				continue; // Strings live inside values, there is no object to count
+			auto live = std::make_shared<std::unordered_map<RyValue, RyValue, RyValueHasher>>();
+			(*live)[RyValue("count")] = RyValue((double) AllocProfile::live[kind].count.load(std::memory_order_relaxed));
+			(*live)[RyValue("bytes")] = RyValue((double) AllocProfile::live[kind].bytes.load(std::memory_order_relaxed));
+			(*stats)[RyValue(allocKindName((AllocKind) kind))] = RyValue(live);
+		}
+		long long count, bytes;
+		AllocProfile::totals(count, bytes);
+		(*stats)[RyValue("allocations")] = RyValue((double) count);
+		(*stats)[RyValue("allocated_bytes")] = RyValue((double) bytes);
+		return RyValue(stats);
+	}
+
 	// Native 'clear()' - Useful for clearing output
 	inline RyValue ry_clear(int argCount, RyValue *args, std::map<std::string, RyValue> &globals) {
 #ifdef _WIN32
@@ -0,0 +1,175 @@
+#pragma once
+#include <chrono>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include "isolate.h"
+#include "value.h"
+#include "vm.h"
+
+namespace RyRuntime {
+	// Optional timeout argument in milliseconds, negative means "wait forever"
+	inline double timeoutArg(int argCount, RyValue *args, int index) {
+		if (argCount > index && args[index].isNumber())
+			return args[index].asNumber();
+		return -1;
+	}
+
+	inline std::chrono::steady_clock::time_point deadlineAfter(double timeoutMs) {
+		if (timeoutMs < 0)
+			return std::chrono::steady_clock::time_point::max();
+		return std::chrono::steady_clock::now() +
+					 std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+							 std::chrono::duration<double, std::milli>(timeoutMs));
+	}
+
+	// A fiber parks instead of blocking the whole thread, as long as some other fiber could run meanwhile
+	inline VM *parkingVM() {
+		VM *vm = VM::current();
+		return vm && vm->canSuspend() && vm->hasOtherFibers() ? vm : nullptr;
+	}
+
+	// Native 'spawn(func, ...args)' - runs func on a new VM in its own thread
+	inline RyValue ry_spawn(int argCount, RyValue *args, std::map<std::string, RyValue> &globals) {
+		if (argCount < 1 || !(args[0].isClosure() || args[0].isFunction() || args[0].isBoundMethod()))
+			throw std::runtime_error("spawn() expects a function.");
+
+		std::vector<RyValue> callArgs(args + 1, args + argCount);
+		return RyValue(std::static_pointer_cast<RyObject>(spawnIsolate(args[0], callArgs, globals)));
+	}
+
+	inline RyValue joinFiber(const std::shared_ptr<Fiber> &target, double timeoutMs) {
+		if (target->finished) {
+			if (target->failed)
+				throw std::runtime_error("Fiber panicked: " + target->message);
+			return target->result;
+		}
+
+		VM *vm = VM::current();
+		if (!vm || !vm->canSuspend())
+			throw std::runtime_error("join() can only wait for a fiber from Ry code.");
+
+		FiberWait wait;
+		wait.ready = [target](Fiber &self, RyValue &result) {
+			if (!target->finished)
+				return false;
+			if (target->failed)
+				self.pendingPanic = "Fiber panicked: " + target->message;
+			result = target->result;
+			return true;
+		};
+		wait.deadline = deadlineAfter(timeoutMs);
+		vm->suspend(std::move(wait));
+		return RyValue();
+	}
+
+	// Native 'join(thread, timeout?)' - waits for the result, re-panics if the worker panicked.
+	// Also works on fibers.
+	inline RyValue ry_join(int argCount, RyValue *args, std::map<std::string, RyValue> &globals) {
+		if (argCount > 0 && args[0].isObject()) {
+			if (auto target = std::dynamic_pointer_cast<Fiber>(args[0].asObject()))
+				return joinFiber(target, timeoutArg(argCount, args, 1));
+		}
+
+		auto thread = argCount > 0 && args[0].isObject() ? std::dynamic_pointer_cast<RyThread>(args[0].asObject()) : nullptr;
+		if (!thread)
+			throw std::runtime_error("join() expects a thread or a fiber.");
+
+		if (VM *vm = parkingVM()) {
+			FiberWait wait;
+			wait.ready = [state = thread->state](Fiber &self, RyValue &result) {
+				std::lock_guard<std::mutex> guard(state->lock);
+				if (!state->finished)
+					return false;
+				if (state->panicked)
+					self.pendingPanic = "Worker panicked: " + state->message;
+				result = state->result;
+				return true;
+			};
+			wait.deadline = deadlineAfter(timeoutArg(argCount, args, 1));
+			vm->suspend(std::move(wait));
+			return RyValue();
+		}
+
+		if (!thread->wait(timeoutArg(argCount, args, 1)))
+			return RyValue(); // Timed out
+
+		std::lock_guard<std::mutex> guard(thread->state->lock);
+		if (thread->state->panicked)
+			throw std::runtime_error("Worker panicked: " + thread->state->message);
+		return thread->state->result;
+	}
+
+	// Native 'channel(capacity?)' - no capacity means send() waits for a receiver
+	inline RyValue ry_channel(int argCount, RyValue *args, std::map<std::string, RyValue> &globals) {
+		size_t capacity = 0;
+		if (argCount > 0 && args[0].isNumber() && args[0].asNumber() > 0)
+			capacity = (size_t) args[0].asNumber();
+		return RyValue(std::static_pointer_cast<RyObject>(std::make_shared<RyChannel>(capacity)));
+	}
+
+	inline std::shared_ptr<RyChannel> channelArg(int argCount, RyValue *args, const char *native) {
+		auto channel = argCount > 0 && args[0].isObject() ? std::dynamic_pointer_cast<RyChannel>(args[0].asObject()) : nullptr;
+		if (!channel)
+			throw std::runtime_error(std::string(native) + "() expects a channel.");
+		return channel;
+	}
+
+	// Native 'send(channel, value, timeout?)' - returns false if the timeout ran out
+	inline RyValue ry_send(int argCount, RyValue *args, std::map<std::string, RyValue> &globals) {
+		auto channel = channelArg(argCount, args, "send");
+		if (argCount < 2)
+			throw std::runtime_error("send() expects a value.");
+
+		if (VM *vm = parkingVM()) {
+			auto ticket = std::make_shared<unsigned long long>(0);
+			bool queued = channel->trySend(args[1], *ticket);
+			if (queued && !channel->unbuffered())
+				return RyValue(true);
+
+			FiberWait wait;
+			wait.ready = [channel, value = args[1], ticket](Fiber &self, RyValue &result) {
+				if (*ticket == 0) {
+					if (!channel->trySend(value, *ticket))
+						return false;
+					self.wait.timeoutResult = RyValue(true); // In a buffered channel now, whatever happens next
+				}
+				if (channel->unbuffered() && !channel->taken(*ticket))
+					return false;
+				result = RyValue(true);
+				return true;
+			};
+			wait.deadline = deadlineAfter(timeoutArg(argCount, args, 2));
+			wait.timeoutResult = RyValue(queued);
+			if (channel->unbuffered()) {
+				// No receiver in time: the send fails and leaves nothing behind
+				wait.timedOut = [channel, ticket](RyValue &result) {
+					result = RyValue(*ticket != 0 && !channel->withdraw(*ticket));
+				};
+			}
+			vm->suspend(std::move(wait));
+			return RyValue();
+		}
+		return RyValue(channel->send(args[1], timeoutArg(argCount, args, 2)));
+	}
+
+	// Native 'recv(channel, timeout?)' - returns null if the timeout ran out
+	inline RyValue ry_recv(int argCount, RyValue *args, std::map<std::string, RyValue> &globals) {
+		auto channel = channelArg(argCount, args, "recv");
+		RyValue value;
+		if (VM *vm = parkingVM()) {
+			if (channel->tryRecv(value))
+				return value;
+
+			FiberWait wait;
+			wait.ready = [channel](Fiber &, RyValue &result) { return channel->tryRecv(result); };
+			wait.deadline = deadlineAfter(timeoutArg(argCount, args, 1));
+			vm->suspend(std::move(wait));
+			return RyValue();
+		}
+		if (!channel->recv(value, timeoutArg(argCount, args, 1)))
+			return RyValue();
+		return value;
+	}
+} // namespace RyRuntime
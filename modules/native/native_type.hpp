@@ -1,4 +1,5 @@
 #include <string>
+#include "object.h"
 #include "value.h"
 
 namespace RyRuntime {
@@ -15,6 +16,8 @@ namespace RyRuntime {
 			return std::string("list");
 		if (value.isMap())
 			return std::string("map");
+		if (value.isObject())
+			return value.asObject()->typeName();
 
 		return std::string("unknown");
 	}
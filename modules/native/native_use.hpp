@@ -1,7 +1,12 @@
 #include <iostream>
 #include <memory>
+#include <mutex>
+#include <pthread.h>
 #include <unordered_map>
+#include "extension.h"
 #include "loader.h"
+#include "prefetch.h"
+#include "tools.h"
 #include "value.h"
 
 namespace RyRuntime {
@@ -10,41 +15,91 @@ namespace RyRuntime {
     
     typedef void (*InitFnType)(RegisterFn, void*);
 
-    inline RyValue ry_use(int argCount, RyValue *args, std::map<std::string, RyValue> &globals) {
-        if (argCount < 1 || !args[0].isString()) return RyValue();
+    // A library stays loaded for the life of the process, it is opened and initialized once
+    struct LoadedLibrary {
+        std::vector<std::pair<RyValue, RyValue>> natives; // What its init registered
+    };
+
+    // Finds the library like import() finds scripts (falling back to the system's own search), keyed by its
+    // canonical path. A name only the system's search finds is keyed by the handle it opens to as well, so every
+    // way of naming a library gets the same one. Returns nullptr if it can't be opened.
+    inline const LoadedLibrary *loadLibrary(const std::string &libName) {
+        static std::mutex lock;
+        static std::unordered_map<std::string, LoadedLibrary *> byPath;
+        static std::unordered_map<LibHandle, LoadedLibrary> byHandle;
+
+        std::string found = RyTools::findModulePath(libName, false);
+        std::string path = found.empty() ? libName : moduleKey(found);
+
+        std::lock_guard<std::mutex> guard(lock);
+        auto cached = byPath.find(path);
+        if (cached != byPath.end()) return cached->second;
 
-        std::string libName = args[0].to_string();
-        LibHandle handle = Backend::RyLoader::open(libName);
+        LibHandle handle = Backend::RyLoader::open(path);
 
         if (!handle) {
             std::cerr << "Ry Library Error: " << Backend::RyLoader::getError() << std::endl;
-            return RyValue(); 
+            return nullptr;
         }
+        auto opened = byHandle.find(handle);
+        if (opened != byHandle.end()) return byPath[path] = &opened->second; // Already loaded under another name
 
-        // Create the Map that will be returned to the Ry script
         auto moduleMap = std::make_shared<std::unordered_map<RyValue, RyValue, RyValueHasher>>();
 
-        // The Bridge: This lambda must NOT capture [&] to be used as a raw function pointer
-        auto register_callback = [](const char* name, NativeFn fn, int arity, void* mapPtr) {
-            auto* map = static_cast<std::unordered_map<RyValue, RyValue, RyValueHasher>*>(mapPtr);
-            
-            // Wrap the C++ function into a Ry Native Object
-            auto native = std::make_shared<Frontend::RyNative>(fn, name, arity);
-            
-            // Insert into the Map
-            (*map)[RyValue(name)] = RyValue(native);
-        };
-
-        // Load the "init_ry_module" symbol
-        InitFnType init_module = (InitFnType)Backend::RyLoader::getSymbol(handle, "init_ry_module");
-
-        if (init_module) {
-            init_module(register_callback, moduleMap.get());
+        if (isExtension(handle)) {
+            // Extensions built against rylib-dk.h get the C ABI, after a version check
+            initExtension(handle, libName, moduleMap);
         } else {
-            std::cerr << "Ry Symbol Error: " << Backend::RyLoader::getError() << std::endl;
+            // Otherwise it is a module built with this very tree (like libry_http), using the C++ types directly
+
+            // The Bridge: This lambda must NOT capture [&] to be used as a raw function pointer
+            auto register_callback = [](const char* name, NativeFn fn, int arity, void* mapPtr) {
+                auto* map = static_cast<std::unordered_map<RyValue, RyValue, RyValueHasher>*>(mapPtr);
+
+                // Wrap the C++ function into a Ry Native Object
+                auto native = std::make_shared<Frontend::RyNative>(fn, name, arity);
+
+                // Insert into the Map
+                (*map)[RyValue(name)] = RyValue(native);
+            };
+
+            // Load the "init_ry_module" symbol
+            InitFnType init_module = (InitFnType)Backend::RyLoader::getSymbol(handle, "init_ry_module");
+
+            if (init_module) {
+                init_module(register_callback, moduleMap.get());
+                // Remembered so heap images can find the function again
+                for (auto &entry : *moduleMap) {
+                    if (entry.second.isNative()) entry.second.asNative()->library = libName;
+                }
+            } else {
+                std::cerr << "Ry Symbol Error: " << Backend::RyLoader::getError() << std::endl;
+            }
         }
 
-        // Return the Map as a RyValue
+        LoadedLibrary &library = byHandle[handle];
+        library.natives.assign(moduleMap->begin(), moduleMap->end());
+        return byPath[path] = &library;
+    }
+
+    inline RyValue ry_use(int argCount, RyValue *args, std::map<std::string, RyValue> &globals) {
+        if (argCount < 1 || !args[0].isString()) return RyValue();
+
+        // Resolving a name takes a few file system calls, so each thread remembers what its names resolved to. The
+        // search is relative to the working directory, which only a daemon's forked child changes, so a fork forgets.
+        thread_local std::unordered_map<std::string, const LoadedLibrary *> resolved;
+        static std::once_flag forgetOnFork;
+        std::call_once(forgetOnFork, [] { pthread_atfork(nullptr, nullptr, [] { resolved.clear(); }); });
+
+        const std::string &libName = std::get<std::string>(args[0].val);
+        const LoadedLibrary *&entry = resolved[libName];
+        if (!entry) entry = loadLibrary(libName);
+        const LoadedLibrary *library = entry;
+        if (!library) return RyValue();
+
+        // Every use() gets a map of its own, so an extension changing one doesn't change what other callers see
+        auto moduleMap = std::make_shared<std::unordered_map<RyValue, RyValue, RyValueHasher>>(
+            library->natives.begin(), library->natives.end());
         return RyValue(moduleMap);
     }
-}
\ No newline at end of file
+}
@@ -0,0 +1,102 @@
+/**
+	File: alloc_profile.h
+	Description: The allocation profiler behind `ry run --alloc-profile`. The VM reports every list, map,
+	string, closure, class, instance and bound method it makes, with the function and line that made it; at
+	exit the sites are printed sorted by bytes and the call stacks are written in the collapsed format flame
+	graph tools read. While profiling, the objects themselves are also counted while they live (mem_stats()).
+*/
+
+#pragma once
+#include <atomic>
+#include <cstddef>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+#include "value.h"
+
+namespace RyRuntime {
+	enum AllocKind : uint8_t {
+		ALLOC_STRING,
+		ALLOC_LIST,
+		ALLOC_MAP,
+		ALLOC_CLOSURE,
+		ALLOC_CLASS,
+		ALLOC_INSTANCE,
+		ALLOC_BOUND_METHOD,
+		ALLOC_NATIVE,
+		ALLOC_KINDS
+	};
+
+	const char *allocKindName(AllocKind kind);
+
+	namespace AllocProfile {
+		// Only set by start(), before the first VM exists, so objects are freed the same way they were made
+		extern bool enabled;
+
+		struct Live {
+			std::atomic<long long> count{0};
+			std::atomic<long long> bytes{0};
+		};
+		extern Live live[ALLOC_KINDS]; // Objects made by makeCounted() and not freed yet
+
+		// Turns profiling on and prints the report at exit, the collapsed stacks going to `stacksPath`
+		void start(const std::string &stacksPath);
+
+		// One allocation: `site` is "function:line", `stack` the sites of every frame down to it, joined by ';'
+		void record(AllocKind kind, size_t bytes, const std::string &site, const std::string &stack);
+
+		// Allocations recorded so far, all kinds together
+		void totals(long long &count, long long &bytes);
+	} // namespace AllocProfile
+
+	// Keeps AllocProfile::live up to date for the shared_ptr blocks it hands out (object and control block)
+	template<typename T, AllocKind Kind>
+	struct CountingAllocator {
+		using value_type = T;
+
+		CountingAllocator() = default;
+		template<typename U>
+		CountingAllocator(const CountingAllocator<U, Kind> &) {}
+
+		T *allocate(size_t n) {
+			AllocProfile::live[Kind].count.fetch_add(1, std::memory_order_relaxed);
+			AllocProfile::live[Kind].bytes.fetch_add(n * sizeof(T), std::memory_order_relaxed);
+			return std::allocator<T>().allocate(n);
+		}
+		void deallocate(T *pointer, size_t n) {
+			AllocProfile::live[Kind].count.fetch_sub(1, std::memory_order_relaxed);
+			AllocProfile::live[Kind].bytes.fetch_sub(n * sizeof(T), std::memory_order_relaxed);
+			std::allocator<T>().deallocate(pointer, n);
+		}
+
+		template<typename U>
+		struct rebind {
+			using other = CountingAllocator<U, Kind>;
+		};
+		template<typename U>
+		bool operator==(const CountingAllocator<U, Kind> &) const { return true; }
+	};
+
+	// std::make_shared, counted while profiling
+	template<AllocKind Kind, typename T, typename... Args>
+	inline std::shared_ptr<T> makeCounted(Args &&...args) {
+		if (!AllocProfile::enabled)
+			return std::make_shared<T>(std::forward<Args>(args)...);
+		return std::allocate_shared<T>(CountingAllocator<T, Kind>(), std::forward<Args>(args)...);
+	}
+
+	// What the profiler charges for each (the control block of a shared_ptr is about two pointers)
+	inline size_t listBytes(const std::vector<RyValue> &list) {
+		return sizeof(list) + 2 * sizeof(void *) + list.capacity() * sizeof(RyValue);
+	}
+	inline size_t mapBytes(const std::unordered_map<RyValue, RyValue, RyValueHasher> &map) {
+		return sizeof(map) + 2 * sizeof(void *) + map.bucket_count() * sizeof(void *) +
+					 map.size() * (sizeof(std::pair<const RyValue, RyValue>) + 2 * sizeof(void *));
+	}
+	// Zero when it fits in the string itself and nothing was allocated
+	inline size_t stringBytes(const std::string &text) {
+		return text.capacity() > std::string().capacity() ? text.capacity() + 1 : 0;
+	}
+} // namespace RyRuntime
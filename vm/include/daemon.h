@@ -0,0 +1,28 @@
+/**
+	File: daemon.h
+	Description: `ry daemon` keeps a warm VM (natives registered, stdlib compiled) behind a Unix socket
+	and forks a copy of it for every `ry exec`. The client ships its stdio descriptors with SCM_RIGHTS.
+*/
+
+#pragma once
+#include <functional>
+#include <string>
+#include <vector>
+#include "vm.h"
+
+namespace RyRuntime {
+	// Runs a script on the (forked) warm VM and returns the process exit code
+	using ScriptRunner = std::function<int(VM &vm, const std::string &path, const std::vector<std::string> &args)>;
+
+	// $RY_DAEMON_SOCKET, else $XDG_RUNTIME_DIR/ry.sock, else /tmp/ry-<uid>.sock
+	std::string defaultDaemonSocket();
+
+	// Compiles every stdlib module into the VM's import cache, returns how many
+	int preloadStdlib(VM &vm);
+
+	// Serves requests until killed
+	int runDaemon(VM &vm, const std::string &socketPath, const ScriptRunner &runScript);
+
+	// Runs the script inside the daemon and returns its exit code, or -1 if no daemon is listening
+	int execInDaemon(const std::string &socketPath, const std::string &script, const std::vector<std::string> &args);
+} // namespace RyRuntime
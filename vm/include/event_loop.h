@@ -0,0 +1,55 @@
+/**
+	File: event_loop.h
+	Description: Wakes parked fibers when the file descriptor they wait on becomes ready.
+	Built on epoll, with a timerfd for the earliest sleep() deadline (Linux only).
+*/
+
+#pragma once
+#include <chrono>
+#include <memory>
+#include <unordered_map>
+#include <vector>
+
+namespace RyRuntime {
+	class Fiber;
+
+	// What a fiber waits for on its fd (see FiberWait)
+	enum FdInterest { FD_READ = 1, FD_WRITE = 2 };
+
+	class EventLoop {
+	public:
+		EventLoop();
+		~EventLoop();
+		EventLoop(const EventLoop &) = delete;
+		EventLoop &operator=(const EventLoop &) = delete;
+
+		// False where epoll is missing, callers fall back to sleeping until the deadline
+		bool available() const { return epollFd >= 0; }
+
+		// Sets the fiber's wait.ioReady once `fd` can be read/written. One wake-up per watch() call.
+		// Any number of fibers can wait on one fd; false if this fiber already waits on it for the same thing.
+		bool watch(int fd, int interest, const std::shared_ptr<Fiber> &fiber);
+		void unwatch(int fd, int interest, const std::shared_ptr<Fiber> &fiber);
+		// The fd is about to be closed: forgets it and wakes its fibers with wait.closed set
+		void closing(int fd);
+		bool empty() const { return watchers.empty(); }
+
+		// Blocks until a watched fd is ready or the deadline passes (time_point::max() waits for I/O only)
+		void wait(std::chrono::steady_clock::time_point deadline);
+
+		// Drops every watch (the fibers behind them are gone)
+		void clear();
+
+	private:
+		struct Watch {
+			std::vector<std::weak_ptr<Fiber>> readers;
+			std::vector<std::weak_ptr<Fiber>> writers;
+		};
+
+		void update(int fd, Watch &watch, bool added);
+
+		int epollFd = -1;
+		int timerFd = -1; // Armed for the deadline passed to wait()
+		std::unordered_map<int, Watch> watchers;
+	};
+} // namespace RyRuntime
@@ -0,0 +1,19 @@
+/**
+	File: extension.h
+	Description: The host side of the C extension ABI in lib-dk/rylib-dk.h. `use()` hands extensions the RyApi
+	table and wraps the functions they define as natives.
+*/
+
+#pragma once
+#include <string>
+#include "loader.h"
+#include "value.h"
+
+namespace RyRuntime {
+	// Whether the library was built against rylib-dk.h (it exports ry_abi_version)
+	bool isExtension(LibHandle handle);
+
+	// Checks the ABI version and runs the library's init_ry_module into `module`.
+	// Throws std::runtime_error if the versions don't match or init fails.
+	void initExtension(LibHandle handle, const std::string &libName, RyValue::Map module);
+} // namespace RyRuntime
@@ -5,10 +5,15 @@
  */
 
 #pragma once // Include Guard
+#include <functional>
 #include <string>
 // Contains Chunk that is essential for making bytecode
 #include "chunk.h"
 
+namespace RyRuntime {
+	struct LazyBody;
+}
+
 namespace Frontend {
 	
 
@@ -21,6 +26,7 @@ namespace Frontend {
 		RyRuntime::Chunk chunk; // The data for the function
 		std::string name; // The name of the function
 		int upvalueCount = 0;
+		std::shared_ptr<RyRuntime::LazyBody> lazy; // Set while the body may still be uncompiled, see compileLazy()
 
 		RyFunction() : arity(0), name("") {} // Default Constructor for main
 
@@ -36,6 +42,9 @@ namespace Frontend {
 		NativeFn function; // Contains the raw function
 		std::string name; // Contains the name
 		int arity; // Constains how much parameters it needs
+		std::string library; // The use() library it came from, empty for built-ins
+		std::function<RyValue(int argCount, RyValue *args)> host; // Set for host functions, used instead of `function`
+		bool iterator = false; // foreach calls it with no arguments for every element until it returns null
 
 		RyNative() : name(""), arity(0) {} // Default Constructor
 
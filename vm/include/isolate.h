@@ -0,0 +1,90 @@
+/**
+	File: isolate.h
+	Description: Worker isolates. Every worker runs its own VM on its own thread,
+	values only cross between them as deep copies.
+*/
+
+#pragma once
+#include <condition_variable>
+#include <deque>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include "object.h"
+#include "value.h"
+
+namespace RyRuntime {
+	// Copies a value graph so it shares nothing mutable with the original.
+	// Compiled functions are immutable and stay shared.
+	RyValue deepCopy(const RyValue &value);
+	std::map<std::string, RyValue> deepCopy(const std::map<std::string, RyValue> &globals);
+
+	// What the worker thread and its handle share
+	struct IsolateState {
+		std::mutex lock;
+		std::condition_variable finishedSignal;
+		bool finished = false;
+		bool panicked = false;
+		RyValue result;
+		std::string message; // Panic message of the worker
+	};
+
+	// Handle returned by spawn()
+	class RyThread : public RyObject {
+	public:
+		std::shared_ptr<IsolateState> state = std::make_shared<IsolateState>();
+		std::thread worker;
+
+		~RyThread() override {
+			if (worker.joinable())
+				worker.join();
+		}
+		std::string typeName() const override { return "thread"; }
+
+		// Waits for the worker, returns false if the timeout (ms) ran out first. Negative waits forever.
+		bool wait(double timeoutMs);
+	};
+
+	// Handle returned by channel(). A capacity of 0 makes send() wait for a receiver.
+	class RyChannel : public RyObject {
+	public:
+		explicit RyChannel(size_t capacity) : capacity(capacity) {}
+		std::string typeName() const override { return "channel"; }
+
+		bool send(const RyValue &value, double timeoutMs);
+		bool recv(RyValue &out, double timeoutMs);
+
+		// Non-blocking versions for fibers, which park and retry instead of waiting.
+		// trySend() hands out a ticket, taken(ticket) tells when a receiver got that value.
+		bool trySend(const RyValue &value, unsigned long long &ticket);
+		bool tryRecv(RyValue &out);
+		bool taken(unsigned long long ticket);
+		// Takes back the parked value of an unbuffered send that no receiver got yet; false if one did
+		bool withdraw(unsigned long long ticket);
+		bool unbuffered() const { return capacity == 0; }
+
+	private:
+		std::mutex lock;
+		std::condition_variable changed;
+		std::deque<RyValue> items;
+		size_t capacity;
+		unsigned long long sent = 0; // Tickets handed to senders
+		unsigned long long received = 0; // How many of them were taken
+	};
+
+	// Calls `body(item)` for every element of a list or range on a pool of worker VMs.
+	// The workers share `globals`, the body and the collection read-only, results come back in order.
+	// Returns false (with the first panic in `message`) if an iteration panicked.
+	bool parallelEach(const RyValue &body, const RyValue &collection, const std::map<std::string, RyValue> &globals,
+										std::vector<RyValue> &results, std::string &message);
+
+	// How many spawned isolates are still running (fibers waiting on them must keep polling)
+	int runningIsolates();
+
+	// Starts `callee(args...)` on a fresh VM seeded with a copy of `globals`
+	std::shared_ptr<RyThread> spawnIsolate(const RyValue &callee, const std::vector<RyValue> &args,
+																				 const std::map<std::string, RyValue> &globals);
+} // namespace RyRuntime
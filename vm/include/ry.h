@@ -0,0 +1,91 @@
+/**
+	File: ry.h
+	Description: Embedding API. Compile a script once into a Program, then run it on as many Ry::VMs as you like.
+
+	  auto program = Ry::Program::compile("func greet(name) { return \"hi \" + name }");
+	  Ry::VM vm;
+	  vm.define("log", [](std::span<Ry::Value> args) { std::cout << args[0].to_string(); return Ry::Value(); });
+	  vm.run(*program);
+	  Ry::Value result = vm.call("greet", {Ry::Value("ry")});
+
+	Threads: a Program is immutable and may be shared by any number of threads. A VM belongs to one thread at a
+	time; give every thread its own. Values that hold lists, maps or instances must not be shared between VMs
+	running at the same time (copy them instead).
+*/
+
+#pragma once
+#include <functional>
+#include <memory>
+#include <span>
+#include <stdexcept>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "value.h"
+
+namespace RyRuntime {
+	class VM;
+}
+
+namespace Ry {
+	using Value = RyValue;
+
+	// A function the host hands to scripts. Throw std::runtime_error to panic inside the script.
+	using HostFunction = std::function<Value(std::span<Value> args)>;
+
+	// Compile errors and uncaught panics. what() has the messages, one per line.
+	class Error : public std::runtime_error {
+	public:
+		using std::runtime_error::runtime_error;
+	};
+
+	Value makeList(std::vector<Value> items = {});
+	Value makeMap();
+
+	// A compiled script. Immutable once built, so it is safe to share between threads.
+	class Program {
+	public:
+		// Throws Ry::Error on syntax/compile errors
+		static std::shared_ptr<const Program> compile(const std::string &source, const std::string &name = "<script>");
+		static std::shared_ptr<const Program> compileFile(const std::string &path);
+
+		const std::string &name() const { return programName; }
+
+	private:
+		friend class VM;
+		Program() = default;
+		std::shared_ptr<Frontend::RyFunction> function;
+		// The modules it imports with literal paths, compiled along with it
+		std::unordered_map<std::string, std::shared_ptr<Frontend::RyFunction>> modules;
+		std::shared_ptr<const std::string> source;
+		std::string programName;
+	};
+
+	// An independent interpreter: its own globals, stack and fibers. Nothing is shared with other VMs.
+	class VM {
+	public:
+		VM();
+		~VM();
+		VM(VM &&other) noexcept;
+		VM &operator=(VM &&other) noexcept;
+		VM(const VM &) = delete;
+		VM &operator=(const VM &) = delete;
+
+		// Makes `function` callable from scripts as `name`
+		void define(const std::string &name, HostFunction function);
+		void set(const std::string &name, Value value);
+		Value get(const std::string &name) const; // null if there is no such global
+
+		// Runs the program's top level. Its functions and data stay in this VM's globals.
+		// Throws Ry::Error if it panics.
+		void run(const Program &program);
+
+		// Calls a global function (or any callable value). Throws Ry::Error if it panics.
+		Value call(const std::string &name, const std::vector<Value> &args = {});
+		Value call(const char *name, const std::vector<Value> &args = {}) { return call(std::string(name), args); }
+		Value call(const Value &callee, const std::vector<Value> &args = {});
+
+	private:
+		std::unique_ptr<RyRuntime::VM> vm;
+	};
+} // namespace Ry
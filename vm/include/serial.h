@@ -0,0 +1,48 @@
+/**
+	File: serial.h
+	Description: Values as bytes and back, for files, caches and pipes between processes. The format is
+	MessagePack for what MessagePack has (null, booleans, numbers, strings, bytes, lists, maps), so other
+	languages can read plain data; ranges, instances and second references to the same list, map, instance
+	or bytes use extension types. Shared references and cycles come back as they were.
+*/
+
+#pragma once
+#include <cstdint>
+#include <cstdlib>
+#include <map>
+#include <memory>
+#include <string>
+#include "value.h"
+
+namespace RyRuntime {
+	// Where an encoding is built: a malloc'd block grown with realloc, which moves the pages of a large block
+	// instead of copying them. release() hands the block over, to be freed with std::free.
+	struct SerialOutput {
+		uint8_t *data = nullptr;
+		size_t size = 0;
+		size_t capacity = 0;
+
+		SerialOutput() = default;
+		SerialOutput(const SerialOutput &) = delete;
+		SerialOutput &operator=(const SerialOutput &) = delete;
+		~SerialOutput() { std::free(data); }
+
+		uint8_t *release() {
+			uint8_t *block = data;
+			data = nullptr;
+			size = capacity = 0;
+			return block;
+		}
+	};
+
+	// Appends the encoding of `value` to `out` and returns its size. With an `fd`, `out` is written there
+	// every 64 KiB and at the end instead of holding the whole encoding. Throws std::runtime_error for
+	// values with no encoding (functions, threads...) and failed writes.
+	size_t serialize(const RyValue &value, SerialOutput &out, int fd = -1);
+
+	// Decodes the value at `at` and moves `at` past it. Instances get their class from `globals` by name.
+	// Bytes in the value point into `data` when `owner` keeps it alive (read-only input), otherwise they
+	// are copied. Throws std::runtime_error for broken or truncated data.
+	RyValue deserialize(const uint8_t *data, size_t size, size_t &at, const std::map<std::string, RyValue> &globals,
+											const std::shared_ptr<void> &owner = nullptr);
+} // namespace RyRuntime
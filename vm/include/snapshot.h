@@ -0,0 +1,20 @@
+/**
+	File: snapshot.h
+	Description: Heap images. `ry snapshot` runs a script's top level and writes its globals (with every
+	function, closure, class, list and map they reach) to a file; `ry run app.img` maps it back in.
+*/
+
+#pragma once
+#include <string>
+#include "vm.h"
+
+namespace RyRuntime {
+	// Whether the file starts with the image magic
+	bool isSnapshot(const std::string &path);
+
+	// Writes the VM's globals to `path`. Throws std::runtime_error for values that can't be saved (threads...)
+	void saveSnapshot(const VM &vm, const std::string &path);
+
+	// Restores an image into the VM's globals. Throws std::runtime_error if the image is broken.
+	void loadSnapshot(VM &vm, const std::string &path);
+} // namespace RyRuntime
@@ -0,0 +1,55 @@
+/**
+	File: trace.h
+	Description: What the VM reports when a Ry function is entered and left. `ry run --trace` writes the calls
+	as Chrome trace events (open the file in Perfetto or chrome://tracing), one track per fiber. Built with
+	-DRY_USDT=ON, the same places fire the USDT probes ry:function__entry(name, argc) and
+	ry:function__return(name) for perf, bpftrace and SystemTap.
+*/
+
+#pragma once
+#include <string>
+
+#ifdef RY_USDT
+// A tracer attaching to a probe counts itself in the probe's semaphore, so nothing runs while nobody listens
+#define _SDT_HAS_SEMAPHORES 1
+#include <sys/sdt.h>
+extern "C" {
+	extern volatile unsigned short ry_function__entry_semaphore;
+	extern volatile unsigned short ry_function__return_semaphore;
+}
+#define RY_USDT_ATTACHED (ry_function__entry_semaphore || ry_function__return_semaphore)
+#define RY_PROBE_FUNCTION_ENTRY(name, argc)                                                                            \
+	do {                                                                                                                 \
+		if (ry_function__entry_semaphore)                                                                                  \
+			DTRACE_PROBE2(ry, function__entry, name, argc);                                                                  \
+	} while (0)
+#define RY_PROBE_FUNCTION_RETURN(name)                                                                                 \
+	do {                                                                                                                 \
+		if (ry_function__return_semaphore)                                                                                 \
+			DTRACE_PROBE1(ry, function__return, name);                                                                       \
+	} while (0)
+#else
+#define RY_USDT_ATTACHED false
+#define RY_PROBE_FUNCTION_ENTRY(name, argc)
+#define RY_PROBE_FUNCTION_RETURN(name)
+#endif
+
+namespace RyRuntime {
+	namespace Trace {
+		// Only set by start(), before the first VM runs, and cleared in a forked child
+		extern bool enabled;
+
+		// Whether the VM reports calls at all: a trace is being written or a tracer is attached to a probe
+		inline bool active() { return enabled || RY_USDT_ATTACHED; }
+
+		// Opens `path` for the trace; it is completed at exit. Forked children (HTTP workers, `ry exec`) leave it
+		// to the process that started it and trace nothing
+		void start(const std::string &path);
+
+		// A new track (a thread in the viewer) called `name` followed by its number
+		int newTrack(const char *name);
+
+		void enter(int track, const std::string &function, int argCount);
+		void leave(int track, const std::string &function);
+	} // namespace Trace
+} // namespace RyRuntime
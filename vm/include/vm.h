@@ -5,10 +5,18 @@
 */
 
 #pragma once // Include guard
+#include <chrono>
+#include <deque>
+#include <functional>
 #include <memory>
+#include <set>
+#include "alloc_profile.h"
 #include "chunk.h" // For the byte chunk
+#include "event_loop.h"
 #include "func.h"
 #include "map" // For map
+#include "object.h"
+#include "trace.h"
 #include "unordered_map" // For unordered map
 
 namespace RyRuntime {
@@ -42,31 +50,133 @@ namespace RyRuntime {
 	};
 
 	// Possible exit states for the VM
-	enum InterpretResult { INTERPRET_OK, INTERPRET_COMPILE_ERROR, INTERPRET_RUNTIME_ERROR };
+	// (INTERPRET_YIELD only travels between run() and the fiber scheduler)
+	enum InterpretResult { INTERPRET_OK, INTERPRET_COMPILE_ERROR, INTERPRET_RUNTIME_ERROR, INTERPRET_YIELD };
+
+	class Fiber;
+
+	// Why a fiber is parked and how it gets going again
+	struct FiberWait {
+		// Returns true once the fiber can continue and fills in the result of the call it is parked in.
+		// Empty means "only the deadline wakes it".
+		std::function<bool(Fiber &fiber, RyValue &result)> ready;
+		std::chrono::steady_clock::time_point deadline = std::chrono::steady_clock::time_point::max();
+		RyValue timeoutResult; // Result of the call if the deadline passes first
+		// Also called then, to undo what ready() started; it may change the result
+		std::function<void(RyValue &result)> timedOut;
+
+		// Waiting on a file descriptor: ready() is only retried once the event loop saw it become ready
+		int fd = -1;
+		int interest = 0; // FdInterest flags
+		bool ioReady = false;
+		bool closed = false; // fd_close() closed the fd while the fiber waited
+	};
+
+	// A lightweight thread of Ry code: its own value stack and call frames,
+	// switched cooperatively by the VM that created it.
+	class Fiber : public RyObject {
+	public:
+		static const int STACK_MAX = 256; // Maximum stack
+		static const int FRAMES_MAX = 64; // Maximum call depth
+
+		RyValue stack[STACK_MAX];
+		CallFrame frames[FRAMES_MAX];
+
+		// The VM's registers while this fiber is switched out
+		RyValue *stackTop = stack;
+		int frameCount = 0;
+		int exitFrame = 0;
+		std::shared_ptr<RyUpValue> openUpvalues;
+		std::vector<ControlBlock> panicStack;
+
+		bool started = false; // The callee and its arguments wait on the stack until the first switch
+		int traceTrack = 0; // Its track in a --trace file, given on its first call
+		bool parked = false;
+		FiberWait wait;
+		std::string pendingPanic; // Raised inside the fiber when it resumes
+
+		bool finished = false;
+		bool failed = false;
+		RyValue result;
+		std::string message; // Panic message if it failed
+
+		std::string typeName() const override { return "fiber"; }
+	};
 
 
 	// The main virtual machine class
 	class VM {
 	public:
 		VM(); // Constructor
+		explicit VM(std::map<std::string, RyValue> seed); // Starts with a copy of another VM's globals
 		~VM() = default; // Default Constructor
 
-		// The main entry point to run a piece of Ry code
-		InterpretResult interpret(std::shared_ptr<Frontend::RyFunction> function);
+		// The main entry point to run a piece of Ry code. `source` is only used to quote lines in error messages.
+		InterpretResult interpret(std::shared_ptr<Frontend::RyFunction> function,
+															std::shared_ptr<const std::string> source = nullptr);
+
+		// Calls a function/closure/class to completion and hands back its return value.
+		// Re-entrant: natives may use it while the VM is already running.
+		InterpretResult call(RyValue callee, const std::vector<RyValue> &args, RyValue &result);
+
+		// The message of the last panic nobody caught
+		std::string panicMessage;
+
+		// --- Fibers ---
+		static VM *current(); // The VM running Ry code on this thread, if any
+		std::shared_ptr<Fiber> spawnFiber(RyValue callee, const std::vector<RyValue> &args);
+		// Parking is only possible from natives called straight from Ry code, not from natives nested in call()
+		bool canSuspend() const { return runDepth == 1; }
+		// Whether anyone else could run while the current fiber waits
+		bool hasOtherFibers() const { return fiber != mainFiber || !waiting.empty(); }
+		// Parks the current fiber once the running native returns
+		void suspend(FiberWait wait);
+		// Wakes the fibers waiting on `fd` with a panic, before it is closed
+		void closingFd(int fd) { events.closing(fd); }
+
+		// Compiles a script and, in parallel, the modules it imports (they go into the import cache).
+		// Returns nullptr if the script has errors, which have been reported.
+		std::shared_ptr<Frontend::RyFunction> compile(const std::string &source, const std::string &name);
+		// Adds already compiled modules to the import cache
+		void addModules(const std::unordered_map<std::string, std::shared_ptr<Frontend::RyFunction>> &modules);
+
+		// Compiles a module into the import cache without running it (used to pre-warm `ry daemon`)
+		bool preload(const std::string &fileName);
+		void defineGlobal(const std::string &name, RyValue value);
+		const std::map<std::string, RyValue> &getGlobals() const { return globals; }
 
 		// Resolver
 		void resolve(Backend::Expr *expr, int depth) { locals[expr] = depth; }
 
 	private:
+		friend struct VMBench; // bench/micro.cpp times push()/pop()
+
 		InterpretResult run(); // Runs ry
+		std::shared_ptr<RyClosure> loadModule(const std::string &fileName); // Compiled import, nullptr if it failed
+		InterpretResult execute(); // The dispatch loop behind run()
+		InterpretResult schedule(); // Runs the current fiber, then every other fiber until all are done
+		std::shared_ptr<Fiber> nextFiber(); // Picks (and waits for) the next fiber that can continue
+		void switchTo(std::shared_ptr<Fiber> next);
+		void finishFiber(InterpretResult status);
+		int runDepth = 0; // Nested run() loops on the C++ stack
+		bool suspendRequested = false;
+		std::shared_ptr<Fiber> fiber; // The fiber whose stack is loaded
+		std::shared_ptr<Fiber> mainFiber; // Runs the script (or call()) itself, everything else is a fiber()
+		std::deque<std::shared_ptr<Fiber>> waiting; // Fibers that are switched out and not finished
+		EventLoop events; // Wakes fibers parked on file descriptors
 		std::map<std::string, RyValue> globals; // Data outside classes/functions
 		std::vector<ControlBlock> panicStack; // Stacks caused by a panic
 		std::shared_ptr<RyUpValue> openUpvalues;
-		std::unordered_map<std::string, std::shared_ptr<RyClosure>> moduleCache;
+		std::unordered_map<std::string, std::shared_ptr<RyClosure>> moduleCache; // By moduleKey()
+		std::set<std::string> namespaces; // Declared by everything compiled so far (the REPL keeps using them)
 
 		uint8_t *ip; // Points to the NEXT byte to be executed
-		CallFrame frames[64]; // The "Call Stack"
+		static const int FRAMES_MAX = Fiber::FRAMES_MAX; // Maximum call depth
+		CallFrame *frames; // The "Call Stack" of the current fiber
 		int frameCount; // Current depth
+		int exitFrame = 0; // run() returns once the frame count drops back to this
+		bool reportErrors = false; // Print uncaught panics (only for scripts, not for call())
+		std::shared_ptr<const std::string> source; // Of the script interpret() is running
 
 		// The bytecode it is currently running
 		Chunk *chunk;
@@ -74,8 +184,8 @@ namespace RyRuntime {
 		std::map<Backend::Expr *, int> locals; // Data inside classes/functions
 
 		// --- The Stack ---
-		static const int STACK_MAX = 256; // Maximum stack
-		RyValue stack[STACK_MAX]; // The stack
+		static const int STACK_MAX = Fiber::STACK_MAX; // Maximum stack
+		RyValue *stack; // The stack of the current fiber
 		RyValue *stackTop; // Points to where the next pushed value will go
 		RyValue peek(int distance); // Returns the stack based on the distance
 
@@ -86,8 +196,18 @@ namespace RyRuntime {
 
 		// Runtime helpers
 		void runtimeError(const char *format, ...); // Calls report() for advance error reporting
+		bool callValue(RyValue callee, int argCount); // Sets up a call, false if it failed
 		bool isTruthy(RyValue value);
+		// The global `name`, or nullptr after an "Undefined variable" error (with the closest name if there is one)
+		RyValue *findGlobal(const std::string &name, bool assigning = false);
+		bool indexValue(const RyValue &object, const RyValue &index, RyValue &out); // object[index], false if it failed
+		RyValue lengthOf(const RyValue &value); // value.len, null for what has no length
 		std::shared_ptr<RyUpValue> captureUpvalue(RyValue *local);
 		void closeUpvalues(RyValue *last);
+		// Charges an allocation to the running function and line (only called while AllocProfile::enabled)
+		void noteAllocation(AllocKind kind, size_t bytes);
+		// While Trace::active(): the top frame was just entered, or the frames from `depth` up are being left
+		void traceEnter(int argCount);
+		void traceLeave(int depth);
 	};
 } // namespace RyRuntime
@@ -0,0 +1,106 @@
+#include "alloc_profile.h"
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <mutex>
+
+namespace RyRuntime {
+	const char *allocKindName(AllocKind kind) {
+		static const char *names[ALLOC_KINDS] = {"string", "list", "map", "closure",
+																						 "class", "instance", "bound_method", "native"};
+		return kind < ALLOC_KINDS ? names[kind] : "?";
+	}
+
+	namespace AllocProfile {
+		bool enabled = false;
+		Live live[ALLOC_KINDS];
+
+		namespace {
+			struct Site {
+				long long count = 0;
+				long long bytes = 0;
+			};
+
+			// Isolates record from their own threads
+			std::mutex lock;
+			std::unordered_map<std::string, Site> sites[ALLOC_KINDS];
+			std::unordered_map<std::string, long long> stacks; // Bytes per collapsed stack, the kind as its last frame
+			std::string stacksFile;
+
+			void report() {
+				std::lock_guard<std::mutex> guard(lock);
+				struct Row {
+					AllocKind kind;
+					const std::string *site;
+					Site totals;
+				};
+				std::vector<Row> rows;
+				Site all, byKind[ALLOC_KINDS];
+				for (int kind = 0; kind < ALLOC_KINDS; kind++) {
+					for (const auto &[site, totals]: sites[kind]) {
+						rows.push_back({(AllocKind) kind, &site, totals});
+						byKind[kind].count += totals.count;
+						byKind[kind].bytes += totals.bytes;
+					}
+					all.count += byKind[kind].count;
+					all.bytes += byKind[kind].bytes;
+				}
+				std::sort(rows.begin(), rows.end(), [](const Row &a, const Row &b) {
+					return a.totals.bytes != b.totals.bytes ? a.totals.bytes > b.totals.bytes : a.totals.count > b.totals.count;
+				});
+
+				std::fprintf(stderr, "\n--- Allocations: %lld, %lld bytes ---\n", all.count, all.bytes);
+				for (int kind = 0; kind < ALLOC_KINDS; kind++) {
+					if (byKind[kind].count)
+						std::fprintf(stderr, "%-14s %12lld %16lld\n", allocKindName((AllocKind) kind), byKind[kind].count,
+												 byKind[kind].bytes);
+				}
+				std::fprintf(stderr, "\n%-32s %-14s %12s %16s %7s\n", "site", "kind", "count", "bytes", "share");
+				size_t shown = std::min<size_t>(rows.size(), 40);
+				for (size_t i = 0; i < shown; i++) {
+					const Row &row = rows[i];
+					std::fprintf(stderr, "%-32s %-14s %12lld %16lld %6.1f%%\n", row.site->c_str(), allocKindName(row.kind),
+											 row.totals.count, row.totals.bytes, all.bytes ? 100.0 * row.totals.bytes / all.bytes : 0.0);
+				}
+				if (rows.size() > shown)
+					std::fprintf(stderr, "(%zu more sites)\n", rows.size() - shown);
+
+				std::ofstream out(stacksFile);
+				for (const auto &[stack, bytes]: stacks)
+					out << stack << ' ' << bytes << '\n';
+				if (out)
+					std::fprintf(stderr, "Collapsed stacks (bytes) written to %s\n", stacksFile.c_str());
+				else
+					std::fprintf(stderr, "Could not write %s\n", stacksFile.c_str());
+			}
+		} // namespace
+
+		void start(const std::string &stacksPath) {
+			if (enabled)
+				return;
+			enabled = true;
+			stacksFile = stacksPath;
+			std::atexit(report); // Also covers exit() from a script
+		}
+
+		void record(AllocKind kind, size_t bytes, const std::string &site, const std::string &stack) {
+			std::lock_guard<std::mutex> guard(lock);
+			Site &totals = sites[kind][site];
+			totals.count++;
+			totals.bytes += (long long) bytes;
+			stacks[stack + ";[" + allocKindName(kind) + "]"] += (long long) bytes;
+		}
+
+		void totals(long long &count, long long &bytes) {
+			std::lock_guard<std::mutex> guard(lock);
+			count = bytes = 0;
+			for (const auto &kind: sites) {
+				for (const auto &[site, totals]: kind) {
+					count += totals.count;
+					bytes += totals.bytes;
+				}
+			}
+		}
+	} // namespace AllocProfile
+} // namespace RyRuntime
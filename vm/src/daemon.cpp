@@ -0,0 +1,322 @@
+#include "daemon.h"
+#include <cerrno>
+#include <csignal>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <iostream>
+#include <map>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#endif
+
+namespace fs = std::filesystem;
+
+namespace RyRuntime {
+	std::string defaultDaemonSocket() {
+		if (const char *path = std::getenv("RY_DAEMON_SOCKET"))
+			return path;
+		if (const char *runtime = std::getenv("XDG_RUNTIME_DIR"))
+			return std::string(runtime) + "/ry.sock";
+#ifndef _WIN32
+		return "/tmp/ry-" + std::to_string(getuid()) + ".sock";
+#else
+		return "";
+#endif
+	}
+
+	int preloadStdlib(VM &vm) {
+		int count = 0;
+		for (const char *directory: {"./modules/library", "/usr/lib/ry"}) {
+			std::error_code error;
+			for (auto const &entry: fs::directory_iterator(directory, error)) {
+				if (entry.path().extension() == ".ry" && vm.preload(entry.path().string()))
+					count++;
+			}
+		}
+		return count;
+	}
+
+#ifndef _WIN32
+	namespace {
+		// Wire format: a u32 payload size, then "cwd\0script\0arg\0...". The first message carries
+		// the client's stdin/stdout/stderr. The daemon answers with the i32 exit code.
+		const uint32_t MAX_REQUEST = 1 << 20;
+#ifdef MSG_CMSG_CLOEXEC
+		const int RECEIVE_FLAGS = MSG_WAITALL | MSG_CMSG_CLOEXEC;
+#else
+		const int RECEIVE_FLAGS = MSG_WAITALL;
+#endif
+
+		int childExited[2] = {-1, -1}; // Self-pipe, SIGCHLD wakes up poll() through it
+
+		void onChildExit(int) {
+			int saved = errno;
+			char byte = 0;
+			ssize_t written = write(childExited[1], &byte, 1);
+			(void) written;
+			errno = saved;
+		}
+
+		bool fillAddress(const std::string &path, sockaddr_un &address) {
+			address = sockaddr_un{};
+			address.sun_family = AF_UNIX;
+			if (path.size() >= sizeof(address.sun_path))
+				return false;
+			std::memcpy(address.sun_path, path.c_str(), path.size() + 1);
+			return true;
+		}
+
+		bool readRequest(int client, std::vector<int> &fds, std::vector<std::string> &fields) {
+			uint32_t size = 0;
+			alignas(cmsghdr) char control[CMSG_SPACE(sizeof(int) * 3)];
+			iovec io{&size, sizeof(size)};
+			msghdr message{};
+			message.msg_iov = &io;
+			message.msg_iovlen = 1;
+			message.msg_control = control;
+			message.msg_controllen = sizeof(control);
+			ssize_t received = recvmsg(client, &message, RECEIVE_FLAGS);
+
+			for (cmsghdr *header = CMSG_FIRSTHDR(&message); header; header = CMSG_NXTHDR(&message, header)) {
+				if (header->cmsg_level == SOL_SOCKET && header->cmsg_type == SCM_RIGHTS) {
+					int *passed = (int *) CMSG_DATA(header);
+					fds.assign(passed, passed + (header->cmsg_len - CMSG_LEN(0)) / sizeof(int));
+				}
+			}
+			if (received != sizeof(size) || size > MAX_REQUEST || fds.size() != 3)
+				return false;
+
+			std::string payload(size, '\0');
+			if (recv(client, payload.data(), size, MSG_WAITALL) != (ssize_t) size)
+				return false;
+			for (size_t at = 0; at < payload.size();) {
+				size_t end = payload.find('\0', at);
+				if (end == std::string::npos)
+					end = payload.size();
+				fields.push_back(payload.substr(at, end - at));
+				at = end + 1;
+			}
+			return fields.size() >= 2;
+		}
+
+		bool samePeer(int client) {
+#ifdef SO_PEERCRED
+			ucred credentials{};
+			socklen_t length = sizeof(credentials);
+			if (getsockopt(client, SOL_SOCKET, SO_PEERCRED, &credentials, &length) < 0)
+				return false;
+			return credentials.uid == getuid();
+#else
+			uid_t uid;
+			gid_t gid;
+			return getpeereid(client, &uid, &gid) == 0 && uid == getuid();
+#endif
+		}
+	} // namespace
+
+	int runDaemon(VM &vm, const std::string &socketPath, const ScriptRunner &runScript) {
+		sockaddr_un address;
+		if (!fillAddress(socketPath, address)) {
+			std::cerr << "ry daemon: socket path too long: " << socketPath << "\n";
+			return 1;
+		}
+
+		int listener = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+		if (connect(listener, (sockaddr *) &address, sizeof(address)) == 0) {
+			std::cerr << "ry daemon: already running on " << socketPath << "\n";
+			return 1;
+		}
+		unlink(socketPath.c_str()); // Left behind by a daemon that died
+
+		mode_t previous = umask(077); // Only our own user may hand us scripts
+		bool bound = bind(listener, (sockaddr *) &address, sizeof(address)) == 0 && listen(listener, SOMAXCONN) == 0;
+		umask(previous);
+		if (!bound) {
+			std::cerr << "ry daemon: cannot listen on " << socketPath << ": " << std::strerror(errno) << "\n";
+			return 1;
+		}
+
+		if (pipe(childExited) < 0)
+			return 1;
+		fcntl(childExited[0], F_SETFL, O_NONBLOCK);
+		fcntl(childExited[1], F_SETFL, O_NONBLOCK);
+		fcntl(childExited[0], F_SETFD, FD_CLOEXEC);
+		fcntl(childExited[1], F_SETFD, FD_CLOEXEC);
+		signal(SIGCHLD, onChildExit);
+		signal(SIGPIPE, SIG_IGN);
+
+		int modules = preloadStdlib(vm);
+		std::cout << "ry daemon: listening on " << socketPath << " (" << modules << " modules cached)" << std::endl;
+
+		std::map<pid_t, int> sessions; // Running script -> the client waiting for its exit code
+		for (;;) {
+			std::vector<pollfd> watched = {{listener, POLLIN, 0}, {childExited[0], POLLIN, 0}};
+			for (auto const &[pid, client]: sessions) {
+				watched.push_back({client, POLLIN, 0}); // Readable only when the client hung up
+			}
+			if (poll(watched.data(), watched.size(), -1) < 0) {
+				if (errno == EINTR)
+					continue;
+				break;
+			}
+
+			// Finished scripts: hand the exit code back
+			if (watched[1].revents) {
+				char drain[64];
+				while (read(childExited[0], drain, sizeof(drain)) > 0) {
+				}
+				int status;
+				pid_t pid;
+				while ((pid = waitpid(-1, &status, WNOHANG)) > 0) {
+					auto session = sessions.find(pid);
+					if (session == sessions.end())
+						continue;
+					int32_t code = WIFEXITED(status) ? WEXITSTATUS(status) : 128 + WTERMSIG(status);
+					send(session->second, &code, sizeof(code), MSG_NOSIGNAL);
+					close(session->second);
+					sessions.erase(session);
+				}
+			}
+
+			// A client that went away (Ctrl-C) takes its script with it
+			for (size_t i = 2; i < watched.size(); i++) {
+				if (!watched[i].revents)
+					continue;
+				for (auto const &[pid, client]: sessions) {
+					if (client == watched[i].fd)
+						kill(pid, SIGTERM);
+				}
+			}
+
+			if (!(watched[0].revents & POLLIN))
+				continue;
+			int client = accept(listener, nullptr, nullptr);
+			if (client < 0)
+				continue;
+			fcntl(client, F_SETFD, FD_CLOEXEC);
+			timeval timeout{1, 0}; // A stuck client must not stall everyone else
+			setsockopt(client, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+
+			std::vector<int> fds;
+			std::vector<std::string> fields;
+			if (!samePeer(client) || !readRequest(client, fds, fields)) {
+				for (int fd: fds)
+					close(fd);
+				close(client);
+				continue;
+			}
+
+			pid_t child = fork();
+			if (child == 0) {
+				// The forked copy of the warm VM runs the script with the client's stdio
+				close(listener);
+				close(childExited[0]);
+				close(childExited[1]);
+				for (auto const &[pid, other]: sessions)
+					close(other);
+				close(client);
+				signal(SIGCHLD, SIG_DFL);
+				signal(SIGPIPE, SIG_DFL);
+				for (int i = 0; i < 3; i++) {
+					dup2(fds[i], i);
+					close(fds[i]);
+				}
+
+				if (chdir(fields[0].c_str()) < 0) {
+					std::cerr << "ry exec: cannot enter " << fields[0] << "\n";
+					_exit(1);
+				}
+				std::vector<std::string> args(fields.begin() + 2, fields.end());
+				int code = runScript(vm, fields[1], args);
+				std::cout << std::flush;
+				std::cerr << std::flush;
+				std::fflush(nullptr);
+				_exit(code);
+			}
+
+			for (int fd: fds)
+				close(fd);
+			if (child < 0) {
+				int32_t code = 1;
+				send(client, &code, sizeof(code), MSG_NOSIGNAL);
+				close(client);
+				continue;
+			}
+			sessions[child] = client;
+		}
+		return 1;
+	}
+
+	int execInDaemon(const std::string &socketPath, const std::string &script, const std::vector<std::string> &args) {
+		sockaddr_un address;
+		if (!fillAddress(socketPath, address))
+			return -1;
+		int daemon = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+		if (daemon < 0 || connect(daemon, (sockaddr *) &address, sizeof(address)) < 0) {
+			if (daemon >= 0)
+				close(daemon);
+			return -1;
+		}
+
+		std::error_code error;
+		std::string payload = fs::current_path(error).string();
+		payload += '\0' + script;
+		for (auto const &arg: args)
+			payload += '\0' + arg;
+		uint32_t size = payload.size();
+
+		// Our stdin, stdout and stderr travel along with the request
+		int fds[3] = {0, 1, 2};
+		alignas(cmsghdr) char control[CMSG_SPACE(sizeof(fds))] = {};
+		iovec io[2] = {{&size, sizeof(size)}, {payload.data(), payload.size()}};
+		msghdr message{};
+		message.msg_iov = io;
+		message.msg_iovlen = 2;
+		message.msg_control = control;
+		message.msg_controllen = sizeof(control);
+		cmsghdr *header = CMSG_FIRSTHDR(&message);
+		header->cmsg_level = SOL_SOCKET;
+		header->cmsg_type = SCM_RIGHTS;
+		header->cmsg_len = CMSG_LEN(sizeof(fds));
+		std::memcpy(CMSG_DATA(header), fds, sizeof(fds));
+
+		ssize_t sent = sendmsg(daemon, &message, MSG_NOSIGNAL);
+		if (sent < (ssize_t) sizeof(size)) {
+			close(daemon);
+			return -1;
+		}
+		// Large argument lists may not fit in one message
+		size_t total = sizeof(size) + payload.size();
+		for (size_t done = sent; done < total;) {
+			ssize_t more = send(daemon, payload.data() + (done - sizeof(size)), total - done, MSG_NOSIGNAL);
+			if (more <= 0)
+				break;
+			done += more;
+		}
+
+		int32_t code = 1;
+		if (recv(daemon, &code, sizeof(code), MSG_WAITALL) != sizeof(code)) {
+			std::cerr << "ry exec: lost the daemon\n";
+			code = 1;
+		}
+		close(daemon);
+		return code;
+	}
+#else
+	int runDaemon(VM &, const std::string &, const ScriptRunner &) {
+		std::cerr << "ry daemon is not supported on this platform\n";
+		return 1;
+	}
+
+	int execInDaemon(const std::string &, const std::string &, const std::vector<std::string> &) { return -1; }
+#endif
+} // namespace RyRuntime
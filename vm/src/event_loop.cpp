@@ -0,0 +1,185 @@
+#include "event_loop.h"
+#include <cerrno>
+#include <thread>
+#include "vm.h"
+
+#ifdef __linux__
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+#include <unistd.h>
+#endif
+
+namespace RyRuntime {
+#ifdef __linux__
+	EventLoop::EventLoop() {
+		epollFd = epoll_create1(EPOLL_CLOEXEC);
+		if (epollFd < 0)
+			return;
+
+		timerFd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+		if (timerFd >= 0) {
+			epoll_event event{};
+			event.events = EPOLLIN;
+			event.data.fd = timerFd;
+			epoll_ctl(epollFd, EPOLL_CTL_ADD, timerFd, &event);
+		}
+	}
+
+	EventLoop::~EventLoop() {
+		if (timerFd >= 0)
+			close(timerFd);
+		if (epollFd >= 0)
+			close(epollFd);
+	}
+
+	namespace {
+		bool waitsIn(std::vector<std::weak_ptr<Fiber>> &waiters, const std::shared_ptr<Fiber> &fiber) {
+			// Fibers that are gone are dropped on the way
+			std::erase_if(waiters, [](const std::weak_ptr<Fiber> &waiter) { return waiter.expired(); });
+			for (auto const &waiter: waiters) {
+				if (waiter.lock() == fiber)
+					return true;
+			}
+			return false;
+		}
+
+		void remove(std::vector<std::weak_ptr<Fiber>> &waiters, const std::shared_ptr<Fiber> &fiber) {
+			std::erase_if(waiters, [&](const std::weak_ptr<Fiber> &waiter) {
+				auto locked = waiter.lock();
+				return !locked || locked == fiber;
+			});
+		}
+
+		void wake(std::vector<std::weak_ptr<Fiber>> &waiters, bool closed = false) {
+			for (auto &waiter: waiters) {
+				if (auto fiber = waiter.lock()) {
+					fiber->wait.ioReady = true;
+					fiber->wait.closed |= closed;
+				}
+			}
+			waiters.clear();
+		}
+	} // namespace
+
+	bool EventLoop::watch(int fd, int interest, const std::shared_ptr<Fiber> &fiber) {
+		auto found = watchers.find(fd);
+		bool added = found == watchers.end();
+		Watch &watch = added ? watchers[fd] : found->second;
+		if (((interest & FD_READ) && waitsIn(watch.readers, fiber)) ||
+				((interest & FD_WRITE) && waitsIn(watch.writers, fiber)))
+			return false;
+		if (interest & FD_READ)
+			watch.readers.push_back(fiber);
+		if (interest & FD_WRITE)
+			watch.writers.push_back(fiber);
+		update(fd, watch, added);
+		return true;
+	}
+
+	void EventLoop::unwatch(int fd, int interest, const std::shared_ptr<Fiber> &fiber) {
+		auto found = watchers.find(fd);
+		if (found == watchers.end())
+			return;
+		if (interest & FD_READ)
+			remove(found->second.readers, fiber);
+		if (interest & FD_WRITE)
+			remove(found->second.writers, fiber);
+		update(fd, found->second, false);
+	}
+
+	void EventLoop::closing(int fd) {
+		auto found = watchers.find(fd);
+		if (found == watchers.end())
+			return;
+		epoll_ctl(epollFd, EPOLL_CTL_DEL, fd, nullptr);
+		wake(found->second.readers, true);
+		wake(found->second.writers, true);
+		watchers.erase(found);
+	}
+
+	void EventLoop::update(int fd, Watch &watch, bool added) {
+		epoll_event event{};
+		event.data.fd = fd;
+		if (!watch.readers.empty())
+			event.events |= EPOLLIN | EPOLLRDHUP;
+		if (!watch.writers.empty())
+			event.events |= EPOLLOUT;
+
+		if (event.events == 0) {
+			// Nobody waits any more, so a later close() can't leave a stale registration behind
+			if (!added)
+				epoll_ctl(epollFd, EPOLL_CTL_DEL, fd, nullptr);
+			watchers.erase(fd);
+			return;
+		}
+
+		if (epoll_ctl(epollFd, added ? EPOLL_CTL_ADD : EPOLL_CTL_MOD, fd, &event) < 0) {
+			// Regular files can't be watched but never block either: wake the fibers right away
+			wake(watch.readers);
+			wake(watch.writers);
+			watchers.erase(fd);
+		}
+	}
+
+	void EventLoop::wait(std::chrono::steady_clock::time_point deadline) {
+		int timeout = -1;
+		if (deadline != std::chrono::steady_clock::time_point::max()) {
+			auto left = deadline - std::chrono::steady_clock::now();
+			if (left <= std::chrono::steady_clock::duration::zero())
+				timeout = 0;
+			else if (timerFd < 0)
+				timeout = (int) std::chrono::ceil<std::chrono::milliseconds>(left).count();
+			else {
+				// steady_clock is CLOCK_MONOTONIC, so the deadline can be armed as is (epoll only counts in ms)
+				auto since = deadline.time_since_epoch();
+				auto seconds = std::chrono::duration_cast<std::chrono::seconds>(since);
+				itimerspec spec{};
+				spec.it_value.tv_sec = seconds.count();
+				spec.it_value.tv_nsec = std::chrono::duration_cast<std::chrono::nanoseconds>(since - seconds).count();
+				timerfd_settime(timerFd, TFD_TIMER_ABSTIME, &spec, nullptr);
+			}
+		}
+
+		epoll_event events[256];
+		int count = epoll_wait(epollFd, events, 256, timeout);
+		for (int i = 0; i < count; i++) {
+			int fd = events[i].data.fd;
+			if (fd == timerFd) {
+				uint64_t expirations;
+				ssize_t drained = read(timerFd, &expirations, sizeof(expirations));
+				(void) drained;
+				continue;
+			}
+
+			auto found = watchers.find(fd);
+			if (found == watchers.end())
+				continue;
+
+			Watch &watch = found->second;
+			uint32_t ready = events[i].events;
+			bool failed = ready & (EPOLLERR | EPOLLHUP);
+			if (ready & (EPOLLIN | EPOLLRDHUP) || failed)
+				wake(watch.readers);
+			if (ready & EPOLLOUT || failed)
+				wake(watch.writers);
+			update(fd, watch, false);
+		}
+	}
+
+	void EventLoop::clear() {
+		for (auto const &[fd, watch]: watchers) {
+			epoll_ctl(epollFd, EPOLL_CTL_DEL, fd, nullptr);
+		}
+		watchers.clear();
+	}
+#else
+	EventLoop::EventLoop() {}
+	EventLoop::~EventLoop() {}
+	bool EventLoop::watch(int, int, const std::shared_ptr<Fiber> &) { return true; }
+	void EventLoop::unwatch(int, int, const std::shared_ptr<Fiber> &) {}
+	void EventLoop::closing(int) {}
+	void EventLoop::update(int, Watch &, bool) {}
+	void EventLoop::wait(std::chrono::steady_clock::time_point deadline) { std::this_thread::sleep_until(deadline); }
+	void EventLoop::clear() {}
+#endif
+} // namespace RyRuntime
@@ -0,0 +1,442 @@
+#include "extension.h"
+#include <memory>
+#include <stdexcept>
+#include <vector>
+#include "bytes.h"
+#include "class.h"
+#include "func.h"
+#include "rylib-dk.h"
+#include "vm.h"
+
+// What a call made, in blocks that never move so handles stay put. Unlike a deque it keeps its blocks when values
+// are released, a value made and moved straight into a list at a block boundary would allocate a block every time.
+class MadeValues {
+public:
+	size_t size() const { return count; }
+	RyValue &at(size_t index) { return blocks[index / BLOCK][index % BLOCK]; }
+	RyValue &back() { return at(count - 1); }
+
+	// The next slot, null until it is set
+	RyValue &push() {
+		if (count == blocks.size() * BLOCK)
+			blocks.push_back(std::make_unique<RyValue[]>(BLOCK));
+		return at(count++);
+	}
+
+	// Releases the values from `size` on
+	void shrink(size_t size) {
+		while (count > size)
+			at(--count).val = std::monostate();
+	}
+
+	// Empty for the next call, the blocks of a call that made a lot are given back
+	void reset() {
+		shrink(0);
+		if (blocks.size() > KEPT)
+			blocks.resize(KEPT);
+	}
+
+private:
+	static constexpr size_t BLOCK = 64, KEPT = 16;
+	std::vector<std::unique_ptr<RyValue[]>> blocks;
+	size_t count = 0;
+};
+
+// The C side only ever sees these as opaque pointers
+struct RyContext {
+	MadeValues values;
+	std::string error;
+	void *data = nullptr;
+};
+
+struct RyModule {
+	RyValue::Map map;
+	std::string library;
+};
+
+namespace RyRuntime {
+	namespace {
+		RyHandle handle(const RyValue *value) { return reinterpret_cast<RyHandle>(value); }
+		RyValue *value(RyHandle handle) { return reinterpret_cast<RyValue *>(const_cast<RyOpaqueValue *>(handle)); }
+
+		// Made in place, RyValue's constructors copy what they are given
+		template<typename T, typename... Args>
+		RyHandle make(RyContext *ctx, Args &&...args) {
+			RyValue &slot = ctx->values.push();
+			slot.val.emplace<T>(std::forward<Args>(args)...);
+			return handle(&slot);
+		}
+
+		RyHandle make(RyContext *ctx, RyValue made) {
+			RyValue &slot = ctx->values.push();
+			slot = std::move(made);
+			return handle(&slot);
+		}
+
+		// The value behind `handle`, moved out of the call's values if it is the last of them
+		RyValue take(RyContext *ctx, RyHandle handle) {
+			if (ctx->values.size() == 0 || &ctx->values.back() != value(handle))
+				return *value(handle);
+			RyValue taken = std::move(ctx->values.back());
+			ctx->values.shrink(ctx->values.size() - 1);
+			return taken;
+		}
+
+		// Contexts are kept for the thread's next call, with the blocks their values were made in
+		class Lease {
+		public:
+			RyContext *ctx;
+
+			Lease() {
+				auto &spare = contexts();
+				if (spare.empty()) {
+					ctx = new RyContext();
+				} else {
+					ctx = spare.back().release();
+					spare.pop_back();
+				}
+			}
+
+			~Lease() {
+				ctx->values.reset();
+				ctx->error.clear();
+				ctx->data = nullptr;
+				contexts().emplace_back(ctx);
+			}
+
+		private:
+			static std::vector<std::unique_ptr<RyContext>> &contexts() {
+				thread_local std::vector<std::unique_ptr<RyContext>> spare;
+				return spare;
+			}
+		};
+
+		RyValue call(RyCFunction function, const std::string &name, int arity, void *data, int argCount, RyValue *args) {
+			if (arity >= 0 && argCount != arity)
+				throw std::runtime_error(name + "() expects " + std::to_string(arity) + " arguments but got " +
+																 std::to_string(argCount) + ".");
+
+			Lease lease;
+			RyContext &ctx = *lease.ctx;
+			ctx.data = data;
+			RyHandle few[8];
+			std::vector<RyHandle> many;
+			RyHandle *handles = few;
+			if (argCount > 8) {
+				many.resize(argCount);
+				handles = many.data();
+			}
+			for (int i = 0; i < argCount; i++)
+				handles[i] = handle(&args[i]);
+
+			RyHandle result = nullptr;
+			if (function(&ctx, argCount, handles, &result) != RY_OK)
+				throw std::runtime_error(ctx.error.empty() ? name + "() failed." : ctx.error);
+			if (!result)
+				return RyValue();
+
+			// A value the call made is about to go away, so it can be moved out instead of copied
+			for (size_t made = ctx.values.size(); made-- > 0;) {
+				if (&ctx.values.at(made) == value(result))
+					return std::move(ctx.values.at(made));
+			}
+			return *value(result);
+		}
+
+		RyHandle makeFunction(RyContext *ctx, const char *name, RyCFunction function, int arity, void *data,
+													void (*release)(void *), bool iterator) {
+			// The data goes with the last copy of the function
+			std::shared_ptr<void> owned(data, [release](void *data) {
+				if (release)
+					release(data);
+			});
+			auto native = std::make_shared<Frontend::RyNative>();
+			native->name = name;
+			native->arity = arity;
+			native->iterator = iterator;
+			native->host = [function, name = std::string(name), arity, owned](int argCount, RyValue *args) {
+				return call(function, name, arity, owned.get(), argCount, args);
+			};
+			return make<RyValue::Native>(ctx, std::move(native));
+		}
+
+		// By the variant's index, extensions ask this for every value they look at
+		RyKind kind(RyHandle handle) {
+			const RyValue &v = *value(handle);
+			switch (v.val.index()) {
+				case 0: // null
+					return RY_KIND_NULL;
+				case 1: // Native
+				case 2: // Func
+				case 3: // Closure
+				case 11: // Class
+				case 12: // BoundMethod
+					return RY_KIND_CALLABLE;
+				case 4:
+					return RY_KIND_NUMBER;
+				case 5:
+					return RY_KIND_BOOL;
+				case 6:
+					return RY_KIND_STRING;
+				case 7:
+					return RY_KIND_LIST;
+				case 8:
+					return RY_KIND_RANGE;
+				case 9:
+					return RY_KIND_MAP;
+				case 10:
+					return RY_KIND_INSTANCE;
+				default:
+					return bytesOf(v) ? RY_KIND_BYTES : RY_KIND_OTHER;
+			}
+		}
+
+		// Extensions built before 1.2 don't know RY_KIND_BYTES, bytes are just something else to them
+		RyKind kindBeforeBytes(RyHandle handle) {
+			RyKind found = kind(handle);
+			return found == RY_KIND_BYTES ? RY_KIND_OTHER : found;
+		}
+
+		const RyApi api = {
+				RY_ABI_VERSION,
+				sizeof(RyApi),
+				[](RyModule *module, const char *name, RyCFunction function, int arity) {
+					auto native = std::make_shared<Frontend::RyNative>();
+					native->name = name;
+					native->arity = arity;
+					native->library = module->library;
+					native->host = [function, name = std::string(name), arity](int argCount, RyValue *args) {
+						return call(function, name, arity, nullptr, argCount, args);
+					};
+					(*module->map)[RyValue(name)] = RyValue(native);
+				},
+				kind,
+				[](RyHandle handle, int *out) {
+					auto found = std::get_if<bool>(&value(handle)->val);
+					return found ? (*out = *found, 1) : 0;
+				},
+				[](RyHandle handle, double *out) {
+					auto found = std::get_if<double>(&value(handle)->val);
+					return found ? (*out = *found, 1) : 0;
+				},
+				[](RyHandle handle, RyStringView *out) {
+					auto found = std::get_if<std::string>(&value(handle)->val);
+					return found ? (*out = {found->data(), found->size()}, 1) : 0;
+				},
+				[](RyHandle handle, double *start, double *end) {
+					auto found = std::get_if<RyRange>(&value(handle)->val);
+					return found ? (*start = found->start, *end = found->end, 1) : 0;
+				},
+				[](RyHandle list) -> size_t {
+					auto found = std::get_if<RyValue::List>(&value(list)->val);
+					return found ? (*found)->size() : 0;
+				},
+				[](RyHandle list, size_t index) -> RyHandle {
+					auto found = std::get_if<RyValue::List>(&value(list)->val);
+					return found && index < (*found)->size() ? handle(&(**found)[index]) : nullptr;
+				},
+				[](RyHandle map) -> size_t {
+					auto found = std::get_if<RyValue::Map>(&value(map)->val);
+					return found ? (*found)->size() : 0;
+				},
+				[](RyHandle map, RyHandle key) -> RyHandle {
+					auto found = std::get_if<RyValue::Map>(&value(map)->val);
+					if (!found)
+						return nullptr;
+					auto entry = (*found)->find(*value(key));
+					return entry == (*found)->end() ? nullptr : handle(&entry->second);
+				},
+				[](RyHandle handle) {
+					const RyValue &v = *value(handle);
+					if (v.isNil())
+						return 0;
+					if (v.isNumber())
+						return v.asNumber() != 0 ? 1 : 0;
+					if (v.isBool())
+						return v.asBool() ? 1 : 0;
+					return 1;
+				},
+				[](RyContext *ctx) { return make<std::monostate>(ctx); },
+				[](RyContext *ctx, int boolean) { return make<bool>(ctx, boolean != 0); },
+				[](RyContext *ctx, double number) { return make<double>(ctx, number); },
+				[](RyContext *ctx, const char *data, size_t length) { return make<std::string>(ctx, data, length); },
+				[](RyContext *ctx, size_t length, RyHandle *out) {
+					*out = make<std::string>(ctx, length, '\0');
+					return std::get<std::string>(value(*out)->val).data();
+				},
+				[](RyContext *ctx, size_t capacity) {
+					auto list = std::make_shared<std::vector<RyValue>>();
+					list->reserve(capacity);
+					return make<RyValue::List>(ctx, std::move(list));
+				},
+				[](RyContext *ctx) {
+					return make<RyValue::Map>(ctx, std::make_shared<std::unordered_map<RyValue, RyValue, RyValueHasher>>());
+				},
+				[](RyHandle list, RyHandle item) {
+					auto found = std::get_if<RyValue::List>(&value(list)->val);
+					if (!found)
+						return RY_ERROR;
+					(*found)->push_back(*value(item));
+					return RY_OK;
+				},
+				[](RyHandle map, RyHandle key, RyHandle item) {
+					auto found = std::get_if<RyValue::Map>(&value(map)->val);
+					if (!found)
+						return RY_ERROR;
+					(**found)[*value(key)] = *value(item);
+					return RY_OK;
+				},
+				[](RyContext *ctx, const char *message) {
+					ctx->error = message ? message : "";
+					return RY_ERROR;
+				},
+				[](RyContext *ctx, const char *name, RyCFunction function, int arity, void *data, void (*release)(void *)) {
+					return makeFunction(ctx, name, function, arity, data, release, false);
+				},
+				[](RyContext *ctx) { return ctx->data; },
+				[](RyHandle handle, RyBytesView *out) {
+					RyBytes *bytes = bytesOf(*value(handle));
+					return bytes ? (*out = {bytes->readOnly ? nullptr : bytes->data, bytes->data, bytes->size}, 1) : 0;
+				},
+				[](RyContext *ctx, size_t length, RyHandle *out) {
+					auto bytes = RyBytes::allocate(length);
+					*out = make<RyValue::Object>(ctx, bytes);
+					return bytes->data;
+				},
+				[](RyContext *ctx, const void *memory, size_t length, void *data, void (*release)(void *)) {
+					std::shared_ptr<void> owner(data, [release](void *data) {
+						if (release)
+							release(data);
+					});
+					auto bytes = std::make_shared<RyBytes>(owner, (uint8_t *) memory, length, true);
+					return make<RyValue::Object>(ctx, std::move(bytes));
+				},
+				[](RyContext *ctx, const char *name, RyCFunction next, void *data, void (*release)(void *)) {
+					return makeFunction(ctx, name, next, 0, data, release, true);
+				},
+				[](RyHandle list, size_t index, RyHandle item) {
+					auto found = std::get_if<RyValue::List>(&value(list)->val);
+					if (!found || index >= (*found)->size())
+						return RY_ERROR;
+					(**found)[index] = *value(item);
+					return RY_OK;
+				},
+				[](RyContext *ctx) { return ctx->values.size(); },
+				[](RyContext *ctx, size_t scope) {
+					ctx->values.shrink(scope);
+				},
+				[](RyContext *ctx, RyHandle list, RyHandle item) {
+					auto found = std::get_if<RyValue::List>(&value(list)->val);
+					if (!found)
+						return RY_ERROR;
+					(*found)->push_back(take(ctx, item));
+					return RY_OK;
+				},
+				[](RyContext *ctx, RyHandle map, RyHandle key, RyHandle item) {
+					auto found = std::get_if<RyValue::Map>(&value(map)->val);
+					if (!found)
+						return RY_ERROR;
+					// The value was made last, after its key
+					RyValue taken = take(ctx, item);
+					(**found)[take(ctx, key)] = std::move(taken);
+					return RY_OK;
+				},
+				[](RyContext *ctx, size_t count) {
+					size_t first = ctx->values.size() - count;
+					auto list = std::make_shared<std::vector<RyValue>>();
+					list->reserve(count);
+					for (size_t i = first; i < ctx->values.size(); i++)
+						list->push_back(std::move(ctx->values.at(i)));
+					ctx->values.shrink(first);
+					return make<RyValue::List>(ctx, std::move(list));
+				},
+				[](RyContext *ctx, size_t pairs) {
+					size_t first = ctx->values.size() - 2 * pairs;
+					auto map = std::make_shared<std::unordered_map<RyValue, RyValue, RyValueHasher>>();
+					map->reserve(pairs);
+					for (size_t i = first; i < ctx->values.size(); i += 2)
+						(*map)[std::move(ctx->values.at(i))] = std::move(ctx->values.at(i + 1)); // The last of equal keys wins
+					ctx->values.shrink(first);
+					return make<RyValue::Map>(ctx, std::move(map));
+				},
+				[](RyHandle map, RyStatus (*visit)(void *, RyHandle, RyHandle), void *data) {
+					auto found = std::get_if<RyValue::Map>(&value(map)->val);
+					if (!found)
+						return RY_ERROR;
+					for (const auto &[key, item]: **found) {
+						if (visit(data, handle(&key), handle(&item)) != RY_OK)
+							return RY_ERROR;
+					}
+					return RY_OK;
+				},
+				[](RyHandle instance, RyStatus (*visit)(void *, RyStringView, RyHandle), void *data) {
+					auto found = std::get_if<RyValue::Instance>(&value(instance)->val);
+					if (!found)
+						return RY_ERROR;
+					for (const auto &[name, item]: (*found)->fields) {
+						if (visit(data, {name.data(), name.size()}, handle(&item)) != RY_OK)
+							return RY_ERROR;
+					}
+					return RY_OK;
+				},
+				[](RyContext *ctx, RyHandle handle) { return make<std::string>(ctx, value(handle)->to_string()); },
+				[](RyContext *ctx, RyHandle callable, int argc, const RyHandle *args, RyHandle *result) {
+					VM *vm = VM::current();
+					if (!vm) {
+						*result = make<std::string>(ctx, "call() needs a running VM.");
+						return RY_ERROR;
+					}
+					std::vector<RyValue> arguments;
+					arguments.reserve(argc);
+					for (int i = 0; i < argc; i++)
+						arguments.push_back(*value(args[i]));
+					RyValue returned;
+					if (vm->call(*value(callable), arguments, returned) != INTERPRET_OK) {
+						*result = make<std::string>(ctx, vm->panicMessage);
+						return RY_ERROR;
+					}
+					*result = make(ctx, std::move(returned));
+					return RY_OK;
+				},
+		};
+
+		// The table an extension built for `minor` gets: the current one, with what has changed meaning since put back
+		const RyApi *apiFor(uint32_t minor) {
+			static const RyApi beforeIterators = [] {
+				RyApi older = api;
+				// A function of no arguments was how an iterator was made
+				older.make_function = [](RyContext *ctx, const char *name, RyCFunction function, int arity, void *data,
+																 void (*release)(void *)) {
+					return makeFunction(ctx, name, function, arity, data, release, arity == 0);
+				};
+				return older;
+			}();
+			static const RyApi beforeBytes = [] {
+				RyApi older = beforeIterators;
+				older.kind = kindBeforeBytes;
+				return older;
+			}();
+			return minor < 2 ? &beforeBytes : minor < 3 ? &beforeIterators : &api;
+		}
+	} // namespace
+
+	bool isExtension(LibHandle handle) { return Backend::RyLoader::getSymbol(handle, "ry_abi_version") != nullptr; }
+
+	void initExtension(LibHandle handle, const std::string &libName, RyValue::Map module) {
+		auto abiVersion = (RyAbiVersionFn) Backend::RyLoader::getSymbol(handle, "ry_abi_version");
+		auto init = (RyInitFn) Backend::RyLoader::getSymbol(handle, "init_ry_module");
+		uint32_t version = abiVersion();
+		// Same major, and nothing newer than what this Ry's RyApi has
+		if (version >> 16 != RY_ABI_MAJOR || (version & 0xffff) > RY_ABI_MINOR) {
+			throw std::runtime_error(libName + " was built for extension ABI " + std::to_string(version >> 16) + "." +
+															 std::to_string(version & 0xffff) + ", this Ry has " + std::to_string(RY_ABI_MAJOR) +
+															 "." + std::to_string(RY_ABI_MINOR) + ".");
+		}
+		if (!init)
+			throw std::runtime_error(libName + " has no init_ry_module.");
+
+		RyModule target{module, libName};
+		if (init(apiFor(version & 0xffff), &target) != RY_OK)
+			throw std::runtime_error(libName + " failed to initialize.");
+	}
+} // namespace RyRuntime
@@ -0,0 +1,416 @@
+#include "isolate.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <unordered_map>
+#include "bytes.h"
+#include "class.h"
+#include "collections.h"
+#include "vm.h"
+
+namespace RyRuntime {
+	namespace {
+		// Remembers what was already copied so shared references and cycles survive the copy
+		struct CopyContext {
+			std::unordered_map<const void *, RyValue> values;
+			std::unordered_map<const RyUpValue *, std::shared_ptr<RyUpValue>> upvalues;
+
+			// Mutable bytes are copied per block so slices of one buffer still share the copy: each window is made
+			// empty while walking, then pointed into its block's copy once finish() knows every window on it
+			struct Window {
+				std::shared_ptr<RyBytes> copy;
+				const uint8_t *from;
+			};
+			std::unordered_map<const void *, std::vector<Window>> blocks;
+
+			void finish() {
+				for (auto &[block, windows]: blocks) {
+					const uint8_t *low = windows[0].from, *high = low;
+					for (const Window &window: windows) {
+						low = std::min(low, window.from);
+						high = std::max(high, window.from + window.copy->size);
+					}
+					auto copy = RyBytes::copyOf(low, high - low);
+					for (Window &window: windows) {
+						window.copy->owner = copy->owner;
+						window.copy->data = copy->data + (window.from - low);
+					}
+				}
+				blocks.clear();
+			}
+
+			std::shared_ptr<RyClosure> closure(const std::shared_ptr<RyClosure> &original) {
+				if (!original)
+					return nullptr;
+				auto found = values.find(original.get());
+				if (found != values.end())
+					return found->second.asClosure();
+
+				auto copy = std::make_shared<RyClosure>(original->function);
+				values[original.get()] = RyValue(copy);
+				for (size_t i = 0; i < original->upvalues.size(); i++) {
+					copy->upvalues[i] = upvalue(original->upvalues[i]);
+				}
+				return copy;
+			}
+
+			std::shared_ptr<RyUpValue> upvalue(const std::shared_ptr<RyUpValue> &original) {
+				if (!original)
+					return nullptr;
+				auto found = upvalues.find(original.get());
+				if (found != upvalues.end())
+					return found->second;
+
+				// Open upvalues point into the other VM's stack, so the copy is always closed
+				auto copy = std::make_shared<RyUpValue>();
+				upvalues[original.get()] = copy;
+				copy->closed = value(*original->location);
+				copy->location = &copy->closed;
+				return copy;
+			}
+
+			std::shared_ptr<Frontend::RyClass> klass(const std::shared_ptr<Frontend::RyClass> &original) {
+				if (!original)
+					return nullptr;
+				auto found = values.find(original.get());
+				if (found != values.end())
+					return found->second.asClass();
+
+				auto copy = std::make_shared<Frontend::RyClass>(original->name);
+				values[original.get()] = RyValue(copy);
+				copy->superclass = klass(original->superclass);
+				for (auto const &[name, method]: original->methods) {
+					copy->methods[name] = closure(method);
+				}
+				return copy;
+			}
+
+			RyValue value(const RyValue &original) {
+				if (original.isList()) {
+					auto list = original.asList();
+					auto found = values.find(list.get());
+					if (found != values.end())
+						return found->second;
+
+					auto copy = std::make_shared<std::vector<RyValue>>();
+					values[list.get()] = RyValue(copy);
+					copy->reserve(list->size());
+					for (const auto &item: *list) {
+						copy->push_back(value(item));
+					}
+					return RyValue(copy);
+				}
+				if (original.isMap()) {
+					auto ryMap = original.asMap();
+					auto found = values.find(ryMap.get());
+					if (found != values.end())
+						return found->second;
+
+					auto copy = std::make_shared<std::unordered_map<RyValue, RyValue, RyValueHasher>>();
+					values[ryMap.get()] = RyValue(copy);
+					for (auto const &[key, item]: *ryMap) {
+						(*copy)[value(key)] = value(item);
+					}
+					return RyValue(copy);
+				}
+				if (original.isInstance()) {
+					auto instance = original.asInstance();
+					auto found = values.find(instance.get());
+					if (found != values.end())
+						return found->second;
+
+					auto copy = std::make_shared<Frontend::RyInstance>(klass(instance->klass));
+					values[instance.get()] = RyValue(copy);
+					for (auto const &[name, field]: instance->fields) {
+						copy->fields[name] = value(field);
+					}
+					return RyValue(copy);
+				}
+				if (RyBytes *bytes = bytesOf(original)) {
+					if (bytes->readOnly)
+						return original; // Nobody writes to them, like strings
+					auto found = values.find(bytes);
+					if (found != values.end())
+						return found->second;
+					auto copy = std::make_shared<RyBytes>(nullptr, nullptr, bytes->size, false);
+					blocks[bytes->owner ? bytes->owner.get() : bytes].push_back({copy, bytes->data});
+					return values[bytes] = RyValue(std::static_pointer_cast<RyObject>(copy));
+				}
+				if (RySet *set = collectionOf<RySet>(original)) {
+					auto found = values.find(set);
+					if (found != values.end())
+						return found->second;
+					auto copy = std::make_shared<RySet>();
+					values[set] = RyValue(std::static_pointer_cast<RyObject>(copy));
+					for (size_t at = set->next(0); at < set->capacity(); at = set->next(at + 1))
+						copy->add(value(set->at(at)));
+					return values[set];
+				}
+				if (RyDeque *deque = collectionOf<RyDeque>(original)) {
+					auto found = values.find(deque);
+					if (found != values.end())
+						return found->second;
+					auto copy = std::make_shared<RyDeque>();
+					values[deque] = RyValue(std::static_pointer_cast<RyObject>(copy));
+					for (size_t i = 0; i < deque->size(); i++)
+						copy->pushBack(value(deque->at(i)));
+					return values[deque];
+				}
+				if (RyHeap *heap = collectionOf<RyHeap>(original)) {
+					auto found = values.find(heap);
+					if (found != values.end())
+						return found->second;
+					auto copy = std::make_shared<RyHeap>();
+					values[heap] = RyValue(std::static_pointer_cast<RyObject>(copy));
+					copy->key = value(heap->key);
+					std::vector<RyValue> items, keys;
+					for (size_t i = 0; i < heap->size(); i++) {
+						items.push_back(value(heap->at(i)));
+						if (!heap->key.isNil())
+							keys.push_back(value(heap->keyAt(i)));
+					}
+					copy->assign(std::move(items), std::move(keys));
+					return values[heap];
+				}
+				if (original.isClosure())
+					return RyValue(closure(original.asClosure()));
+				if (original.isClass())
+					return RyValue(klass(original.asClass()));
+				if (original.isBoundMethod()) {
+					auto bound = original.asBoundMethod();
+					return RyValue(std::make_shared<Frontend::RyBoundMethod>(value(bound->receiver), closure(bound->method)));
+				}
+
+				// Numbers, strings, ranges, functions, natives and handles (threads, channels) are
+				// either plain data or meant to be shared between isolates.
+				return original;
+			}
+		};
+	} // namespace
+
+	RyValue deepCopy(const RyValue &value) {
+		CopyContext context;
+		RyValue copy = context.value(value);
+		context.finish();
+		return copy;
+	}
+
+	std::map<std::string, RyValue> deepCopy(const std::map<std::string, RyValue> &globals) {
+		CopyContext context;
+		std::map<std::string, RyValue> copy;
+		for (auto const &[name, value]: globals) {
+			copy[name] = context.value(value);
+		}
+		context.finish();
+		return copy;
+	}
+
+	bool RyThread::wait(double timeoutMs) {
+		std::unique_lock<std::mutex> guard(state->lock);
+		if (timeoutMs < 0) {
+			state->finishedSignal.wait(guard, [&] { return state->finished; });
+			return true;
+		}
+		return state->finishedSignal.wait_for(guard, std::chrono::duration<double, std::milli>(timeoutMs),
+																					[&] { return state->finished; });
+	}
+
+	bool RyChannel::send(const RyValue &value, double timeoutMs) {
+		RyValue copy = deepCopy(value);
+		std::unique_lock<std::mutex> guard(lock);
+		auto deadline = std::chrono::steady_clock::now() + std::chrono::duration<double, std::milli>(timeoutMs);
+		auto waitFor = [&](auto ready) {
+			if (timeoutMs < 0) {
+				changed.wait(guard, ready);
+				return true;
+			}
+			return changed.wait_until(guard, deadline, ready);
+		};
+
+		// An unbuffered channel still parks one value while the sender waits for its receiver
+		size_t limit = capacity == 0 ? 1 : capacity;
+		if (!waitFor([&] { return items.size() < limit; }))
+			return false;
+
+		items.push_back(std::move(copy));
+		unsigned long long ticket = ++sent;
+		changed.notify_all();
+
+		if (capacity == 0 && !waitFor([&] { return received >= ticket; })) {
+			// Nobody took it in time: the value is still the one parked, take it back so the send has no effect
+			items.pop_back();
+			sent--;
+			changed.notify_all();
+			return false;
+		}
+		return true;
+	}
+
+	bool RyChannel::trySend(const RyValue &value, unsigned long long &ticket) {
+		RyValue copy = deepCopy(value);
+		std::lock_guard<std::mutex> guard(lock);
+		if (items.size() >= (capacity == 0 ? 1 : capacity))
+			return false;
+
+		items.push_back(std::move(copy));
+		ticket = ++sent;
+		changed.notify_all();
+		return true;
+	}
+
+	bool RyChannel::tryRecv(RyValue &out) {
+		std::lock_guard<std::mutex> guard(lock);
+		if (items.empty())
+			return false;
+
+		out = std::move(items.front());
+		items.pop_front();
+		received++;
+		changed.notify_all();
+		return true;
+	}
+
+	bool RyChannel::taken(unsigned long long ticket) {
+		std::lock_guard<std::mutex> guard(lock);
+		return received >= ticket;
+	}
+
+	bool RyChannel::withdraw(unsigned long long ticket) {
+		std::lock_guard<std::mutex> guard(lock);
+		if (received >= ticket)
+			return false;
+		items.pop_back();
+		sent--;
+		changed.notify_all();
+		return true;
+	}
+
+	bool RyChannel::recv(RyValue &out, double timeoutMs) {
+		std::unique_lock<std::mutex> guard(lock);
+		auto ready = [&] { return !items.empty(); };
+		if (timeoutMs < 0) {
+			changed.wait(guard, ready);
+		} else if (!changed.wait_for(guard, std::chrono::duration<double, std::milli>(timeoutMs), ready)) {
+			return false;
+		}
+
+		out = std::move(items.front());
+		items.pop_front();
+		received++;
+		changed.notify_all();
+		return true;
+	}
+
+	bool parallelEach(const RyValue &body, const RyValue &collection, const std::map<std::string, RyValue> &globals,
+										std::vector<RyValue> &results, std::string &message) {
+		size_t count = 0;
+		double start = 0;
+		RyValue::List list = nullptr;
+		if (collection.isRange()) {
+			// The same values as foreach: counting up to the end, none if it isn't above the start
+			RyRange range = collection.asRange();
+			start = range.start;
+			count = range.end > range.start ? (size_t) std::ceil(range.end - range.start) : 0;
+		} else if (collection.isList()) {
+			list = collection.asList();
+			count = list->size();
+		} else {
+			message = "Can only use 'parallel foreach' on lists or ranges.";
+			return false;
+		}
+
+		results.assign(count, RyValue());
+		if (count == 0)
+			return true;
+
+		size_t workers = std::max(1u, std::thread::hardware_concurrency());
+		if (const char *requested = std::getenv("RY_THREADS")) {
+			workers = std::max(1, std::atoi(requested));
+		}
+		workers = std::min(workers, count);
+
+		// Small chunks keep every worker busy until the end, the shared cursor hands them out
+		size_t chunk = std::max<size_t>(1, count / (workers * 8));
+		std::atomic<size_t> cursor{0};
+		std::atomic<bool> failed{false};
+		std::mutex messageLock;
+
+		auto work = [&]() {
+			VM vm(globals);
+			std::vector<RyValue> args(1);
+			RyValue result;
+			while (!failed.load(std::memory_order_relaxed)) {
+				size_t first = cursor.fetch_add(chunk);
+				if (first >= count)
+					break;
+				size_t last = std::min(count, first + chunk);
+				for (size_t i = first; i < last; i++) {
+					args[0] = list ? (*list)[i] : RyValue(start + (double) i);
+					if (vm.call(body, args, result) != INTERPRET_OK) {
+						std::lock_guard<std::mutex> guard(messageLock);
+						if (!failed.exchange(true))
+							message = vm.panicMessage;
+						return;
+					}
+					results[i] = std::move(result);
+				}
+			}
+		};
+
+		std::vector<std::thread> pool;
+		for (size_t i = 1; i < workers; i++) {
+			pool.emplace_back(work);
+		}
+		work(); // The calling thread is a worker too
+		for (auto &thread: pool) {
+			thread.join();
+		}
+		return !failed;
+	}
+
+	static std::atomic<int> liveIsolates{0};
+
+	int runningIsolates() { return liveIsolates.load(); }
+
+	std::shared_ptr<RyThread> spawnIsolate(const RyValue &callee, const std::vector<RyValue> &args,
+																				 const std::map<std::string, RyValue> &globals) {
+		// Copy on the spawning thread, the originals keep changing once we return
+		CopyContext context;
+		RyValue function = context.value(callee);
+		std::vector<RyValue> arguments;
+		for (const auto &arg: args) {
+			arguments.push_back(context.value(arg));
+		}
+		std::map<std::string, RyValue> seed;
+		for (auto const &[name, value]: globals) {
+			seed[name] = context.value(value);
+		}
+		context.finish();
+
+		auto handle = std::make_shared<RyThread>();
+		auto state = handle->state;
+		liveIsolates++;
+		handle->worker = std::thread([state, function = std::move(function), arguments = std::move(arguments),
+																	seed = std::move(seed)]() mutable {
+			RyValue result;
+			std::string message;
+			InterpretResult status;
+			{
+				VM vm(std::move(seed));
+				status = vm.call(function, arguments, result);
+				message = vm.panicMessage;
+			}
+
+			std::lock_guard<std::mutex> guard(state->lock);
+			state->finished = true;
+			state->panicked = status != INTERPRET_OK;
+			state->result = std::move(result);
+			state->message = std::move(message);
+			state->finishedSignal.notify_all();
+			liveIsolates--;
+		});
+		return handle;
+	}
+} // namespace RyRuntime
@@ -0,0 +1,97 @@
+#include "ry.h"
+#include <fstream>
+#include "compiler.h"
+#include "prefetch.h"
+#include "func.h"
+#include "tools.h"
+#include "vm.h"
+
+namespace Ry {
+	namespace {
+		// Collects the errors reported on this thread while it is alive instead of printing them
+		class ErrorCapture {
+		public:
+			std::string message(const std::string &fallback) const {
+				if (log.empty())
+					return fallback;
+				return log.back() == '\n' ? log.substr(0, log.size() - 1) : log;
+			}
+
+		private:
+			std::string log;
+			RyTools::CaptureErrors capture{log};
+		};
+	} // namespace
+
+	Value makeList(std::vector<Value> items) { return Value(std::make_shared<std::vector<Value>>(std::move(items))); }
+
+	Value makeMap() { return Value(std::make_shared<std::unordered_map<Value, Value, RyValueHasher>>()); }
+
+	std::shared_ptr<const Program> Program::compile(const std::string &source, const std::string &name) {
+		ErrorCapture errors;
+		std::set<std::string> namespaces;
+		RyRuntime::CompiledProgram compiled = RyRuntime::compileProgram(source, name, namespaces);
+		if (!compiled.main)
+			throw Error(errors.message("Could not compile " + name + "."));
+
+		std::shared_ptr<Program> program(new Program());
+		program->function = compiled.main;
+		program->modules = std::move(compiled.modules);
+		program->source = std::make_shared<const std::string>(source);
+		program->programName = name;
+		return program;
+	}
+
+	std::shared_ptr<const Program> Program::compileFile(const std::string &path) {
+		std::ifstream file(path);
+		if (!file.is_open())
+			throw Error("Could not open file: " + path);
+		std::string source((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+		return compile(source, path);
+	}
+
+	VM::VM() : vm(std::make_unique<RyRuntime::VM>()) {}
+	VM::~VM() = default;
+	VM::VM(VM &&other) noexcept = default;
+	VM &VM::operator=(VM &&other) noexcept = default;
+
+	void VM::define(const std::string &name, HostFunction function) {
+		auto native = std::make_shared<Frontend::RyNative>();
+		native->name = name;
+		native->arity = -1;
+		native->host = [function = std::move(function)](int argCount, RyValue *args) {
+			return function(std::span<Value>(args, argCount));
+		};
+		vm->defineGlobal(name, Value(native));
+	}
+
+	void VM::set(const std::string &name, Value value) { vm->defineGlobal(name, std::move(value)); }
+
+	Value VM::get(const std::string &name) const {
+		auto const &globals = vm->getGlobals();
+		auto found = globals.find(name);
+		return found == globals.end() ? Value() : found->second;
+	}
+
+	void VM::run(const Program &program) {
+		ErrorCapture errors;
+		vm->addModules(program.modules);
+		if (vm->interpret(program.function, program.source) != RyRuntime::INTERPRET_OK)
+			throw Error(errors.message(vm->panicMessage));
+	}
+
+	Value VM::call(const std::string &name, const std::vector<Value> &args) {
+		auto const &globals = vm->getGlobals();
+		auto found = globals.find(name);
+		if (found == globals.end())
+			throw Error("Undefined function '" + name + "'.");
+		return call(found->second, args);
+	}
+
+	Value VM::call(const Value &callee, const std::vector<Value> &args) {
+		Value result;
+		if (vm->call(callee, args, result) != RyRuntime::INTERPRET_OK)
+			throw Error(vm->panicMessage);
+		return result;
+	}
+} // namespace Ry
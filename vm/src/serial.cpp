@@ -0,0 +1,499 @@
+#include "serial.h"
+#include <algorithm>
+#include <cerrno>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <new>
+#include <stdexcept>
+#include <unordered_map>
+#include <vector>
+#include "bytes.h"
+#include "class.h"
+
+#ifndef _WIN32
+#include <unistd.h>
+#endif
+
+// Encoding (big endian, as in MessagePack):
+//   null c0, false c2, true c3
+//   numbers: whole numbers up to 2^53 as the smallest MessagePack integer (fixint, cc-cf, d0-d3),
+//            anything else as float 64 (cb)
+//   strings: fixstr a0-bf, str 8/16/32 (d9-db)       bytes: bin 8/16/32 (c4-c6)
+//   lists:   fixarray 90-9f, array 16/32 (dc, dd)    maps:  fixmap 80-8f, map 16/32 (de, df)
+//   range:     fixext 16 (d8) type 1, start and end as float 64
+//   reference: fixext 4 (d6) type 2, u32 index of an earlier list, map, instance or bytes, numbered in the
+//              order they first appear
+//   instance:  fixext 4 (d6) type 3, u32 field count; followed by the class name (a string) and the fields
+//              as name, value pairs
+
+namespace RyRuntime {
+	namespace {
+		const size_t CHUNK = 64 * 1024;
+		const size_t MAX_DEPTH = 4096;
+
+		enum Extension : uint8_t { EXT_RANGE = 1, EXT_REFERENCE = 2, EXT_INSTANCE = 3 };
+
+		class Encoder {
+		public:
+			Encoder(SerialOutput &out, int fd) : out(out), fd(fd), start(out.size) {}
+
+			void value(const RyValue &item, size_t depth) {
+				if (depth > MAX_DEPTH)
+					throw std::runtime_error("serialize(): nested deeper than " + std::to_string(MAX_DEPTH) + ".");
+				if (fd >= 0 && out.size >= CHUNK)
+					flush();
+
+				switch (item.val.index()) {
+					case 0: // null
+						byte(0xc0);
+						return;
+					case 4:
+						number(std::get<double>(item.val));
+						return;
+					case 5:
+						byte(std::get<bool>(item.val) ? 0xc3 : 0xc2);
+						return;
+					case 6:
+						string(std::get<std::string>(item.val));
+						return;
+					case 8: {
+						const RyRange &range = std::get<RyRange>(item.val);
+						byte(0xd8);
+						byte(EXT_RANGE);
+						big(bitsOf(range.start));
+						big(bitsOf(range.end));
+						return;
+					}
+					case 7: {
+						const RyValue::List &list = std::get<RyValue::List>(item.val);
+						if (reference(list))
+							return;
+						header(list->size(), 0x90, 0xdc);
+						for (const auto &element: *list)
+							value(element, depth + 1);
+						return;
+					}
+					case 9: {
+						const RyValue::Map &map = std::get<RyValue::Map>(item.val);
+						if (reference(map))
+							return;
+						header(map->size(), 0x80, 0xde);
+						for (const auto &[key, field]: *map) {
+							value(key, depth + 1);
+							value(field, depth + 1);
+						}
+						return;
+					}
+					case 10: {
+						const RyValue::Instance &instance = std::get<RyValue::Instance>(item.val);
+						if (reference(instance))
+							return;
+						byte(0xd6);
+						byte(EXT_INSTANCE);
+						big((uint32_t) instance->fields.size());
+						string(instance->klass->name);
+						for (const auto &[name, field]: instance->fields) {
+							string(name);
+							value(field, depth + 1);
+						}
+						return;
+					}
+					default:
+						break;
+				}
+
+				if (RyBytes *bytes = bytesOf(item)) {
+					if (reference(std::get<RyValue::Object>(item.val)))
+						return;
+					sized(bytes->size, 0xc4);
+					append(bytes->data, bytes->size);
+				} else {
+					throw std::runtime_error("serialize(): cannot serialize " + item.to_string() + ".");
+				}
+			}
+
+			// Whatever is still buffered goes to fd
+			void flush() {
+#ifndef _WIN32
+				size_t done = 0;
+				while (done < out.size) {
+					ssize_t wrote = ::write(fd, out.data + done, out.size - done);
+					if (wrote < 0 && errno == EINTR)
+						continue;
+					if (wrote < 0)
+						throw std::runtime_error("serialize(): " + std::string(std::strerror(errno)) + ".");
+					done += (size_t) wrote;
+				}
+				written += done;
+				out.size = 0;
+#else
+				throw std::runtime_error("serialize(): writing to a descriptor is not supported on this platform.");
+#endif
+			}
+
+			size_t size() const { return written + out.size - start; }
+
+		private:
+			SerialOutput &out;
+			int fd;
+			size_t start; // What was in `out` before
+			size_t written = 0;
+			std::unordered_map<const void *, uint32_t> seen; // Shared lists, maps, instances and bytes written so far
+			uint32_t numbered = 0; // All of them, shared or not
+
+			// Doubles the block, at least to fit `more` bytes
+			void grow(size_t more) {
+				size_t capacity = std::max(out.capacity * 2, std::max(out.size + more, CHUNK));
+				auto grown = (uint8_t *) std::realloc(out.data, capacity);
+				if (!grown)
+					throw std::bad_alloc();
+				out.data = grown;
+				out.capacity = capacity;
+			}
+
+			void append(const void *from, size_t count) {
+				if (out.capacity - out.size < count)
+					grow(count);
+				std::memcpy(out.data + out.size, from, count);
+				out.size += count;
+			}
+
+			void byte(uint8_t value) {
+				if (out.size == out.capacity)
+					grow(1);
+				out.data[out.size++] = value;
+			}
+
+			template<typename T>
+			void big(T value) {
+				uint8_t raw[sizeof(T)];
+				for (size_t i = 0; i < sizeof(T); i++)
+					raw[i] = (uint8_t) (value >> (8 * (sizeof(T) - 1 - i)));
+				append(raw, sizeof(T));
+			}
+
+			static uint64_t bitsOf(double value) {
+				uint64_t bits;
+				std::memcpy(&bits, &value, sizeof(bits));
+				return bits;
+			}
+
+			void number(double value) {
+				if (value == std::trunc(value) && std::fabs(value) <= 9007199254740992.0 && !(value == 0 && std::signbit(value))) {
+					int64_t whole = (int64_t) value;
+					if (whole >= 0 && whole < 128) {
+						byte((uint8_t) whole);
+					} else if (whole >= -32 && whole < 0) {
+						byte((uint8_t) (int8_t) whole);
+					} else if (whole >= 0) {
+						if (whole <= UINT8_MAX) {
+							byte(0xcc);
+							byte((uint8_t) whole);
+						} else if (whole <= UINT16_MAX) {
+							byte(0xcd);
+							big((uint16_t) whole);
+						} else if (whole <= UINT32_MAX) {
+							byte(0xce);
+							big((uint32_t) whole);
+						} else {
+							byte(0xcf);
+							big((uint64_t) whole);
+						}
+					} else if (whole >= INT8_MIN) {
+						byte(0xd0);
+						byte((uint8_t) (int8_t) whole);
+					} else if (whole >= INT16_MIN) {
+						byte(0xd1);
+						big((uint16_t) (int16_t) whole);
+					} else if (whole >= INT32_MIN) {
+						byte(0xd2);
+						big((uint32_t) (int32_t) whole);
+					} else {
+						byte(0xd3);
+						big((uint64_t) whole);
+					}
+					return;
+				}
+				byte(0xcb);
+				big(bitsOf(value));
+			}
+
+			// str and bin: a fix form (strings only), then 8, 16 and 32 bit lengths at consecutive tags
+			void sized(size_t size, uint8_t tag8) {
+				if (size > UINT32_MAX)
+					throw std::runtime_error("serialize(): strings and bytes are limited to 4 GB.");
+				if (size <= UINT8_MAX) {
+					byte(tag8);
+					byte((uint8_t) size);
+				} else if (size <= UINT16_MAX) {
+					byte(tag8 + 1);
+					big((uint16_t) size);
+				} else {
+					byte(tag8 + 2);
+					big((uint32_t) size);
+				}
+			}
+
+			void string(const std::string &text) {
+				if (text.size() < 32) {
+					// Most strings (map keys above all) are short: one check for the tag and the text
+					if (out.capacity - out.size < 32)
+						grow(32);
+					out.data[out.size] = (uint8_t) (0xa0 | text.size());
+					std::memcpy(out.data + out.size + 1, text.data(), text.size());
+					out.size += 1 + text.size();
+					return;
+				}
+				sized(text.size(), 0xd9);
+				append(text.data(), text.size());
+			}
+
+			// array and map: a fix form, then 16 and 32 bit counts
+			void header(size_t count, uint8_t fix, uint8_t tag16) {
+				if (count < 16) {
+					byte((uint8_t) (fix | count));
+				} else if (count <= UINT16_MAX) {
+					byte(tag16);
+					big((uint16_t) count);
+				} else {
+					if (count > UINT32_MAX)
+						throw std::runtime_error("serialize(): lists and maps are limited to 2^32 items.");
+					byte(tag16 + 1);
+					big((uint32_t) count);
+				}
+			}
+
+			// Writes a reference if the object was written before, otherwise numbers it. Only objects held in
+			// more than one place can come up again, so the rest are counted without the lookup.
+			template<typename T>
+			bool reference(const std::shared_ptr<T> &object) {
+				uint32_t index = numbered++;
+				if (object.use_count() == 1)
+					return false;
+				auto [found, added] = seen.try_emplace(object.get(), index);
+				if (added)
+					return false;
+				numbered--;
+				byte(0xd6);
+				byte(EXT_REFERENCE);
+				big(found->second);
+				return true;
+			}
+		};
+
+		class Decoder {
+		public:
+			Decoder(const uint8_t *data, size_t size, size_t &at, const std::map<std::string, RyValue> &globals,
+							const std::shared_ptr<void> &owner) :
+					data(data), size(size), at(at), globals(globals), owner(owner) {}
+
+			RyValue value(size_t depth) {
+				if (depth > MAX_DEPTH)
+					fail("nested deeper than " + std::to_string(MAX_DEPTH));
+				uint8_t tag = take<uint8_t>();
+				if (tag < 0x80)
+					return RyValue((double) tag);
+				if (tag >= 0xe0)
+					return RyValue((double) (int8_t) tag);
+				if (tag < 0x90)
+					return map(tag & 0x0f, depth);
+				if (tag < 0xa0)
+					return list(tag & 0x0f, depth);
+				if (tag < 0xc0)
+					return string(tag & 0x1f);
+
+				switch (tag) {
+					case 0xc0:
+						return RyValue();
+					case 0xc2:
+						return RyValue(false);
+					case 0xc3:
+						return RyValue(true);
+					case 0xc4:
+						return bytes(take<uint8_t>());
+					case 0xc5:
+						return bytes(take<uint16_t>());
+					case 0xc6:
+						return bytes(take<uint32_t>());
+					case 0xca: {
+						uint32_t bits = take<uint32_t>();
+						float single;
+						std::memcpy(&single, &bits, sizeof(single));
+						return RyValue((double) single);
+					}
+					case 0xcb:
+						return RyValue(number());
+					case 0xcc:
+						return RyValue((double) take<uint8_t>());
+					case 0xcd:
+						return RyValue((double) take<uint16_t>());
+					case 0xce:
+						return RyValue((double) take<uint32_t>());
+					case 0xcf:
+						return RyValue((double) take<uint64_t>());
+					case 0xd0:
+						return RyValue((double) (int8_t) take<uint8_t>());
+					case 0xd1:
+						return RyValue((double) (int16_t) take<uint16_t>());
+					case 0xd2:
+						return RyValue((double) (int32_t) take<uint32_t>());
+					case 0xd3:
+						return RyValue((double) (int64_t) take<uint64_t>());
+					case 0xd6:
+						return extension4(depth);
+					case 0xd8: {
+						if (take<uint8_t>() != EXT_RANGE)
+							fail("unknown extension");
+						double start = number();
+						return RyValue(RyRange{start, number()});
+					}
+					case 0xd9:
+						return string(take<uint8_t>());
+					case 0xda:
+						return string(take<uint16_t>());
+					case 0xdb:
+						return string(take<uint32_t>());
+					case 0xdc:
+						return list(take<uint16_t>(), depth);
+					case 0xdd:
+						return list(take<uint32_t>(), depth);
+					case 0xde:
+						return map(take<uint16_t>(), depth);
+					case 0xdf:
+						return map(take<uint32_t>(), depth);
+					default:
+						fail("unsupported tag " + std::to_string(tag));
+				}
+			}
+
+		private:
+			const uint8_t *data;
+			size_t size;
+			size_t &at;
+			const std::map<std::string, RyValue> &globals;
+			const std::shared_ptr<void> &owner;
+			std::vector<RyValue> shared; // Lists, maps, instances and bytes in the order they appeared
+
+			[[noreturn]] void fail(const std::string &message) {
+				throw std::runtime_error("deserialize(): " + message + " at offset " + std::to_string(at) + ".");
+			}
+
+			void need(size_t count) {
+				if (size - at < count)
+					fail("truncated data");
+			}
+
+			template<typename T>
+			T take() {
+				need(sizeof(T));
+				uint64_t value = 0;
+				for (size_t i = 0; i < sizeof(T); i++)
+					value = value << 8 | data[at + i];
+				at += sizeof(T);
+				return (T) value;
+			}
+
+			double number() {
+				uint64_t bits = take<uint64_t>();
+				double value;
+				std::memcpy(&value, &bits, sizeof(value));
+				return value;
+			}
+
+			// Made in place, RyValue(std::string) would copy the text again
+			RyValue string(size_t length) {
+				need(length);
+				RyValue text;
+				text.val.emplace<std::string>((const char *) data + at, length);
+				at += length;
+				return text;
+			}
+
+			// A count can't be more than the bytes left, every item takes at least one
+			size_t count(size_t items) {
+				need(items);
+				return items;
+			}
+
+			RyValue list(size_t items, size_t depth) {
+				auto made = std::make_shared<std::vector<RyValue>>();
+				made->reserve(count(items));
+				shared.emplace_back(made); // Before the items, which may refer back to it
+				for (size_t i = 0; i < items; i++)
+					made->push_back(value(depth + 1));
+				return RyValue(made);
+			}
+
+			RyValue map(size_t items, size_t depth) {
+				auto made = std::make_shared<std::unordered_map<RyValue, RyValue, RyValueHasher>>();
+				made->reserve(count(items));
+				shared.emplace_back(made);
+				for (size_t i = 0; i < items; i++) {
+					RyValue key = value(depth + 1);
+					RyValue field = value(depth + 1);
+					made->insert_or_assign(std::move(key), std::move(field));
+				}
+				return RyValue(made);
+			}
+
+			RyValue bytes(size_t length) {
+				need(length);
+				std::shared_ptr<RyBytes> made;
+				if (owner)
+					made = std::make_shared<RyBytes>(owner, const_cast<uint8_t *>(data + at), length, true);
+				else
+					made = RyBytes::copyOf(data + at, length);
+				at += length;
+				RyValue result(std::static_pointer_cast<RyObject>(made));
+				shared.push_back(result);
+				return result;
+			}
+
+			RyValue extension4(size_t depth) {
+				uint8_t type = take<uint8_t>();
+				uint32_t payload = take<uint32_t>();
+				if (type == EXT_REFERENCE) {
+					if (payload >= shared.size())
+						fail("reference to an object not seen yet");
+					return shared[payload];
+				}
+				if (type != EXT_INSTANCE)
+					fail("unknown extension");
+
+				RyValue name = value(depth + 1);
+				if (!name.isString())
+					fail("expected a class name");
+				return instance(name.asString(), count(payload), depth);
+			}
+
+			RyValue instance(const std::string &className, size_t fields, size_t depth) {
+				auto found = globals.find(className);
+				if (found == globals.end() || !found->second.isClass())
+					fail("no class named '" + className + "'");
+				auto made = std::make_shared<Frontend::RyInstance>(found->second.asClass());
+				shared.emplace_back(made);
+				for (size_t i = 0; i < fields; i++) {
+					RyValue name = value(depth + 1);
+					if (!name.isString())
+						fail("expected a field name");
+					made->fields[std::move(std::get<std::string>(name.val))] = value(depth + 1);
+				}
+				return RyValue(made);
+			}
+		};
+	} // namespace
+
+	size_t serialize(const RyValue &value, SerialOutput &out, int fd) {
+		Encoder encoder(out, fd);
+		encoder.value(value, 0);
+		if (fd >= 0)
+			encoder.flush();
+		return encoder.size();
+	}
+
+	RyValue deserialize(const uint8_t *data, size_t size, size_t &at, const std::map<std::string, RyValue> &globals,
+											const std::shared_ptr<void> &owner) {
+		return Decoder(data, size, at, globals, owner).value(0);
+	}
+} // namespace RyRuntime
@@ -0,0 +1,555 @@
+#include "snapshot.h"
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+#include <unordered_map>
+#include <vector>
+#include "class.h"
+#include "compiler.h"
+#include "native.hpp"
+#include "object.h"
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#ifndef MAP_POPULATE
+#define MAP_POPULATE 0
+#endif
+#endif
+
+// Image layout (native byte order):
+//   magic, u32 object count, u32 global count
+//   shells:  one record per heap object, enough to allocate it (kind, names)
+//   globals: name + value for every global
+//   bodies:  the contents of every object, in shell order
+// Values that live on the heap are written as an index into the shell table. The loader allocates every
+// shell first, so the bodies and globals can be patched to point at them in a single pass.
+
+namespace RyRuntime {
+	namespace {
+		const char MAGIC[8] = {'R', 'Y', 'I', 'M', 'G', 0, 0, 1}; // Last byte is the format version
+
+		enum ValueTag : uint8_t { TAG_NIL, TAG_NUMBER, TAG_BOOL, TAG_STRING, TAG_RANGE, TAG_OBJECT };
+		enum ObjectKind : uint8_t {
+			KIND_LIST,
+			KIND_MAP,
+			KIND_FUNCTION,
+			KIND_CLOSURE,
+			KIND_UPVALUE,
+			KIND_CLASS,
+			KIND_INSTANCE,
+			KIND_BOUND_METHOD,
+			KIND_NATIVE
+		};
+
+		class Writer {
+		public:
+			explicit Writer(const std::map<std::string, RyValue> &globals) {
+				uint32_t count = 0;
+				for (auto const &[name, value]: globals) {
+					// Built-ins are registered again by the VM that loads the image
+					if (value.isNative() && value.asNative()->library.empty() && value.asNative()->name == name)
+						continue;
+					string(globalsOut, name);
+					write(globalsOut, value);
+					count++;
+				}
+				globalCount = count;
+
+				// Writing a body can discover more objects, they queue up behind it
+				for (size_t i = 0; i < objects.size(); i++) {
+					body(objects[i]);
+				}
+			}
+
+			void save(const std::string &path) {
+				std::ofstream file(path, std::ios::binary | std::ios::trunc);
+				if (!file.is_open())
+					throw std::runtime_error("Cannot write '" + path + "'.");
+				uint32_t objectCount = objects.size();
+				file.write(MAGIC, sizeof(MAGIC));
+				file.write((const char *) &objectCount, sizeof(objectCount));
+				file.write((const char *) &globalCount, sizeof(globalCount));
+				file.write(shellsOut.data(), shellsOut.size());
+				file.write(globalsOut.data(), globalsOut.size());
+				file.write(bodiesOut.data(), bodiesOut.size());
+			}
+
+		private:
+			struct Entry {
+				ObjectKind kind;
+				RyValue value; // Keeps the object alive and tells body() what it is
+				std::shared_ptr<RyUpValue> upvalue; // For KIND_UPVALUE
+			};
+
+			template<typename T>
+			static void raw(std::string &out, const T &data) {
+				out.append((const char *) &data, sizeof(T));
+			}
+
+			static void string(std::string &out, const std::string &text) {
+				raw(out, (uint32_t) text.size());
+				out += text;
+			}
+
+			uint32_t intern(const void *address, ObjectKind kind, RyValue value,
+											std::shared_ptr<RyUpValue> upvalue = nullptr) {
+				auto found = indices.find(address);
+				if (found != indices.end())
+					return found->second;
+
+				uint32_t index = objects.size();
+				indices[address] = index;
+				objects.push_back({kind, value, upvalue});
+
+				raw(shellsOut, (uint8_t) kind);
+				if (kind == KIND_FUNCTION) {
+					auto function = value.asFunction();
+					string(shellsOut, function->name);
+					raw(shellsOut, (int32_t) function->arity);
+					raw(shellsOut, (int32_t) function->upvalueCount);
+				} else if (kind == KIND_CLASS) {
+					string(shellsOut, value.asClass()->name);
+				} else if (kind == KIND_NATIVE) {
+					auto native = value.asNative();
+					if (native->name.empty())
+						throw std::runtime_error("Cannot snapshot an anonymous native function.");
+					string(shellsOut, native->name);
+					string(shellsOut, native->library);
+				}
+				return index;
+			}
+
+			uint32_t closureIndex(const std::shared_ptr<RyClosure> &closure) {
+				return intern(closure.get(), KIND_CLOSURE, RyValue(closure));
+			}
+
+			template<typename T>
+			static void array(std::string &out, const std::vector<T> &items) {
+				raw(out, (uint32_t) items.size());
+				out.append((const char *) items.data(), items.size() * sizeof(T));
+			}
+
+			void reference(std::string &out, uint32_t index) {
+				raw(out, (uint8_t) TAG_OBJECT);
+				raw(out, index);
+			}
+
+			void write(std::string &out, const RyValue &value) {
+				if (value.isNil()) {
+					raw(out, (uint8_t) TAG_NIL);
+				} else if (value.isNumber()) {
+					raw(out, (uint8_t) TAG_NUMBER);
+					raw(out, value.asNumber());
+				} else if (value.isBool()) {
+					raw(out, (uint8_t) TAG_BOOL);
+					raw(out, (uint8_t) value.asBool());
+				} else if (value.isString()) {
+					raw(out, (uint8_t) TAG_STRING);
+					string(out, value.asString());
+				} else if (value.isRange()) {
+					raw(out, (uint8_t) TAG_RANGE);
+					raw(out, value.asRange().start);
+					raw(out, value.asRange().end);
+				} else if (value.isList()) {
+					reference(out, intern(value.asList().get(), KIND_LIST, value));
+				} else if (value.isMap()) {
+					reference(out, intern(value.asMap().get(), KIND_MAP, value));
+				} else if (value.isFunction()) {
+					reference(out, intern(value.asFunction().get(), KIND_FUNCTION, value));
+				} else if (value.isClosure()) {
+					reference(out, closureIndex(value.asClosure()));
+				} else if (value.isClass()) {
+					reference(out, intern(value.asClass().get(), KIND_CLASS, value));
+				} else if (value.isInstance()) {
+					reference(out, intern(value.asInstance().get(), KIND_INSTANCE, value));
+				} else if (value.isBoundMethod()) {
+					reference(out, intern(value.asBoundMethod().get(), KIND_BOUND_METHOD, value));
+				} else if (value.isNative()) {
+					reference(out, intern(value.asNative().get(), KIND_NATIVE, value));
+				} else {
+					throw std::runtime_error("Cannot snapshot a " + value.to_string() + ".");
+				}
+			}
+
+			void body(const Entry &entry) {
+				std::string &out = bodiesOut;
+				switch (entry.kind) {
+					case KIND_LIST: {
+						auto list = entry.value.asList();
+						raw(out, (uint32_t) list->size());
+						for (auto const &item: *list)
+							write(out, item);
+						break;
+					}
+					case KIND_MAP: {
+						auto map = entry.value.asMap();
+						raw(out, (uint32_t) map->size());
+						for (auto const &[key, item]: *map) {
+							write(out, key);
+							write(out, item);
+						}
+						break;
+					}
+					case KIND_FUNCTION: {
+						auto function = entry.value.asFunction();
+						std::string error;
+						if (function->lazy && !RyRuntime::compileLazy(*function, error)) // Images hold compiled bodies only
+							throw std::runtime_error(error);
+						const Chunk &chunk = function->chunk;
+						array(out, chunk.code);
+						array(out, chunk.lines);
+						array(out, chunk.columns);
+						raw(out, (uint32_t) chunk.constants.size());
+						for (auto const &constant: chunk.constants)
+							write(out, constant);
+						break;
+					}
+					case KIND_CLOSURE: {
+						auto closure = entry.value.asClosure();
+						raw(out, intern(closure->function.get(), KIND_FUNCTION, RyValue(closure->function)));
+						raw(out, (uint32_t) closure->upvalues.size());
+						for (auto const &upvalue: closure->upvalues) {
+							if (!upvalue)
+								throw std::runtime_error("Cannot snapshot a closure that is still being built.");
+							raw(out, intern(upvalue.get(), KIND_UPVALUE, RyValue(), upvalue));
+						}
+						break;
+					}
+					case KIND_UPVALUE:
+						write(out, *entry.upvalue->location); // Open ones are saved closed
+						break;
+					case KIND_CLASS: {
+						auto klass = entry.value.asClass();
+						write(out, klass->superclass ? RyValue(klass->superclass) : RyValue());
+						raw(out, (uint32_t) klass->methods.size());
+						for (auto const &[name, method]: klass->methods) {
+							string(out, name);
+							raw(out, closureIndex(method));
+						}
+						break;
+					}
+					case KIND_INSTANCE: {
+						auto instance = entry.value.asInstance();
+						raw(out, intern(instance->klass.get(), KIND_CLASS, RyValue(instance->klass)));
+						raw(out, (uint32_t) instance->fields.size());
+						for (auto const &[name, field]: instance->fields) {
+							string(out, name);
+							write(out, field);
+						}
+						break;
+					}
+					case KIND_BOUND_METHOD: {
+						auto bound = entry.value.asBoundMethod();
+						write(out, bound->receiver);
+						raw(out, closureIndex(bound->method));
+						break;
+					}
+					case KIND_NATIVE:
+						break; // Resolved by name when loading
+				}
+			}
+
+			std::unordered_map<const void *, uint32_t> indices;
+			std::vector<Entry> objects;
+			uint32_t globalCount = 0;
+			std::string shellsOut, globalsOut, bodiesOut;
+		};
+
+		class Reader {
+		public:
+			Reader(const char *data, size_t size) : at(data), end(data + size) {}
+
+			void load(std::map<std::string, RyValue> &globals) {
+				if (size_t(end - at) < sizeof(MAGIC) || std::memcmp(at, MAGIC, sizeof(MAGIC)) != 0)
+					throw std::runtime_error("Not a Ry image (or made by another version of Ry).");
+				at += sizeof(MAGIC);
+				uint32_t objectCount = raw<uint32_t>();
+				uint32_t globalCount = raw<uint32_t>();
+
+				// Natives are looked up in a clean set of built-ins (or their library)
+				registerNatives(builtins);
+
+				kinds.reserve(objectCount);
+				objects.reserve(objectCount);
+				for (uint32_t i = 0; i < objectCount; i++) {
+					shell();
+				}
+
+				for (uint32_t i = 0; i < globalCount; i++) {
+					std::string name = string();
+					globals[name] = value();
+				}
+
+				for (uint32_t i = 0; i < objectCount; i++) {
+					body(i);
+				}
+			}
+
+		private:
+			void need(size_t bytes) {
+				if (size_t(end - at) < bytes)
+					throw std::runtime_error("The image is truncated.");
+			}
+
+			template<typename T>
+			T raw() {
+				need(sizeof(T));
+				T data;
+				std::memcpy(&data, at, sizeof(T));
+				at += sizeof(T);
+				return data;
+			}
+
+			std::string string() {
+				uint32_t length = raw<uint32_t>();
+				need(length);
+				std::string text(at, length);
+				at += length;
+				return text;
+			}
+
+			const RyValue &object(uint32_t index, ObjectKind kind) {
+				if (index >= objects.size() || kinds[index] != kind)
+					throw std::runtime_error("The image is corrupt.");
+				return objects[index];
+			}
+
+			RyValue value() {
+				switch (raw<uint8_t>()) {
+					case TAG_NIL:
+						return RyValue();
+					case TAG_NUMBER:
+						return RyValue(raw<double>());
+					case TAG_BOOL:
+						return RyValue(raw<uint8_t>() != 0);
+					case TAG_STRING:
+						return RyValue(string());
+					case TAG_RANGE: {
+						double start = raw<double>();
+						return RyValue(RyRange{start, raw<double>()});
+					}
+					case TAG_OBJECT: {
+						uint32_t index = raw<uint32_t>();
+						if (index >= objects.size() || kinds[index] == KIND_UPVALUE)
+							throw std::runtime_error("The image is corrupt.");
+						return objects[index];
+					}
+					default:
+						throw std::runtime_error("The image is corrupt.");
+				}
+			}
+
+			RyValue native(const std::string &name, const std::string &library) {
+				if (library.empty()) {
+					auto found = builtins.find(name);
+					if (found == builtins.end())
+						throw std::runtime_error("The image needs a native '" + name + "' this build doesn't have.");
+					return found->second;
+				}
+
+				auto loaded = libraries.find(library);
+				if (loaded == libraries.end()) {
+					RyValue path(library);
+					loaded = libraries.emplace(library, ry_use(1, &path, builtins)).first;
+				}
+				if (loaded->second.isMap()) {
+					auto found = loaded->second.asMap()->find(RyValue(name));
+					if (found != loaded->second.asMap()->end())
+						return found->second;
+				}
+				throw std::runtime_error("Cannot load '" + name + "' from '" + library + "'.");
+			}
+
+			// Allocates an empty object, body() fills it in once everything exists
+			void shell() {
+				auto kind = (ObjectKind) raw<uint8_t>();
+				RyValue created;
+				std::shared_ptr<RyUpValue> upvalue;
+				switch (kind) {
+					case KIND_LIST:
+						created = RyValue(std::make_shared<std::vector<RyValue>>());
+						break;
+					case KIND_MAP:
+						created = RyValue(std::make_shared<std::unordered_map<RyValue, RyValue, RyValueHasher>>());
+						break;
+					case KIND_FUNCTION: {
+						auto function = std::make_shared<Frontend::RyFunction>();
+						function->name = string();
+						function->arity = raw<int32_t>();
+						function->upvalueCount = raw<int32_t>();
+						created = RyValue(function);
+						break;
+					}
+					case KIND_CLOSURE:
+						created = RyValue(std::make_shared<RyClosure>(std::make_shared<Frontend::RyFunction>()));
+						break;
+					case KIND_UPVALUE:
+						upvalue = std::make_shared<RyUpValue>();
+						upvalue->location = &upvalue->closed;
+						break;
+					case KIND_CLASS:
+						created = RyValue(std::make_shared<Frontend::RyClass>(string()));
+						break;
+					case KIND_INSTANCE:
+						created = RyValue(std::make_shared<Frontend::RyInstance>(nullptr));
+						break;
+					case KIND_BOUND_METHOD:
+						created = RyValue(std::make_shared<Frontend::RyBoundMethod>(RyValue(), nullptr));
+						break;
+					case KIND_NATIVE: {
+						std::string name = string();
+						created = native(name, string());
+						break;
+					}
+					default:
+						throw std::runtime_error("The image is corrupt.");
+				}
+				kinds.push_back(kind);
+				objects.push_back(created);
+				upvalues.push_back(upvalue);
+			}
+
+			template<typename T>
+			void array(std::vector<T> &out) {
+				size_t count = raw<uint32_t>();
+				need(count * sizeof(T));
+				out.resize(count);
+				std::memcpy(out.data(), at, count * sizeof(T));
+				at += count * sizeof(T);
+			}
+
+			void body(uint32_t index) {
+				const RyValue &target = objects[index];
+				switch (kinds[index]) {
+					case KIND_LIST: {
+						auto list = target.asList();
+						uint32_t count = raw<uint32_t>();
+						list->reserve(count);
+						for (uint32_t i = 0; i < count; i++)
+							list->push_back(value());
+						break;
+					}
+					case KIND_MAP: {
+						auto map = target.asMap();
+						uint32_t count = raw<uint32_t>();
+						for (uint32_t i = 0; i < count; i++) {
+							RyValue key = value();
+							(*map)[key] = value();
+						}
+						break;
+					}
+					case KIND_FUNCTION: {
+						Chunk &chunk = target.asFunction()->chunk;
+						array(chunk.code);
+						array(chunk.lines);
+						array(chunk.columns);
+						uint32_t count = raw<uint32_t>();
+						chunk.constants.reserve(count);
+						for (uint32_t i = 0; i < count; i++)
+							chunk.constants.push_back(value());
+						break;
+					}
+					case KIND_CLOSURE: {
+						auto closure = target.asClosure();
+						closure->function = object(raw<uint32_t>(), KIND_FUNCTION).asFunction();
+						uint32_t count = raw<uint32_t>();
+						closure->upvalues.resize(count);
+						for (uint32_t i = 0; i < count; i++) {
+							uint32_t slot = raw<uint32_t>();
+							if (slot >= objects.size() || kinds[slot] != KIND_UPVALUE)
+								throw std::runtime_error("The image is corrupt.");
+							closure->upvalues[i] = upvalues[slot];
+						}
+						break;
+					}
+					case KIND_UPVALUE:
+						upvalues[index]->closed = value();
+						break;
+					case KIND_CLASS: {
+						auto klass = target.asClass();
+						RyValue superclass = value();
+						if (superclass.isClass())
+							klass->superclass = superclass.asClass();
+						uint32_t count = raw<uint32_t>();
+						for (uint32_t i = 0; i < count; i++) {
+							std::string name = string();
+							klass->methods[name] = object(raw<uint32_t>(), KIND_CLOSURE).asClosure();
+						}
+						break;
+					}
+					case KIND_INSTANCE: {
+						auto instance = target.asInstance();
+						instance->klass = object(raw<uint32_t>(), KIND_CLASS).asClass();
+						uint32_t count = raw<uint32_t>();
+						for (uint32_t i = 0; i < count; i++) {
+							std::string name = string();
+							instance->fields[name] = value();
+						}
+						break;
+					}
+					case KIND_BOUND_METHOD: {
+						auto bound = target.asBoundMethod();
+						bound->receiver = value();
+						bound->method = object(raw<uint32_t>(), KIND_CLOSURE).asClosure();
+						break;
+					}
+					case KIND_NATIVE:
+						break;
+				}
+			}
+
+			const char *at;
+			const char *end;
+			std::vector<ObjectKind> kinds;
+			std::vector<RyValue> objects;
+			std::vector<std::shared_ptr<RyUpValue>> upvalues;
+			std::map<std::string, RyValue> builtins;
+			std::map<std::string, RyValue> libraries;
+		};
+	} // namespace
+
+	bool isSnapshot(const std::string &path) {
+		std::ifstream file(path, std::ios::binary);
+		char magic[sizeof(MAGIC)] = {};
+		file.read(magic, sizeof(magic));
+		return file.gcount() == sizeof(magic) && std::memcmp(magic, MAGIC, 5) == 0;
+	}
+
+	void saveSnapshot(const VM &vm, const std::string &path) { Writer(vm.getGlobals()).save(path); }
+
+	void loadSnapshot(VM &vm, const std::string &path) {
+		std::map<std::string, RyValue> globals;
+#ifndef _WIN32
+		// Map the image instead of copying it into a buffer. The loader reads every byte front to back, so
+		// MAP_POPULATE faults all the pages in with one call rather than one fault per page (Linux only).
+		int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+		if (fd < 0)
+			throw std::runtime_error("Cannot open '" + path + "'.");
+		struct stat info;
+		fstat(fd, &info);
+		size_t size = info.st_size;
+		void *mapped = size ? mmap(nullptr, size, PROT_READ, MAP_PRIVATE | MAP_POPULATE, fd, 0) : MAP_FAILED;
+		close(fd);
+		if (mapped == MAP_FAILED)
+			throw std::runtime_error("Cannot map '" + path + "'.");
+		try {
+			Reader((const char *) mapped, size).load(globals);
+		} catch (...) {
+			munmap(mapped, size);
+			throw;
+		}
+		munmap(mapped, size);
+#else
+		std::ifstream file(path, std::ios::binary);
+		std::string data((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+		Reader(data.data(), data.size()).load(globals);
+#endif
+		for (auto &[name, value]: globals) {
+			vm.defineGlobal(name, std::move(value));
+		}
+	}
+} // namespace RyRuntime
@@ -0,0 +1,145 @@
+#include "trace.h"
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <mutex>
+#ifdef _WIN32
+#include <process.h>
+#define getpid _getpid
+#else
+#include <pthread.h>
+#include <unistd.h>
+#endif
+
+#ifdef RY_USDT
+// Where the probes' notes point tracers to; the section is what they look for
+extern "C" {
+volatile unsigned short ry_function__entry_semaphore __attribute__((section(".probes"), used)) = 0;
+volatile unsigned short ry_function__return_semaphore __attribute__((section(".probes"), used)) = 0;
+}
+#endif
+
+namespace RyRuntime {
+	namespace Trace {
+		bool enabled = false;
+
+		namespace {
+			// Isolates write from their own threads
+			std::mutex lock;
+			FILE *out = nullptr;
+			std::string buffer;
+			bool firstEvent = true;
+			std::atomic<int> tracks{0};
+			std::chrono::steady_clock::time_point origin;
+			int pid = 0;
+
+			// Microseconds since start(), which is what the format counts in
+			double now() {
+				return std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - origin).count();
+			}
+
+			std::string quoted(const std::string &text) {
+				std::string result = "\"";
+				for (char c: text) {
+					if (c == '"' || c == '\\') {
+						result += '\\';
+						result += c;
+					} else if ((unsigned char) c < 0x20) {
+						char escape[8];
+						std::snprintf(escape, sizeof(escape), "\\u%04x", c);
+						result += escape;
+					} else {
+						result += c;
+					}
+				}
+				return result + "\"";
+			}
+
+			void write(const std::string &event) {
+				std::lock_guard<std::mutex> guard(lock);
+				if (!out)
+					return;
+				buffer += firstEvent ? "\n" : ",\n";
+				firstEvent = false;
+				buffer += event;
+				if (buffer.size() >= (1 << 20)) {
+					std::fwrite(buffer.data(), 1, buffer.size(), out);
+					buffer.clear();
+				}
+			}
+
+			void finish() {
+				std::lock_guard<std::mutex> guard(lock);
+				if (!out)
+					return;
+				buffer += "\n]}\n";
+				std::fwrite(buffer.data(), 1, buffer.size(), out);
+				std::fclose(out);
+				out = nullptr;
+			}
+
+#ifndef _WIN32
+			// The trace belongs to the process that started it. A forked child (an HTTP worker, a daemon's script)
+			// would write into the same file and complete it again at exit, so it forgets the trace instead.
+			void beforeFork() {
+				lock.lock();
+				if (out)
+					std::fflush(out); // So the child's copy of the stream has nothing left to write
+			}
+
+			void afterForkInParent() { lock.unlock(); }
+
+			void afterForkInChild() {
+				if (out)
+					std::fclose(out);
+				out = nullptr;
+				buffer.clear();
+				enabled = false;
+				lock.unlock();
+			}
+#endif
+		} // namespace
+
+		void start(const std::string &path) {
+			if (enabled)
+				return;
+			out = std::fopen(path.c_str(), "w");
+			if (!out) {
+				std::fprintf(stderr, "Could not write the trace to %s\n", path.c_str());
+				return;
+			}
+			enabled = true;
+			origin = std::chrono::steady_clock::now();
+			pid = (int) getpid();
+			std::fputs("{\"displayTimeUnit\": \"ns\", \"traceEvents\": [", out);
+			std::atexit(finish); // Also covers exit() from a script
+#ifndef _WIN32
+			pthread_atfork(beforeFork, afterForkInParent, afterForkInChild);
+#endif
+		}
+
+		int newTrack(const char *name) {
+			int track = ++tracks;
+			char event[160];
+			std::snprintf(event, sizeof(event),
+										"{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": %d, \"tid\": %d, \"args\": {\"name\": \"%s %d\"}}",
+										pid, track, name, track);
+			write(event);
+			return track;
+		}
+
+		void enter(int track, const std::string &function, int argCount) {
+			char event[96];
+			std::snprintf(event, sizeof(event), ", \"ph\": \"B\", \"ts\": %.3f, \"pid\": %d, \"tid\": %d, \"args\": {\"argc\": %d}}",
+										now(), pid, track, argCount);
+			write("{\"name\": " + quoted(function) + event);
+		}
+
+		void leave(int track, const std::string &function) {
+			char event[80];
+			std::snprintf(event, sizeof(event), ", \"ph\": \"E\", \"ts\": %.3f, \"pid\": %d, \"tid\": %d}", now(), pid, track);
+			write("{\"name\": " + quoted(function) + event);
+		}
+	} // namespace Trace
+} // namespace RyRuntime
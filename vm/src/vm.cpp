@@ -4,19 +4,23 @@
 #include <fstream>
 #include <set>
 #include <stdarg.h>
+#include <thread>
+#include "bytes.h"
 #include "chunk.h"
 #include "class.h"
+#include "collections.h"
 #include "common.h"
 #include "compiler.h"
 #include "func.h"
+#include "isolate.h"
 #include "lexer.h"
 #include "native.hpp"
 #include "parser.h"
+#include "prefetch.h"
 #include "tools.h"
 
 namespace RyRuntime {
-	static std::string vmSource;
-	void setVMSource(const std::string &source) { vmSource = source; }
+	static thread_local VM *activeVM = nullptr;
 	int calculateDistance(const std::string &s1, const std::string &s2) {
 		int n = s1.length();
 		int m = s2.length();
@@ -44,13 +48,13 @@ namespace RyRuntime {
 	}
 
 	void VM::push(RyValue value) {
-		*stackTop = value;
+		*stackTop = std::move(value);
 		stackTop++;
 	}
 
 	RyValue VM::pop() {
 		stackTop--;
-		return *stackTop;
+		return std::move(*stackTop); // The slot is dead now, its string or list need not be copied
 	}
 	std::shared_ptr<RyUpValue> VM::captureUpvalue(RyValue *local) {
 		std::shared_ptr<RyUpValue> prevUpvalue = nullptr;
@@ -79,11 +83,24 @@ namespace RyRuntime {
 	}
 
 	VM::VM() {
+		mainFiber = std::make_shared<Fiber>();
+		mainFiber->started = true; // interpret() and call() set up its frames themselves
+		fiber = mainFiber;
+		stack = fiber->stack;
+		frames = fiber->frames;
 		resetStack();
 		openUpvalues = nullptr;
 		registerNatives(globals);
 	}
 
+	VM *VM::current() { return activeVM; }
+
+	VM::VM(std::map<std::string, RyValue> seed) : VM() {
+		for (auto &[name, value]: seed) {
+			globals[name] = std::move(value);
+		}
+	}
+
 	void VM::resetStack() {
 		stackTop = stack;
 		frameCount = 0;
@@ -100,8 +117,12 @@ namespace RyRuntime {
 		push(RyValue(std::string(buffer)));
 	}
 
-	InterpretResult VM::interpret(std::shared_ptr<Frontend::RyFunction> function) {
+	InterpretResult VM::interpret(std::shared_ptr<Frontend::RyFunction> function,
+																std::shared_ptr<const std::string> source) {
+		this->source = std::move(source);
 		resetStack();
+		exitFrame = 0;
+		reportErrors = true;
 
 		std::shared_ptr<RyClosure> closure = std::make_shared<RyClosure>(function);
 		push(RyValue(closure));
@@ -110,8 +131,165 @@ namespace RyRuntime {
 		frame->closure = closure;
 		frame->ip = function->chunk.code.data();
 		frame->slots = stack;
+		if (Trace::active())
+			traceEnter(0);
+
+		InterpretResult result = schedule();
+		reportErrors = false;
+		return result;
+	}
+
+	InterpretResult VM::call(RyValue callee, const std::vector<RyValue> &args, RyValue &result) {
+		if (stackTop + args.size() + 1 >= stack + STACK_MAX) {
+			panicMessage = "Stack Overflow!";
+			return INTERPRET_RUNTIME_ERROR;
+		}
+
+		// Remember where the caller was so nested runs stop at the right frame
+		int previousExit = exitFrame;
+		bool previousReport = reportErrors;
+		RyValue *base = stackTop;
+		exitFrame = frameCount;
+		reportErrors = false;
 
-		return run();
+		push(callee);
+		for (const auto &arg: args) {
+			push(arg);
+		}
+
+		InterpretResult status = INTERPRET_OK;
+		if (!callValue(callee, (int) args.size())) {
+			panicMessage = pop().to_string();
+			status = INTERPRET_RUNTIME_ERROR;
+		} else if (frameCount > exitFrame) {
+			if (Trace::active())
+				traceEnter((int) args.size());
+			// Only the outermost entry drives fibers, nested calls just run to their return
+			status = runDepth == 0 ? schedule() : run();
+		}
+
+		if (status == INTERPRET_OK) {
+			result = pop();
+		}
+		stackTop = base;
+
+		exitFrame = previousExit;
+		reportErrors = previousReport;
+		return status;
+	}
+
+	// Function bodies the parser skimmed get compiled on their first call
+	static inline bool ensureCompiled(Frontend::RyFunction &function, std::string &error) {
+		if (!function.lazy || (function.lazy->ready.load(std::memory_order_acquire) && function.lazy->error.empty()))
+			return true;
+		return compileLazy(function, error);
+	}
+
+	bool VM::callValue(RyValue callee, int argCount) {
+		if (callee.isNative()) {
+			try {
+				auto nativeObj = callee.asNative();
+				RyValue result = nativeObj->host ? nativeObj->host(argCount, stackTop - argCount)
+																				 : nativeObj->function(argCount, stackTop - argCount, globals);
+
+				// Identify the callee's index
+				int calleeIndex = 1 + argCount;
+
+				stackTop -= calleeIndex; // Pop args and function
+				push(result);
+			} catch (const std::runtime_error &e) {
+				runtimeError("%s", e.what());
+				return false;
+			}
+			return true;
+		}
+
+		if (frameCount == FRAMES_MAX) {
+			runtimeError("Stack Overflow! Too many nested calls.");
+			return false;
+		}
+
+		std::string error;
+		if (callee.isClosure()) {
+			auto closure = callee.asClosure();
+			if (argCount != closure->function->arity) {
+				runtimeError("Expected %d arguments but got %d.", closure->function->arity, argCount);
+				return false;
+			}
+
+			if (!ensureCompiled(*closure->function, error)) {
+				runtimeError("%s", error.c_str());
+				return false;
+			}
+
+			CallFrame *frame = &frames[frameCount++];
+			frame->closure = closure;
+			frame->ip = closure->function->chunk.code.data();
+			frame->slots = stackTop - argCount - 1;
+		} else if (callee.isFunction()) {
+			if (argCount != callee.asFunction()->arity) {
+				runtimeError("Expected %d arguments but got %d.", callee.asFunction()->arity, argCount);
+				return false;
+			}
+			if (!ensureCompiled(*callee.asFunction(), error)) {
+				runtimeError("%s", error.c_str());
+				return false;
+			}
+
+			CallFrame *frame = &frames[frameCount++];
+
+			frame->closure = makeCounted<ALLOC_CLOSURE, RyClosure>(callee.asFunction());
+			if (AllocProfile::enabled)
+				noteAllocation(ALLOC_CLOSURE, sizeof(RyClosure));
+			frame->ip = frame->closure->function->chunk.code.data();
+			frame->slots = stackTop - argCount - 1;
+		} else if (callee.isClass()) {
+			auto klass = callee.asClass();
+			auto instance = makeCounted<ALLOC_INSTANCE, Frontend::RyInstance>(klass);
+			if (AllocProfile::enabled)
+				noteAllocation(ALLOC_INSTANCE, sizeof(Frontend::RyInstance));
+			*(stackTop - argCount - 1) = RyValue(instance);
+
+			auto initializer = klass->methods.find("init");
+			if (initializer != klass->methods.end()) {
+				if (argCount != initializer->second->function->arity) {
+					runtimeError("Expected %d arguments but got %d.", initializer->second->function->arity, argCount);
+					return false;
+				}
+				if (!ensureCompiled(*initializer->second->function, error)) {
+					runtimeError("%s", error.c_str());
+					return false;
+				}
+
+				CallFrame *frame = &frames[frameCount++];
+				frame->closure = initializer->second;
+				frame->ip = frame->closure->function->chunk.code.data();
+				frame->slots = stackTop - argCount - 1;
+			} else if (argCount != 0) {
+				runtimeError("Expected 0 arguments but got %d.", argCount);
+				return false;
+			}
+		} else if (callee.isBoundMethod()) {
+			auto bound = callee.asBoundMethod();
+			if (argCount != bound->method->function->arity) {
+				runtimeError("Expected %d arguments but got %d.", bound->method->function->arity, argCount);
+				return false;
+			}
+			if (!ensureCompiled(*bound->method->function, error)) {
+				runtimeError("%s", error.c_str());
+				return false;
+			}
+			*(stackTop - argCount - 1) = bound->receiver;
+
+			CallFrame *frame = &frames[frameCount++];
+			frame->closure = bound->method;
+			frame->ip = frame->closure->function->chunk.code.data();
+			frame->slots = stackTop - argCount - 1;
+		} else {
+			runtimeError("Can only call functions and classes.");
+			return false;
+		}
+		return true;
 	}
 	bool VM::isTruthy(RyValue value) {
 		if (value.isNil())
@@ -122,6 +300,107 @@ namespace RyRuntime {
 			return value.asBool();
 		return true;
 	}
+	RyValue *VM::findGlobal(const std::string &name, bool assigning) {
+		auto it = globals.find(name);
+		if (it != globals.end())
+			return &it->second;
+
+		std::string bestMatch = "";
+		int minDistance = 3;
+
+		for (auto const &[key, val]: globals) {
+			int dist = calculateDistance(name, key);
+			if (dist < minDistance) {
+				minDistance = dist;
+				bestMatch = key;
+			}
+		}
+
+		if (!bestMatch.empty()) {
+			runtimeError("%s variable '%s'. Did you mean '%s'?", assigning ? "Cannot set undefined" : "Undefined",
+									 name.c_str(), bestMatch.c_str());
+		} else {
+			runtimeError("Undefined variable '%s'.", name.c_str());
+		}
+		return nullptr;
+	}
+
+	bool VM::indexValue(const RyValue &object, const RyValue &index, RyValue &out) {
+		if (object.isList()) {
+			auto list = object.asList();
+			// Ensure the index is a number
+			if (!index.isNumber()) {
+				runtimeError("List index must be a number.");
+				return false;
+			}
+			int i = (int) index.asNumber();
+			if (i >= 0 && i < list->size()) {
+				out = (*list)[i];
+			} else {
+				runtimeError("List index out of bounds.");
+				return false;
+			}
+		} else if (object.isMap()) {
+			auto ryMap = object.asMap();
+
+			auto it = ryMap->find(index);
+			if (it != ryMap->end()) {
+				out = it->second;
+			} else {
+				runtimeError("Key '%s' not found in map.", index.to_string().c_str());
+				return false;
+			}
+		} else if (auto str = std::get_if<std::string>(&object.val)) {
+			if (!index.isNumber()) {
+				runtimeError("String index must be a number.");
+				return false;
+			}
+			int i = (int) index.asNumber();
+			if (i >= 0 && i < str->length()) {
+				out = RyValue::character((*str)[i]);
+			} else {
+				runtimeError("String index out of bounds.");
+				return false;
+			}
+		} else if (RyBytes *bytes = bytesOf(object)) {
+			double i = index.isNumber() ? index.asNumber() : -1;
+			if (i >= 0 && i < bytes->size) {
+				out = RyValue((double) bytes->data[(size_t) i]);
+			} else {
+				runtimeError("Bytes index out of bounds.");
+				return false;
+			}
+		} else if (RyDeque *deque = collectionOf<RyDeque>(object)) {
+			double i = index.isNumber() ? index.asNumber() : -1;
+			if (i >= 0 && i < deque->size()) {
+				out = deque->at((size_t) i);
+			} else {
+				runtimeError("Deque index out of bounds.");
+				return false;
+			}
+		} else {
+			runtimeError("Can only index lists, maps, strings and bytes.");
+			return false;
+		}
+		return true;
+	}
+	RyValue VM::lengthOf(const RyValue &value) {
+		if (value.isList())
+			return RyValue((double) value.asList()->size());
+		if (auto str = std::get_if<std::string>(&value.val))
+			return RyValue((double) str->length());
+		if (value.isMap())
+			return RyValue((double) value.asMap()->size());
+		if (RyBytes *bytes = bytesOf(value))
+			return RyValue((double) bytes->size);
+		if (RySet *set = collectionOf<RySet>(value))
+			return RyValue((double) set->size());
+		if (RyDeque *deque = collectionOf<RyDeque>(value))
+			return RyValue((double) deque->size());
+		if (RyHeap *heap = collectionOf<RyHeap>(value))
+			return RyValue((double) heap->size());
+		return RyValue();
+	}
 	RyValue VM::peek(int distance) {
 		// stackTop points to the NEXT empty slot,
 		// so -1 is the current top, -2 is one below, etc.
@@ -137,7 +416,294 @@ namespace RyRuntime {
 		}
 	}
 
+	void VM::noteAllocation(AllocKind kind, size_t bytes) {
+		if (bytes == 0)
+			return; // A short string, kept inside the value
+		std::string site, stack;
+		for (int i = 0; i < frameCount; i++) {
+			const Frontend::RyFunction &function = *frames[i].closure->function;
+			// Every frame's ip is past the instruction it is on: the call in the frames below the top
+			size_t offset = frames[i].ip - function.chunk.code.data();
+			int line = offset > 0 && offset <= function.chunk.lines.size() ? function.chunk.lines[offset - 1] : 0;
+			site = (function.name.empty() ? "<script>" : function.name) + ":" + std::to_string(line);
+			if (i > 0)
+				stack += ';';
+			stack += site;
+		}
+		AllocProfile::record(kind, bytes, site.empty() ? "<native>" : site, stack.empty() ? "<native>" : stack);
+	}
+
+	void VM::traceEnter(int argCount) {
+		const std::string &name = frames[frameCount - 1].closure->function->name;
+		RY_PROBE_FUNCTION_ENTRY(name.c_str(), argCount);
+		if (!Trace::enabled)
+			return;
+		if (fiber->traceTrack == 0)
+			fiber->traceTrack = Trace::newTrack(fiber == mainFiber ? "vm" : "fiber");
+		Trace::enter(fiber->traceTrack, name.empty() ? "<script>" : name, argCount);
+	}
+
+	void VM::traceLeave(int depth) {
+		for (int i = frameCount - 1; i >= depth; i--) {
+			const std::string &name = frames[i].closure->function->name;
+			RY_PROBE_FUNCTION_RETURN(name.c_str());
+			if (Trace::enabled && fiber->traceTrack != 0)
+				Trace::leave(fiber->traceTrack, name.empty() ? "<script>" : name);
+		}
+	}
+
+	std::shared_ptr<Fiber> VM::spawnFiber(RyValue callee, const std::vector<RyValue> &args) {
+		if (args.size() + 1 >= STACK_MAX)
+			throw std::runtime_error("Too many arguments for a fiber.");
+
+		auto created = std::make_shared<Fiber>();
+		*created->stackTop++ = callee;
+		for (const auto &arg: args) {
+			*created->stackTop++ = arg;
+		}
+		waiting.push_back(created);
+		return created;
+	}
+
+	void VM::suspend(FiberWait wait) {
+		if (wait.fd >= 0 && !events.watch(wait.fd, wait.interest, fiber))
+			throw std::runtime_error("This fiber is already waiting on fd " + std::to_string(wait.fd) + ".");
+		fiber->wait = std::move(wait);
+		fiber->parked = true;
+		suspendRequested = true;
+	}
+
+	void VM::switchTo(std::shared_ptr<Fiber> next) {
+		// Save the registers of the fiber that stops
+		fiber->stackTop = stackTop;
+		fiber->frameCount = frameCount;
+		fiber->exitFrame = exitFrame;
+		fiber->openUpvalues = std::move(openUpvalues);
+		fiber->panicStack = std::move(panicStack);
+
+		fiber = std::move(next);
+		stack = fiber->stack;
+		frames = fiber->frames;
+		stackTop = fiber->stackTop;
+		frameCount = fiber->frameCount;
+		exitFrame = fiber->exitFrame;
+		openUpvalues = std::move(fiber->openUpvalues);
+		panicStack = std::move(fiber->panicStack);
+	}
+
+	void VM::finishFiber(InterpretResult status) {
+		fiber->finished = true;
+		if (status == INTERPRET_OK) {
+			fiber->result = *(stackTop - 1);
+		} else {
+			fiber->failed = true;
+			fiber->message = panicMessage;
+		}
+
+		// Let go of everything the finished fiber still references
+		std::fill(stack, stack + STACK_MAX, RyValue());
+		resetStack();
+		openUpvalues = nullptr;
+		panicStack.clear();
+	}
+
+	std::shared_ptr<Fiber> VM::nextFiber() {
+		for (;;) {
+			if (waiting.empty())
+				return nullptr;
+
+			auto now = std::chrono::steady_clock::now();
+			auto earliest = std::chrono::steady_clock::time_point::max();
+			bool waitingOnIO = false;
+
+			// Round robin: the first one that can continue goes, it rejoins at the back when it parks
+			for (auto it = waiting.begin(); it != waiting.end(); ++it) {
+				Fiber &candidate = **it;
+				FiberWait &wait = candidate.wait;
+				bool resume = !candidate.parked;
+				if (!resume) {
+					RyValue result;
+					bool onFd = wait.fd >= 0;
+					bool ready = false;
+					if (wait.closed) {
+						candidate.pendingPanic = "fd " + std::to_string(wait.fd) + " was closed while this fiber waited on it.";
+						ready = true;
+					} else if (wait.ready && (!onFd || wait.ioReady)) {
+						try {
+							ready = wait.ready(candidate, result);
+						} catch (const std::runtime_error &e) {
+							candidate.pendingPanic = e.what(); // The retried operation failed for good
+							ready = true;
+						}
+					}
+
+					if (ready) {
+						candidate.stackTop[-1] = result;
+						resume = true;
+					} else if (wait.deadline <= now) {
+						candidate.stackTop[-1] = wait.timeoutResult;
+						if (wait.timedOut)
+							wait.timedOut(candidate.stackTop[-1]);
+						resume = true;
+					} else {
+						earliest = std::min(earliest, wait.deadline);
+						if (onFd) {
+							if (wait.ioReady) {
+								// Woken for nothing, keep watching
+								wait.ioReady = false;
+								events.watch(wait.fd, wait.interest, *it);
+							}
+							waitingOnIO = true;
+						}
+					}
+					if (resume && onFd && !wait.ioReady)
+						events.unwatch(wait.fd, wait.interest, *it);
+				}
+
+				if (resume) {
+					std::shared_ptr<Fiber> next = *it;
+					next->parked = false;
+					next->wait = FiberWait();
+					waiting.erase(it);
+					return next;
+				}
+			}
+
+			// Worker threads might still feed a channel somebody waits on
+			if (runningIsolates() > 0)
+				earliest = std::min(earliest, now + std::chrono::milliseconds(1));
+
+			if (waitingOnIO && events.available()) {
+				events.wait(earliest);
+				continue;
+			}
+
+			if (earliest == std::chrono::steady_clock::time_point::max()) {
+				// Nothing can ever wake them up, panic inside one of them (the script itself if it waits)
+				auto victim = std::find(waiting.begin(), waiting.end(), mainFiber);
+				if (victim == waiting.end())
+					victim = waiting.begin();
+				std::shared_ptr<Fiber> next = *victim;
+				next->parked = false;
+				next->wait = FiberWait();
+				next->pendingPanic = "Deadlock! Every fiber is waiting and nothing can wake them up.";
+				waiting.erase(victim);
+				return next;
+			}
+
+			std::this_thread::sleep_until(earliest);
+		}
+	}
+
+	InterpretResult VM::schedule() {
+		InterpretResult mainResult = INTERPRET_OK;
+		InterpretResult status = run();
+
+		for (;;) {
+			if (status == INTERPRET_YIELD) {
+				fiber->stackTop = stackTop; // nextFiber() fills in the parked call's result through it
+				waiting.push_back(fiber);
+			} else if (fiber == mainFiber) {
+				mainResult = status;
+				if (status != INTERPRET_OK)
+					break; // An uncaught panic in the script ends all fibers
+			} else {
+				finishFiber(status);
+			}
+
+			std::shared_ptr<Fiber> next = nextFiber();
+			if (!next)
+				break;
+			switchTo(next);
+
+			if (!fiber->started) {
+				// The callee and its arguments were left on the fiber's stack by spawnFiber()
+				fiber->started = true;
+				int argCount = (int) (stackTop - stack) - 1;
+				if (!callValue(stack[0], argCount)) {
+					panicMessage = pop().to_string();
+					status = INTERPRET_RUNTIME_ERROR;
+					continue;
+				}
+				if (frameCount == 0) {
+					status = INTERPRET_OK; // A native finished right away
+					continue;
+				}
+				if (Trace::active())
+					traceEnter(argCount);
+			}
+			status = run();
+		}
+
+		if (fiber != mainFiber)
+			switchTo(mainFiber);
+		waiting.clear();
+		events.clear();
+		return mainResult;
+	}
+
+	std::shared_ptr<Frontend::RyFunction> VM::compile(const std::string &source, const std::string &name) {
+		CompiledProgram program =
+				compileProgram(source, name, namespaces, [this](const std::string &key) { return moduleCache.count(key) > 0; });
+		addModules(program.modules);
+		return program.main;
+	}
+
+	void VM::addModules(const std::unordered_map<std::string, std::shared_ptr<Frontend::RyFunction>> &modules) {
+		for (auto const &[key, function]: modules) {
+			if (!moduleCache.count(key))
+				moduleCache[key] = std::make_shared<RyClosure>(function);
+		}
+	}
+
+	std::shared_ptr<RyClosure> VM::loadModule(const std::string &fileName) {
+		// The same file reached through different relative paths is still one module
+		std::string key = moduleKey(fileName);
+		auto cached = moduleCache.find(key);
+		if (cached != moduleCache.end())
+			return cached->second;
+
+		// Not prefetched (a computed path, or it failed to compile then): compile it now
+		std::ifstream file(fileName);
+		if (!file.is_open()) {
+			runtimeError("Could not open script file '%s'.", fileName.c_str());
+			return nullptr;
+		}
+		std::string source((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+
+		auto function = compile(source, fileName);
+		if (!function) {
+			runtimeError("Failed to compile imported script '%s'.", fileName.c_str());
+			return nullptr;
+		}
+
+		auto closure = std::make_shared<RyClosure>(function);
+		moduleCache[key] = closure;
+		return closure;
+	}
+
+	bool VM::preload(const std::string &fileName) {
+		if (loadModule(fileName))
+			return true;
+		pop(); // The error message runtimeError() left behind
+		return false;
+	}
+
+	void VM::defineGlobal(const std::string &name, RyValue value) { globals[name] = std::move(value); }
+
 	InterpretResult VM::run() {
+		VM *previous = activeVM;
+		activeVM = this;
+		runDepth++;
+
+		InterpretResult result = execute();
+
+		runDepth--;
+		activeVM = previous;
+		return result;
+	}
+
+	InterpretResult VM::execute() {
 #define FRAME (frames[frameCount - 1])
 #define READ_BYTE() (*FRAME.ip++)
 #define READ_CONSTANT() (FRAME.closure->function->chunk.constants[READ_BYTE()])
@@ -149,6 +715,13 @@ namespace RyRuntime {
 		goto trigger_panic;                                                                                                \
 	}
 
+		if (!fiber->pendingPanic.empty()) {
+			// Something went wrong while this fiber was parked
+			push(RyValue(fiber->pendingPanic));
+			fiber->pendingPanic.clear();
+			goto trigger_panic;
+		}
+
 		for (;;) {
 			// Debug: Print stack height
 			/*std::cout << "--- STACK DEBUG (Height: " << (stackTop - stack) << ") ---" << std::endl;
@@ -195,7 +768,7 @@ namespace RyRuntime {
 					RyValue a = pop();
 
 					if (a.isList()) {
-						auto newList = std::make_shared<std::vector<RyValue>>(*a.asList());
+						auto newList = makeCounted<ALLOC_LIST, std::vector<RyValue>>(*a.asList());
 
 						if (b.isList()) {
 							auto bList = b.asList();
@@ -203,11 +776,16 @@ namespace RyRuntime {
 						} else {
 							newList->push_back(b);
 						}
+						if (AllocProfile::enabled)
+							noteAllocation(ALLOC_LIST, listBytes(*newList));
 						push(RyValue(newList));
 					} else if (a.isNumber() && b.isNumber()) {
 						push(RyValue(a.asNumber() + b.asNumber()));
 					} else if (a.isString() || b.isString()) {
-						push(RyValue(a.to_string() + b.to_string()));
+						RyValue joined(a.to_string() + b.to_string());
+						if (AllocProfile::enabled)
+							noteAllocation(ALLOC_STRING, stringBytes(*std::get_if<std::string>(&joined.val)));
+						push(std::move(joined));
 					} else {
 						runtimeError("Operands must be numbers, strings, or lists.");
 						goto trigger_panic;
@@ -231,7 +809,7 @@ namespace RyRuntime {
 					RyValue a = pop();
 
 					if (a.isList()) {
-						auto newList = std::make_shared<std::vector<RyValue>>(*a.asList());
+						auto newList = makeCounted<ALLOC_LIST, std::vector<RyValue>>(*a.asList());
 
 						if (b.isList()) {
 							auto bList = b.asList();
@@ -239,6 +817,8 @@ namespace RyRuntime {
 						} else {
 							newList->push_back(b);
 						}
+						if (AllocProfile::enabled)
+							noteAllocation(ALLOC_LIST, listBytes(*newList));
 						push(RyValue(newList));
 					} else if (a.isNumber() && b.isNumber()) {
 						push(RyValue(a.asNumber() * b.asNumber()));
@@ -248,6 +828,8 @@ namespace RyRuntime {
 						for (size_t i = 0; i < a.asNumber(); ++i) {
 							result += b.to_string();
 						}
+						if (AllocProfile::enabled)
+							noteAllocation(ALLOC_STRING, stringBytes(result));
 						push(RyValue(result));
 					} else if (a.isString() && b.isNumber()) {
 						std::string result;
@@ -255,6 +837,8 @@ namespace RyRuntime {
 						for (size_t i = 0; i < b.asNumber(); ++i) {
 							result += a.to_string();
 						}
+						if (AllocProfile::enabled)
+							noteAllocation(ALLOC_STRING, stringBytes(result));
 						push(RyValue(result));
 					} else {
 						runtimeError("Operands must be numbers, strings, or lists.");
@@ -342,61 +926,17 @@ namespace RyRuntime {
 					break;
 				}
 				case OP_GET_GLOBAL: {
-					RyValue nameValue = READ_CONSTANT();
-					std::string name = nameValue.to_string();
-					auto it = globals.find(name);
-
-					if (it == globals.end()) {
-						std::string bestMatch = "";
-						int minDistance = 3;
-
-						for (auto const &[key, val]: globals) {
-							int dist = calculateDistance(name, key);
-							if (dist < minDistance) {
-								minDistance = dist;
-								bestMatch = key;
-							}
-						}
-
-						if (!bestMatch.empty()) {
-							runtimeError("Undefined variable '%s'. Did you mean '%s'?", name.c_str(), bestMatch.c_str());
-						} else {
-							runtimeError("Undefined variable '%s'.", name.c_str());
-						}
-
+					RyValue *global = findGlobal(READ_CONSTANT().to_string());
+					if (!global)
 						goto trigger_panic;
-					}
-					push(it->second);
+					push(*global);
 					break;
 				}
 				case OP_SET_GLOBAL: {
-					RyValue nameValue = READ_CONSTANT();
-					std::string name = nameValue.to_string();
-					auto it = globals.find(name);
-
-					if (it == globals.end()) {
-						std::string bestMatch = "";
-						int minDistance = 3;
-
-						for (auto const &[key, val]: globals) {
-							int dist = calculateDistance(name, key);
-							if (dist < minDistance) {
-								minDistance = dist;
-								bestMatch = key;
-							}
-						}
-
-						if (!bestMatch.empty()) {
-							runtimeError("Cannot set undefined variable '%s'. Did you mean '%s'?", name.c_str(), bestMatch.c_str());
-						} else {
-							runtimeError("Undefined variable '%s'.", name.c_str());
-						}
-
+					RyValue *global = findGlobal(READ_CONSTANT().to_string(), true);
+					if (!global)
 						goto trigger_panic;
-					}
-
-					// D it->second = *(stackTop - 1);
-					it->second = pop();
+					*global = pop();
 					break;
 				}
 				case OP_PANIC: {
@@ -404,23 +944,35 @@ namespace RyRuntime {
 					RyValue message = pop();
 					std::string output = message.isNil() ? "Unknown Panic" : message.to_string();
 
-					if (panicStack.empty()) {
-						if (frameCount > 0) {
+					// Handlers installed below exitFrame belong to whoever called us
+					if (panicStack.empty() || panicStack.back().frameDepth <= exitFrame) {
+						panicMessage = output;
+						if (reportErrors && fiber == mainFiber && frameCount > 0) {
 							auto &frame = frames[frameCount - 1];
 							size_t instruction = frame.ip - frame.closure->function->chunk.code.data() - 1;
 							int line = frame.closure->function->chunk.lines[instruction];
 							int column = frame.closure->function->chunk.columns[instruction];
 
-							RyTools::report(line, column, "", output, vmSource);
+							RyTools::report(line, column, "", output, source ? *source : "");
 						}
 
-						resetStack();
+						if (Trace::active())
+							traceLeave(exitFrame);
+						if (exitFrame == 0) {
+							resetStack();
+						} else {
+							stackTop = frames[exitFrame].slots;
+							closeUpvalues(stackTop);
+							frameCount = exitFrame;
+						}
 						return INTERPRET_RUNTIME_ERROR;
 					}
 
 					ControlBlock block = panicStack.back();
 					panicStack.pop_back();
 
+					if (Trace::active())
+						traceLeave(block.frameDepth);
 					frameCount = block.frameDepth;
 					stackTop = stack + block.stackDepth;
 					closeUpvalues(stackTop);
@@ -431,81 +983,17 @@ namespace RyRuntime {
 				}
 				case OP_CALL: {
 					uint8_t argCount = READ_BYTE();
-					RyValue callee = *(stackTop - 1 - argCount);
-
-					if (callee.isNative()) {
-						try {
-							auto nativeObj = callee.asNative();
-							RyValue result = nativeObj->function(argCount, stackTop - argCount, globals);
-
-							// Identify the callee's index
-							int calleeIndex = 1 + argCount;
-
-							stackTop -= calleeIndex; // Pop args and function
-							push(result);
-						} catch (const std::runtime_error &e) {
-							runtimeError("%s", e.what());
-							goto trigger_panic;
-						}
-					} else if (callee.isClosure()) {
-						auto closure = callee.asClosure();
-						if (argCount != closure->function->arity) {
-							runtimeError("Expected %d arguments but got %d.", closure->function->arity, argCount);
-							goto trigger_panic;
-						}
-
-						CallFrame *frame = &frames[frameCount++];
-						frame->closure = closure;
-						frame->ip = closure->function->chunk.code.data();
-						frame->slots = stackTop - argCount - 1;
-					} else if (callee.isFunction()) {
-						if (argCount != callee.asFunction()->arity) {
-							runtimeError("Expected %d arguments but got %d.", callee.asFunction()->arity, argCount);
-							goto trigger_panic;
-						}
-
-						CallFrame *frame = &frames[frameCount++];
-
-						frame->closure = std::make_shared<RyClosure>(callee.asFunction());
-						frame->ip = frame->closure->function->chunk.code.data();
-						frame->slots = stackTop - argCount - 1;
-					} else if (callee.isClass()) {
-						auto klass = callee.asClass();
-						auto instance = std::make_shared<Frontend::RyInstance>(klass);
-						*(stackTop - argCount - 1) = RyValue(instance);
-
-						auto initializer = klass->methods.find("init");
-						if (initializer != klass->methods.end()) {
-							CallFrame *frame = &frames[frameCount++];
-							frame->closure = initializer->second;
-							frame->ip = frame->closure->function->chunk.code.data();
-							frame->slots = stackTop - argCount - 1;
-
-							if (argCount != frame->closure->function->arity) {
-								runtimeError("Expected %d arguments but got %d.", frame->closure->function->arity, argCount);
-								goto trigger_panic;
-							}
-						} else if (argCount != 0) {
-							runtimeError("Expected 0 arguments but got %d.", argCount);
-							goto trigger_panic;
-						}
-					} else if (callee.isBoundMethod()) {
-						auto bound = callee.asBoundMethod();
-						*(stackTop - argCount - 1) = bound->receiver;
-
-						CallFrame *frame = &frames[frameCount++];
-						frame->closure = bound->method;
-						frame->ip = frame->closure->function->chunk.code.data();
-						frame->slots = stackTop - argCount - 1;
-
-						if (argCount != frame->closure->function->arity) {
-							runtimeError("Expected %d arguments but got %d.", frame->closure->function->arity, argCount);
-							goto trigger_panic;
-						}
-					} else {
-						runtimeError("Can only call functions and classes.");
+					int depth = frameCount;
+					if (!callValue(*(stackTop - 1 - argCount), argCount)) {
 						goto trigger_panic;
 					}
+					if (frameCount > depth && Trace::active())
+						traceEnter(argCount);
+					if (suspendRequested) {
+						// The native parked this fiber, its result gets filled in when it resumes
+						suspendRequested = false;
+						return INTERPRET_YIELD;
+					}
 					break;
 				}
 				case OP_RETURN: {
@@ -518,24 +1006,23 @@ namespace RyRuntime {
 					// Save the starting point of the frame it's are about to leave
 					RyValue *currentFrameSlots = FRAME.slots;
 
+					if (Trace::active())
+						traceLeave(frameCount - 1);
 					frameCount--;
 
-					if (frameCount == 0) {
-						if (stackTop > stack) {
-							pop();
-						}
-						return INTERPRET_OK;
-					}
-
 					// Reset stackTop to where the CALLEE started (popping args + callee)
 					stackTop = currentFrameSlots;
 					push(result);
+
+					if (frameCount == exitFrame) {
+						return INTERPRET_OK;
+					}
 					break;
 				}
 				case OP_FOR_EACH_NEXT: {
 					uint16_t offset = READ_SHORT();
 					RyValue indexValue = peek(0);
-					RyValue collectionValue = peek(1);
+					const RyValue &collectionValue = stackTop[-2]; // Borrowed, strings are not copied every step
 
 					int index = (int) indexValue.asNumber();
 
@@ -563,10 +1050,8 @@ namespace RyRuntime {
 						// For '1 to 10', if index is 0, value is 1.
 						double current = range.start + index;
 
-						// Check bounds
-						bool isInBounds = (range.start < range.end) ? (current < range.end) : (current > range.end);
-
-						if (isInBounds) {
+						// Ranges count up to (not including) the end, `5 to 0` is empty
+						if (current < range.end) {
 							*(stackTop - 1) = RyValue((double) (index + 1));
 							push(RyValue((double) current));
 						} else {
@@ -580,8 +1065,59 @@ namespace RyRuntime {
 						} else {
 							FRAME.ip += offset;
 						}
+					} else if (auto str = std::get_if<std::string>(&collectionValue.val)) {
+						if (index < str->size()) {
+							*(stackTop - 1) = RyValue((double) (index + 1));
+							push(RyValue::character((*str)[index]));
+						} else {
+							FRAME.ip += offset;
+						}
+					} else if (RyBytes *bytes = bytesOf(collectionValue)) {
+						if (index < bytes->size) {
+							*(stackTop - 1) = RyValue((double) (index + 1));
+							push(RyValue((double) bytes->data[index]));
+						} else {
+							FRAME.ip += offset;
+						}
+					} else if (RySet *set = collectionOf<RySet>(collectionValue)) {
+						// The index is the next slot to look at
+						size_t slot = set->next(index);
+						if (slot < set->capacity()) {
+							*(stackTop - 1) = RyValue((double) (slot + 1));
+							push(set->at(slot));
+						} else {
+							FRAME.ip += offset;
+						}
+					} else if (RyDeque *deque = collectionOf<RyDeque>(collectionValue)) {
+						if (index < deque->size()) {
+							*(stackTop - 1) = RyValue((double) (index + 1));
+							push(deque->at(index));
+						} else {
+							FRAME.ip += offset;
+						}
+					} else if (RyHeap *heap = collectionOf<RyHeap>(collectionValue)) {
+						if (index < heap->size()) {
+							*(stackTop - 1) = RyValue((double) (index + 1));
+							push(heap->at(index));
+						} else {
+							FRAME.ip += offset;
+						}
+					} else if (collectionValue.isNative() && collectionValue.asNative()->iterator) {
+						auto iterator = collectionValue.asNative();
+						RyValue next;
+						try {
+							next = iterator->host ? iterator->host(0, stackTop) : iterator->function(0, stackTop, globals);
+						} catch (const std::runtime_error &e) {
+							runtimeError("%s", e.what());
+							goto trigger_panic;
+						}
+						if (next.isNil()) {
+							FRAME.ip += offset;
+						} else {
+							push(std::move(next));
+						}
 					} else {
-						runtimeError("Can only use 'each' on lists or ranges.");
+						runtimeError("Can only use 'each' on lists, ranges, strings, bytes, sets, deques, heaps or iterators.");
 						goto trigger_panic;
 					}
 					break;
@@ -595,7 +1131,7 @@ namespace RyRuntime {
 
 				case OP_BUILD_LIST: {
 					uint8_t count = READ_BYTE();
-					auto listVec = std::make_shared<std::vector<RyValue>>();
+					auto listVec = makeCounted<ALLOC_LIST, std::vector<RyValue>>();
 
 					// Elements are on stack in order, but we pop them in reverse
 					// A simple way is to pre-size and fill from the end
@@ -603,6 +1139,8 @@ namespace RyRuntime {
 					for (int i = count - 1; i >= 0; i--) {
 						(*listVec)[i] = pop();
 					}
+					if (AllocProfile::enabled)
+						noteAllocation(ALLOC_LIST, listBytes(*listVec));
 
 					push(RyValue(listVec));
 					break;
@@ -640,49 +1178,43 @@ namespace RyRuntime {
 					break;
 				}
 				case OP_GET_INDEX: {
-					RyValue index = pop();
-					RyValue object = pop();
-
-					if (object.isList()) {
-						auto list = object.asList();
-						// Ensure the index is a number
-						if (!index.isNumber()) {
-							runtimeError("List index must be a number.");
-							goto trigger_panic;
-						}
-						int i = (int) index.asNumber();
-						if (i >= 0 && i < list->size()) {
-							push((*list)[i]);
-						} else {
-							runtimeError("List index out of bounds.");
-							goto trigger_panic;
-						}
-					} else if (object.isMap()) {
-						auto ryMap = object.asMap();
-
-						if (ryMap->find(index) != ryMap->end()) {
-							push((*ryMap)[index]);
-						} else {
-							runtimeError("Key '%s' not found in map.", index.to_string().c_str());
-							goto trigger_panic;
-						}
-					} else if (object.isString()) {
-						auto str = object.to_string();
-						if (!index.isNumber()) {
-							runtimeError("String index must be a number.");
-							goto trigger_panic;
-						}
-						int i = (int) index.asNumber();
-						if (i >= 0 && i < str.length()) {
-							push(RyValue(std::string(1, str[i])));
-						} else {
-							runtimeError("String index out of bounds.");
-							goto trigger_panic;
-						}
-					} else {
-						runtimeError("Can only index lists, maps, and strings.");
+					// Indexed where they lie on the stack, a string is not copied to read one character of it
+					RyValue item;
+					if (!indexValue(stackTop[-2], stackTop[-1], item))
 						goto trigger_panic;
-					}
+					pop();
+					pop();
+					push(std::move(item));
+					break;
+				}
+				case OP_GET_LOCAL_INDEX: {
+					uint8_t slot = READ_BYTE();
+					RyValue item;
+					if (!indexValue(FRAME.slots[slot], stackTop[-1], item))
+						goto trigger_panic;
+					stackTop[-1] = std::move(item);
+					break;
+				}
+				case OP_GET_LOCAL_LEN: {
+					uint8_t slot = READ_BYTE();
+					push(lengthOf(FRAME.slots[slot]));
+					break;
+				}
+				case OP_GET_GLOBAL_INDEX: {
+					RyValue *global = findGlobal(READ_CONSTANT().to_string());
+					if (!global)
+						goto trigger_panic;
+					RyValue item;
+					if (!indexValue(*global, stackTop[-1], item))
+						goto trigger_panic;
+					stackTop[-1] = std::move(item);
+					break;
+				}
+				case OP_GET_GLOBAL_LEN: {
+					RyValue *global = findGlobal(READ_CONSTANT().to_string());
+					if (!global)
+						goto trigger_panic;
+					push(lengthOf(*global));
 					break;
 				}
 				case OP_GET_UPVALUE: {
@@ -698,7 +1230,9 @@ namespace RyRuntime {
 				case OP_CLOSURE: {
 					std::shared_ptr<Frontend::RyFunction> function = READ_CONSTANT().asFunction();
 
-					auto closure = std::make_shared<RyClosure>(function);
+					auto closure = makeCounted<ALLOC_CLOSURE, RyClosure>(function);
+					if (AllocProfile::enabled)
+						noteAllocation(ALLOC_CLOSURE, sizeof(RyClosure) + function->upvalueCount * sizeof(std::shared_ptr<RyUpValue>));
 					push(RyValue(closure));
 
 					for (int i = 0; i < function->upvalueCount; i++) {
@@ -715,7 +1249,9 @@ namespace RyRuntime {
 				}
 				case OP_CLASS: {
 					RyValue name = READ_CONSTANT();
-					auto klass = std::make_shared<Frontend::RyClass>(name.to_string());
+					auto klass = makeCounted<ALLOC_CLASS, Frontend::RyClass>(name.to_string());
+					if (AllocProfile::enabled)
+						noteAllocation(ALLOC_CLASS, sizeof(Frontend::RyClass));
 					push(RyValue(klass));
 					break;
 				}
@@ -732,24 +1268,23 @@ namespace RyRuntime {
 					RyValue nameValue = READ_CONSTANT();
 					std::string propertyName = nameValue.to_string();
 
-					RyValue object = peek(0);
-
-					// Handle properties that REPLACE the object (like .len)
+					// Handle properties that REPLACE the object (like .len), looked at in place so a long string
+					// isn't copied just to be measured
 					if (propertyName == "len") {
+						RyValue length = lengthOf(stackTop[-1]);
 						pop(); // Now we can safely remove the list
-						if (object.isList())
-							push(RyValue((double) object.asList()->size()));
-						else if (object.isString())
-							push(RyValue((double) object.to_string().length()));
-						else if (object.isMap())
-							push(RyValue((double) object.asMap()->size()));
+						push(length);
 						break;
 					}
 
+					RyValue object = peek(0);
+
 					// Handle methods (the object stays on the stack as the 'receiver')
 					if (propertyName == "pop") {
 						// We leave the list at peek(0) and push the function on top
-						auto nativeObj = std::make_shared<Frontend::RyNative>(ry_pop, 0);
+						auto nativeObj = makeCounted<ALLOC_NATIVE, Frontend::RyNative>(ry_pop, 0);
+						if (AllocProfile::enabled)
+							noteAllocation(ALLOC_NATIVE, sizeof(Frontend::RyNative));
 						push(RyValue(nativeObj));
 						break;
 					}
@@ -775,7 +1310,9 @@ namespace RyRuntime {
 						auto method = instance->klass->methods.find(propertyName);
 						if (method != instance->klass->methods.end()) {
 							pop(); // Instance
-							auto bound = std::make_shared<Frontend::RyBoundMethod>(object, method->second);
+							auto bound = makeCounted<ALLOC_BOUND_METHOD, Frontend::RyBoundMethod>(object, method->second);
+							if (AllocProfile::enabled)
+								noteAllocation(ALLOC_BOUND_METHOD, sizeof(Frontend::RyBoundMethod));
 							push(RyValue(bound));
 							break;
 						}
@@ -810,6 +1347,21 @@ namespace RyRuntime {
 						}
 						(*list)[(int) index.asNumber()] = value;
 						// D push(value);
+					} else if (RyBytes *bytes = bytesOf(object)) {
+						double i = index.isNumber() ? index.asNumber() : -1;
+						if (bytes->readOnly) {
+							runtimeError("These bytes are read-only.");
+							goto trigger_panic;
+						}
+						if (i < 0 || i >= bytes->size) {
+							runtimeError("Bytes index out of bounds.");
+							goto trigger_panic;
+						}
+						if (!value.isNumber() || value.asNumber() < 0 || value.asNumber() > 255) {
+							runtimeError("A byte must be a number from 0 to 255.");
+							goto trigger_panic;
+						}
+						bytes->data[(size_t) i] = (uint8_t) value.asNumber();
 					} else if (object.isString()) {
 						runtimeError("Strings are immutable and do not support index assignment.");
 						goto trigger_panic;
@@ -819,7 +1371,7 @@ namespace RyRuntime {
 						runtimeError("Instances do not support index assignment.");
 						goto trigger_panic;
 					} else {
-						runtimeError("Only lists support index assignment.");
+						runtimeError("Only lists and bytes support index assignment.");
 						goto trigger_panic;
 					}
 					break;
@@ -922,13 +1474,15 @@ namespace RyRuntime {
 				}
 				case OP_BUILD_MAP: {
 					uint8_t count = READ_BYTE();
-					auto mapPtr = std::make_shared<std::unordered_map<RyValue, RyValue, RyValueHasher>>();
+					auto mapPtr = makeCounted<ALLOC_MAP, std::unordered_map<RyValue, RyValue, RyValueHasher>>();
 
 					for (int i = 0; i < count; i++) {
 						RyValue value = pop();
 						RyValue key = pop();
 						(*mapPtr)[key] = value;
 					}
+					if (AllocProfile::enabled)
+						noteAllocation(ALLOC_MAP, mapBytes(*mapPtr));
 
 					push(RyValue(mapPtr));
 					break;
@@ -942,48 +1496,10 @@ namespace RyRuntime {
 					std::string fileName = RyTools::findModulePath(fileNameValue.to_string(), false);
 
 					// Check if the module is already compiled and cached
-					auto cached = moduleCache.find(fileName);
-					if (cached != moduleCache.end()) {
-						// Found in cache, push it and call it.
-						push(RyValue(cached->second));
-
-						CallFrame *frame = &frames[frameCount++];
-						frame->closure = cached->second;
-						frame->ip = frame->closure->function->chunk.code.data();
-						frame->slots = stackTop - 1;
-						break; // Done with this opcode
-					}
-
-					// Read the file
-					std::ifstream file(fileName);
-					if (!file.is_open()) {
-						runtimeError("Could not open script file '%s'.", fileName.c_str());
+					std::shared_ptr<RyClosure> closure = loadModule(fileName);
+					if (!closure) {
 						goto trigger_panic;
 					}
-					std::string source((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
-
-					// Compile the imported script
-					Backend::Lexer lexer(source);
-					auto tokens = lexer.scanTokens();
-
-					// Use a temporary set for aliases if needed
-					std::set<std::string> tempAliases;
-					Backend::Parser parser(tokens, tempAliases, source);
-					auto statements = parser.parse();
-
-					Compiler compiler = Compiler(nullptr, source);
-					Chunk chunk;
-					if (!compiler.compile(statements, &chunk)) {
-						runtimeError("Failed to compile imported script '%s'.", fileName.c_str());
-						goto trigger_panic;
-					}
-
-					// Execute the script immediately
-					auto function = std::make_shared<Frontend::RyFunction>(std::move(chunk), fileName, 0);
-
-					auto closure = std::make_shared<RyClosure>(function);
-					// Store the newly compiled module in the cache
-					moduleCache[fileName] = closure;
 
 					push(RyValue(closure));
 
@@ -991,11 +1507,29 @@ namespace RyRuntime {
 					frame->closure = closure; // Assign the closure object
 					frame->ip = closure->function->chunk.code.data();
 					frame->slots = stackTop - 1;
+					if (Trace::active())
+						traceEnter(0);
 
 					// The VM will now continue running the code inside the imported file
 					// before returning to the original script.
 					break;
 				}
+				case OP_PARALLEL_EACH: {
+					RyValue body = pop();
+					RyValue collection = pop();
+
+					std::vector<RyValue> results;
+					std::string message;
+					if (!parallelEach(body, collection, globals, results, message)) {
+						runtimeError("%s", message.c_str());
+						goto trigger_panic;
+					}
+					auto resultList = makeCounted<ALLOC_LIST, std::vector<RyValue>>(std::move(results));
+					if (AllocProfile::enabled)
+						noteAllocation(ALLOC_LIST, listBytes(*resultList));
+					push(RyValue(resultList));
+					break;
+				}
 				default:
 					return INTERPRET_COMPILE_ERROR;
 			}